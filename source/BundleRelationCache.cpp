@@ -0,0 +1,471 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "fdutils.h"
+#include "BundleRelationCache.h"
+#include "FileDescriptorOwner.h"
+#include "DirStar.h"
+
+/* The relation cache file format *******************************************
+// **************************************************************************
+*/
+
+// Like compiled scripts, this is a cache, not an interchange format.
+// It is in native byte order and is simply ignored if anything about it does not match.
+
+const char bundle_relation_cache_name[] = ".relations.nosh-compiled";
+
+namespace {
+
+const char magic[8] = { 'n', 'o', 's', 'h', 'r', 'e', 'l', 's' };
+enum { VERSION = 2U };
+
+struct header {
+	char magic[8];
+	uint32_t version, record_count;
+	uint64_t edge_count, strings_length;
+};
+
+/// Records are sorted by device and i-node number, so that they can be binary searched in place.
+/// Each also records which bundle, and which of its relation directories, it was read from, so that it can be dropped when those go away.
+struct record {
+	uint64_t dev, ino;
+	int64_t mtime_sec, mtime_nsec;
+	uint64_t first_edge;
+	uint32_t edge_count, relation;	///< relation is the offset of a NUL-terminated string
+	uint64_t bundle_dev, bundle_ino;
+};
+
+struct edge_record {
+	uint64_t dev, ino;
+	uint32_t name, link;	///< offsets of NUL-terminated strings
+	uint32_t is_link, reserved;
+};
+
+inline
+void
+get_mtime (
+	const struct stat & s,
+	int64_t & sec,
+	int64_t & nsec
+) {
+#if defined(__LINUX__) || defined(__linux__)
+	sec = s.st_mtim.tv_sec;
+	nsec = s.st_mtim.tv_nsec;
+#else
+	sec = s.st_mtimespec.tv_sec;
+	nsec = s.st_mtimespec.tv_nsec;
+#endif
+}
+
+inline
+bool
+operator < (
+	const record & r,
+	const std::pair<uint64_t, uint64_t> & k
+) {
+	return r.dev < k.first || (r.dev == k.first && r.ino < k.second);
+}
+
+inline
+bool
+write_all (
+	int fd,
+	const void * v,
+	std::size_t l
+) {
+	const char * p(static_cast<const char *>(v));
+	while (l) {
+		const ssize_t n(write(fd, p, l));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			return false;
+		}
+		p += n;
+		l -= n;
+	}
+	return true;
+}
+
+/// Create a temporary file to be renamed over name, unique to this process so that concurrent writers do not write into the same file.
+inline
+int
+open_new_file (
+	int dir_fd,
+	const char * name,
+	std::string & new_name
+) {
+	char pid[32];
+	snprintf(pid, sizeof pid, ".new.%u", getpid());
+	new_name = std::string(name) + pid;
+	int fd(open_writecreateexclusive_at(dir_fd, new_name.c_str(), 0644));
+	if (0 > fd && EEXIST == errno) {
+		// Process IDs are unique amongst live processes, so this can only be left over from one that died.
+		unlinkat(dir_fd, new_name.c_str(), 0);
+		fd = open_writecreateexclusive_at(dir_fd, new_name.c_str(), 0644);
+	}
+	return fd;
+}
+
+/// The devices and i-node numbers of the bundles in a directory of bundles, which is all that is needed to tell whether a bundle is still there.
+/// Records are keyed by the bundle directories themselves, so symbolic links to bundles are followed.
+void
+list_bundles (
+	int dir_fd,
+	std::set<std::pair<uint64_t, uint64_t> > & bundles
+) {
+	FileDescriptorOwner self_fd(open_dir_at(dir_fd, "."));
+	if (0 > self_fd.get()) return;
+	const DirStar dir(self_fd);
+	if (!dir) return;
+	while (const dirent * entry = readdir(dir)) {
+		struct stat s;
+		if (0 > fstatat(dir.fd(), entry->d_name, &s, 0)) continue;
+		if (S_ISDIR(s.st_mode))
+			bundles.insert(std::make_pair(uint64_t(s.st_dev), uint64_t(s.st_ino)));
+	}
+}
+
+/// Read a relation directory in the same way as the uncached code does, resolving each entry as well.
+void
+scan (
+	int bundle_dir_fd,
+	const char * relation,
+	BundleRelationCache::edges & r
+) {
+	r.clear();
+	FileDescriptorOwner relation_dir_fd(open_dir_at(bundle_dir_fd, relation));
+	if (0 > relation_dir_fd.get()) return;
+	const DirStar relation_dir(relation_dir_fd);
+	if (!relation_dir) return;
+	for (;;) {
+		const dirent * entry(readdir(relation_dir));
+		if (!entry) break;
+		if ('.' == entry->d_name[0]) continue;
+		struct stat s;
+		if (0 > fstatat(relation_dir.fd(), entry->d_name, &s, AT_SYMLINK_NOFOLLOW)) continue;
+		if (!S_ISLNK(s.st_mode) && !S_ISDIR(s.st_mode)) continue;
+		BundleRelationCache::edge e;
+		e.name = entry->d_name;
+		if (S_ISLNK(s.st_mode)) {
+			e.is_link = true;
+			std::vector<char> buf(s.st_size, char());
+			const int l(readlinkat(relation_dir.fd(), entry->d_name, buf.data(), s.st_size));
+			if (0 > l) continue;
+			e.link.assign(buf.data(), l);
+			if (0 <= fstatat(relation_dir.fd(), entry->d_name, &s, 0) && S_ISDIR(s.st_mode)) {
+				e.dev = s.st_dev;
+				e.ino = s.st_ino;
+			}
+		} else
+		{
+			e.dev = s.st_dev;
+			e.ino = s.st_ino;
+		}
+		r.push_back(e);
+	}
+}
+
+}
+
+/* The per-directory caches *************************************************
+// **************************************************************************
+*/
+
+BundleRelationCache::root::root() :
+	dir_fd(-1),
+	enabled(false),
+	dirty(false),
+	base(nullptr),
+	length(0U),
+	fresh()
+{
+}
+
+BundleRelationCache::root::~root()
+{
+	if (base)
+		munmap(base, length);
+}
+
+/// Map the cache file, if it is there; an empty or unusable one still opts the directory in, and is rewritten.
+void
+BundleRelationCache::root::load (
+) {
+	const FileDescriptorOwner fd(open_read_at(dir_fd.get(), bundle_relation_cache_name));
+	if (0 > fd.get()) return;
+	enabled = true;
+	struct stat s;
+	if (0 > fstat(fd.get(), &s) || !S_ISREG(s.st_mode) || std::size_t(s.st_size) < sizeof(header)) return;
+	const std::size_t l(s.st_size);
+	void * const p(mmap(nullptr, l, PROT_READ, MAP_PRIVATE, fd.get(), 0));
+	if (MAP_FAILED == p) return;
+	const header & h(*static_cast<const header *>(p));
+	if (0 != std::memcmp(h.magic, magic, sizeof magic)
+	||  VERSION != h.version
+	||  l != sizeof h + h.record_count * sizeof(record) + h.edge_count * sizeof(edge_record) + h.strings_length
+	||  (h.strings_length && '\0' != static_cast<const char *>(p)[l - 1U])
+	) {
+		munmap(p, l);
+		return;
+	}
+	base = p;
+	length = l;
+}
+
+bool
+BundleRelationCache::root::lookup (
+	const key & k,
+	int64_t mtime_sec,
+	int64_t mtime_nsec,
+	edges & r
+) const {
+	const fresh_map::const_iterator f(fresh.find(k));
+	if (fresh.end() != f) {
+		if (f->second.racy || f->second.mtime_sec != mtime_sec || f->second.mtime_nsec != mtime_nsec) return false;
+		r = f->second.e;
+		return true;
+	}
+	if (!base) return false;
+	const header & h(*static_cast<const header *>(base));
+	const record * const records(reinterpret_cast<const record *>(&h + 1));
+	const edge_record * const edge_records(reinterpret_cast<const edge_record *>(records + h.record_count));
+	const char * const strings(reinterpret_cast<const char *>(edge_records + h.edge_count));
+	const record * const re(records + h.record_count);
+	const record * const rp(std::lower_bound(records, re, k));
+	if (re == rp || rp->dev != k.first || rp->ino != k.second) return false;
+	if (rp->mtime_sec != mtime_sec || rp->mtime_nsec != mtime_nsec) return false;
+	if (rp->first_edge > h.edge_count || rp->edge_count > h.edge_count - rp->first_edge) return false;
+	r.clear();
+	r.reserve(rp->edge_count);
+	for (const edge_record * ep(edge_records + rp->first_edge), * const ee(ep + rp->edge_count); ep < ee; ++ep) {
+		if (ep->name >= h.strings_length || ep->link >= h.strings_length) return false;
+		edge e;
+		e.is_link = ep->is_link;
+		e.name = strings + ep->name;
+		e.link = strings + ep->link;
+		e.dev = ep->dev;
+		e.ino = ep->ino;
+		r.push_back(e);
+	}
+	return true;
+}
+
+/// Write the merger of the mapped records and the fresh ones, atomically replacing the existing file.
+bool
+BundleRelationCache::root::write (
+) {
+	typedef std::map<key, const record *> old_map;
+	old_map old;
+	const header * oh(static_cast<const header *>(base));
+	const record * const old_records(oh ? reinterpret_cast<const record *>(oh + 1) : nullptr);
+	const edge_record * const old_edges(oh ? reinterpret_cast<const edge_record *>(old_records + oh->record_count) : nullptr);
+	const char * const old_strings(oh ? reinterpret_cast<const char *>(old_edges + oh->edge_count) : nullptr);
+	if (oh) {
+		// Old records are carried over only for bundles still in the directory, and only if not superseded by a fresh read of the same relation.
+		std::set<key> live;
+		list_bundles(dir_fd.get(), live);
+		std::set<std::pair<key, std::string> > superseded;
+		for (fresh_map::const_iterator i(fresh.begin()), e(fresh.end()); e != i; ++i)
+			superseded.insert(std::make_pair(i->second.bundle, i->second.relation));
+		for (const record * rp(old_records), * const re(rp + oh->record_count); rp < re; ++rp)
+			if (!fresh.count(key(rp->dev, rp->ino))
+			&&  rp->first_edge <= oh->edge_count && rp->edge_count <= oh->edge_count - rp->first_edge
+			&&  rp->relation < oh->strings_length
+			&&  live.count(key(rp->bundle_dev, rp->bundle_ino))
+			&&  !superseded.count(std::make_pair(key(rp->bundle_dev, rp->bundle_ino), std::string(old_strings + rp->relation)))
+			)
+				old[key(rp->dev, rp->ino)] = rp;
+	}
+
+	std::vector<record> records;
+	std::vector<edge_record> edge_records;
+	std::string strings;
+	fresh_map::const_iterator fi(fresh.begin()), fe(fresh.end());
+	old_map::const_iterator oi(old.begin()), oe(old.end());
+	while (fi != fe || oi != oe) {
+		if (fi != fe && fi->second.racy) {
+			++fi;
+			continue;
+		}
+		record r;
+		r.first_edge = edge_records.size();
+		if (oi == oe || (fi != fe && fi->first < oi->first)) {
+			r.dev = fi->first.first;
+			r.ino = fi->first.second;
+			r.mtime_sec = fi->second.mtime_sec;
+			r.mtime_nsec = fi->second.mtime_nsec;
+			r.bundle_dev = fi->second.bundle.first;
+			r.bundle_ino = fi->second.bundle.second;
+			r.relation = strings.length();
+			strings += fi->second.relation;
+			strings += '\0';
+			for (edges::const_iterator i(fi->second.e.begin()), e(fi->second.e.end()); e != i; ++i) {
+				edge_record er;
+				er.dev = i->dev;
+				er.ino = i->ino;
+				er.is_link = i->is_link;
+				er.reserved = 0U;
+				er.name = strings.length();
+				strings += i->name;
+				strings += '\0';
+				er.link = strings.length();
+				strings += i->link;
+				strings += '\0';
+				edge_records.push_back(er);
+			}
+			++fi;
+		} else
+		{
+			const record & o(*oi->second);
+			r.dev = o.dev;
+			r.ino = o.ino;
+			r.mtime_sec = o.mtime_sec;
+			r.mtime_nsec = o.mtime_nsec;
+			r.bundle_dev = o.bundle_dev;
+			r.bundle_ino = o.bundle_ino;
+			r.relation = strings.length();
+			strings += old_strings + o.relation;
+			strings += '\0';
+			for (const edge_record * ep(old_edges + o.first_edge), * const ee(ep + o.edge_count); ep < ee; ++ep) {
+				edge_record er(*ep);
+				er.name = strings.length();
+				strings += old_strings + ep->name;
+				strings += '\0';
+				er.link = strings.length();
+				strings += old_strings + ep->link;
+				strings += '\0';
+				edge_records.push_back(er);
+			}
+			++oi;
+		}
+		r.edge_count = edge_records.size() - r.first_edge;
+		records.push_back(r);
+	}
+
+	header h;
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = VERSION;
+	h.record_count = records.size();
+	h.edge_count = edge_records.size();
+	h.strings_length = strings.length();
+
+	std::string new_name;
+	FileDescriptorOwner fd(open_new_file(dir_fd.get(), bundle_relation_cache_name, new_name));
+	if (0 > fd.get()) return false;
+	if (!write_all(fd.get(), &h, sizeof h)
+	||  !write_all(fd.get(), records.data(), records.size() * sizeof(record))
+	||  !write_all(fd.get(), edge_records.data(), edge_records.size() * sizeof(edge_record))
+	||  !write_all(fd.get(), strings.data(), strings.length())
+	||  0 > fsync(fd.get())
+	) {
+		unlinkat(dir_fd.get(), new_name.c_str(), 0);
+		return false;
+	}
+	fd.reset(-1);
+	if (0 > renameat(dir_fd.get(), new_name.c_str(), dir_fd.get(), bundle_relation_cache_name)) {
+		unlinkat(dir_fd.get(), new_name.c_str(), 0);
+		return false;
+	}
+	return true;
+}
+
+/* The relation cache *******************************************************
+// **************************************************************************
+*/
+
+BundleRelationCache::BundleRelationCache() :
+	roots()
+{
+}
+
+BundleRelationCache::~BundleRelationCache()
+{
+	for (root_map::iterator i(roots.begin()), e(roots.end()); e != i; ++i)
+		delete i->second;
+}
+
+/// Find the cache for the directory that contains a bundle, loading it the first time around.
+BundleRelationCache::root *
+BundleRelationCache::find_root (
+	int bundle_dir_fd
+) {
+	struct stat s;
+	if (0 > fstatat(bundle_dir_fd, "..", &s, 0)) return nullptr;
+	const key k(s.st_dev, s.st_ino);
+	root_map::iterator i(roots.find(k));
+	if (roots.end() != i) return i->second;
+	root * r(new root);
+	roots[k] = r;
+	r->dir_fd.reset(open_dir_at(bundle_dir_fd, ".."));
+	if (0 <= r->dir_fd.get())
+		r->load();
+	return r;
+}
+
+/// Yield the entries of one relation directory of a bundle, from the cache where that is still valid.
+/// \returns false if the directory of bundles has not opted in, in which case the caller reads the relation directory itself.
+bool
+BundleRelationCache::get (
+	int bundle_dir_fd,
+	const char * relation,
+	edges & r
+) {
+	root * const rt(find_root(bundle_dir_fd));
+	if (!rt || !rt->enabled) return false;
+	struct stat s;
+	if (0 > fstatat(bundle_dir_fd, relation, &s, 0) || !S_ISDIR(s.st_mode)) {
+		r.clear();
+		return true;
+	}
+	const key k(s.st_dev, s.st_ino);
+	int64_t sec, nsec;
+	get_mtime(s, sec, nsec);
+	if (rt->lookup(k, sec, nsec, r)) return true;
+	timespec start;
+	clock_gettime(CLOCK_REALTIME, &start);
+	scan(bundle_dir_fd, relation, r);
+	fresh_record & f(rt->fresh[k]);
+	f.mtime_sec = sec;
+	f.mtime_nsec = nsec;
+	f.e = r;
+	f.relation = relation;
+	if (0 <= fstat(bundle_dir_fd, &s))
+		f.bundle = key(s.st_dev, s.st_ino);
+	// As with git's "racily clean" index entries: a modification in the same timestamp tick as the read would leave the modification time unchanged, so the record cannot be trusted later.
+	// A whole second of leeway allows for filesystem timestamps that are coarser than, or lag behind, the system clock.
+	f.racy = sec + 1 >= start.tv_sec;
+	if (!f.racy)
+		rt->dirty = true;
+	return true;
+}
+
+/// Rewrite the cache files of any opted-in directories whose caches were incomplete or out of date.
+/// Failure, such as from a lack of write permission, is not an error; the cache just remains as it was.
+void
+BundleRelationCache::save (
+) {
+	for (root_map::iterator i(roots.begin()), e(roots.end()); e != i; ++i) {
+		root & rt(*i->second);
+		if (rt.enabled && rt.dirty && rt.write())
+			rt.dirty = false;
+	}
+}
@@ -0,0 +1,80 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#if !defined(INCLUDE_BUNDLERELATIONCACHE_H)
+#define INCLUDE_BUNDLERELATIONCACHE_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+#include "FileDescriptorOwner.h"
+
+/// The name of the file, in a directory of bundles, whose existence opts that directory in to relation caching.
+extern const char bundle_relation_cache_name[];
+
+/// \brief An optional compiled cache of the relation directories (wants/, after/, and so forth) of service bundles
+/// A directory of bundles opts in by containing a (possibly empty) file named by bundle_relation_cache_name.
+/// Each cached relation directory is keyed by its device and i-node numbers and is only trusted whilst its modification time is unchanged.
+/// Otherwise the directory is read afresh, and the cache file is rewritten by save(), if it can be.
+/// Directories modified too recently to tell apart from a modification made during the read are not cached at all.
+/// Records for bundles that are no longer in the directory, or for relation directories that have been replaced, are dropped on rewrite.
+class BundleRelationCache
+{
+public:
+	/// One entry in a relation directory.
+	struct edge {
+		edge() : is_link(false), name(), link(), dev(0U), ino(0U) {}
+		bool is_link;		///< the entry is a symbolic link, rather than a directory
+		std::string name;	///< the entry's name in the relation directory
+		std::string link;	///< the symbolic link's contents, if it is one
+		uint64_t dev, ino;	///< the bundle directory that the entry resolved to when cached; zero if it did not resolve
+	};
+	typedef std::vector<edge> edges;
+
+	BundleRelationCache();
+	~BundleRelationCache();
+
+	bool get(int bundle_dir_fd, const char * relation, edges &);
+	void save();
+protected:
+	typedef std::pair<uint64_t, uint64_t> key;
+	struct fresh_record {
+		fresh_record() : racy(false), mtime_sec(0), mtime_nsec(0), bundle(), relation(), e() {}
+		bool racy;
+		int64_t mtime_sec, mtime_nsec;
+		key bundle;
+		std::string relation;
+		edges e;
+	};
+	typedef std::map<key, fresh_record> fresh_map;
+	struct root {
+		root();
+		~root();
+		FileDescriptorOwner dir_fd;
+		bool enabled, dirty;
+		void * base;
+		std::size_t length;
+		fresh_map fresh;
+
+		void load();
+		bool lookup(const key &, int64_t, int64_t, edges &) const;
+		bool write();
+	private:
+		root(const root &);
+		root & operator = (const root &);
+	};
+	typedef std::map<key, root *> root_map;
+	root_map roots;
+
+	root * find_root(int bundle_dir_fd);
+private:
+	BundleRelationCache(const BundleRelationCache &);
+	BundleRelationCache & operator = (const BundleRelationCache &);
+};
+
+#endif
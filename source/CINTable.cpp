@@ -0,0 +1,748 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "utils.h"
+#include "fdutils.h"
+#include "CINTable.h"
+#include "FileDescriptorOwner.h"
+#include "ChunkedReader.h"
+#include "UTF8Decoder.h"
+
+/* The compiled table file format *******************************************
+// **************************************************************************
+*/
+
+// Like compiled scripts, this is a cache, not an interchange format.
+// It is in native byte order and is simply discarded if anything about it does not match.
+//
+// After the header come, as arrays of 32-bit words:
+//  * 256 pool offsets of the engravings for each raw character;
+//  * the base, check, and value arrays of the double-array trie, each with one word per state;
+//  * the pool, holding engravings as a length followed by characters, and conversion lists as a count followed by that many engravings.
+// A transition from state s on raw character k goes to state t = base[s] + k + 1, and is valid only if check[t] is s.
+
+const char compiled_cin_table_suffix[] = ".nosh-compiled";
+const CINTable::state CINTable::ROOT;
+
+struct CINTable::header {
+	char magic[8];
+	uint32_t version, flags;
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+	uint32_t states, pool_length;
+};
+
+namespace {
+
+const char magic[8] = { 'n', 'o', 's', 'h', 'c', 'i', 'n', 't' };
+enum { VERSION = 1U };
+enum { FOLD_CASE = 0x00000001 };
+enum { ENGRAVINGS = 256U };
+const uint32_t NONE(0xFFFFFFFF);
+
+typedef std::vector<uint32_t> charvec;
+
+inline
+uint32_t
+code (
+	char k
+) {
+	return uint32_t(static_cast<unsigned char>(k)) + 1U;
+}
+
+inline
+void
+get_mtime (
+	const struct stat & s,
+	int64_t & sec,
+	int64_t & nsec
+) {
+#if defined(__LINUX__) || defined(__linux__)
+	sec = s.st_mtim.tv_sec;
+	nsec = s.st_mtim.tv_nsec;
+#else
+	sec = s.st_mtimespec.tv_sec;
+	nsec = s.st_mtimespec.tv_nsec;
+#endif
+}
+
+inline
+bool
+write_all (
+	int fd,
+	const char * p,
+	std::size_t l
+) {
+	while (l) {
+		const ssize_t n(write(fd, p, l));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			return false;
+		}
+		p += n;
+		l -= n;
+	}
+	return true;
+}
+
+/// Create a temporary file to be renamed over name, unique to this process so that concurrent compiles do not write into the same file.
+inline
+int
+open_new_file (
+	const std::string & name,
+	std::string & new_name
+) {
+	char pid[32];
+	snprintf(pid, sizeof pid, ".new.%u", getpid());
+	new_name = name + pid;
+	int fd(open_writecreateexclusive_at(AT_FDCWD, new_name.c_str(), 0644));
+	if (0 > fd && EEXIST == errno) {
+		// Process IDs are unique amongst live processes, so this can only be left over from one that died.
+		unlink(new_name.c_str());
+		fd = open_writecreateexclusive_at(AT_FDCWD, new_name.c_str(), 0644);
+	}
+	return fd;
+}
+
+inline
+bool
+is_begin (
+	const charvec & v
+) {
+	return 5 == v.size() && 'b' == v[0] && 'e' == v[1] && 'g' == v[2] && 'i' == v[3] && 'n' == v[4];
+}
+
+inline
+bool
+is_end (
+	const charvec & v
+) {
+	return 3 == v.size() && 'e' == v[0] && 'n' == v[1] && 'd' == v[2];
+}
+
+}
+
+/* Compiling tables *********************************************************
+// **************************************************************************
+*/
+
+namespace {
+
+/// The contents of a CIN file, as parsed and before compilation.
+struct table_source {
+	table_source() : fold_case(true) {}
+
+	typedef std::multimap<std::string, charvec> conversion_map;
+	conversion_map raw_to_kana;
+	typedef std::map<char, charvec> engraving_map;
+	engraving_map raw_to_engraving;
+	bool fold_case;
+};
+
+class Compiler
+{
+public:
+	Compiler(const table_source & s) : source(s) {}
+	void compile(const struct stat &, std::vector<uint32_t> &);
+protected:
+	typedef std::vector<table_source::conversion_map::const_iterator> key_list;
+	const table_source & source;
+	key_list keys;
+	std::vector<uint32_t> base, check, values, pool;
+	// The free states are kept in a doubly-linked list, so that finding a base does not rescan all of the used ones.
+	std::vector<uint32_t> next_free, prev_free;
+	uint32_t free_head, free_tail;
+
+	uint32_t add_to_pool(const charvec &);
+	uint32_t new_state(uint32_t);
+	void build(uint32_t, std::size_t, key_list::size_type, key_list::size_type);
+};
+
+uint32_t
+Compiler::add_to_pool (
+	const charvec & v
+) {
+	const uint32_t o(pool.size());
+	pool.push_back(v.size());
+	pool.insert(pool.end(), v.begin(), v.end());
+	return o;
+}
+
+/// Claim the free state t, extending the arrays as necessary.
+uint32_t
+Compiler::new_state (
+	uint32_t t
+) {
+	while (check.size() <= t) {
+		const uint32_t n(check.size());
+		base.push_back(0U);
+		check.push_back(NONE);
+		values.push_back(NONE);
+		next_free.push_back(NONE);
+		prev_free.push_back(free_tail);
+		if (NONE == free_tail)
+			free_head = n;
+		else
+			next_free[free_tail] = n;
+		free_tail = n;
+	}
+	const uint32_t n(next_free[t]), p(prev_free[t]);
+	if (NONE == p) free_head = n; else next_free[p] = n;
+	if (NONE == n) free_tail = p; else prev_free[n] = p;
+	return t;
+}
+
+/// Build the subtrie at state s for the keys in [first, last), which all share the first depth characters.
+void
+Compiler::build (
+	uint32_t s,
+	std::size_t depth,
+	key_list::size_type first,
+	key_list::size_type last
+) {
+	if (first < last && keys[first]->first.length() == depth) {
+		// The multimap keeps conversions for the same key in the order that they were added.
+		const table_source::conversion_map::const_iterator b(keys[first]), e(source.raw_to_kana.upper_bound(b->first));
+		const uint32_t o(pool.size());
+		pool.push_back(0U);
+		for (table_source::conversion_map::const_iterator i(b); e != i; ++i, ++pool[o])
+			add_to_pool(i->second);
+		values[s] = o;
+		++first;
+	}
+	if (first >= last) return;
+
+	std::vector<uint32_t> codes;
+	for (key_list::size_type i(first); i < last; ++i) {
+		const uint32_t c(code(keys[i]->first[depth]));
+		if (codes.empty() || codes.back() != c)
+			codes.push_back(c);
+	}
+
+	// Find the first base at which every child state is free, trying only those that put the first child in a free state.
+	uint32_t b(check.size() > codes.front() ? check.size() - codes.front() : 0U);
+	for (uint32_t f(free_head); NONE != f; f = next_free[f]) {
+		if (f < codes.front()) continue;
+		std::vector<uint32_t>::const_iterator c(codes.begin() + 1);
+		while (codes.end() != c && (check.size() <= f - codes.front() + *c || NONE == check[f - codes.front() + *c])) ++c;
+		if (codes.end() == c) {
+			b = f - codes.front();
+			break;
+		}
+	}
+	base[s] = b;
+	for (std::vector<uint32_t>::const_iterator c(codes.begin()); codes.end() != c; ++c)
+		check[new_state(b + *c)] = s;
+
+	for (key_list::size_type i(first); i < last; ) {
+		const char k(keys[i]->first[depth]);
+		key_list::size_type j(i + 1U);
+		while (j < last && keys[j]->first[depth] == k) ++j;
+		build(b + code(k), depth + 1U, i, j);
+		i = j;
+	}
+}
+
+void
+Compiler::compile (
+	const struct stat & status,
+	std::vector<uint32_t> & image
+) {
+	keys.clear();
+	for (table_source::conversion_map::const_iterator i(source.raw_to_kana.begin()), e(source.raw_to_kana.end()); e != i; i = source.raw_to_kana.upper_bound(i->first))
+		keys.push_back(i);
+	base.clear();
+	check.clear();
+	values.clear();
+	pool.clear();
+	next_free.clear();
+	prev_free.clear();
+	free_head = free_tail = NONE;
+	check[new_state(CINTable::ROOT)] = CINTable::ROOT;
+	std::vector<uint32_t> engravings(ENGRAVINGS, NONE);
+	for (table_source::engraving_map::const_iterator i(source.raw_to_engraving.begin()), e(source.raw_to_engraving.end()); e != i; ++i)
+		engravings[static_cast<unsigned char>(i->first)] = add_to_pool(i->second);
+	build(CINTable::ROOT, 0U, 0U, keys.size());
+
+	CINTable::header h;
+	std::memset(&h, 0, sizeof h);
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = VERSION;
+	h.flags = source.fold_case ? uint32_t(FOLD_CASE) : 0U;
+	h.dev = status.st_dev;
+	h.ino = status.st_ino;
+	h.size = status.st_size;
+	get_mtime(status, h.mtime_sec, h.mtime_nsec);
+	h.states = check.size();
+	h.pool_length = pool.size();
+
+	image.resize(sizeof h / sizeof(uint32_t));
+	std::memcpy(image.data(), &h, sizeof h);
+	image.insert(image.end(), engravings.begin(), engravings.end());
+	image.insert(image.end(), base.begin(), base.end());
+	image.insert(image.end(), check.begin(), check.end());
+	image.insert(image.end(), values.begin(), values.end());
+	image.insert(image.end(), pool.begin(), pool.end());
+}
+
+}
+
+/* Parsing CIN files ********************************************************
+// **************************************************************************
+*/
+
+namespace {
+
+class Loader :
+	public UTF8Decoder::UCS32CharacterSink
+{
+public:
+	Loader(table_source & t, const char * p, const ProcessEnvironment & e, const char * f);
+	void load();
+protected:
+	table_source & table;
+	UTF8Decoder decoder;
+	enum { FIRST, COMMENT_REST, DIRECTIVE_FIRST, DIRECTIVE_SPACE1, DIRECTIVE_SECOND, DIRECTIVE_REST, DATA_FIRST, DATA_SPACE1, DATA_SECOND, DATA_REST } state;
+	bool chardef, keyname;
+	const char * const prog;
+	const ProcessEnvironment & envs;
+	const char * const filename;
+	unsigned long line;
+	std::string first;
+	charvec second;
+
+	virtual void ProcessDecodedUTF8(char32_t character, bool decoder_error, bool overlong);
+};
+
+Loader::Loader(
+	table_source & t,
+	const char * p,
+	const ProcessEnvironment & e,
+	const char * f
+) :
+	table(t),
+	decoder(*this),
+	state(FIRST),
+	chardef(false),
+	keyname(false),
+	prog(p),
+	envs(e),
+	filename(f),
+	line(0UL)
+{
+}
+
+void
+Loader::load (
+) {
+	const FileDescriptorOwner fd(open_read_at(AT_FDCWD, filename));
+	if (0 > fd.get()) {
+		die_errno(prog, envs, filename);
+	}
+	ChunkedReader f(fd.get());
+	line = 1UL;
+	for (ChunkedReader::span chunk; f.read_chunk(chunk); ) {
+		for (const char * p(chunk.data), * const e(chunk.data + chunk.length); p < e; ++p)
+			decoder.Process(static_cast<unsigned char>(*p));
+	}
+	if (const int error = f.error()) {
+		errno = error;
+		die_errno(prog, envs, filename);
+	}
+}
+
+void
+Loader::ProcessDecodedUTF8(
+	char32_t character,
+	bool decoder_error,
+	bool /*overlong*/
+) {
+	if (decoder_error)
+		die_parser_error(prog, envs, filename, line, "Invalid UTF-8 in file.");
+	if ('\n' == character) ++line;
+	switch (state) {
+		case FIRST:
+			if ('\n' == character)
+				break;
+			else
+			{
+				first.clear();
+				second.clear();
+				if ('%' == character)
+					state = DIRECTIVE_FIRST;
+				else
+				if ('#' == character)
+					state = COMMENT_REST;
+				else
+				if (character < 0x100 && std::isspace(character))
+					state = DATA_FIRST;
+				else
+				{
+					state = DATA_FIRST;
+					goto data1;
+				}
+			}
+			break;
+
+		case COMMENT_REST:
+			if ('\n' == character)
+				state = FIRST;
+			break;
+
+		// Parsing directives into a leading ASCII portion and a trailing Unicode portion.
+
+		case DIRECTIVE_FIRST:
+			if ('\n' == character)
+				goto directive_end;
+			if (0x100 <= character)
+				die_parser_error(prog, envs, filename, line, "Invalid directive name.");
+			else
+			if (!std::isspace(static_cast<char>(character)))
+				first.push_back(static_cast<char>(character));
+			else
+			if (first.empty())
+				die_parser_error(prog, envs, filename, line, "Invalid directive line with empty first field.");
+			else
+			{
+				state = DIRECTIVE_SPACE1;
+				goto directive_space;
+			}
+			break;
+		case DIRECTIVE_SPACE1:
+		directive_space:
+			if ('\n' == character)
+				goto directive_end;
+			else
+			if (0x100 <= character || !std::isspace(static_cast<char>(character))) {
+				state = DIRECTIVE_SECOND;
+				goto directive2;
+			}
+			break;
+		case DIRECTIVE_SECOND:
+			if ('\n' == character)
+				goto directive_end;
+			else
+		directive2:
+				second.push_back(character);
+			break;
+		case DIRECTIVE_REST:
+			if ('\n' == character)
+				goto directive_end;
+			break;
+		directive_end:
+			if ("keyname" == first) {
+				if (is_begin(second)) {
+					keyname = true;
+					chardef = false;
+				} else
+				if (is_end(second)) {
+					keyname = false;
+				} else
+					die_parser_error(prog, envs, filename, line, first.c_str(), "Directive followed by neither begin nor end.");
+			} else
+			if ("chardef" == first) {
+				if (is_begin(second)) {
+					chardef = true;
+					keyname = false;
+				} else
+				if (is_end(second)) {
+					chardef = false;
+				} else
+					die_parser_error(prog, envs, filename, line, first.c_str(), "Directive followed by neither begin nor end.");
+			} else
+			if ("keep_key_case" == first)
+				table.fold_case = false;
+			else
+			{
+			}
+			state = FIRST;
+			break;
+
+		// Parsing data lines into a leading ASCII field, a Unicode field, and a trailing portion that is ignored.
+
+		case DATA_FIRST:
+			if ('\n' == character)
+				die_parser_error(prog, envs, filename, line, "Invalid data line with only 1 field.");
+		data1:
+			if (0x100 <= character)
+				die_parser_error(prog, envs, filename, line, "Invalid raw data field.");
+			else
+			if (!std::isspace(static_cast<char>(character)))
+				first.push_back(static_cast<char>(character));
+			else
+			if (first.empty())
+				die_parser_error(prog, envs, filename, line, "Invalid data line with empty first field.");
+			else
+			{
+				state = DATA_SPACE1;
+				goto data_space;
+			}
+			break;
+		case DATA_SPACE1:
+		data_space:
+			if ('\n' == character)
+				die_parser_error(prog, envs, filename, line, "Invalid data line with only 1 field.");
+			else
+			if (0x100 <= character || !std::isspace(static_cast<char>(character))) {
+				state = DATA_SECOND;
+				goto data2;
+			}
+			break;
+		case DATA_SECOND:
+			if ('\n' == character)
+				goto data_end;
+		data2:
+			if (character < 0x100 && std::isspace(static_cast<char>(character))) {
+				state = DATA_REST;
+				goto data_rest;
+			} else
+				second.push_back(character);
+			break;
+		case DATA_REST:
+		data_rest:
+			if ('\n' == character)
+				goto data_end;
+			break;
+		data_end:
+			if (keyname) {
+				if (first.length() != 1U)
+					die_parser_error(prog, envs, filename, line, "Invalid key name that is not 1 character.");
+				table.raw_to_engraving.insert(std::make_pair(first.front(), second));
+			} else
+			if (chardef)
+				table.raw_to_kana.insert(std::make_pair(first, second));
+			else
+				die_parser_error(prog, envs, filename, line, first.c_str(), "Bogus data not part of an engraving or a conversion.");
+			state = FIRST;
+			break;
+	}
+}
+
+}
+
+/* Loading and saving *******************************************************
+// **************************************************************************
+*/
+
+CINTable::CINTable(
+) :
+	map_base(nullptr),
+	map_length(0U),
+	image(),
+	h(nullptr),
+	base(nullptr),
+	check(nullptr),
+	values(nullptr),
+	pool(nullptr),
+	engravings(nullptr)
+{
+}
+
+CINTable::~CINTable()
+{
+	unmap();
+}
+
+void
+CINTable::unmap()
+{
+	if (map_base) {
+		munmap(map_base, map_length);
+		map_base = nullptr;
+		map_length = 0U;
+	}
+}
+
+/// Point the arrays into a compiled form, if it is wholly consistent.
+bool
+CINTable::attach (
+	const void * p,
+	std::size_t length
+) {
+	if (length < sizeof(header)) return false;
+	const header & t(*static_cast<const header *>(p));
+	if (0 != std::memcmp(t.magic, magic, sizeof magic)
+	||  VERSION != t.version
+	||  1U > t.states
+	||  length != sizeof t + sizeof(uint32_t) * (ENGRAVINGS + 3U * uint64_t(t.states) + t.pool_length)
+	)
+		return false;
+	h = &t;
+	engravings = reinterpret_cast<const uint32_t *>(&t + 1);
+	base = engravings + ENGRAVINGS;
+	check = base + t.states;
+	values = check + t.states;
+	pool = values + t.states;
+	return true;
+}
+
+/// Map the compiled form of a table, if it exists and is current.
+bool
+CINTable::load_compiled (
+	const char * name,
+	const struct stat & table_status
+) {
+	const std::string compiled_name(std::string(name) + compiled_cin_table_suffix);
+	const FileDescriptorOwner fd(open_read_at(AT_FDCWD, compiled_name.c_str()));
+	if (0 > fd.get()) return false;
+	struct stat s;
+	if (0 > fstat(fd.get(), &s)
+	||  !S_ISREG(s.st_mode)
+	||  std::size_t(s.st_size) <= sizeof(header)
+	// Whoever could have written the compiled form must be no more than whoever could have written the table.
+	||  (s.st_uid != table_status.st_uid && 0 != s.st_uid)
+	||  (s.st_mode & (S_IWGRP|S_IWOTH) & ~table_status.st_mode)
+	)
+		return false;
+	const std::size_t length(s.st_size);
+	void * const p(mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd.get(), 0));
+	if (MAP_FAILED == p) return false;
+	int64_t sec, nsec;
+	get_mtime(table_status, sec, nsec);
+	const header & t(*static_cast<const header *>(p));
+	if (uint64_t(table_status.st_dev) != t.dev
+	||  uint64_t(table_status.st_ino) != t.ino
+	||  uint64_t(table_status.st_size) != t.size
+	||  sec != t.mtime_sec
+	||  nsec != t.mtime_nsec
+	||  !attach(p, length)
+	) {
+		munmap(p, length);
+		return false;
+	}
+	unmap();
+	image.clear();
+	map_base = p;
+	map_length = length;
+	return true;
+}
+
+/// Parse a table from its CIN file and compile it in memory, exiting the program if there is a parse error.
+void
+CINTable::load (
+	const char * prog,
+	const ProcessEnvironment & envs,
+	const char * name,
+	const struct stat & table_status
+) {
+	table_source source;
+	Loader loader(source, prog, envs, name);
+	loader.load();
+	unmap();
+	Compiler(source).compile(table_status, image);
+	attach(image.data(), image.size() * sizeof(uint32_t));
+}
+
+/// Write the compiled form of a table, atomically replacing any existing one.
+bool
+CINTable::save_compiled (
+	const char * name
+) const {
+	if (!h) {
+		errno = EINVAL;
+		return false;
+	}
+	const std::size_t length(sizeof *h + sizeof(uint32_t) * (ENGRAVINGS + 3U * h->states + h->pool_length));
+	const std::string compiled_name(std::string(name) + compiled_cin_table_suffix);
+	std::string new_name;
+	FileDescriptorOwner fd(open_new_file(compiled_name, new_name));
+	if (0 > fd.get()) return false;
+	if (!write_all(fd.get(), reinterpret_cast<const char *>(h), length)
+	||  0 > fsync(fd.get())
+	) {
+		const int error(errno);
+		unlink(new_name.c_str());
+		errno = error;
+		return false;
+	}
+	fd.reset(-1);
+	if (0 > rename(new_name.c_str(), compiled_name.c_str())) {
+		const int error(errno);
+		unlink(new_name.c_str());
+		errno = error;
+		return false;
+	}
+	return true;
+}
+
+/* Lookups ******************************************************************
+// **************************************************************************
+*/
+
+bool
+CINTable::query_fold_case (
+) const {
+	return !h || (h->flags & FOLD_CASE);
+}
+
+/// Advance s along the trie by the raw character k, if any key continues that way.
+bool
+CINTable::walk (
+	state & s,
+	char k
+) const {
+	if (!h || h->states <= s) return false;
+	const uint32_t t(base[s] + code(k));
+	if (h->states <= t || check[t] != s) return false;
+	s = t;
+	return true;
+}
+
+/// Position a cursor at the conversions of the key that ends at state s, if there is one.
+bool
+CINTable::conversions (
+	state s,
+	cursor & c
+) const {
+	if (!h || h->states <= s) return false;
+	const uint32_t o(values[s]);
+	if (h->pool_length <= o) return false;
+	c.p = pool + o + 1U;
+	c.e = pool + h->pool_length;
+	c.remaining = pool[o];
+	return 0U < c.remaining;
+}
+
+bool
+CINTable::cursor::next (
+	const uint32_t * & chars,
+	std::size_t & length
+) {
+	if (!remaining || p >= e) return false;
+	length = *p++;
+	if (std::size_t(e - p) < length) return false;
+	chars = p;
+	p += length;
+	--remaining;
+	return true;
+}
+
+bool
+CINTable::engraving (
+	char k,
+	const uint32_t * & chars,
+	std::size_t & length
+) const {
+	if (!h) return false;
+	const uint32_t o(engravings[static_cast<unsigned char>(k)]);
+	if (h->pool_length <= o) return false;
+	length = pool[o];
+	if (h->pool_length - o - 1U < length) return false;
+	chars = pool + o + 1U;
+	return true;
+}
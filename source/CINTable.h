@@ -0,0 +1,65 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#if !defined(INCLUDE_CINTABLE_H)
+#define INCLUDE_CINTABLE_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+struct stat;
+class ProcessEnvironment;
+
+/// The suffix that names the compiled form of a CIN table alongside the table itself.
+extern const char compiled_cin_table_suffix[];
+
+/// \brief A CIN input method data table, held as a double-array trie of raw key sequences with packed lists of conversions
+/// The table is either mapped straight from a compiled form or, failing that, parsed from the CIN file and compiled in memory.
+/// Either way, lookups point into the table itself and never allocate.
+class CINTable
+{
+public:
+	CINTable();
+	~CINTable();
+
+	typedef uint32_t state;
+	static const state ROOT = 0U;
+	struct header;
+
+	/// \brief A cursor over a packed list of conversions in the table
+	class cursor {
+	public:
+		cursor() : p(nullptr), e(nullptr), remaining(0U) {}
+		bool next(const uint32_t * & chars, std::size_t & length);
+	protected:
+		friend class CINTable;
+		const uint32_t * p, * e;
+		uint32_t remaining;
+	};
+
+	bool load_compiled(const char * name, const struct stat &);
+	void load(const char * prog, const ProcessEnvironment & envs, const char * name, const struct stat &);
+	bool save_compiled(const char * name) const;
+
+	bool query_fold_case() const;
+	bool walk(state &, char) const;
+	bool conversions(state, cursor &) const;
+	bool engraving(char, const uint32_t * & chars, std::size_t & length) const;
+protected:
+	void * map_base;
+	std::size_t map_length;
+	std::vector<uint32_t> image;
+	const header * h;
+	const uint32_t * base, * check, * values, * pool, * engravings;
+
+	bool attach(const void *, std::size_t);
+	void unmap();
+private:
+	CINTable(const CINTable &);
+	CINTable & operator = (const CINTable &);
+};
+
+#endif
@@ -0,0 +1,102 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ChunkedReader.h"
+
+ChunkedReader::ChunkedReader(
+	int f
+) :
+	fd(f),
+	buffer(),
+	head(0U),
+	tail(0U),
+	at_eof(false),
+	read_error(0)
+{
+	std::size_t size(CHUNK_SIZE);
+	struct stat s;
+	if (0 <= fstat(fd, &s) && S_ISREG(s.st_mode)) {
+		// Only what lies beyond the current offset is still to be read; the descriptor may have been partly consumed already.
+		const off_t o(lseek(fd, 0, SEEK_CUR));
+		const std::size_t l(0 <= o && o < s.st_size ? s.st_size - o : 0U);
+		// Small regular files, which are the common case, should need just the one read() plus the one that returns EOF.
+		// Large ones are read in large chunks, rather than mapped, so that a file truncated underneath us yields EOF rather than SIGBUS.
+		size = l < MAX_CHUNK_SIZE ? l + 1U : std::size_t(MAX_CHUNK_SIZE);
+#if defined(POSIX_FADV_SEQUENTIAL)
+		if (l >= CHUNK_SIZE)
+			posix_fadvise(fd, 0 <= o ? o : 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+	buffer.resize(size);
+}
+
+bool
+ChunkedReader::fill(
+) {
+	if (at_eof) return false;
+	if (head > 0U) {
+		if (tail > head)
+			std::memmove(buffer.data(), buffer.data() + head, tail - head);
+		tail -= head;
+		head = 0U;
+	}
+	if (tail >= buffer.size())
+		buffer.resize(buffer.size() * 2U);
+	for (;;) {
+		const ssize_t n(read(fd, buffer.data() + tail, buffer.size() - tail));
+		if (0 < n) {
+			tail += n;
+			return true;
+		}
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			read_error = errno;
+		}
+		at_eof = true;
+		return false;
+	}
+}
+
+/// Yield whatever is next, in whatever size chunk it happens to come.
+bool
+ChunkedReader::read_chunk(
+	span & s
+) {
+	if (head >= tail && !fill()) return false;
+	s = span(base() + head, tail - head);
+	head = tail;
+	return true;
+}
+
+/// Yield the next line, excluding its terminating LF; a final line lacking a terminator still counts.
+bool
+ChunkedReader::read_line(
+	span & s
+) {
+	std::size_t scanned(0U);
+	for (;;) {
+		const char * const b(base() + head);
+		if (const void * nl = std::memchr(b + scanned, '\n', tail - head - scanned)) {
+			const std::size_t l(static_cast<const char *>(nl) - b);
+			s = span(b, l);
+			head += l + 1U;
+			return true;
+		}
+		scanned = tail - head;
+		if (!fill()) break;
+	}
+	if (head >= tail) return false;
+	s = span(base() + head, tail - head);
+	head = tail;
+	return true;
+}
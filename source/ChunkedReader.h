@@ -0,0 +1,49 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#if !defined(INCLUDE_CHUNKEDREADER_H)
+#define INCLUDE_CHUNKEDREADER_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+/// \brief A reader that pulls a file descriptor's content in large chunks and hands out views of it.
+/// The descriptor is not owned, and must not be read by anything else whilst the reader is in use.
+/// Reading starts at the descriptor's current file offset, and always uses read() so that the offset advances as it would with stdio.
+class ChunkedReader
+{
+public:
+	/// A view of some bytes in the reader's buffer, valid only until the next read.
+	struct span {
+		span() : data(nullptr), length(0U) {}
+		span(const char * d, std::size_t l) : data(d), length(l) {}
+		const char * data;
+		std::size_t length;
+		bool empty() const { return 0U == length; }
+		std::string str() const { return std::string(data, length); }
+	};
+
+	explicit ChunkedReader(int fd);
+
+	bool read_chunk(span &);
+	bool read_line(span &);
+	int error() const { return read_error; }
+protected:
+	enum { CHUNK_SIZE = 64U * 1024U, MAX_CHUNK_SIZE = 1024U * 1024U };
+	const int fd;
+	std::vector<char> buffer;
+	std::size_t head, tail;
+	bool at_eof;
+	int read_error;
+
+	const char * base() const { return buffer.data(); }
+	bool fill();
+private:
+	ChunkedReader(const ChunkedReader &);
+	ChunkedReader & operator = (const ChunkedReader &);
+};
+
+#endif
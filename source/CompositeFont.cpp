@@ -5,6 +5,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 #include <vector>
 #include <list>
+#include <unordered_map>
 #include <stdint.h>
 #include <cstddef>
 #include <sys/mman.h>
@@ -226,7 +227,10 @@ CombinedFont::RawFileFont *
 CombinedFont::AddRawFileFont(CombinedFont::Font::Weight w, CombinedFont::Font::Slant s, unsigned short y, unsigned short x, const void * b, std::size_t z, std::size_t o)
 {
 	RawFileFont * f(new RawFileFont(w, s, y, x, b, z, o));
-	if (f) fonts.push_back(f);
+	if (f) {
+		fonts.push_back(f);
+		resolutions.clear();
+	}
 	return f;
 }
 
@@ -234,7 +238,10 @@ CombinedFont::LeftVTFileFont *
 CombinedFont::AddLeftVTFileFont(bool faint, Font::Slant s, unsigned short y, unsigned short x, const void * b, const void * rb, std::size_t z, std::size_t o)
 {
 	LeftVTFileFont * f(new LeftVTFileFont(faint, s, y, x, b, rb, z, o));
-	if (f) fonts.push_back(f);
+	if (f) {
+		fonts.push_back(f);
+		resolutions.clear();
+	}
 	return f;
 }
 
@@ -242,7 +249,10 @@ CombinedFont::LeftRightVTFileFont *
 CombinedFont::AddLeftRightVTFileFont(bool faint, Font::Slant s, unsigned short y, unsigned short x, const void * b, const void * rb, std::size_t z, std::size_t o)
 {
 	LeftRightVTFileFont * f(new LeftRightVTFileFont(faint, s, y, x, b, rb, z, o));
-	if (f) fonts.push_back(f);
+	if (f) {
+		fonts.push_back(f);
+		resolutions.clear();
+	}
 	return f;
 }
 
@@ -297,58 +307,81 @@ CombinedFont::ReadGlyph (
 	CombinedFont::Font::Weight w,
 	CombinedFont::Font::Slant s,
 	bool synthesize_bold,
-	bool synthesize_oblique
+	bool synthesize_oblique,
+	Resolution & resolution
 ) {
 	for (FontList::iterator fontit(fonts.begin()); fontit != fonts.end(); ++fontit) {
 		Font * font(*fontit);
 		if (s != font->query_slant()) continue;
-		if (const uint16_t * r = ReadGlyph(*font, character, w, synthesize_bold, synthesize_oblique))
+		if (const uint16_t * r = ReadGlyph(*font, character, w, synthesize_bold, synthesize_oblique)) {
+			resolution.font = font;
+			resolution.weight = w;
+			resolution.synthesize_bold = synthesize_bold;
+			resolution.synthesize_oblique = synthesize_oblique;
 			return r;
+		}
 	}
 	return nullptr;
 }
 
 const uint16_t *
 CombinedFont::ReadGlyph (uint32_t character, bool bold, bool faint, bool italic)
+{
+	const uint64_t key((uint64_t(character) << 3U) | (bold ? 4U : 0U) | (faint ? 2U : 0U) | (italic ? 1U : 0U));
+	ResolutionIndex::const_iterator i(resolutions.find(key));
+	if (resolutions.end() != i) {
+		const Resolution & r(i->second);
+		return r.font ? ReadGlyph(*r.font, character, r.weight, r.synthesize_bold, r.synthesize_oblique) : nullptr;
+	}
+	Resolution r;
+	const uint16_t * const f(Resolve(character, bold, faint, italic, r));
+	resolutions[key] = r;
+	return f;
+}
+
+/// Fall back through the fonts, weights, and slants, synthesizing boldface and obliqueness where they are lacking.
+inline
+const uint16_t *
+CombinedFont::Resolve (uint32_t character, bool bold, bool faint, bool italic, Resolution & r)
 {
 	if (faint) {
 		if (bold) {
 			if (italic) {
-				if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::ITALIC, false, false))
+				if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::ITALIC, false, false, r))
 					return f;
-				if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::OBLIQUE, false, false))
+				if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::OBLIQUE, false, false, r))
 					return f;
 			}
-			if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::UPRIGHT, false, italic))
+			if (const uint16_t * const f = ReadGlyph(character, Font::DEMIBOLD, Font::UPRIGHT, false, italic, r))
 				return f;
 		}
 		if (italic) {
-			if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::ITALIC, bold, false))
+			if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::ITALIC, bold, false, r))
 				return f;
-			if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::OBLIQUE, bold, false))
+			if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::OBLIQUE, bold, false, r))
 				return f;
 		}
-		if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::UPRIGHT, bold, italic))
+		if (const uint16_t * const f = ReadGlyph(character, Font::LIGHT, Font::UPRIGHT, bold, italic, r))
 			return f;
 	} else
 	{
 		if (bold) {
 			if (italic) {
-				if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::ITALIC, false, false))
+				if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::ITALIC, false, false, r))
 					return f;
-				if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::OBLIQUE, false, false))
+				if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::OBLIQUE, false, false, r))
 					return f;
 			}
-			if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::UPRIGHT, false, italic))
+			if (const uint16_t * const f = ReadGlyph(character, Font::BOLD, Font::UPRIGHT, false, italic, r))
 				return f;
 		}
 		if (italic) {
-			if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::ITALIC, bold, false))
+			if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::ITALIC, bold, false, r))
 				return f;
-			if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::OBLIQUE, bold, false))
+			if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::OBLIQUE, bold, false, r))
 				return f;
 		}
-		if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::UPRIGHT, bold, italic))
+		if (const uint16_t * const f = ReadGlyph(character, Font::MEDIUM, Font::UPRIGHT, bold, italic, r))
 			return f;
 	}
 	return nullptr;
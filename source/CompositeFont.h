@@ -8,6 +8,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 #include <vector>
 #include <list>
+#include <unordered_map>
 #include <stdint.h>
 #include <unistd.h>
 #include <cstddef>
@@ -95,9 +96,21 @@ protected:
 	typedef std::list<Font *> FontList;
 	FontList fonts;
 	uint16_t synthetic[16];
+	/// \brief which font, at which weight and with what synthesis, a character with particular attributes has been found in
+	struct Resolution {
+		Font * font;	///< null if no font has the character at all
+		Font::Weight weight;
+		bool synthesize_bold, synthesize_oblique;
+		Resolution() : font(nullptr), weight(Font::MEDIUM), synthesize_bold(false), synthesize_oblique(false) {}
+	};
+	/// \brief An index of prior resolutions, so that the fall-back through fonts, weights, and slants happens only once per character and attribute combination.
+	/// It is keyed by character and attribute flags, and is emptied whenever a font is added.
+	typedef std::unordered_map<uint64_t, Resolution> ResolutionIndex;
+	ResolutionIndex resolutions;
 
 	const uint16_t * ReadGlyph (Font &, uint32_t character, Font::Weight w, bool synthesize_bold, bool synthesize_oblique);
-	const uint16_t * ReadGlyph (uint32_t character, Font::Weight w, Font::Slant s, bool synthesize_bold, bool synthesize_oblique);
+	const uint16_t * ReadGlyph (uint32_t character, Font::Weight w, Font::Slant s, bool synthesize_bold, bool synthesize_oblique, Resolution &);
+	const uint16_t * Resolve (uint32_t character, bool bold, bool faint, bool italic, Resolution &);
 };
 
 #endif
@@ -3,11 +3,41 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
+#include <cerrno>
+#include <unistd.h>
 #include "ECMA48Output.h"
 #include "TerminalCapabilities.h"
 
 namespace {
 
+// Decimal parameters are converted two digits at a time from this table, rather than going through printf().
+const char digit_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899"
+;
+
+inline
+void
+write_all (
+	int fd,
+	const char * p,
+	std::size_t l
+) {
+	while (l) {
+		const ssize_t n(write(fd, p, l));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			// There is nothing useful to be done about a terminal that has gone away, and the output is simply lost.
+			return;
+		}
+		p += n;
+		l -= n;
+	}
+}
+
 inline
 uint_fast16_t
 SquareDiff(
@@ -29,19 +59,83 @@ PythagoreanDistance (
 
 }
 
+void
+ECMA48Output::flush() const
+{
+	std::fflush(out);
+	if (arena && !arena->empty()) {
+		write_all(fd(), arena->data(), arena->length());
+		// The capacity is retained, so that the next frame is assembled without any reallocation.
+		arena->clear();
+	}
+}
+
+unsigned
+ECMA48Output::control_character_length(
+	unsigned char character
+) const {
+	if (character < 0x80) return 1U;
+	if (c1_7bit || !c1_8bit) return 2U;
+	return 1U;
+}
+
+unsigned
+ECMA48Output::decimal_length(
+	unsigned n
+) {
+	unsigned l(1U);
+	while (n >= 10U) {
+		n /= 10U;
+		++l;
+	}
+	return l;
+}
+
+unsigned
+ECMA48Output::UTF8_length(
+	uint32_t ch
+) {
+	return	ch < 0x00000080 ? 1U :
+		ch < 0x00000800 ? 2U :
+		ch < 0x00010000 ? 3U :
+		ch < 0x00200000 ? 4U :
+		ch < 0x04000000 ? 5U :
+		6U;
+}
+
+void
+ECMA48Output::decimal(
+	unsigned n
+) const {
+	char buf[16];
+	char * p(buf + sizeof buf);
+	while (n >= 100U) {
+		const unsigned i((n % 100U) * 2U);
+		n /= 100U;
+		*--p = digit_pairs[i + 1U];
+		*--p = digit_pairs[i];
+	}
+	if (n >= 10U) {
+		*--p = digit_pairs[n * 2U + 1U];
+		*--p = digit_pairs[n * 2U];
+	} else
+		*--p = char('0' + n);
+	put(p, buf + sizeof buf - p);
+}
+
 void
 ECMA48Output::print_control_character(
 	unsigned char character
 ) const {
         if (c1_7bit) {
                 if (character >= 0x80) {
-                        std::putc(ESC, out);
+                        put(char(ESC));
                         character -= 0x40;
                 }
-                std::putc(character, out);
+                put(char(character));
         } else
         if (c1_8bit)
-                std::putc(character, out);
+                put(char(character));
         else
                 UTF8(character);
 }
@@ -89,14 +183,14 @@ ECMA48Output::UTF8(
 		const char s[1] = {
 			static_cast<char>(ch)
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	} else
 	if (ch < 0x00000800) {
 		const char s[2] = {
 			static_cast<char>(0xC0 | (0x1F & (ch >> 6U))),
 			static_cast<char>(0x80 | (0x3F & (ch >> 0U))),
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	} else
 	if (ch < 0x00010000) {
 		const char s[3] = {
@@ -104,7 +198,7 @@ ECMA48Output::UTF8(
 			static_cast<char>(0x80 | (0x3F & (ch >> 6U))),
 			static_cast<char>(0x80 | (0x3F & (ch >> 0U))),
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	} else
 	if (ch < 0x00200000) {
 		const char s[4] = {
@@ -113,7 +207,7 @@ ECMA48Output::UTF8(
 			static_cast<char>(0x80 | (0x3F & (ch >> 6U))),
 			static_cast<char>(0x80 | (0x3F & (ch >> 0U))),
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	} else
 	if (ch < 0x04000000) {
 		const char s[5] = {
@@ -123,7 +217,7 @@ ECMA48Output::UTF8(
 			static_cast<char>(0x80 | (0x3F & (ch >> 6U))),
 			static_cast<char>(0x80 | (0x3F & (ch >> 0U))),
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	} else
 	{
 		const char s[6] = {
@@ -134,7 +228,7 @@ ECMA48Output::UTF8(
 			static_cast<char>(0x80 | (0x3F & (ch >> 6U))),
 			static_cast<char>(0x80 | (0x3F & (ch >> 0U))),
 		};
-		std::fwrite(s, sizeof s, 1, out);
+		put(s, sizeof s);
 	}
 }
 
@@ -234,21 +328,23 @@ ECMA48Output::SCUSR() const
 
 void
 ECMA48Output::SGRColour(
-	bool is_fg
+	bool is_fg,
+	char & semi
 ) const {
 	if (TerminalCapabilities::NO_COLOURS == caps.colour_level) return;
-	csi();
-	std::fprintf(out, "%um", is_fg ? 39U : 49U);
+	SGRParameterSeparator(semi);
+	decimal(is_fg ? 39U : 49U);
 }
 
 void
 ECMA48Output::SGRColour(
 	bool is_fg,
-	const CharacterCell::colour_type & colour
+	const CharacterCell::colour_type & colour,
+	char & semi
 ) const {
 	if (TerminalCapabilities::NO_COLOURS == caps.colour_level) return;
 	if (colour.is_default_or_erased()) {
-		SGRColour(is_fg);
+		SGRColour(is_fg, semi);
 		return;
 	}
 	// If we know that the RGB triple came from an ECMA-48 standard colour or AIXTerm colour in the first place ...
@@ -264,7 +360,7 @@ ECMA48Output::SGRColour(
 				for (uint_least8_t i(0U); i < 8U; ++i) {
 					const uint_fast32_t d(PythagoreanDistance(Map16Colour(i), colour));
 					if (0 == d) {
-						SGRColour16(is_fg, i);
+						SGRColour16(is_fg, i, semi);
 						return;
 					}
 				}
@@ -287,7 +383,7 @@ ECMA48Output::SGRColour(
 					if (0 == d) closest = i;
 				}
 				if (closest < 256U) {
-					SGRColour256Ambig(is_fg, closest);
+					SGRColour256Ambig(is_fg, closest, semi);
 					return;
 				}
 				break;
@@ -300,7 +396,7 @@ ECMA48Output::SGRColour(
 					if (0 == d) closest = i;
 				}
 				if (closest < 256U) {
-					SGRColour256(is_fg, closest);
+					SGRColour256(is_fg, closest, semi);
 					return;
 				}
 				break;
@@ -329,7 +425,7 @@ ECMA48Output::SGRColour(
 						if (0 == dist) break;
 					}
 				}
-				SGRColour8(is_fg, closest);
+				SGRColour8(is_fg, closest, semi);
 			}
 			return;
 		case TerminalCapabilities::ECMA_16_COLOURS:
@@ -344,7 +440,7 @@ ECMA48Output::SGRColour(
 						if (0 == dist) break;
 					}
 				}
-				SGRColour16(is_fg, closest);
+				SGRColour16(is_fg, closest, semi);
 			}
 			return;
 		case TerminalCapabilities::INDEXED_COLOUR_FAULTY:
@@ -362,7 +458,7 @@ ECMA48Output::SGRColour(
 						if (prefer_standard && 0 == dist) break;
 					}
 				}
-				SGRColour256Ambig(is_fg, closest);
+				SGRColour256Ambig(is_fg, closest, semi);
 			}
 			return;
 		case TerminalCapabilities::ISO_INDEXED_COLOUR:
@@ -379,14 +475,14 @@ ECMA48Output::SGRColour(
 						if (prefer_standard && 0 == dist) break;
 					}
 				}
-				SGRColour256(is_fg, closest);
+				SGRColour256(is_fg, closest, semi);
 			}
 			return;
 		case TerminalCapabilities::DIRECT_COLOUR_FAULTY:
-			SGRTrueColourAmbig(is_fg, colour.red, colour.green, colour.blue);
+			SGRTrueColourAmbig(is_fg, colour.red, colour.green, colour.blue, semi);
 			return;
 		case TerminalCapabilities::ISO_DIRECT_COLOUR:
-			SGRTrueColour(is_fg, colour.red, colour.green, colour.blue);
+			SGRTrueColour(is_fg, colour.red, colour.green, colour.blue, semi);
 			return;
 	}
 }
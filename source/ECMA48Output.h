@@ -7,57 +7,78 @@ For copyright and licensing terms, see the file named COPYING.
 #define INCLUDE_ECMA48OUTPUT_H
 
 #include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <string>
 #include "CharacterCell.h"
 #include "ControlCharacters.h"
 
 class TerminalCapabilities;
 
 /// \brief Encapsulate ECMA-48 output control sequences for a terminal with the given capabilities.
+///
+/// Output normally goes straight to the stdio stream, so that it can be freely interleaved with other output to that stream.
+/// If given an arena, output is instead accumulated there and only written, with a single write(), when flushed.
 class ECMA48Output
 {
 public:
-	ECMA48Output(const TerminalCapabilities & c, FILE * f, bool c1_7, bool c1_8) : caps(c), c1_7bit(c1_7), c1_8bit(c1_8), out(f) {}
+	ECMA48Output(const TerminalCapabilities & c, FILE * f, bool c1_7, bool c1_8, std::string * a = nullptr) : caps(c), c1_7bit(c1_7), c1_8bit(c1_8), out(f), arena(a) {}
 
 	const TerminalCapabilities & caps;
 	bool c1_7bit, c1_8bit;
 
 	int fd() const { return fileno(out); }
 	FILE * file() const { return out; }
-	void flush() const { std::fflush(out); }
+	void flush() const;
+	/// \brief The lengths in bytes of various outputs, for callers that are choosing the cheapest of several ways to achieve something.
+	/// @{
+	unsigned control_character_length(unsigned char c) const;
+	unsigned csi_length() const { return control_character_length(CSI); }
+	static unsigned decimal_length(unsigned n);
+	static unsigned UTF8_length(uint32_t ch);
+	/// @}
         void csi() const { print_control_character(CSI); }
         void esc() const { print_control_character(ESC); }
 	void newline() const;
 	void reverse_index() const;
 	void forward_index() const;
 	void UTF8(uint32_t ch) const;
-	void SGRColour(bool is_fg, const CharacterCell::colour_type & colour) const;
-	void SGRColour(bool is_fg) const;
-	void SGRAttribute(unsigned n) const { csi(); std::fprintf(out, "%um", n); }
+	void SGRColour(bool is_fg, const CharacterCell::colour_type & colour) const { char semi(0); SGRColour(is_fg, colour, semi); if (semi) put('m'); }
+	void SGRColour(bool is_fg) const { char semi(0); SGRColour(is_fg, semi); if (semi) put('m'); }
+	/// \brief Build up a single SGR control sequence from several parameters, which the caller terminates if anything was emitted.
+	/// @{
+	void SGRParameterSeparator(char & semi) const { if (semi) put(semi); else csi(); semi = ';'; }
+	void SGRColour(bool is_fg, const CharacterCell::colour_type & colour, char & semi) const;
+	void SGRColour(bool is_fg, char & semi) const;
+	/// @}
+	void SGRAttribute(unsigned n) const { csi(); decimal(n); put('m'); }
 	void set_italics (bool v) { SGRAttribute(v ? 3U : 23U); }
 	void set_underline (bool v) { SGRAttribute(v ? 4U : 24U); }
-	void print_subparameter(unsigned n) const { std::fprintf(out, ":%u", n); }
-	void print_graphic_character(unsigned char c) const { std::fputc(c, out); }
+	void print_subparameter(unsigned n) const { put(':'); decimal(n); }
+	void print_graphic_character(unsigned char c) const { put(char(c)); }
 	void print_control_character(unsigned char c) const;
 	void print_control_characters(unsigned char c, unsigned int n) const;
 	void change_cursor_visibility(bool) const;
 
 	void SCUSR(CursorSprite::attribute_type a, CursorSprite::glyph_type g) const;
 	void SCUSR() const;
-	void ED(unsigned n) const { csi(); std::fprintf(out, "%uJ", n); }
-	void EL(unsigned n) const { csi(); std::fprintf(out, "%uK", n); }
-	void HPA(unsigned n) const { csi(); std::fprintf(out, "%u`", n); }
-	void CHA(unsigned n) const { csi(); std::fprintf(out, "%uG", n); }
-	void CTC(unsigned n) const { csi(); std::fprintf(out, "%uW", n); }
-	void TBC(unsigned n) const { csi(); std::fprintf(out, "%ug", n); }
-	void CUP(unsigned r, unsigned c) const { csi(); std::fprintf(out, "%u;%uH", r, c); }
-	void CUP() const { csi(); std::fputs("H", out); }
-	void CUU(unsigned n) const { csi(); std::fprintf(out, "%uA", n); }
-	void CUD(unsigned n) const { csi(); std::fprintf(out, "%uB", n); }
-	void CUR(unsigned n) const { csi(); std::fprintf(out, "%uC", n); }
-	void CUL(unsigned n) const { csi(); std::fprintf(out, "%uD", n); }
-	void REP(unsigned n) const { csi(); std::fprintf(out, "%ub", n); }
+	void ED(unsigned n) const { csi(); decimal(n); put('J'); }
+	void EL(unsigned n) const { csi(); decimal(n); put('K'); }
+	void HPA(unsigned n) const { csi(); decimal(n); put('`'); }
+	void CHA(unsigned n) const { csi(); decimal(n); put('G'); }
+	void CTC(unsigned n) const { csi(); decimal(n); put('W'); }
+	void TBC(unsigned n) const { csi(); decimal(n); put('g'); }
+	void CUP(unsigned r, unsigned c) const { csi(); decimal(r); put(';'); decimal(c); put('H'); }
+	void CUP() const { csi(); put('H'); }
+	void CUU(unsigned n) const { csi(); decimal(n); put('A'); }
+	void CUD(unsigned n) const { csi(); decimal(n); put('B'); }
+	void CUR(unsigned n) const { csi(); decimal(n); put('C'); }
+	void CUL(unsigned n) const { csi(); decimal(n); put('D'); }
+	void REP(unsigned n) const { csi(); decimal(n); put('b'); }
+	void IL(unsigned n) const { csi(); decimal(n); put('L'); }
+	void DL(unsigned n) const { csi(); decimal(n); put('M'); }
 	void IRM(bool v) const { Mode(1U, v); }
-	void DECSTR() const { csi(); std::fputs("!p", out); }
+	void DECSTR() const { csi(); put("!p"); }
 	void DECST8C() const { DECCursorTabulationControl(5U); }
 	void DECCKM(bool v) const { DECPrivateMode(1U, v); }
 	void DECCOLM(bool v) const { DECPrivateMode(3U, v); }
@@ -68,15 +89,15 @@ public:
 	void DECBKM(bool v) const { DECPrivateMode(67U, v); }
 	void DECSLRMM(bool v) const { DECPrivateMode(69U, v); }
 	void DECECM(bool v) const { DECPrivateMode(117U, v); }
-	void DECSCPP(unsigned n) const { csi(); std::fprintf(out, "%u$|", n); }
-	void DECSNLS(unsigned n) const { csi(); std::fprintf(out, "%u*|", n); }
-	void DECELR(bool enable) const { csi(); std::fprintf(out, "%u\'z", enable ? 1U : 0U); }
-	void DECSLE(bool press, bool enable) const { csi(); std::fprintf(out, "%u\'{", 1U + (press ? 0U : 2U) + (enable ? 0U : 1U)); }
-	void DECSLE() const { csi(); std::fprintf(out, "%u\'{", 0U); }
-	void DECSLPP(unsigned n) const { csi(); std::fprintf(out, "%ut", n); }
-	void DTTermResize(unsigned n0, unsigned n1) const { csi(); std::fprintf(out, "8;%u;%ut", n0, n1); }
-	void DECSTBM(unsigned n0, unsigned n1) const { csi(); std::fprintf(out, "%u;%ur", n0, n1); }
-	void DECSLRM(unsigned n0, unsigned n1) const { csi(); std::fprintf(out, "%u;%us", n0, n1); }
+	void DECSCPP(unsigned n) const { csi(); decimal(n); put("$|"); }
+	void DECSNLS(unsigned n) const { csi(); decimal(n); put("*|"); }
+	void DECELR(bool enable) const { csi(); decimal(enable ? 1U : 0U); put("\'z"); }
+	void DECSLE(bool press, bool enable) const { csi(); decimal(1U + (press ? 0U : 2U) + (enable ? 0U : 1U)); put("\'{"); }
+	void DECSLE() const { csi(); decimal(0U); put("\'{"); }
+	void DECSLPP(unsigned n) const { csi(); decimal(n); put('t'); }
+	void DTTermResize(unsigned n0, unsigned n1) const { csi(); put("8;"); decimal(n0); put(';'); decimal(n1); put('t'); }
+	void DECSTBM(unsigned n0, unsigned n1) const { csi(); decimal(n0); put(';'); decimal(n1); put('r'); }
+	void DECSLRM(unsigned n0, unsigned n1) const { csi(); decimal(n0); put(';'); decimal(n1); put('s'); }
 	void DECKPxM(bool application) const { esc(); print_graphic_character(application ? '=' : '>'); }
 	// The 1006 private mode is not separately tweakable because we *always* want 1006 encoding; it entirely supersedes the 1005 and 1015 encodings.other encodings are inferior and superseded.
 	// The 1000, 1002, and 1003 private modes are radio buttons in a terminal emulator, but not all emulators implement all modes (MobaXTerm lacking 1003 support, for example).
@@ -95,24 +116,30 @@ public:
 	void TekenFunctionKeys(bool v) const { SCOPrivateMode(4U, v); }
 protected:
 	FILE * const out;
+	std::string * const arena;
 
-	void Mode(unsigned n, bool v) const { csi(); std::fprintf(out, "%u%c", n, v ? 'h' : 'l'); }
-	void DECPrivateMode(unsigned n, bool v) const { csi(); std::fprintf(out, "?%u%c", n, v ? 'h' : 'l'); }
-	void DECCursorTabulationControl(unsigned n) const { csi(); std::fprintf(out, "?%uW", n); }
-	void DECSCUSR(unsigned n) const { csi(); std::fprintf(out, "%u q", n); }
-	void DECSCUSR() const { csi(); std::fputs(" q", out); }
+	void put(char c) const { if (arena) arena->push_back(c); else std::fputc(c, out); }
+	void put(const char * s, std::size_t l) const { if (arena) arena->append(s, l); else std::fwrite(s, 1, l, out); }
+	void put(const char * s) const { put(s, std::strlen(s)); }
+	void decimal(unsigned n) const;
+
+	void Mode(unsigned n, bool v) const { csi(); decimal(n); put(v ? 'h' : 'l'); }
+	void DECPrivateMode(unsigned n, bool v) const { csi(); put('?'); decimal(n); put(v ? 'h' : 'l'); }
+	void DECCursorTabulationControl(unsigned n) const { csi(); put('?'); decimal(n); put('W'); }
+	void DECSCUSR(unsigned n) const { csi(); decimal(n); put(" q"); }
+	void DECSCUSR() const { csi(); put(" q"); }
 	// LINUXSCUSR is documented in VGA-softcursor.txt.
-	void LINUXSCUSR(unsigned n) const { csi(); std::fprintf(out, "?%uc", n); }
-	void LINUXSCUSR() const { csi(); std::fputs("?c", out); }
+	void LINUXSCUSR(unsigned n) const { csi(); put('?'); decimal(n); put('c'); }
+	void LINUXSCUSR() const { csi(); put("?c"); }
 	// SCO Private modes are an extension, following the SCO screen(HW) pattern of using '=' as an intermediate character.
-	void SCOPrivateMode(unsigned n, bool v) const { csi(); std::fprintf(out, "=%u%c", n, v ? 'h' : 'l'); }
-	void SGRColour8(bool is_fg, unsigned n) const { csi(); std::fprintf(out, "%um", (is_fg ? 30U : 40U) + n); }
-	void SGRColour16(bool is_fg, unsigned n) const { if (n >= 8U) n += 90U - 38U; csi(); std::fprintf(out, "%um", (is_fg ? 30U : 40U) + n); }
-	void SGRColour256Ambig(bool is_fg, unsigned n) const { csi(); std::fprintf(out, "%u;5;%um", (is_fg ? 38U : 48U), n); }
-	void SGRColour256(bool is_fg, unsigned n) const { csi(); std::fprintf(out, "%u:5:%um", (is_fg ? 38U : 48U), n); }
-	void SGRTrueColourAmbig(bool is_fg, unsigned r, unsigned g, unsigned b) const { csi(); std::fprintf(out, "%u;2;%u;%u;%um", (is_fg ? 38U : 48U), r, g, b); }
-	void SGRTrueColourFaulty(bool is_fg, unsigned r, unsigned g, unsigned b) const { csi(); std::fprintf(out, "%u:2:%u:%u:%um", (is_fg ? 38U : 48U), r, g, b); }
-	void SGRTrueColour(bool is_fg, unsigned r, unsigned g, unsigned b) const { csi(); std::fprintf(out, "%u:2::%u:%u:%um", (is_fg ? 38U : 48U), r, g, b); }
+	void SCOPrivateMode(unsigned n, bool v) const { csi(); put('='); decimal(n); put(v ? 'h' : 'l'); }
+	void SGRColour8(bool is_fg, unsigned n, char & semi) const { SGRParameterSeparator(semi); decimal((is_fg ? 30U : 40U) + n); }
+	void SGRColour16(bool is_fg, unsigned n, char & semi) const { if (n >= 8U) n += 90U - 38U; SGRParameterSeparator(semi); decimal((is_fg ? 30U : 40U) + n); }
+	void SGRColour256Ambig(bool is_fg, unsigned n, char & semi) const { SGRParameterSeparator(semi); decimal(is_fg ? 38U : 48U); put(";5;"); decimal(n); }
+	void SGRColour256(bool is_fg, unsigned n, char & semi) const { SGRParameterSeparator(semi); decimal(is_fg ? 38U : 48U); put(":5:"); decimal(n); }
+	void SGRTrueColourAmbig(bool is_fg, unsigned r, unsigned g, unsigned b, char & semi) const { SGRParameterSeparator(semi); decimal(is_fg ? 38U : 48U); put(";2;"); decimal(r); put(';'); decimal(g); put(';'); decimal(b); }
+	void SGRTrueColourFaulty(bool is_fg, unsigned r, unsigned g, unsigned b, char & semi) const { SGRParameterSeparator(semi); decimal(is_fg ? 38U : 48U); put(":2:"); decimal(r); put(':'); decimal(g); put(':'); decimal(b); }
+	void SGRTrueColour(bool is_fg, unsigned r, unsigned g, unsigned b, char & semi) const { SGRParameterSeparator(semi); decimal(is_fg ? 38U : 48U); put(":2::"); decimal(r); put(':'); decimal(g); put(':'); decimal(b); }
 };
 
 #endif
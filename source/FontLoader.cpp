@@ -4,6 +4,7 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #define _XOPEN_SOURCE_EXTENDED
+#include <vector>
 #include <cerrno>
 #include <cstdio>
 #include <cstddef>
@@ -44,17 +45,32 @@ pread(int fd, bsd_vtfont_header & header, off_t o)
 	return rc;
 }
 
+/// Read all of the map entries in one go, rather than one pread() per entry.
 inline
 ssize_t
-pread(int fd, bsd_vtfont_map_entry & me, off_t o)
+pread(int fd, std::vector<bsd_vtfont_map_entry> & map, off_t o)
 {
-	const ssize_t rc(pread(fd, &me, sizeof me, o));
-	if (0 <= rc) {
-		me.character = be32toh(me.character);
-		me.glyph = be16toh(me.glyph);
-		me.count = be16toh(me.count);
+	char * const b(reinterpret_cast<char *>(map.data()));
+	const std::size_t l(map.size() * sizeof(bsd_vtfont_map_entry));
+	std::size_t done(0U);
+	while (done < l) {
+		const ssize_t rc(::pread(fd, b + done, l - done, o + done));
+		if (0 > rc) {
+			if (EINTR == errno) continue;
+			return rc;
+		}
+		if (0 == rc) {
+			errno = EINVAL;
+			return -1;
+		}
+		done += rc;
 	}
-	return rc;
+	for (std::vector<bsd_vtfont_map_entry>::iterator p(map.begin()), e(map.end()); e != p; ++p) {
+		p->character = be32toh(p->character);
+		p->glyph = be16toh(p->glyph);
+		p->count = be16toh(p->count);
+	}
+	return done;
 }
 
 inline
@@ -138,30 +154,31 @@ bad_glyph_map:
 		die_invalid(prog, envs, name, "VT4 font has a corrupt glyph map.");
 	}
 
+	uint64_t map_length(0U);
+	for (unsigned vtfont_index(0U); vtfont_index < 4U; ++vtfont_index)
+		map_length += header.map_lengths[vtfont_index];
+	if (uint64_t(map_start(header)) + map_length * sizeof(bsd_vtfont_map_entry) > uint64_t(t.st_size)) goto bad_glyph_map;
+	std::vector<bsd_vtfont_map_entry> map(map_length);
+	if (0 > pread(font_fd.get(), map, map_start(header))) goto bad_file;
+
 	if (header.map_lengths[1U] > 0U || header.map_lengths[3U] > 0U) {
 		if (CombinedFont::LeftRightVTFileFont * f = font.AddLeftRightVTFileFont(faint, slant, header.height, header.width, base, real_base, size, 0U)) {
-			bsd_vtfont_map_entry me;
-			off_t pos(map_start(header));
+			std::vector<bsd_vtfont_map_entry>::const_iterator me(map.begin());
 			for (unsigned vtfont_index(0U); vtfont_index < 4U; ++vtfont_index) {
-				for (unsigned c(0U); c < header.map_lengths[vtfont_index]; ++c) {
-					if (0 > pread(font_fd.get(), me, pos)) goto bad_file;
-					if (me.glyph + me.count + 1U > header.glyphs) goto bad_glyph_map;
-					f->AddMapping(vtfont_index, me.character, me.glyph, me.count + 1U);
-					pos += sizeof me;
+				for (unsigned c(0U); c < header.map_lengths[vtfont_index]; ++c, ++me) {
+					if (me->glyph + me->count + 1U > header.glyphs) goto bad_glyph_map;
+					f->AddMapping(vtfont_index, me->character, me->glyph, me->count + 1U);
 				}
 			}
 		}
 	} else
 	{
 		if (CombinedFont::LeftVTFileFont * f = font.AddLeftVTFileFont(faint, slant, header.height, header.width, base, real_base, size, 0U)) {
-			bsd_vtfont_map_entry me;
-			off_t pos(map_start(header));
+			std::vector<bsd_vtfont_map_entry>::const_iterator me(map.begin());
 			for (unsigned vtfont_index(0U); vtfont_index < 4U; vtfont_index += 2U) {
-				for (unsigned c(0U); c < header.map_lengths[vtfont_index]; ++c) {
-					if (0 > pread(font_fd.get(), me, pos)) goto bad_file;
-					if (me.glyph + me.count + 1U > header.glyphs) goto bad_glyph_map;
-					f->AddMapping(vtfont_index, me.character, me.glyph, me.count + 1U);
-					pos += sizeof me;
+				for (unsigned c(0U); c < header.map_lengths[vtfont_index]; ++c, ++me) {
+					if (me->glyph + me->count + 1U > header.glyphs) goto bad_glyph_map;
+					f->AddMapping(vtfont_index, me->character, me->glyph, me->count + 1U);
 				}
 			}
 		}
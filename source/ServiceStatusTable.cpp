@@ -0,0 +1,201 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "ServiceStatusTable.h"
+#include "runtime-dir.h"
+#include "fdutils.h"
+
+const char service_manager_status_table_magic[8] = { 'n', 'o', 's', 'h', 's', 't', 'a', 't' };
+
+/* The table views **********************************************************
+// **************************************************************************
+*/
+
+ServiceStatusTable::table::table() :
+	name(),
+	fd(-1),
+	base(nullptr),
+	length(0U),
+	slot_count(0U),
+	generation(0U),
+	indexed(false),
+	index()
+{
+}
+
+ServiceStatusTable::table::~table()
+{
+	if (base)
+		munmap(base, length);
+}
+
+void
+ServiceStatusTable::table::open (
+	const std::string & n
+) {
+	name = n;
+	attach();
+}
+
+void
+ServiceStatusTable::table::attach (
+) {
+	fd.reset(open_read_at(AT_FDCWD, name.c_str()));
+	if (0 > fd.get()) return;
+	// A table that nothing holds locked has been left behind by a service manager that is no longer running.
+	// Being able to take a shared lock is the test, and closing the descriptor relinquishes the lock again.
+	struct stat s;
+	if (0 <= flock(fd.get(), LOCK_SH|LOCK_NB)
+	||  0 > fstat(fd.get(), &s)
+	||  !S_ISREG(s.st_mode)
+	||  std::size_t(s.st_size) < sizeof(service_manager_status_table_header)
+	) {
+		fd.reset(-1);
+		return;
+	}
+	void * const p(mmap(nullptr, sizeof(service_manager_status_table_header), PROT_READ, MAP_SHARED, fd.get(), 0));
+	if (MAP_FAILED == p) {
+		fd.reset(-1);
+		return;
+	}
+	base = p;
+	length = sizeof(service_manager_status_table_header);
+	const service_manager_status_table_header & h(header());
+	if (0 != std::memcmp(h.magic, service_manager_status_table_magic, sizeof h.magic)
+	||  service_manager_status_table_header::VERSION != h.version
+	||  sizeof(service_manager_status_table_slot) != h.slot_size
+	||  !remap()
+	)
+		close();
+}
+
+void
+ServiceStatusTable::table::close (
+) {
+	if (base) munmap(base, length);
+	base = nullptr;
+	length = 0U;
+	slot_count = 0U;
+	indexed = false;
+	index.clear();
+	fd.reset(-1);
+}
+
+/// Drop the table if its service manager has gone away since it was opened, or pick up a table that a service manager has since started publishing.
+void
+ServiceStatusTable::table::refresh (
+) {
+	if (!base)
+		attach();
+	else
+	if (0 <= flock(fd.get(), LOCK_SH|LOCK_NB))
+		close();
+}
+
+/// Extend the mapping to cover all of the slots, which the service manager can have added to since it was last mapped.
+/// The service manager only ever extends the file before it increases the slot count, so the count is always safe to map.
+bool
+ServiceStatusTable::table::remap (
+) {
+	const uint32_t count(__atomic_load_n(&header().slot_count, __ATOMIC_ACQUIRE));
+	if (count == slot_count && length > sizeof(service_manager_status_table_header)) return true;
+	const std::size_t l(sizeof(service_manager_status_table_header) + std::size_t(count) * sizeof(service_manager_status_table_slot));
+	void * const p(mmap(nullptr, l, PROT_READ, MAP_SHARED, fd.get(), 0));
+	if (MAP_FAILED == p) return false;
+	munmap(base, length);
+	base = p;
+	length = l;
+	slot_count = count;
+	indexed = false;
+	return true;
+}
+
+/// Build the device and inode index of the slots in one pass over the table.
+/// Slots can change underfoot, so entries are only hints as to where to look; query() checks them.
+void
+ServiceStatusTable::table::reindex (
+) {
+	generation = __atomic_load_n(&header().generation, __ATOMIC_ACQUIRE);
+	index.clear();
+	const service_manager_status_table_slot * const s(slots());
+	for (uint32_t i(0U); i < slot_count; ++i) {
+		const uint64_t ino(__atomic_load_n(&s[i].ino, __ATOMIC_RELAXED));
+		if (ino)
+			index[key(__atomic_load_n(&s[i].dev, __ATOMIC_RELAXED), ino)] = i;
+	}
+	indexed = true;
+}
+
+bool
+ServiceStatusTable::table::query (
+	const key & k,
+	char (& status)[STATUS_BLOCK_SIZE]
+) {
+	if (!base) return false;
+	if (!remap()) return false;
+	if (!indexed || generation != __atomic_load_n(&header().generation, __ATOMIC_ACQUIRE))
+		reindex();
+	slot_index::const_iterator i(index.find(k));
+	if (index.end() == i) return false;
+	const service_manager_status_table_slot & s(slots()[i->second]);
+	// The service manager never holds a slot for long, so a bounded number of retries suffices.
+	// A service manager that died mid-write leaves an odd sequence number forever; the status file is the fallback.
+	for (unsigned retries(0U); retries < 1000U; ++retries) {
+		const uint32_t before(__atomic_load_n(&s.sequence, __ATOMIC_ACQUIRE));
+		if (before & 1U) continue;
+		const uint64_t dev(__atomic_load_n(&s.dev, __ATOMIC_RELAXED)), ino(__atomic_load_n(&s.ino, __ATOMIC_RELAXED));
+		std::memcpy(status, const_cast<const unsigned char *>(s.status), sizeof status);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const uint32_t after(__atomic_load_n(&s.sequence, __ATOMIC_RELAXED));
+		if (before != after) continue;
+		return k.first == dev && k.second == ino;
+	}
+	return false;
+}
+
+/* The status table *********************************************************
+// **************************************************************************
+*/
+
+ServiceStatusTable::ServiceStatusTable()
+{
+	// These follow where the service manager control sockets are.
+	tables[0].open("/run/service-manager/status-table");
+	tables[1].open(effective_user_runtime_dir() + "service-manager/status-table");
+}
+
+ServiceStatusTable::~ServiceStatusTable()
+{
+}
+
+/// Re-check that the service managers whose tables are open are still running, costing a system call or so per table.
+void
+ServiceStatusTable::refresh (
+) {
+	for (table * t(tables), * const e(tables + sizeof tables/sizeof *tables); t < e; ++t)
+		t->refresh();
+}
+
+/// Copy the status block of the service whose supervise directory this is, if a running service manager has it loaded.
+bool
+ServiceStatusTable::query (
+	const struct stat & supervise_dir,
+	char (& status)[STATUS_BLOCK_SIZE]
+) {
+	const key k(supervise_dir.st_dev, supervise_dir.st_ino);
+	for (table * t(tables), * const e(tables + sizeof tables/sizeof *tables); t < e; ++t)
+		if (t->query(k, status))
+			return true;
+	return false;
+}
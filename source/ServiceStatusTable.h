@@ -0,0 +1,65 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#if !defined(INCLUDE_SERVICESTATUSTABLE_H)
+#define INCLUDE_SERVICESTATUSTABLE_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+#include "service-manager.h"
+#include "FileDescriptorOwner.h"
+
+struct stat;
+
+/// \brief A read-only view of the shared memory status tables of the system-wide and per-user service managers
+/// Tables whose service managers are not running are ignored, as is anything that does not look like a table.
+/// A service that is not found is not necessarily unloaded; callers fall back to the supervise directory's status file and ok FIFO.
+/// Whether the service managers are running is checked when the tables are opened and thereafter only by refresh(), so that query() is a pure memory read.
+/// Long-running readers must call refresh() once per refresh of their own, before querying.
+class ServiceStatusTable
+{
+public:
+	ServiceStatusTable();
+	~ServiceStatusTable();
+
+	void refresh();
+	bool query(const struct stat & supervise_dir, char (& status)[STATUS_BLOCK_SIZE]);
+protected:
+	typedef std::pair<uint64_t, uint64_t> key;
+	typedef std::map<key, uint32_t> slot_index;
+	struct table {
+		table();
+		~table();
+		std::string name;
+		FileDescriptorOwner fd;
+		void * base;
+		std::size_t length;
+		uint32_t slot_count, generation;
+		bool indexed;
+		slot_index index;
+
+		void open(const std::string &);
+		void attach();
+		void close();
+		void refresh();
+		bool remap();
+		void reindex();
+		bool query(const key &, char (&)[STATUS_BLOCK_SIZE]);
+		const service_manager_status_table_header & header() const { return *static_cast<const service_manager_status_table_header *>(base); }
+		const service_manager_status_table_slot * slots() const { return reinterpret_cast<const service_manager_status_table_slot *>(&header() + 1); }
+	private:
+		table(const table &);
+		table & operator = (const table &);
+	};
+	table tables[2];
+private:
+	ServiceStatusTable(const ServiceStatusTable &);
+	ServiceStatusTable & operator = (const ServiceStatusTable &);
+};
+
+#endif
@@ -3,6 +3,7 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
+#include <algorithm>
 #include <cstddef>
 #include "UnicodeClassification.h"
 #include "CharacterCell.h"
@@ -43,6 +44,34 @@ width (
 	return 1U;
 }
 
+// This is FNV-1a, taken a 32-bit word rather than an octet at a time.
+inline
+uint32_t
+hash (
+	uint32_t h,
+	uint32_t v
+) {
+	return (h ^ v) * 16777619U;
+}
+
+inline
+uint32_t
+hash (
+	uint32_t h,
+	const CharacterCell::colour_type & c
+) {
+	return hash(h, (uint32_t(c.alpha) << 24U) | (uint32_t(c.red) << 16U) | (uint32_t(c.green) << 8U) | uint32_t(c.blue));
+}
+
+inline
+uint32_t
+hash (
+	uint32_t h,
+	const CharacterCell & c
+) {
+	return hash(hash(hash(hash(h, c.character), c.attributes), c.foreground), c.background);
+}
+
 }
 
 /* The TUIDisplayCompositor class *******************************************
@@ -63,7 +92,10 @@ TUIDisplayCompositor::TUIDisplayCompositor(
 	screen_flags(0),
 	size(init_w, init_h),
 	cur_cells(static_cast<std::size_t>(size.h) * size.w),
-	new_cells(static_cast<std::size_t>(size.h) * size.w)
+	new_cells(static_cast<std::size_t>(size.h) * size.w),
+	dirty_rows(size.h, true),
+	dirty_spans(size.h, span(0U, size.w)),
+	stale_row_hashes(size.h, true)
 {
 }
 
@@ -94,92 +126,100 @@ TUIDisplayCompositor::resize(
 	coordinate new_w
 ) {
 	if (size.h == new_h && size.w == new_w) return;
-	touch_all();
 	size.h = new_h;
 	size.w = new_w;
 	const std::size_t s(static_cast<std::size_t>(size.h) * size.w);
 	if (cur_cells.size() != s) cur_cells.resize(s);
 	if (new_cells.size() != s) new_cells.resize(s);
+	dirty_rows.resize(size.h);
+	dirty_spans.resize(size.h);
+	stale_row_hashes.assign(size.h, true);
+	touch_all();
 }
 
 void
-TUIDisplayCompositor::scroll_up (
-	coordinate h
+TUIDisplayCompositor::mark_dirty(
+	coordinate y,
+	coordinate begin,
+	coordinate end
 ) {
-	if (h >= size.h) {
-		touch_all();
-		return;
+	span & d(dirty_spans[y]);
+	if (dirty_rows[y]) {
+		if (begin < d.begin) d.begin = begin;
+		if (end > d.end) d.end = end;
+	} else
+	{
+		dirty_rows[y] = true;
+		d = span(begin, end);
 	}
-	for (unsigned row(size.h); row-- > h; )
-		for (unsigned col(0); col < size.w; ++col)
-			cur_at(row, col) = cur_at(row - h, col);
-	for (unsigned row(h); row-- > 0U; )
-		for (unsigned col(0); col < size.w; ++col)
-			cur_at(row, col).touch();
 }
 
+/// Called once everything touched has been output and untouched.
 void
-TUIDisplayCompositor::scroll_down (
-	coordinate h
-) {
-	if (h >= size.h) {
-		touch_all();
-		return;
-	}
-	for (unsigned row(0U); row < size.h - h; ++row)
-		for (unsigned col(0); col < size.w; ++col)
-			cur_at(row, col) = cur_at(row + h, col);
-	for (unsigned row(size.h - h); row < size.h; ++row)
-		for (unsigned col(0); col < size.w; ++col)
-			cur_at(row, col).touch();
+TUIDisplayCompositor::clear_dirty()
+{
+	dirty_rows.assign(size.h, false);
 }
 
 void
 TUIDisplayCompositor::touch_all()
 {
-	for (unsigned row(0); row < size.h; ++row)
+	for (unsigned row(0); row < size.h; ++row) {
 		for (unsigned col(0); col < size.w; ++col)
 			cur_at(row, col).touch();
+		mark_dirty(row, 0U, size.w);
+	}
 }
 
 void
 TUIDisplayCompositor::touch_width_change_shadows()
 {
-	for (unsigned row(0); row < size.h; ++row)
-		for (unsigned col(0); col < size.w; ++col) {
+	for (unsigned row(0); row < size.h; ++row) {
+		if (!dirty_rows[row]) continue;
+		for (unsigned col(dirty_spans[row].begin), end(dirty_spans[row].end); col < end; ++col) {
 			const DirtiableCell & c(cur_at(row, col));
 			const CharacterCell & n(new_at(row, col));
 			if (c.character != n.character) {
 				const unsigned cw(width(c.character));
 				const unsigned nw(width(n.character));
 				for (unsigned i(nw); i < cw && col + i < size.w; ++i)
-					cur_at(row, col + i).touch();
+					touch(row, col + i);
 			}
 		}
+	}
 }
 
 void
 TUIDisplayCompositor::repaint_new_to_cur()
 {
-	for (unsigned row(0); row < size.h; ++row)
-		for (unsigned col(0); col < size.w; ++col)
+	for (unsigned row(0); row < size.h; ++row) {
+		if (!dirty_rows[row]) continue;
+		for (unsigned col(dirty_spans[row].begin), end(dirty_spans[row].end); col < end; ++col)
 			cur_at(row, col) = new_at(row, col);
+	}
 }
 
 void
 TUIDisplayCompositor::poke(coordinate y, coordinate x, const CharacterCell & c)
 {
-	if (y < size.h && x < size.w) new_at(y, x) = c;
+	if (y < size.h && x < size.w) {
+		CharacterCell & n(new_cells[static_cast<std::size_t>(y) * size.w + x]);
+		if (n != c) {
+			n = c;
+			mark_dirty(y, x, x + 1U);
+			stale_row_hashes[y] = true;
+		}
+	}
 }
 
 void
 TUIDisplayCompositor::move_cursor(coordinate row, coordinate col)
 {
 	if (cursor.y != row || cursor.x != col) {
-		if (invalidate_software_cursor) cur_at(cursor.y, cursor.x).touch();
+		if (invalidate_software_cursor) touch(cursor.y, cursor.x);
 		cursor.y = row;
 		cursor.x = col;
-		if (invalidate_software_cursor) cur_at(cursor.y, cursor.x).touch();
+		if (invalidate_software_cursor) touch(cursor.y, cursor.x);
 	}
 }
 
@@ -187,9 +227,9 @@ bool
 TUIDisplayCompositor::change_pointer_col(coordinate col)
 {
 	if (col < size.w && pointer.x != col) {
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		pointer.x = col;
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		return true;
 	}
 	return false;
@@ -199,9 +239,9 @@ bool
 TUIDisplayCompositor::change_pointer_row(coordinate row)
 {
 	if (row < size.h && pointer.y != row) {
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		pointer.y = row;
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		return true;
 	}
 	return false;
@@ -211,9 +251,9 @@ bool
 TUIDisplayCompositor::change_pointer_dep(coordinate dep)
 {
 	if (pointer.z != dep) {
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		pointer.z = dep;
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 		return true;
 	}
 	return false;
@@ -225,7 +265,7 @@ TUIDisplayCompositor::set_cursor_state(CursorSprite::attribute_type a, CursorSpr
 	if (cursor_attributes != a || cursor_glyph != g) {
 		cursor_attributes = a;
 		cursor_glyph = g;
-		if (invalidate_software_cursor) cur_at(cursor.y, cursor.x).touch();
+		if (invalidate_software_cursor) touch(cursor.y, cursor.x);
 	}
 }
 
@@ -234,7 +274,7 @@ TUIDisplayCompositor::set_pointer_attributes(PointerSprite::attribute_type a)
 {
 	if (pointer_attributes != a) {
 		pointer_attributes = a;
-		cur_at(pointer.y, pointer.x).touch();
+		touch(pointer.y, pointer.x);
 	}
 }
 
@@ -261,3 +301,166 @@ TUIDisplayCompositor::is_pointer(coordinate row, coordinate col)
 {
 	return pointer.y == row && pointer.x == col;
 }
+
+/* Row move detection ******************************************************
+// **************************************************************************
+*/
+
+// Rows are compared by hashes of their contents.
+// A row of "cur" that has any touched cells is going to be redrawn anyway, and never matches anything.
+// A row that is not dirty is the same in "cur" and "new", and rows of "new" are only rehashed when poked; so only changes cost anything.
+void
+TUIDisplayCompositor::hash_rows()
+{
+	cur_row_hashes.resize(size.h);
+	new_row_hashes.resize(size.h);
+	clean_rows.resize(size.h);
+	for (unsigned row(0); row < size.h; ++row) {
+		if (stale_row_hashes[row]) {
+			uint32_t hn(2166136261U);
+			for (unsigned col(0); col < size.w; ++col)
+				hn = hash(hn, new_at(row, col));
+			new_row_hashes[row] = hn;
+			stale_row_hashes[row] = false;
+		}
+		if (!dirty_rows[row]) {
+			cur_row_hashes[row] = new_row_hashes[row];
+			clean_rows[row] = true;
+			continue;
+		}
+		uint32_t hc(2166136261U);
+		bool clean(true);
+		for (unsigned col(0); col < size.w; ++col) {
+			const DirtiableCell & c(cur_at(row, col));
+			if (c.touched()) clean = false;
+			hc = hash(hc, c);
+		}
+		cur_row_hashes[row] = hc;
+		clean_rows[row] = clean;
+	}
+}
+
+/// The number of rows of the region that would match after the move, less the number that match before it.
+/// Rows vacated by the move are assumed not to match.
+int
+TUIDisplayCompositor::gain_from(
+	const row_move & m
+) const {
+	int gain(0);
+	for (std::size_t row(m.top); row <= m.bottom; ++row) {
+		if (rows_match(row, row)) --gain;
+		const bool vacated(m.down ? row < std::size_t(m.top) + m.count : row + m.count > m.bottom);
+		if (!vacated && rows_match(m.down ? row - m.count : row + m.count, row)) ++gain;
+	}
+	return gain;
+}
+
+/// Find the single most beneficial move of rows within "cur".
+/// The longest common subsequence of "cur" and "new" rows is broken into runs of rows that have all moved by the same distance.
+/// Each such run determines a region that can be scrolled by that distance, and the run whose region gains the most matching rows wins.
+bool
+TUIDisplayCompositor::find_row_move(
+	row_move & best
+) {
+	const std::size_t h(size.h);
+	if (h < 2U || dirty_rows.end() == std::find(dirty_rows.begin(), dirty_rows.end(), true)) return false;
+	hash_rows();
+	bool all_match(true);
+	for (std::size_t row(0U); row < h && all_match; ++row)
+		all_match = rows_match(row, row);
+	if (all_match) return false;
+
+	const std::size_t stride(h + 1U);
+	common_lengths.assign(stride * stride, 0U);
+	for (std::size_t i(h); i-- > 0U; )
+		for (std::size_t j(h); j-- > 0U; )
+			common_lengths[i * stride + j] = rows_match(i, j) ?
+				common_lengths[(i + 1U) * stride + j + 1U] + 1U :
+				std::max(common_lengths[(i + 1U) * stride + j], common_lengths[i * stride + j + 1U]);
+
+	int best_gain(0);
+	std::size_t i(0U), j(0U);
+	while (i < h && j < h) {
+		if (!rows_match(i, j)) {
+			if (common_lengths[(i + 1U) * stride + j] >= common_lengths[i * stride + j + 1U])
+				++i;
+			else
+				++j;
+			continue;
+		}
+		const std::size_t i0(i), j0(j);
+		do {
+			++i;
+			++j;
+		} while (i < h && j < h && rows_match(i, j));
+		if (i0 == j0) continue;
+		row_move m;
+		m.down = j0 > i0;
+		m.count = m.down ? j0 - i0 : i0 - j0;
+		m.top = m.down ? i0 : j0;
+		m.bottom = (m.down ? j : i) - 1U;
+		const int gain(gain_from(m));
+		if (gain > best_gain) {
+			best_gain = gain;
+			best = m;
+		}
+	}
+	return best_gain > 0;
+}
+
+/// A sprite that was drawn within the region will have moved along with it, and where it is now drawn needs redrawing.
+/// Where the sprite belongs needs redrawing as well, as whatever was moved there was drawn without it.
+void
+TUIDisplayCompositor::touch_after_move(
+	coordinate y,
+	coordinate x,
+	const row_move & m
+) {
+	if (y < m.top || y > m.bottom) return;
+	touch(y, x);
+	if (m.down) {
+		if (y + m.count <= m.bottom)
+			touch(y + m.count, x);
+	} else
+	{
+		if (y >= m.top + m.count)
+			touch(y - m.count, x);
+	}
+}
+
+/// Move rows of "cur" in the same way that the realizing terminal has just moved them.
+/// The vacated rows are touched, as it is up to the caller to know what the terminal filled them with.
+void
+TUIDisplayCompositor::move_rows(
+	const row_move & m
+) {
+	if (m.bottom >= size.h || m.top > m.bottom) return;
+	// Every row of the region may now differ from "new", not just the vacated ones.
+	for (unsigned row(m.top); row <= m.bottom; ++row)
+		mark_dirty(row, 0U, size.w);
+	if (std::size_t(m.top) + m.count > m.bottom) {
+		for (unsigned row(m.top); row <= m.bottom; ++row)
+			for (unsigned col(0); col < size.w; ++col)
+				cur_at(row, col).touch();
+		return;
+	}
+	if (m.down) {
+		for (unsigned row(m.bottom + 1U); row-- > unsigned(m.top + m.count); )
+			for (unsigned col(0); col < size.w; ++col)
+				cur_at(row, col) = cur_at(row - m.count, col);
+		for (unsigned row(m.top); row < unsigned(m.top + m.count); ++row)
+			for (unsigned col(0); col < size.w; ++col)
+				cur_at(row, col).touch();
+	} else
+	{
+		for (unsigned row(m.top); row + m.count <= m.bottom; ++row)
+			for (unsigned col(0); col < size.w; ++col)
+				cur_at(row, col) = cur_at(row + m.count, col);
+		for (unsigned row(m.bottom + 1U - m.count); row <= m.bottom; ++row)
+			for (unsigned col(0); col < size.w; ++col)
+				cur_at(row, col).touch();
+	}
+	touch_after_move(pointer.y, pointer.x, m);
+	if (invalidate_software_cursor)
+		touch_after_move(cursor.y, cursor.x, m);
+}
@@ -7,6 +7,8 @@ For copyright and licensing terms, see the file named COPYING.
 #define INCLUDE_TUIDISPLAYCOMPOSITOR_H
 
 #include <vector>
+#include <cstddef>
+#include <stdint.h>
 #include "CharacterCell.h"
 
 /// \brief Output composition and change buffering for a TUI
@@ -14,6 +16,7 @@ For copyright and licensing terms, see the file named COPYING.
 /// This implements a "new" array and a "cur" array.
 /// The output is composed into the "new" array and then transposed into the "cur" array.
 /// Entries in the "cur" array have an additional "touched" flag to indicate that they were changed during transposition.
+/// Each row has a span of columns outside of which no "cur" cell is touched and "new" does not differ from "cur", so that transposition and output need only visit the spans of dirty rows.
 /// Actually outputting the "cur" array is the job of another class; this class knows nothing about I/O.
 /// Layered on top of this are VIO and other access methods.
 class TUIDisplayCompositor
@@ -48,6 +51,10 @@ public:
 	void touch_all();
 	void touch_width_change_shadows();
 	void repaint_new_to_cur();
+	void clear_dirty();
+	bool is_dirty_row(coordinate y) const { return dirty_rows[y]; }
+	coordinate query_dirty_begin(coordinate y) const { return dirty_spans[y].begin; }
+	coordinate query_dirty_end(coordinate y) const { return dirty_spans[y].end; }
 	void poke(coordinate y, coordinate x, const CharacterCell & c);
 	void move_cursor(coordinate y, coordinate x);
 	bool change_pointer_col(coordinate col);
@@ -63,8 +70,15 @@ public:
 	PointerSprite::attribute_type query_pointer_attributes() const { return pointer_attributes; }
 	ScreenFlags::flag_type query_screen_flags() const { return screen_flags; }
 	void resize(coordinate h, coordinate w);
-	void scroll_up(coordinate h);
-	void scroll_down(coordinate h);
+
+	/// \brief A move of rows of "cur", down or up by count rows within the region from top to bottom inclusive, that would make more of it match "new".
+	struct row_move {
+		coordinate top, bottom, count;
+		bool down;
+		row_move() : top(0U), bottom(0U), count(0U), down(false) {}
+	} ;
+	bool find_row_move(row_move &);
+	void move_rows(const row_move &);
 
 	class DirtiableCell : public CharacterCell {
 	public:
@@ -80,8 +94,15 @@ public:
 	};
 
 	DirtiableCell & cur_at(coordinate y, coordinate x) { return cur_cells[static_cast<std::size_t>(y) * size.w + x]; }
-	CharacterCell & new_at(coordinate y, coordinate x) { return new_cells[static_cast<std::size_t>(y) * size.w + x]; }
+	const CharacterCell & new_at(coordinate y, coordinate x) const { return new_cells[static_cast<std::size_t>(y) * size.w + x]; }
 protected:
+	/// \brief A half-open range of columns.
+	struct span {
+		coordinate begin, end;
+		span(coordinate b, coordinate e) : begin(b), end(e) {}
+		span() : begin(0U), end(0U) {}
+	} ;
+
 	bool invalidate_software_cursor;
 	struct xy cursor;
 	struct xyz pointer;
@@ -92,6 +113,24 @@ protected:
 	struct wh size;
 	std::vector<DirtiableCell> cur_cells;
 	std::vector<CharacterCell> new_cells;
+	/// \brief Dirty tracking, one entry per row.
+	/// @{
+	std::vector<bool> dirty_rows;
+	std::vector<span> dirty_spans;
+	/// @}
+	/// \brief Scratch space for finding row moves, retained to avoid reallocation on every update.
+	/// @{
+	std::vector<uint32_t> cur_row_hashes, new_row_hashes;
+	std::vector<bool> clean_rows, stale_row_hashes;
+	std::vector<unsigned short> common_lengths;
+	/// @}
+
+	void mark_dirty(coordinate y, coordinate begin, coordinate end);
+	void touch(coordinate y, coordinate x) { if (y < size.h && x < size.w) { cur_at(y, x).touch(); mark_dirty(y, x, x + 1U); } }
+	void hash_rows();
+	bool rows_match(std::size_t cur_row, std::size_t new_row) const { return clean_rows[cur_row] && cur_row_hashes[cur_row] == new_row_hashes[new_row]; }
+	int gain_from(const row_move &) const;
+	void touch_after_move(coordinate y, coordinate x, const row_move &);
 };
 
 #endif
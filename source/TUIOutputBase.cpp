@@ -6,6 +6,7 @@ For copyright and licensing terms, see the file named COPYING.
 #define __STDC_FORMAT_MACROS
 #define _XOPEN_SOURCE_EXTENDED
 #include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -108,31 +109,6 @@ TUIOutputBase::fixup(
 	}
 }
 
-inline
-unsigned
-TUIOutputBase::count_cheap_narrow(
-	unsigned short row,
-	unsigned short col,
-	unsigned cols
-) const {
-	for (unsigned i(0U); i < cols; ++i) {
-		if (false
-		||  c.is_marked(false /* does not include cursor */, row, col + i)
-		||  c.is_pointer(row, col + i)
-		)
-			return i;
-		CharacterCell cell(c.cur_at(row, col + i));
-		fixup(cell, false, false /* We checked for no pointer or mark. */);
-		if (cell.attributes != current_attr
-		||  cell.foreground != current.foreground
-		||  cell.background != current.background
-		||  (1U != width(cell.character))
-		)
-			return i;
-	}
-	return cols;
-}
-
 inline
 unsigned
 TUIOutputBase::count_cheap(
@@ -192,6 +168,132 @@ TUIOutputBase::count_cheap_repeatable(
 	return count_cheap(row, col, cols, current_attr, ch);
 }
 
+/// The number of bytes needed to reprint the given cells as they already are, or an impossibly large number if they cannot be reprinted without side-effects.
+inline
+unsigned
+TUIOutputBase::cost_of_reprinting(
+	unsigned short row,
+	unsigned short col,
+	unsigned cols
+) const {
+	unsigned cost(0U);
+	for (unsigned i(0U); i < cols; ++i) {
+		if (false
+		||  c.is_marked(false /* does not include cursor */, row, col + i)
+		||  c.is_pointer(row, col + i)
+		)
+			return -1U;
+		CharacterCell cell(c.cur_at(row, col + i));
+		fixup(cell, false, false /* We checked for no pointer or mark. */);
+		if (cell.attributes != current_attr
+		||  cell.foreground != current.foreground
+		||  cell.background != current.background
+		||  (1U != width(cell.character))
+		)
+			return -1U;
+		cost += ECMA48Output::UTF8_length(cell.character);
+	}
+	return cost;
+}
+
+inline
+unsigned
+TUIOutputBase::newline_length() const
+{
+	return !out.caps.lacks_NEL ? out.control_character_length(NEL) : 2U;
+}
+
+inline
+unsigned
+TUIOutputBase::cost_of_moving_vertically(
+	const unsigned short from,
+	const unsigned short to
+) const {
+	if (to < from) {
+		const unsigned short n(from - to);
+		const unsigned sequence(out.csi_length() + ECMA48Output::decimal_length(n) + 1U);
+		if (out.caps.lacks_RI) return sequence;
+		return std::min(sequence, n * out.control_character_length(RI));
+	} else
+	if (to > from) {
+		const unsigned short n(to - from);
+		const unsigned sequence(out.csi_length() + ECMA48Output::decimal_length(n) + 1U);
+		return std::min(sequence, n * (out.caps.lacks_IND ? 1U : out.control_character_length(IND)));
+	} else
+		return 0U;
+}
+
+inline
+unsigned
+TUIOutputBase::cost_of_moving_horizontally(
+	const unsigned short row,
+	const unsigned short from,
+	const unsigned short to
+) const {
+	if (to < from) {
+		const unsigned short n(from - to);
+		return std::min(out.csi_length() + ECMA48Output::decimal_length(n) + 1U, n * out.control_character_length(BS));
+	} else
+	if (to > from) {
+		const unsigned short n(to - from);
+		return std::min(out.csi_length() + ECMA48Output::decimal_length(n) + 1U, cost_of_reprinting(row, from, n));
+	} else
+		return 0U;
+}
+
+inline
+void
+TUIOutputBase::move_vertically(
+	const unsigned short row
+) {
+	if (row < cursor_y) {
+		const unsigned short n(cursor_y - row);
+		if (!out.caps.lacks_RI && n * out.control_character_length(RI) <= out.csi_length() + ECMA48Output::decimal_length(n) + 1U)
+			out.print_control_characters(RI, n);
+		else
+			out.CUU(n);
+	} else
+	if (row > cursor_y) {
+		const unsigned short n(row - cursor_y);
+		// Prefer IND to LF where possible, as LF might be subject to newline mode.
+		const unsigned char control(out.caps.lacks_IND ? LF : IND);
+		if (n * out.control_character_length(control) <= out.csi_length() + ECMA48Output::decimal_length(n) + 1U)
+			out.print_control_characters(control, n);
+		else
+			out.CUD(n);
+	}
+	cursor_y = row;
+}
+
+inline
+void
+TUIOutputBase::move_horizontally(
+	const unsigned short col
+) {
+	if (col < cursor_x) {
+		const unsigned short n(cursor_x - col);
+		if (n * out.control_character_length(BS) <= out.csi_length() + ECMA48Output::decimal_length(n) + 1U)
+			out.print_control_characters(BS, n);
+		else
+			out.CUL(n);
+		cursor_x = col;
+	} else
+	if (col > cursor_x) {
+		const unsigned short n(col - cursor_x);
+		// Going right by re-printing the actual characters is preferable if it is shorter than the control sequence.
+		if (cost_of_reprinting(cursor_y, cursor_x, n) <= out.csi_length() + ECMA48Output::decimal_length(n) + 1U) {
+			for (unsigned i(cursor_x); i < col; ++i) {
+				TUIDisplayCompositor::DirtiableCell & cell(c.cur_at(cursor_y, i));
+				print(cell, false, false /* We checked for no pointer or mark. */);
+				cell.untouch();
+			}
+		} else
+			out.CUR(n);
+		cursor_x = col;
+	}
+}
+
+/// Cursor positioning is a choice amongst several ways of getting there, picking whichever is the fewest bytes of output.
 inline
 void
 TUIOutputBase::GotoYX(
@@ -200,88 +302,59 @@ TUIOutputBase::GotoYX(
 ) {
 	if (row == cursor_y && col == cursor_x)
 		return;
-	// Going to the home position is easy.
-	if (0 == col && 0 == row) {
-		out.CUP();
-		cursor_y = cursor_x = 0;
-		return;
-	}
-	// If we are going to the first 3 columns in a row, use newlines and carriage returns to get roughly there.
-	if (0 == col ? col != cursor_x :
-	    1 == col ? 2 < cursor_x :
-	    2 == col ? 5 < cursor_x :
-	    false
-	) {
-		if (row > cursor_y) {
-			out.newline();
-			++cursor_y;
-			if (row > cursor_y) {
-				const unsigned short n(row - cursor_y);
-				if (!out.caps.lacks_IND && n <= 3U)
-					out.print_control_characters(IND, n);
-				else
-				if (n <= 6U)
-					out.print_control_characters(LF, n);
-				else
-					out.CUD(n);
-				cursor_y = row;
+	// Absolute positioning with the ordinary control sequence always works, and is the yardstick.
+	enum { ABSOLUTE, RELATIVE, CARRIAGE_RETURN, NEWLINE } how(ABSOLUTE);
+	unsigned best(0 == col && 0 == row ?
+		out.csi_length() + 1U :
+		out.csi_length() + ECMA48Output::decimal_length(row + 1U) + 1U + ECMA48Output::decimal_length(col + 1U) + 1U
+	);
+	if (cursor_y < c.query_h()) {
+		// Motion relative to the current column requires that we know what it is, which we do not in the pending wrap state at the right margin.
+		if (cursor_x < c.query_w()) {
+			const unsigned cost(cost_of_moving_vertically(cursor_y, row) + cost_of_moving_horizontally(row, cursor_x, col));
+			if (cost < best) {
+				best = cost;
+				how = RELATIVE;
 			}
-		} else
-			out.print_control_character(CR);
-		cursor_x = 0;
-	}
-	// If we are (now) in the right column, use index and reverse index to get to the right row.
-	if (col == cursor_x) {
-		if (row < cursor_y) {
-			const unsigned short n(cursor_y - row);
-			if (!out.caps.lacks_RI && n <= 3U)
-				out.print_control_characters(RI, n);
-			else
-				out.CUU(n);
-			cursor_y = row;
-		} else
+		}
+		// A carriage return or a newline gets to a known column, whatever state the cursor was in.
+		const unsigned cr(1U + cost_of_moving_vertically(cursor_y, row) + cost_of_moving_horizontally(row, 0U, col));
+		if (cr < best) {
+			best = cr;
+			how = CARRIAGE_RETURN;
+		}
 		if (row > cursor_y) {
-			const unsigned short n(row - cursor_y);
-			if (!out.caps.lacks_IND && n <= 3U)
-				out.print_control_characters(IND, n);
-			else
-			if (n <= 6U)
-				out.print_control_characters(LF, n);
-			else
-				out.CUD(n);
-			cursor_y = row;
+			const unsigned nl(newline_length() + cost_of_moving_vertically(cursor_y + 1U, row) + cost_of_moving_horizontally(row, 0U, col));
+			if (nl < best) {
+				best = nl;
+				how = NEWLINE;
+			}
 		}
-	} else
-	// If we are (now) in the right row, use left and right to get to the right row.
-	if (row == cursor_y && cursor_x < c.query_w()) {
-		if (col < cursor_x) {
-			const unsigned short n(cursor_x - col);
-			// Optimize going left if the control sequence is longer than just printing enough BS characters.
-			if (n <= 6U)
-				out.print_control_characters(BS, n);
-			else
-				out.CUL(n);
-			cursor_x = col;
-		} else
-		if (col > cursor_x) {
-			const unsigned short n(col - cursor_x);
-			// Optimize going right if the control sequence is longer than just re-printing the actual characters.
-			if (n <= 6U && n == count_cheap_narrow(cursor_y, cursor_x, n))
-				for (unsigned i(cursor_x); i < col; ++i) {
-					TUIDisplayCompositor::DirtiableCell & cell(c.cur_at(cursor_y, i));
-					print(cell, false, false /* We checked for no pointer or mark. */);
-					cell.untouch();
-				}
+	}
+	switch (how) {
+		case ABSOLUTE:
+			if (0 == col && 0 == row)
+				out.CUP();
 			else
-				out.CUR(n);
+				out.CUP(row + 1U, col + 1U);
+			cursor_y = row;
 			cursor_x = col;
-		}
-	} else
-	// Non-optimized positioning with the ordinary control sequence.
-	{
-		out.CUP(row + 1U, col + 1U);
-		cursor_y = row;
-		cursor_x = col;
+			break;
+		case NEWLINE:
+			out.newline();
+			++cursor_y;
+			cursor_x = 0;
+			move_vertically(row);
+			move_horizontally(col);
+			break;
+		case CARRIAGE_RETURN:
+			out.print_control_character(CR);
+			cursor_x = 0;
+			[[clang::fallthrough]];
+		case RELATIVE:
+			move_vertically(row);
+			move_horizontally(col);
+			break;
 	}
 }
 
@@ -294,10 +367,9 @@ TUIOutputBase::SGRAttr1(
 	char & semi
 ) const {
 	if ((attr & mask) != (current_attr & mask)) {
-		if (semi) out.print_graphic_character(semi);
+		out.SGRParameterSeparator(semi);
 		if (!(attr & mask)) out.print_graphic_character('2');
 		out.print_graphic_character(m);
-		semi = ';';
 	}
 }
 
@@ -312,27 +384,26 @@ TUIOutputBase::SGRAttr1(
 ) const {
 	const CharacterCell::attribute_type bits(attr & mask);
 	if (bits != (current_attr & mask)) {
-		if (semi) out.print_graphic_character(semi);
+		out.SGRParameterSeparator(semi);
 		if (!bits) out.print_graphic_character('2');
 		out.print_graphic_character(m);
 		if (bits) out.print_subparameter(bits / unit);
-		semi = ';';
 	}
 }
 
 inline
 void
 TUIOutputBase::SGRAttr (
-	const CharacterCell::attribute_type & attr
+	const CharacterCell::attribute_type & attr,
+	char & semi
 ) {
 	if (attr == current_attr) return;
-	out.csi();
-	char semi(0);
 	if (out.caps.lacks_reverse_off && (current_attr & CharacterCell::INVERSE)) {
-		if (semi) out.print_graphic_character(semi);
+		out.SGRParameterSeparator(semi);
 		out.print_graphic_character('0');
-		semi = ';';
 		current_attr = 0;
+		// This resets the colours as well, so they must be sent again.
+		current = ColourPair::impossible;
 	}
 	enum {
 		BF = CharacterCell::BOLD|CharacterCell::FAINT,
@@ -340,40 +411,34 @@ TUIOutputBase::SGRAttr (
 	};
 	if ((attr & BF) != (current_attr & BF)) {
 		if (current_attr & BF) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('2');
 			out.print_graphic_character('2');
-			semi = ';';
 		}
 		if (CharacterCell::BOLD & attr) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('1');
-			semi = ';';
 		}
 		if (CharacterCell::FAINT & attr) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('2');
-			semi = ';';
 		}
 	}
 	if ((attr & FE) != (current_attr & FE)) {
 		if (current_attr & FE) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('5');
 			out.print_graphic_character('4');
-			semi = ';';
 		}
 		if (CharacterCell::FRAME & attr) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('5');
 			out.print_graphic_character('1');
-			semi = ';';
 		}
 		if (CharacterCell::ENCIRCLE & attr) {
-			if (semi) out.print_graphic_character(semi);
+			out.SGRParameterSeparator(semi);
 			out.print_graphic_character('5');
 			out.print_graphic_character('2');
-			semi = ';';
 		}
 	}
 	SGRAttr1(attr, CharacterCell::ITALIC, '3', semi);
@@ -391,18 +456,28 @@ TUIOutputBase::SGRAttr (
 		SGRAttr1(attr, CharacterCell::STRIKETHROUGH, '9', semi);
 	}
 	if ((attr & CharacterCell::OVERLINE) != (current_attr & CharacterCell::OVERLINE)) {
-		if (semi) out.print_graphic_character(semi);
+		out.SGRParameterSeparator(semi);
 		out.print_graphic_character('5');
 		if (attr & CharacterCell::OVERLINE)
 			out.print_graphic_character('3');
 		else
 			out.print_graphic_character('5');
-		semi = ';';
 	}
-	out.print_graphic_character('m');
 	current_attr = attr;
 }
 
+/// Attributes and colours are all combined into one SGR control sequence, attributes first in case they include a reset.
+void
+TUIOutputBase::SGR (
+	const ColourPairAndAttributes & a
+) {
+	char semi(0);
+	SGRAttr(a.attributes, semi);
+	SGRFGColour(a.foreground, semi);
+	SGRBGColour(a.background, semi);
+	if (semi) out.print_graphic_character('m');
+}
+
 void
 TUIOutputBase::print(
 	CharacterCell cell,	///< a copy of the character cell, so that we can alter it
@@ -417,9 +492,7 @@ TUIOutputBase::print(
 		w = 1U;
 	}
 
-	SGRFGColour(cell.foreground);
-	SGRBGColour(cell.background);
-	SGRAttr(cell.attributes);
+	SGR(cell);
 	out.UTF8(cell.character);
 	for (unsigned n(w); n > 0U; --n) {
 		++cursor_x;
@@ -442,9 +515,7 @@ TUIOutputBase::enter_full_screen_mode(
 	}
 	out.CUP();
 	cursor_y = cursor_x = 0U;
-	SGRAttr(0U);
-	SGRFGColour(ColourPair::colour_type::default_foreground);
-	SGRBGColour(ColourPair::colour_type::default_background);
+	SGR(ColourPairAndAttributes(0U, ColourPair::colour_type::default_foreground, ColourPair::colour_type::default_background));
 	// DEC Locator is the less preferable protocol since it does not carry modifier information.
 	if (out.caps.use_DECLocator && !out.caps.has_XTerm1006Mouse) {
 		out.DECELR(true);
@@ -503,9 +574,7 @@ TUIOutputBase::exit_full_screen_mode(
 		out.DECSLE();
 		out.DECELR(false);
 	}
-	SGRBGColour(ColourPair::colour_type::default_background);
-	SGRFGColour(ColourPair::colour_type::default_foreground);
-	SGRAttr(0U);
+	SGR(ColourPairAndAttributes(0U, ColourPair::colour_type::default_foreground, ColourPair::colour_type::default_background));
 	out.CUP();
 	cursor_y = cursor_x = 0U;
 	if (out.caps.use_DECPrivateMode) {
@@ -524,7 +593,8 @@ TUIOutputBase::TUIOutputBase(
 ) :
 	c(comp),
 	options(o),
-	out(t, f, true /* C1 is 7-bit aliased */, false /* C1 is not raw 8-bit */),
+	frame(),
+	out(t, f, true /* C1 is 7-bit aliased */, false /* C1 is not raw 8-bit */, &frame),
 	window_resized(true),
 	refresh_needed(true),
 	update_needed(true),
@@ -537,15 +607,14 @@ TUIOutputBase::TUIOutputBase(
 	invert_screen(-1),	// Use an impossible value to force an initial update.
 	current_attr_unknown(true)
 {
+	frame.reserve(64U * 1024U);
 	out.flush();
-	std::setvbuf(out.file(), out_buffer, _IOFBF, sizeof out_buffer);
 	enter_full_screen_mode();
 }
 
 TUIOutputBase::~TUIOutputBase()
 {
 	exit_full_screen_mode();
-	std::setvbuf(out.file(), nullptr, _IOFBF, 1024);
 }
 
 void
@@ -582,9 +651,6 @@ TUIOutputBase::handle_update_event (
 ) {
 	if (update_needed) {
 		update_needed = false;
-		if (!out.caps.has_square_mode)
-			c.touch_width_change_shadows();
-		c.repaint_new_to_cur();
 		write_changed_cells_to_output();
 	}
 }
@@ -643,8 +709,14 @@ TUIOutputBase::write_changed_cells_to_output()
 	const CursorSprite::attribute_type a(c.query_cursor_attributes());
 	if (CursorSprite::VISIBLE & a)
 		out.change_cursor_visibility(false);
+	if (!out.caps.lacks_IL_DL)
+		move_rows();
+	if (!out.caps.has_square_mode)
+		c.touch_width_change_shadows();
+	c.repaint_new_to_cur();
 	for (unsigned row(0U); row < c.query_h(); ++row) {
-		for (unsigned col(0U); col < c.query_w(); ++col) {
+		if (!c.is_dirty_row(row)) continue;
+		for (unsigned col(c.query_dirty_begin(row)), end(c.query_dirty_end(row)); col < end; ++col) {
 			TUIDisplayCompositor::DirtiableCell & cell(c.cur_at(row, col));
 			if (!cell.touched()) continue;
 			GotoYX(row, col);
@@ -682,7 +754,8 @@ TUIOutputBase::write_changed_cells_to_output()
 				&&  (!out.caps.faulty_SP_REP || UnicodeCategorization::IsBMP(cell.character))
 				) {
 					const unsigned r(count_cheap_repeatable(row, col + 1U, toeol - 1U, cell.character));
-					if (3U < r) {
+					// Only repeat if the control sequence is shorter than just printing the characters again.
+					if (r * ECMA48Output::UTF8_length(cell.character) > out.csi_length() + ECMA48Output::decimal_length(r) + 1U) {
 						out.REP(r);
 						for (unsigned i(0U); i < r; ++i)
 							c.cur_at(row, ++col).untouch();
@@ -692,6 +765,7 @@ TUIOutputBase::write_changed_cells_to_output()
 			}
 		}
 	}
+	c.clear_dirty();
 	GotoYX(c.query_cursor_row(), c.query_cursor_col());
 	const CursorSprite::glyph_type g(c.query_cursor_glyph());
 	if (a != cursor_attributes || g != cursor_glyph) {
@@ -704,52 +778,45 @@ TUIOutputBase::write_changed_cells_to_output()
 	out.flush();
 }
 
+/// Before anything is repainted, move any rows that have merely moved up or down on the display, using IL and DL rather than redrawing them.
+/// We do not use DECSTBM and SU/SD, as scrolling margins are not as widely and reliably implemented.
+/// A region that does not extend to the bottom of the display is instead moved with a DL and IL pair, the DL pulling up the rows below the region and the IL pushing them back down again.
 void
-TUIOutputBase::optimize_scroll_up(
-	unsigned short rows
-) {
-	const CursorSprite::attribute_type a(c.query_cursor_attributes());
-	if (CursorSprite::VISIBLE & a)
-		out.change_cursor_visibility(false);
-	GotoYX(0U, 0U);
-	for (unsigned row(0); row < rows; ++row)
-		out.reverse_index();
-	GotoYX(c.query_cursor_row(), c.query_cursor_col());
-	if (CursorSprite::VISIBLE & a)
-		out.change_cursor_visibility(true);
-	c.scroll_up(rows);
-	if ((out.caps.has_DECECM || !out.caps.initial_DECECM)	// i.e. does not always erase to default colour
-	&&  !out.caps.faulty_inverse_erase
-	) {
-		// RI scrolling sets erased cells to 0 attributes, by widespread tacit agreement.
-		TUIDisplayCompositor::DirtiableCell spc(SPC, 0, current);
-		for (unsigned row(0U); row < rows && row < c.query_h(); ++row)
-			for (unsigned col(0U); col < c.query_w(); ++col)
-				c.cur_at(row, col) = spc;
-	}
-}
-
-void
-TUIOutputBase::optimize_scroll_down(
-	unsigned short rows
-) {
-	const CursorSprite::attribute_type a(c.query_cursor_attributes());
-	if (CursorSprite::VISIBLE & a)
-		out.change_cursor_visibility(false);
-	GotoYX(c.query_h() - 1U, 0U);
-	for (unsigned row(0); row < rows; ++row)
-		out.forward_index();
-	GotoYX(c.query_cursor_row(), c.query_cursor_col());
-	if (CursorSprite::VISIBLE & a)
-		out.change_cursor_visibility(true);
-	c.scroll_down(rows);
-	if ((out.caps.has_DECECM || !out.caps.initial_DECECM)	// i.e. does not always erase to default colour
-	&&  !out.caps.faulty_inverse_erase
-	) {
-		// IND scrolling sets erased cells to 0 attributes, by widespread tacit agreement.
-		TUIDisplayCompositor::DirtiableCell spc(SPC, 0, current);
-		for (unsigned row(0U); row < rows && row < c.query_h(); ++row)
-			for (unsigned col(0U); col < c.query_w(); ++col)
-				c.cur_at(c.query_h() - 1U - row, col) = spc;
+TUIOutputBase::move_rows()
+{
+	TUIDisplayCompositor::row_move m;
+	for (unsigned attempts(0U); attempts < 8U && c.find_row_move(m); ++attempts) {
+		const unsigned short h(c.query_h());
+		if (m.bottom + 1U >= h) {
+			GotoYX(m.top, 0U);
+			if (m.down)
+				out.IL(m.count);
+			else
+				out.DL(m.count);
+		} else
+		if (m.down) {
+			GotoYX(m.bottom + 1U - m.count, 0U);
+			out.DL(m.count);
+			GotoYX(m.top, 0U);
+			out.IL(m.count);
+		} else
+		{
+			GotoYX(m.top, 0U);
+			out.DL(m.count);
+			GotoYX(m.bottom + 1U - m.count, 0U);
+			out.IL(m.count);
+		}
+		c.move_rows(m);
+		if ((out.caps.has_DECECM || !out.caps.initial_DECECM)	// i.e. does not always erase to default colour
+		&&  !out.caps.faulty_inverse_erase
+		&&  !invert_screen
+		) {
+			// IL and DL set inserted cells to 0 attributes, by widespread tacit agreement.
+			const TUIDisplayCompositor::DirtiableCell spc(SPC, 0, current);
+			const unsigned short first(m.down ? m.top : m.bottom + 1U - m.count);
+			for (unsigned row(first); row < first + m.count; ++row)
+				for (unsigned col(0U); col < c.query_w(); ++col)
+					c.cur_at(row, col) = spc;
+		}
 	}
 }
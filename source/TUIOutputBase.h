@@ -8,6 +8,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 #include <termios.h>
 #include <csignal>
+#include <string>
 #include "CharacterCell.h"
 #include "ECMA48Output.h"
 #include "TUIDisplayCompositor.h"
@@ -65,10 +66,11 @@ protected:
 	void write_changed_cells_to_output ();
 	void suspended ();
 	void continued ();
-	void optimize_scroll_up(unsigned short rows);
-	void optimize_scroll_down(unsigned short rows);
 
 private:
+	/// \brief Each update is assembled here and then emitted with a single write.
+	/// This must precede out, which refers to it.
+	std::string frame;
 	ECMA48Output out;
 	/// \brief event pending flags
 	/// @{
@@ -90,15 +92,22 @@ private:
 	unsigned width (char32_t ch) const;
 	void fixup(CharacterCell &, bool, bool) const;
 	void print(CharacterCell, bool, bool);
-	unsigned count_cheap_narrow(unsigned short row, unsigned short col, unsigned cols) const;
 	unsigned count_cheap(unsigned short row, unsigned short col, unsigned cols, CharacterCell::attribute_type attr, uint32_t ch) const;
 	unsigned count_cheap_spaces(unsigned short row, unsigned short col, unsigned cols) const;
 	unsigned count_cheap_eraseable(unsigned short row, unsigned short col, unsigned cols, CharacterCell::attribute_type attr) const;
 	unsigned count_cheap_repeatable(unsigned short row, unsigned short col, unsigned cols, uint32_t ch) const;
+	unsigned cost_of_reprinting(unsigned short row, unsigned short col, unsigned cols) const;
+	unsigned cost_of_moving_vertically(unsigned short from, unsigned short to) const;
+	unsigned cost_of_moving_horizontally(unsigned short row, unsigned short from, unsigned short to) const;
+	unsigned newline_length() const;
+	void move_vertically(unsigned short to);
+	void move_horizontally(unsigned short to);
 	void GotoYX(unsigned short row, unsigned short col);
-	void SGRFGColour(const CharacterCell::colour_type & colour) { if (colour != current.foreground) out.SGRColour(true, current.foreground = colour); }
-	void SGRBGColour(const CharacterCell::colour_type & colour) { if (colour != current.background) out.SGRColour(false, current.background = colour); }
-	void SGRAttr(const CharacterCell::attribute_type & attr);
+	void move_rows();
+	void SGR(const ColourPairAndAttributes & a);
+	void SGRFGColour(const CharacterCell::colour_type & colour, char & semi) { if (colour != current.foreground) out.SGRColour(true, current.foreground = colour, semi); }
+	void SGRBGColour(const CharacterCell::colour_type & colour, char & semi) { if (colour != current.background) out.SGRColour(false, current.background = colour, semi); }
+	void SGRAttr(const CharacterCell::attribute_type & attr, char & semi);
 	void SGRAttr1(const CharacterCell::attribute_type & attr, const CharacterCell::attribute_type & mask, char m, char & semi) const;
 	void SGRAttr1(const CharacterCell::attribute_type & attr, const CharacterCell::attribute_type & mask, const CharacterCell::attribute_type & unit, char m, char & semi) const;
 	void enter_full_screen_mode() ;
@@ -106,7 +115,6 @@ private:
 
 private:
 	termios original_attr;
-	char out_buffer[64U * 1024U];
 };
 
 #endif
@@ -52,6 +52,7 @@ TerminalCapabilities::TerminalCapabilities(
 	lacks_NEL(false),
 	lacks_RI(false),
 	lacks_IND(false),
+	lacks_IL_DL(false),
 	lacks_CTC(true),
 	lacks_HPA(true),
 	lacks_REP(true),
@@ -277,6 +278,10 @@ TerminalCapabilities::TerminalCapabilities(
 			lacks_reverse_off = true;
 		}
 
+		if (dumb) {
+			lacks_IL_DL = true;
+		}
+
 		if (true_xterm
 		||  putty
 		||  msterminal
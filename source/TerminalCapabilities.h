@@ -19,7 +19,7 @@ public:
 	enum { NO_SCUSR, ORIGINAL_DECSCUSR, XTERM_DECSCUSR, EXTENDED_DECSCUSR, LINUX_SCUSR } cursor_shape_command;
 	/// \brief standards non-conformance, deficiencies, and bugs
 	/// @{
-	bool lacks_pending_wrap, lacks_NEL, lacks_RI, lacks_IND, lacks_CTC, lacks_HPA, lacks_REP, lacks_invisible, lacks_strikethrough, lacks_reverse_off;
+	bool lacks_pending_wrap, lacks_NEL, lacks_RI, lacks_IND, lacks_IL_DL, lacks_CTC, lacks_HPA, lacks_REP, lacks_invisible, lacks_strikethrough, lacks_reverse_off;
 	bool faulty_reverse_video, faulty_inverse_erase, faulty_SP_REP;
 	bool linux_editing_keypad, interix_function_keys, teken_function_keys, sco_function_keys, rxvt_function_keys, linux_function_keys;
 	/// @}
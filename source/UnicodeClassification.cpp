@@ -3,7 +3,10 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
-#include <algorithm>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstddef>
 #include <stdint.h>
 #include "UnicodeClassification.h"
 
@@ -15,60 +18,13 @@ namespace {
 
 struct ClosedRange {
 	char32_t first, last;
-	bool operator < (const ClosedRange &) const;
-	bool Contains (char32_t character) const { return first <= character && character <= last; }
 };
 
 struct ClosedRangeWithRank {
 	char32_t first, last;
 	unsigned rank;
-	bool operator < (const ClosedRangeWithRank &) const;
-	bool Contains (char32_t character) const { return first <= character && character <= last; }
 };
 
-inline
-bool
-ClosedRange::operator < (
-	const ClosedRange & b
-) const {
-	return last < b.first;
-}
-
-inline
-bool
-ClosedRangeWithRank::operator < (
-	const ClosedRangeWithRank & b
-) const {
-	return last < b.first;
-}
-
-inline
-bool
-Contains (
-	const ClosedRange * begin,
-	const ClosedRange * end,
-	char32_t character
-) {
-	const ClosedRange one = { character, character };
-	const ClosedRange * p(std::lower_bound(begin, end, one));
-	if (p >= end) return false;
-	return p->Contains(character);
-}
-
-inline
-unsigned int
-Rank (
-	const ClosedRangeWithRank * begin,
-	const ClosedRangeWithRank * end,
-	char32_t character,
-	unsigned int d
-) {
-	const ClosedRangeWithRank one = { character, character, -1U };
-	const ClosedRangeWithRank * p(std::lower_bound(begin, end, one));
-	if (p >= end || !p->Contains(character)) return d;
-	return p->rank;
-}
-
 }
 
 /* Unicode-defined ranges ***************************************************
@@ -562,6 +518,114 @@ const ClosedRange * const Hr_end(Hr + sizeof Hr/sizeof *Hr);
 
 }
 
+/* Two-stage lookup tables *************************************************
+// **************************************************************************
+*/
+
+// Rather than binary searching several range tables for every classification of every character, the range tables are expanded once, on first use, into two-stage tables.
+// The first stage maps each block of 256 code points to a block in the second stage, and identical blocks (most of them, in practice) are shared.
+// Classification is then two memory loads.
+
+namespace {
+
+enum {
+	IS_Mn = 1U << 0U,
+	IS_Me = 1U << 1U,
+	IS_Cf = 1U << 2U,
+	IS_Cc = 1U << 3U,
+	IS_Cs = 1U << 4U,
+	IS_WF = 1U << 5U,
+	IS_Bd = 1U << 6U,
+	IS_Hr = 1U << 7U,
+};
+
+class TwoStageTable {
+public:
+	enum { BLOCK_BITS = 8U, BLOCK_SIZE = 1U << BLOCK_BITS, LIMIT = 0x110000 };
+	explicit TwoStageTable(const std::vector<uint8_t> & flat);
+	uint8_t operator[] (char32_t character) const { return character < LIMIT ? blocks[(std::size_t(index[character >> BLOCK_BITS]) << BLOCK_BITS) | (character & (BLOCK_SIZE - 1U))] : 0U; }
+protected:
+	std::vector<uint16_t> index;
+	std::vector<uint8_t> blocks;
+};
+
+TwoStageTable::TwoStageTable(
+	const std::vector<uint8_t> & flat
+) :
+	index(LIMIT >> BLOCK_BITS)
+{
+	std::map<std::string, uint16_t> seen;
+	for (std::size_t i(0U); i < index.size(); ++i) {
+		const std::string block(reinterpret_cast<const char *>(flat.data()) + (i << BLOCK_BITS), BLOCK_SIZE);
+		std::map<std::string, uint16_t>::const_iterator p(seen.find(block));
+		if (seen.end() == p) {
+			p = seen.insert(std::make_pair(block, uint16_t(blocks.size() >> BLOCK_BITS))).first;
+			blocks.insert(blocks.end(), block.begin(), block.end());
+		}
+		index[i] = p->second;
+	}
+}
+
+inline
+void
+Set (
+	std::vector<uint8_t> & flat,
+	const ClosedRange * begin,
+	const ClosedRange * end,
+	uint8_t bit
+) {
+	for (const ClosedRange * p(begin); p < end; ++p)
+		for (char32_t c(p->first); c <= p->last && c < flat.size(); ++c)
+			flat[c] |= bit;
+}
+
+inline
+void
+Set (
+	std::vector<uint8_t> & flat,
+	const ClosedRangeWithRank * begin,
+	const ClosedRangeWithRank * end
+) {
+	for (const ClosedRangeWithRank * p(begin); p < end; ++p)
+		for (char32_t c(p->first); c <= p->last && c < flat.size(); ++c)
+			flat[c] = p->rank;
+}
+
+std::vector<uint8_t>
+MakeProperties()
+{
+	std::vector<uint8_t> flat(TwoStageTable::LIMIT, 0U);
+	Set(flat, Mn, Mn_end, IS_Mn);
+	Set(flat, Me, Me_end, IS_Me);
+	Set(flat, Cf, Cf_end, IS_Cf);
+	Set(flat, Cc, Cc_end, IS_Cc);
+	Set(flat, Cs, Cs_end, IS_Cs);
+	Set(flat, WF, WF_end, IS_WF);
+	Set(flat, Bd, Bd_end, IS_Bd);
+	Set(flat, Hr, Hr_end, IS_Hr);
+	return flat;
+}
+
+std::vector<uint8_t>
+MakeCombiningClasses()
+{
+	std::vector<uint8_t> flat(TwoStageTable::LIMIT, 0U);
+	Set(flat, CC, CC_end);
+	return flat;
+}
+
+inline
+bool
+Has (
+	char32_t character,
+	uint8_t bit
+) {
+	static const TwoStageTable properties(MakeProperties());
+	return properties[character] & bit;
+}
+
+}
+
 /* External API *************************************************************
 // **************************************************************************
 */
@@ -571,55 +635,56 @@ namespace UnicodeCategorization {
 bool
 IsMarkNonSpacing(char32_t character)
 {
-	return Contains(Mn, Mn_end, character);
+	return Has(character, IS_Mn);
 }
 
 bool
 IsMarkEnclosing(char32_t character)
 {
-	return Contains(Me, Me_end, character);
+	return Has(character, IS_Me);
 }
 
 bool
 IsOtherFormat(char32_t character)
 {
-	return Contains(Cf, Cf_end, character);
+	return Has(character, IS_Cf);
 }
 
 bool
 IsOtherControl(char32_t character)
 {
-	return Contains(Cc, Cc_end, character);
+	return Has(character, IS_Cc);
 }
 
 bool
 IsOtherSurrogate(char32_t character)
 {
-	return Contains(Cs, Cs_end, character);
+	return Has(character, IS_Cs);
 }
 
 bool
 IsWideOrFull(char32_t character)
 {
-	return Contains(WF, WF_end, character);
+	return Has(character, IS_WF);
 }
 
 bool
 IsDrawing(char32_t character)
 {
-	return Contains(Bd, Bd_end, character);
+	return Has(character, IS_Bd);
 }
 
 bool
 IsHorizontallyRepeatable(char32_t character)
 {
-	return Contains(Hr, Hr_end, character);
+	return Has(character, IS_Hr);
 }
 
 unsigned int
 CombiningClass(char32_t character)
 {
-	return Rank(CC, CC_end, character, 0U);
+	static const TwoStageTable classes(MakeCombiningClasses());
+	return classes[character];
 }
 
 /// Unicode version of the standard isascii() function.
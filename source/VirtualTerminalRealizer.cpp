@@ -673,6 +673,7 @@ SharedHODResources::SharedHODResources(
 	gdi(),
 	font(f),
 	glyph_cache(),
+	glyph_cache_index(),
 	mouse_glyph_handle(gdi.MakeGlyphBitmap()),
 	underline_glyph_handle(gdi.MakeGlyphBitmap()),
 	underover_glyph_handle(gdi.MakeGlyphBitmap()),
@@ -761,13 +762,12 @@ SharedHODResources::GetCachedGlyphBitmap(
 	uint32_t character,
 	CharacterCell::attribute_type attributes
 ) {
-	// A linear search isn't particularly nice, but we maintain the cache in recently-used order.
-	for (GlyphCache::iterator i(glyph_cache.begin()); glyph_cache.end() != i; ++i) {
-		if (i->character != character || i->attributes != attributes) continue;
-		GlyphBitmapHandle handle(i->handle);
-		glyph_cache.erase(i);
-		glyph_cache.push_front(GlyphCacheEntry(handle, character, attributes));
-		return handle;
+	// The cache is a list in recently-used order, with a hash index into it.
+	const uint64_t key(GlyphCacheKey(character, attributes));
+	const GlyphCacheIndex::const_iterator i(glyph_cache_index.find(key));
+	if (glyph_cache_index.end() != i) {
+		glyph_cache.splice(glyph_cache.begin(), glyph_cache, i->second);
+		return i->second->handle;
 	}
 	GlyphBitmapHandle handle(gdi.MakeGlyphBitmap());
 	if (const uint16_t * const s = font.ReadGlyph(character, CharacterCell::BOLD & attributes, CharacterCell::FAINT & attributes, CharacterCell::ITALIC & attributes))
@@ -775,8 +775,9 @@ SharedHODResources::GetCachedGlyphBitmap(
 	else
 		gdi.PlotGreek(handle, character);
 	gdi.ApplyAttributesToGlyphBitmap(handle, attributes);
-	ReduceCacheSizeTo(MAX_CACHED_GLYPHS);
-	glyph_cache.push_back(GlyphCacheEntry(handle, character, attributes));
+	ReduceCacheSizeTo(MAX_CACHED_GLYPHS - 1U);
+	glyph_cache.push_front(GlyphCacheEntry(handle, character, attributes));
+	glyph_cache_index[key] = glyph_cache.begin();
 	return handle;
 }
 
@@ -786,6 +787,7 @@ SharedHODResources::ReduceCacheSizeTo(
 ) {
 	while (glyph_cache.size() > size) {
 		const GlyphCacheEntry e(glyph_cache.back());
+		glyph_cache_index.erase(GlyphCacheKey(e.character, e.attributes));
 		glyph_cache.pop_back();
 		gdi.DeleteGlyphBitmap(e.handle);
 	}
@@ -845,7 +847,8 @@ HOD::paint_changed_cells_onto_framebuffer()
 	if (!screen) return;
 
 	for (unsigned row(0); row < c.query_h(); ++row) {
-		for (unsigned col(0); col < c.query_w(); ++col) {
+		if (!c.is_dirty_row(row)) continue;
+		for (unsigned col(c.query_dirty_begin(row)), end(c.query_dirty_end(row)); col < end; ++col) {
 			TUIDisplayCompositor::DirtiableCell & cell(c.cur_at(row, col));
 			if (!cell.touched()) continue;
 			CharacterCell::attribute_type font_attributes(cell.attributes);
@@ -906,6 +909,7 @@ HOD::paint_changed_cells_onto_framebuffer()
 			cell.untouch();
 		}
 	}
+	c.clear_dirty();
 }
 
 /// \brief Clip and position the visible portion of the terminal's display buffer.
@@ -10,6 +10,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <set>
 #include <string>
 #include <memory>
+#include <unordered_map>
 #include <termios.h>
 #include "kbdmap.h"
 #include "kqueue_common.h"
@@ -315,9 +316,11 @@ protected:
 		CharacterCell::attribute_type attributes;
 	};
 	typedef std::list<GlyphCacheEntry> GlyphCache;
+	typedef std::unordered_map<uint64_t, GlyphCache::iterator> GlyphCacheIndex;
 
 	enum { MAX_CACHED_GLYPHS = 16384U };
-	GlyphCache glyph_cache;		///< a recently-used cache of handles to 2-colour bitmaps
+	GlyphCache glyph_cache;		///< a recently-used cache of handles to 2-colour bitmaps, most recently used first
+	GlyphCacheIndex glyph_cache_index;	///< the glyph cache keyed by character and attributes
 	const GlyphBitmapHandle mouse_glyph_handle;
 	const GlyphBitmapHandle underline_glyph_handle;
 	const GlyphBitmapHandle underover_glyph_handle;
@@ -328,6 +331,7 @@ protected:
 	const GlyphBitmapHandle mirrorl_glyph_handle;
 
 	void ReduceCacheSizeTo(std::size_t size);
+	static uint64_t GlyphCacheKey(uint32_t character, CharacterCell::attribute_type attributes) { return (uint64_t(character) << 32U) | attributes; }
 };
 
 /// \brief common shared resources for HIDs
@@ -19,6 +19,7 @@ extern void appendpath ( const char * &, std::vector<const char *> &, ProcessEnv
 extern void builtins ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void chdir_home ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_clear ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
+extern void console_compile_cin_table ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_control_sequence ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_convert_kbdmap ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_decode_ecma48 ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
@@ -88,6 +89,7 @@ commands[] = {
 	{	"builtins",				builtins			},
 	{	"version",				system_version			},
 	{	"console-clear",			console_clear			},
+	{	"console-compile-cin-table",		console_compile_cin_table	},
 	{	"console-control-sequence",		console_control_sequence	},
 	{	"console-convert-kbdmap",		console_convert_kbdmap		},
 	{	"console-decode-ecma48",		console_decode_ecma48		},
@@ -21,6 +21,7 @@ extern void chdir_home ( const char * &, std::vector<const char *> &, ProcessEnv
 extern void chroot ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void clearenv ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void command_exec ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
+extern void compile_nosh_script ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_flat_table_viewer ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_docbook_xml_viewer ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
 extern void console_tty37_viewer ( const char * &, std::vector<const char *> &, ProcessEnvironment & );
@@ -204,6 +205,7 @@ commands[] = {
 	{	"pause",				pause				},
 	{	"tai64n",				tai64n				},
 	{	"tai64nlocal",				tai64nlocal			},
+	{	"compile-nosh-script",			compile_nosh_script		},
 	{	"set-dynamic-hostname",			set_dynamic_hostname		},
 	{	"setup-machine-id",			setup_machine_id		},
 	{	"erase-machine-id",			erase_machine_id		},
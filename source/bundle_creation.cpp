@@ -184,3 +184,64 @@ flag_file (
 		}
 	}
 }
+
+conversion_batch::~conversion_batch() {}
+
+bool
+conversion_batch::convert_share (
+	std::size_t worker,
+	std::size_t workers
+) {
+	bool failed(false);
+	for (std::size_t i(0U); i < groups.size(); ++i) {
+		if (worker != groups[i] % workers) continue;
+		try {
+			convert(i);
+		} catch (int s) {
+			if (EXIT_SUCCESS != s)
+				failed = true;
+		}
+	}
+	return !failed;
+}
+
+bool
+conversion_batch::run (
+	const char * prog,
+	std::size_t workers
+) {
+	if (workers > groups.size()) workers = groups.size();
+	if (workers < 2U) return convert_share(0U, 1U);
+
+	// Nothing buffered before the fork must be output twice.
+	std::fflush(nullptr);
+	std::vector<pid_t> pids;
+	bool failed(false);
+	for (std::size_t w(0U); w < workers; ++w) {
+		const pid_t child(fork());
+		if (0 > child) {
+			const int error(errno);
+			std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, "fork", std::strerror(error));
+			// Do this share ourselves, instead.
+			if (!convert_share(w, workers))
+				failed = true;
+			continue;
+		}
+		if (0 == child) {
+			bool ok(false);
+			try {
+				ok = convert_share(w, workers);
+			} catch (...) {
+			}
+			std::fflush(nullptr);
+			_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		pids.push_back(child);
+	}
+	for (std::vector<pid_t>::const_iterator i(pids.begin()); pids.end() != i; ++i) {
+		int status, code;
+		if (0 >= wait_blocking_for_exit_of(*i, status, code) || WAIT_STATUS_EXITED != status || EXIT_SUCCESS != code)
+			failed = true;
+	}
+	return !failed;
+}
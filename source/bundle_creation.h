@@ -6,7 +6,9 @@ For copyright and licensing terms, see the file named COPYING.
 #if !defined(INCLUDE_BUNDLE_CREATON_H)
 #define INCLUDE_BUNDLE_CREATON_H
 
+#include <vector>
 #include <string>
+#include <cstddef>
 
 class FileDescriptorOwner;
 
@@ -59,6 +61,22 @@ flag_file (
 	const char * name,
 	bool make
 ) ;
+
+/// \brief A batch of independent conversions, shared out amongst a pool of worker processes
+/// Items added in the same group are always converted by the same worker, in the order that they were added.
+class conversion_batch {
+public:
+	conversion_batch() : groups() {}
+	virtual ~conversion_batch();
+	void add(std::size_t group) { groups.push_back(group); }
+	std::size_t size() const { return groups.size(); }
+	bool run(const char * prog, std::size_t workers);	///< \returns false if any conversion failed
+protected:
+	std::vector<std::size_t> groups;
+	virtual void convert(std::size_t item) = 0;	///< throws an exit status, as the die_*() functions do, upon failure
+	bool convert_share(std::size_t worker, std::size_t workers);
+};
+
 static inline
 bool
 is_root(
@@ -24,6 +24,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "fdutils.h"
 #include "service-manager-client.h"
 #include "service-manager.h"
+#include "ServiceStatusTable.h"
 #include "unpack.h"
 #include "popt.h"
 #include "FileDescriptorOwner.h"
@@ -73,12 +74,14 @@ struct bundle {
 		bundle_dir_fd(-1),
 		supervise_dir_fd(-1),
 		service_dir_fd(-1),
+		status_fd(-1),
 		state(UNKNOWN)
 	{
 	}
 	~bundle() {}
 
 	FileDescriptorOwner bundle_dir_fd, supervise_dir_fd, service_dir_fd;
+	FileDescriptorOwner status_fd;	///< kept open, both for reading and for change notifications
 	std::string path, name, suffix;
 
 	enum state_type {
@@ -91,7 +94,8 @@ struct bundle {
 	uint64_t seconds;
 	uint32_t nanoseconds;
 
-	void load_data();
+	void load_data(ServiceStatusTable &);
+	bool open_status();
 	const ColourPair & colour_of_state () const;
 	const char * name_of_state () const;
 	bool valid_status() const { return UNKNOWN != state && UNLOADED != state && NOTAPI != state && FIFO_ERROR != state && STATUS_ERROR != state && LOADING != state; }
@@ -153,32 +157,39 @@ bundle::state_of (
 
 void
 bundle::load_data(
+	ServiceStatusTable & status_table
 ) {
 	initially_up = is_initially_up(service_dir_fd.get());
 
-	const FileDescriptorOwner ok_fd(open_writeexisting_at(supervise_dir_fd.get(), "ok"));
-	if (0 > ok_fd.get()) {
-		const int error(errno);
-		if (ENXIO == error) {
-			state = UNLOADED;
-		} else
-		if (ENOENT == error) {
-			state = NOTAPI;
-		} else
-		{
-			state = FIFO_ERROR;
+	char status[STATUS_BLOCK_SIZE];
+	int b;
+	struct stat supervise_dir_s;
+	if (0 <= fstat(supervise_dir_fd.get(), &supervise_dir_s) && status_table.query(supervise_dir_s, status))
+		b = sizeof status;
+	else
+	{
+		const FileDescriptorOwner ok_fd(open_writeexisting_at(supervise_dir_fd.get(), "ok"));
+		if (0 > ok_fd.get()) {
+			const int error(errno);
+			if (ENXIO == error) {
+				state = UNLOADED;
+			} else
+			if (ENOENT == error) {
+				state = NOTAPI;
+			} else
+			{
+				state = FIFO_ERROR;
+			}
+			return;
 		}
-		return;
-	}
 
-	const FileDescriptorOwner status_fd(open_read_at(supervise_dir_fd.get(), "status"));
-	if (0 > status_fd.get()) {
-		state = STATUS_ERROR;
-		return;
-	}
+		if (!open_status()) {
+			state = STATUS_ERROR;
+			return;
+		}
 
-	char status[STATUS_BLOCK_SIZE];
-	const int b(read(status_fd.get(), status, sizeof status));
+		b = pread(status_fd.get(), status, sizeof status, 0);
+	}
 
 	if (b < DAEMONTOOLS_STATUS_BLOCK_SIZE) {
 		state = LOADING;
@@ -200,12 +211,20 @@ bundle::load_data(
 		}
 	}
 	pid = 0 == p ? -1 : static_cast<uint32_t>(-1) == p ? 0 : static_cast<int>(p);
-	const char state_byte(b >= ENCORE_STATUS_BLOCK_SIZE ? status[ENCORE_STATUS_OFFSET] : p ? encore_status_running : encore_status_stopped);
+	const char state_byte(b >= ENCORE_STATUS_BLOCK_SIZE ? status[ENCORE_STATUS_OFFSET] : static_cast<char>(p ? encore_status_running : encore_status_stopped));
 	const bool exited_run(has_exited_run(b, status));
 	const bool ready_after_run(is_ready_after_run(service_dir_fd.get()));
 	state = state_of(ready_after_run, p, exited_run, state_byte);
 }
 
+bool
+bundle::open_status(
+) {
+	if (0 > status_fd.get())
+		status_fd.reset(open_read_at(supervise_dir_fd.get(), "status"));
+	return 0 <= status_fd.get();
+}
+
 namespace std {
 
 template <> struct hash<struct index> {
@@ -281,6 +300,8 @@ struct TUI :
 	void handle_signal (int);
 	void handle_stdin (int);
 	void handle_sort_needed ();
+	void handle_bundle_changed (const bundle &);
+	void handle_changed_bundles ();
 
 protected:
 	TUIInputBase::WheelToKeyboard handler0;
@@ -303,6 +324,7 @@ protected:
 	sig_atomic_t terminate_signalled, interrupt_signalled, hangup_signalled, usr1_signalled, usr2_signalled;
 	bundle_info_map & bundle_map;
 	bundle_pointer_list bundles;
+	std::set<const bundle *> changed_bundles;
 	TUIVIO vio;
 	std::size_t current_row;
 	std::size_t top_row;
@@ -350,6 +372,8 @@ TUI::TUI(
 	usr1_signalled(false),
 	usr2_signalled(false),
 	bundle_map(m),
+	bundles(),
+	changed_bundles(),
 	vio(comp),
 	current_row(0U),
 	top_row(0U),
@@ -524,6 +548,37 @@ TUI::handle_sort_needed (
 	}
 }
 
+/// A bundle's status has changed, so its row needs repainting and, unless the rows are sorted by name alone, the rows need resorting.
+void
+TUI::handle_bundle_changed (
+	const bundle & b
+) {
+	if (4U != sort_mode)
+		sort_needed = true;
+	changed_bundles.insert(&b);
+}
+
+/// Repaint just the visible rows of bundles whose statuses have changed, leaving the rest of the display as it is.
+void
+TUI::handle_changed_bundles (
+) {
+	if (changed_bundles.empty()) return;
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	const uint64_t z(time_to_tai64(envs, TimeTAndLeap(now.tv_sec, false)));
+
+	std::size_t row(0U);
+	for (bundle_pointer_list::const_iterator i(bundles.begin()), e(bundles.end()); e != i; ++i, ++row) {
+		if (row < top_row) continue;
+		if (row + 1U >= top_row + c.query_h()) break;
+		if (!changed_bundles.count(*i)) continue;
+		const CharacterCell::attribute_type attr(row == current_row ? static_cast<CharacterCell::attribute_type>(CharacterCell::INVERSE) : 0U);
+		write_one_line(row - top_row + 1U, -window_x, attr, **i, z);
+	}
+	changed_bundles.clear();
+	set_update_needed();
+}
+
 void
 TUI::handle_stdin (
 	int n		///< number of characters available; can be <= 0 erroneously
@@ -563,11 +618,9 @@ TUI::redraw_new (
 
 	// Scroll so that the current row is visible.
 	if (top_row > current_row) {
-		optimize_scroll_up(top_row - current_row);
 		top_row = current_row;
 	} else
 	if (current_row + 1U >= top_row + c.query_h()) {
-		optimize_scroll_down(current_row - c.query_h() - top_row + 1);
 		top_row = current_row - c.query_h() + 2U;
 	}
 
@@ -590,7 +643,7 @@ TUI::redraw_new (
 	for (bundle_pointer_list::const_iterator i(bundles.begin()), e(bundles.end()); e != i; ++i, ++row) {
 		if (row < top_row) continue;
 		if (row + 1U >= top_row + c.query_h()) break;
-		const CharacterCell::attribute_type attr(row == current_row ? CharacterCell::INVERSE : 0U);
+		const CharacterCell::attribute_type attr(row == current_row ? static_cast<CharacterCell::attribute_type>(CharacterCell::INVERSE) : 0U);
 		write_one_line(row - top_row + 1U, -window_x, attr, **i, z);
 	}
 
@@ -703,7 +756,7 @@ chkservice [[gnu::noreturn]] (
 		args = new_args;
 		next_prog = arg0_of(args);
 		if (p.stopped()) throw EXIT_SUCCESS;
-		options.tui_level = tui_level_option.value() < options.TUI_LEVELS ? tui_level_option.value() : options.TUI_LEVELS;
+		options.tui_level = tui_level_option.value() < options.TUI_LEVELS ? tui_level_option.value() : static_cast<unsigned>(options.TUI_LEVELS);
 	} catch (const popt::error & e) {
 		die(prog, envs, e);
 	}
@@ -748,15 +801,25 @@ chkservice [[gnu::noreturn]] (
 		bundle_map.add_bundle(bundle_dir_s, bundle_dir_fd, supervise_dir_fd, service_dir_fd, path, name, suffix);
 	}
 
-	for (bundle_info_map::iterator i(bundle_map.begin()), e(bundle_map.end()); e != i; ++i)
-		i->second.load_data();
-
 	const FileDescriptorOwner queue(kqueue());
 	if (0 > queue.get()) {
 		die_errno(prog, envs, "kqueue");
 	}
 	std::vector<struct kevent> ip;
 
+	// Rather than periodically reloading every bundle, we watch each status file for writes and reload only the bundles that change.
+	// A bundle with no status file yet has its supervise directory watched instead, for the status file's creation.
+	typedef std::unordered_map<int, bundle *> watch_map;
+	watch_map watched;
+	ServiceStatusTable status_table;
+	for (bundle_info_map::iterator i(bundle_map.begin()), e(bundle_map.end()); e != i; ++i) {
+		bundle & b(i->second);
+		b.load_data(status_table);
+		const int fd(b.open_status() ? b.status_fd.get() : b.supervise_dir_fd.get());
+		append_event(ip, fd, EVFILT_VNODE, EV_ADD|EV_ENABLE|EV_CLEAR, NOTE_WRITE, 0, nullptr);
+		watched[fd] = &b;
+	}
+
 	append_event(ip, STDIN_FILENO, EVFILT_READ, EV_ADD, 0, 0, nullptr);
 	ReserveSignalsForKQueue kqueue_reservation(SIGTERM, SIGINT, SIGHUP, SIGPIPE, SIGUSR1, SIGUSR2, SIGWINCH, SIGTSTP, SIGCONT, 0);
 	PreventDefaultForFatalSignals ignored_signals(SIGTERM, SIGINT, SIGHUP, SIGPIPE, SIGUSR1, SIGUSR2, 0);
@@ -775,6 +838,7 @@ chkservice [[gnu::noreturn]] (
 		if (ui.exit_signalled() || ui.quit_flagged())
 			break;
 		ui.handle_sort_needed();
+		ui.handle_changed_bundles();
 		ui.handle_resize_event();
 		ui.handle_refresh_event();
 		ui.handle_update_event();
@@ -788,6 +852,9 @@ chkservice [[gnu::noreturn]] (
 			die_errno(prog, envs, "kevent");
 		}
 
+		// One check per wakeup, rather than one per reloaded bundle, of whether the service managers behind the status tables are still there.
+		status_table.refresh();
+
 		for (std::size_t i(0); i < static_cast<std::size_t>(rc); ++i) {
 			const struct kevent & e(p[i]);
 			switch (e.filter) {
@@ -798,6 +865,22 @@ chkservice [[gnu::noreturn]] (
 					if (STDIN_FILENO == e.ident)
 						ui.handle_stdin(e.data);
 					break;
+				case EVFILT_VNODE:
+				{
+					const watch_map::iterator w(watched.find(e.ident));
+					if (watched.end() == w) break;
+					bundle & b(*w->second);
+					if (b.supervise_dir_fd.get() == static_cast<int>(e.ident) && b.open_status()) {
+						// The status file has appeared, so switch to watching it instead.
+						append_event(ip, e.ident, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
+						append_event(ip, b.status_fd.get(), EVFILT_VNODE, EV_ADD|EV_ENABLE|EV_CLEAR, NOTE_WRITE, 0, nullptr);
+						watched.erase(w);
+						watched[b.status_fd.get()] = &b;
+					}
+					b.load_data(status_table);
+					ui.handle_bundle_changed(b);
+					break;
+				}
 			}
 		}
 	}
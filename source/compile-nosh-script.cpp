@@ -0,0 +1,95 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "utils.h"
+#include "popt.h"
+#include "compiled-script.h"
+
+/* Main function ************************************************************
+// **************************************************************************
+*/
+
+void
+compile_nosh_script [[gnu::noreturn]] (
+	const char * & next_prog,
+	std::vector<const char *> & args,
+	ProcessEnvironment & envs
+) {
+	const char * prog(basename_of(args[0]));
+	bool remove(false);
+	try {
+		popt::bool_definition remove_option('r', "remove", "Remove the compiled forms instead of creating them.", remove);
+		popt::definition * top_table[] = {
+			&remove_option,
+		};
+		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "{script(s)...}");
+
+		std::vector<const char *> new_args;
+		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
+		p.process(true /* strictly options before arguments */);
+		args = new_args;
+		next_prog = arg0_of(args);
+		if (p.stopped()) throw EXIT_SUCCESS;
+	} catch (const popt::error & e) {
+		die(prog, envs, e);
+	}
+
+	if (args.empty()) die_missing_argument(prog, envs, "script name");
+
+	// Scripts that the service manager runs are run by open file descriptor, and nosh looks for their compiled forms here.
+	const std::string runtime_dir(compiled_script_runtime_dir());
+	if (!remove && 0 > mkdir(runtime_dir.c_str(), 0755) && EEXIST != errno) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, runtime_dir.c_str(), std::strerror(error));
+		throw EXIT_FAILURE;
+	}
+
+	bool failed(false);
+	for (std::vector<const char *>::const_iterator i(args.begin()), e(args.end()); e != i; ++i) {
+		const char * name(*i);
+		struct stat s;
+		const bool have_status(0 <= stat(name, &s));
+		if (remove) {
+			std::string compiled_names[2] = { compiled_script_name(name) };
+			if (have_status)
+				compiled_names[1] = compiled_script_runtime_name(s);
+			for (const std::string * n(compiled_names); n < compiled_names + sizeof compiled_names/sizeof *compiled_names; ++n) {
+				if (n->empty()) continue;
+				if (0 > unlink(n->c_str()) && ENOENT != errno) {
+					const int error(errno);
+					std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, n->c_str(), std::strerror(error));
+					failed = true;
+				}
+			}
+			continue;
+		}
+		if (!have_status) {
+			const int error(errno);
+			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, name, std::strerror(error));
+			failed = true;
+			continue;
+		}
+		// This exits the program on a lexical error, just as nosh itself would.
+		const std::vector<std::string> script_args(read_file(prog, envs, name));
+		const std::string compiled_names[2] = { compiled_script_name(name), compiled_script_runtime_name(s) };
+		for (const std::string * n(compiled_names); n < compiled_names + sizeof compiled_names/sizeof *compiled_names; ++n) {
+			if (!save_compiled_script(n->c_str(), s, script_args)) {
+				const int error(errno);
+				std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, n->c_str(), std::strerror(error));
+				failed = true;
+			}
+		}
+	}
+	throw failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
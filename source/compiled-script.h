@@ -0,0 +1,25 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#if !defined(INCLUDE_COMPILED_SCRIPT_H)
+#define INCLUDE_COMPILED_SCRIPT_H
+
+#include <vector>
+#include <string>
+
+struct stat;
+
+/// The suffix that names the pre-parsed form of a nosh script alongside the script itself.
+extern const char compiled_script_suffix[];
+
+/// The directory where the compiled forms of scripts that are run by open file descriptor are kept, by device and i-node.
+extern std::string compiled_script_runtime_dir();
+
+extern std::string compiled_script_name(const char * script_name);
+extern std::string compiled_script_runtime_name(const struct stat & script_status);
+extern bool load_compiled_script(const char * compiled_name, const struct stat & script_status, std::vector<const char *> & args);
+extern bool save_compiled_script(const char * compiled_name, const struct stat & script_status, const std::vector<std::string> & args);
+
+#endif
@@ -0,0 +1,239 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "fdutils.h"
+#include "runtime-dir.h"
+#include "compiled-script.h"
+#include "FileDescriptorOwner.h"
+
+/* The compiled script file format ******************************************
+// **************************************************************************
+*/
+
+// This is a cache, not an interchange format.
+// It is in native byte order and is simply discarded if anything about it does not match.
+
+const char compiled_script_suffix[] = ".nosh-compiled";
+
+namespace {
+
+const char magic[8] = { 'n', 'o', 's', 'h', 'a', 'r', 'g', 'v' };
+enum { VERSION = 1U };
+
+struct header {
+	char magic[8];
+	uint32_t version, argc;
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+	uint64_t strings_length;
+};
+
+inline
+void
+get_mtime (
+	const struct stat & s,
+	int64_t & sec,
+	int64_t & nsec
+) {
+#if defined(__LINUX__) || defined(__linux__)
+	sec = s.st_mtim.tv_sec;
+	nsec = s.st_mtim.tv_nsec;
+#else
+	sec = s.st_mtimespec.tv_sec;
+	nsec = s.st_mtimespec.tv_nsec;
+#endif
+}
+
+inline
+bool
+matches (
+	const header & h,
+	const struct stat & s
+) {
+	int64_t sec, nsec;
+	get_mtime(s, sec, nsec);
+	return 0 == std::memcmp(h.magic, magic, sizeof magic)
+	&&	VERSION == h.version
+	&&	uint64_t(s.st_dev) == h.dev
+	&&	uint64_t(s.st_ino) == h.ino
+	&&	uint64_t(s.st_size) == h.size
+	&&	sec == h.mtime_sec
+	&&	nsec == h.mtime_nsec
+	;
+}
+
+inline
+bool
+write_all (
+	int fd,
+	const char * p,
+	std::size_t l
+) {
+	while (l) {
+		const ssize_t n(write(fd, p, l));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			return false;
+		}
+		p += n;
+		l -= n;
+	}
+	return true;
+}
+
+/// Create a temporary file to be renamed over name, unique to this process so that concurrent compiles do not write into the same file.
+inline
+int
+open_new_file (
+	const std::string & name,
+	mode_t mode,
+	std::string & new_name
+) {
+	char pid[32];
+	snprintf(pid, sizeof pid, ".new.%u", getpid());
+	new_name = name + pid;
+	int fd(open_writecreateexclusive_at(AT_FDCWD, new_name.c_str(), mode));
+	if (0 > fd && EEXIST == errno) {
+		// Process IDs are unique amongst live processes, so this can only be left over from one that died.
+		unlink(new_name.c_str());
+		fd = open_writecreateexclusive_at(AT_FDCWD, new_name.c_str(), mode);
+	}
+	return fd;
+}
+
+}
+
+/* Naming *******************************************************************
+// **************************************************************************
+*/
+
+/// The system-wide runtime directory for the superuser, as for the service manager itself; and the per-user one otherwise.
+std::string
+compiled_script_runtime_dir()
+{
+	return (0 == geteuid() ? std::string("/run/") : effective_user_runtime_dir()) + "nosh-compiled/";
+}
+
+/// The compiled form of a script that is run by name lives alongside it.
+std::string
+compiled_script_name (
+	const char * script_name
+) {
+	return std::string(script_name) + compiled_script_suffix;
+}
+
+/// The compiled form of a script that is run by open file descriptor lives in the runtime directory, named for the script's device and i-node.
+std::string
+compiled_script_runtime_name (
+	const struct stat & script_status
+) {
+	char name[64];
+	snprintf(name, sizeof name, "%llx:%llx", static_cast<unsigned long long>(script_status.st_dev), static_cast<unsigned long long>(script_status.st_ino));
+	return compiled_script_runtime_dir() + name;
+}
+
+/* Loading and saving *******************************************************
+// **************************************************************************
+*/
+
+/// Map the compiled form of a script, if it exists and is current, and point the arguments into it.
+/// On success the mapping is deliberately never unmapped, as the arguments refer to it for the remainder of the process.
+bool
+load_compiled_script (
+	const char * compiled_name,
+	const struct stat & script_status,
+	std::vector<const char *> & args
+) {
+	const FileDescriptorOwner fd(open_read_at(AT_FDCWD, compiled_name));
+	if (0 > fd.get()) return false;
+	struct stat s;
+	if (0 > fstat(fd.get(), &s)
+	||  !S_ISREG(s.st_mode)
+	||  std::size_t(s.st_size) <= sizeof(header)
+	// Whoever could have written the compiled form must be no more than whoever could have written the script.
+	||  (s.st_uid != script_status.st_uid && 0 != s.st_uid)
+	||  (s.st_mode & (S_IWGRP|S_IWOTH) & ~script_status.st_mode)
+	)
+		return false;
+	const std::size_t length(s.st_size);
+	void * const base(mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd.get(), 0));
+	if (MAP_FAILED == base) return false;
+	const header & h(*static_cast<const header *>(base));
+	const char * const strings(static_cast<const char *>(base) + sizeof h);
+	if (!matches(h, script_status)
+	||  h.strings_length != length - sizeof h
+	||  '\0' != strings[h.strings_length - 1U]
+	) {
+		munmap(base, length);
+		return false;
+	}
+	std::vector<const char *> a;
+	a.reserve(h.argc);
+	for (const char * p(strings), * const e(strings + h.strings_length); p < e; p += std::strlen(p) + 1U)
+		a.push_back(p);
+	if (a.size() != h.argc) {
+		munmap(base, length);
+		return false;
+	}
+	args.swap(a);
+	return true;
+}
+
+/// Write the compiled form of a script, atomically replacing any existing one.
+bool
+save_compiled_script (
+	const char * compiled_name,
+	const struct stat & script_status,
+	const std::vector<std::string> & args
+) {
+	header h;
+	std::memcpy(h.magic, magic, sizeof magic);
+	h.version = VERSION;
+	h.argc = args.size();
+	h.dev = script_status.st_dev;
+	h.ino = script_status.st_ino;
+	h.size = script_status.st_size;
+	get_mtime(script_status, h.mtime_sec, h.mtime_nsec);
+	std::string strings;
+	for (std::vector<std::string>::const_iterator i(args.begin()), e(args.end()); e != i; ++i) {
+		// Arguments end up as NUL-terminated strings when executed, so it is no loss to truncate them at the first NUL here.
+		strings += i->c_str();
+		strings += '\0';
+	}
+	h.strings_length = strings.length();
+
+	std::string new_name;
+	// The compiled form holds every argument of the script, so it must be no more readable than the script itself.
+	FileDescriptorOwner fd(open_new_file(compiled_name, script_status.st_mode & 0666, new_name));
+	if (0 > fd.get()) return false;
+	if (!write_all(fd.get(), reinterpret_cast<const char *>(&h), sizeof h)
+	||  !write_all(fd.get(), strings.data(), strings.length())
+	||  0 > fsync(fd.get())
+	) {
+		const int error(errno);
+		unlink(new_name.c_str());
+		errno = error;
+		return false;
+	}
+	fd.reset(-1);
+	if (0 > rename(new_name.c_str(), compiled_name)) {
+		const int error(errno);
+		unlink(new_name.c_str());
+		errno = error;
+		return false;
+	}
+	return true;
+}
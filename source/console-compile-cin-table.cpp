@@ -0,0 +1,79 @@
+/* COPYING ******************************************************************
+For copyright and licensing terms, see the file named COPYING.
+// **************************************************************************
+*/
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "utils.h"
+#include "popt.h"
+#include "CINTable.h"
+
+/* Main function ************************************************************
+// **************************************************************************
+*/
+
+void
+console_compile_cin_table [[gnu::noreturn]] (
+	const char * & next_prog,
+	std::vector<const char *> & args,
+	ProcessEnvironment & envs
+) {
+	const char * prog(basename_of(args[0]));
+	bool remove(false);
+	try {
+		popt::bool_definition remove_option('r', "remove", "Remove the compiled forms instead of creating them.", remove);
+		popt::definition * top_table[] = {
+			&remove_option,
+		};
+		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "{table(s)...}");
+
+		std::vector<const char *> new_args;
+		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
+		p.process(true /* strictly options before arguments */);
+		args = new_args;
+		next_prog = arg0_of(args);
+		if (p.stopped()) throw EXIT_SUCCESS;
+	} catch (const popt::error & e) {
+		die(prog, envs, e);
+	}
+
+	if (args.empty()) die_missing_argument(prog, envs, "table name");
+
+	bool failed(false);
+	for (std::vector<const char *>::const_iterator i(args.begin()), e(args.end()); e != i; ++i) {
+		const char * name(*i);
+		if (remove) {
+			const std::string compiled_name(std::string(name) + compiled_cin_table_suffix);
+			if (0 > unlink(compiled_name.c_str()) && ENOENT != errno) {
+				const int error(errno);
+				std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, compiled_name.c_str(), std::strerror(error));
+				failed = true;
+			}
+			continue;
+		}
+		struct stat s;
+		if (0 > stat(name, &s)) {
+			const int error(errno);
+			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, name, std::strerror(error));
+			failed = true;
+			continue;
+		}
+		// This exits the program on a parse error, just as console-input-method itself would.
+		CINTable table;
+		table.load(prog, envs, name, s);
+		if (!table.save_compiled(name)) {
+			const int error(errno);
+			std::fprintf(stderr, "%s: ERROR: %s%s: %s\n", prog, name, compiled_cin_table_suffix, std::strerror(error));
+			failed = true;
+		}
+	}
+	throw failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
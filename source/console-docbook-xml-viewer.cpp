@@ -21,6 +21,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "ttyname.h"
 #include "FileDescriptorOwner.h"
 #include "FileStar.h"
+#include "ChunkedReader.h"
 #include "UTF8Decoder.h"
 #include "CharacterCell.h"
 #include "ControlCharacters.h"
@@ -1202,11 +1203,9 @@ TUI::redraw_new (
 	TUIDisplayCompositor::coordinate y(current_row), x(current_col);
 	// The window includes the cursor position.
 	if (window_y > y) {
-		optimize_scroll_up(window_y - y);
 		window_y = y;
 	} else
 	if (window_y + c.query_h() <= y) {
-		optimize_scroll_down(y - c.query_h() - window_y + 1);
 		window_y = y - c.query_h() + 1;
 	}
 	if (window_x > x) {
@@ -1348,6 +1347,27 @@ TUI::EventHandler::ExtendedKey(
 // Seat of the class
 TUI::EventHandler::~EventHandler() {}
 
+namespace {
+
+inline
+void
+decode (
+	ChunkedReader & r,
+	UTF8Decoder & decoder,
+	unsigned long long & line
+) {
+	for (ChunkedReader::span chunk; r.read_chunk(chunk); ) {
+		for (const char * p(chunk.data), * const e(chunk.data + chunk.length); p < e; ++p) {
+			const unsigned char c(*p);
+			decoder.Process(c);
+			if (LF == c) ++line;
+		}
+	}
+	if (const int error = r.error()) throw std::strerror(error);
+}
+
+}
+
 /* Main function ************************************************************
 // **************************************************************************
 */
@@ -1420,11 +1440,8 @@ console_docbook_xml_viewer [[gnu::noreturn]]
 			}
 			unsigned long long line(1ULL);
 			try {
-				for (int c = std::fgetc(stdin); EOF != c; c = std::fgetc(stdin)) {
-					decoder.Process(c);
-					if (LF == c) ++line;
-				}
-				if (std::ferror(stdin)) throw std::strerror(errno);
+				ChunkedReader r(STDIN_FILENO);
+				decode(r, decoder, line);
 			} catch (const char * s) {
 				die_parser_error(prog, envs, "<stdin>", line, s);
 			}
@@ -1434,14 +1451,11 @@ console_docbook_xml_viewer [[gnu::noreturn]]
 				unsigned long long line(1ULL);
 				const char * file(args.front());
 				args.erase(args.begin());
-				FileStar f(std::fopen(file, "r"));
+				const FileDescriptorOwner fd(open_read_at(AT_FDCWD, file));
 				try {
-					if (!f) throw std::strerror(errno);
-					for (int c = std::fgetc(f); EOF != c; c = std::fgetc(f)) {
-						decoder.Process(c);
-						if (LF == c) ++line;
-					}
-					if (std::ferror(f)) throw std::strerror(errno);
+					if (0 > fd.get()) throw std::strerror(errno);
+					ChunkedReader r(fd.get());
+					decode(r, decoder, line);
 				} catch (const char * s) {
 					die_parser_error(prog, envs, file, line, s);
 				}
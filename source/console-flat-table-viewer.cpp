@@ -5,7 +5,10 @@ For copyright and licensing terms, see the file named COPYING.
 
 #define __STDC_FORMAT_MACROS
 #include <map>
+#include <unordered_map>
 #include <vector>
+#include <algorithm>
+#include <utility>
 #include <limits>
 #include <cstdio>
 #include <cstdlib>
@@ -16,6 +19,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include "kqueue_common.h"
 #include "popt.h"
@@ -100,7 +104,7 @@ struct TUI :
 	public TUIOutputBase,
 	public TUIInputBase
 {
-	TUI(ProcessEnvironment & e, Table & m, TUIDisplayCompositor & c, FILE * tty, unsigned long header_count, const ParserCharacters &, const CharacterCell::colour_type &, const CharacterCell::colour_type &, const TUIOutputBase::Options &);
+	TUI(ProcessEnvironment & e, Table & m, TUIDisplayCompositor & c, FILE * tty, unsigned long header_count, bool keyed, const ParserCharacters &, const CharacterCell::colour_type &, const CharacterCell::colour_type &, const TUIOutputBase::Options &);
 	~TUI();
 
 	bool quit_flagged() const { return pending_quit_event; }
@@ -151,11 +155,45 @@ protected:
 	enum { START, FIELD, COMMENT } state;
 	std::size_t data_nr, data_nf, current_nr, current_nf;
 	VisDecoder unvisdec;
+	/// \name Keyed mode
+	/// In keyed mode, body records are not rows but changes to rows, identified by key.
+	/// Changes that only replace fields are made in place.
+	/// Insertions and deletions instead relink rows in a list, indexed by row ID, and the table is rebuilt in order once at the end of each batch of changes.
+/// A batch ends at a group separator, or when no more input is waiting to be read.
+	/// So a batch of k changes to n rows costs O(n + k) rather than O(n * k).
+	/// Between batches a row's ID is its row number, and relink_base is NO_ROW.
+	/// @{
+	enum { NO_ROW = static_cast<std::size_t>(-1) };
+	const bool keyed;
+	Record scratch;
+	std::vector<Field> row_keys;
+	std::unordered_map<Field, std::size_t> key_index;	///< key to row ID
+	bool relinking;
+	std::size_t relink_base, first_row, last_row, current_row;
+	std::vector<std::size_t> next_row, prev_row, changed_rows;
+	std::vector<Record> added_rows;
+	std::vector<Field> added_keys;
+	/// @}
 
 	virtual void redraw_new();
 	void set_refresh_and_immediate_update_needed () { immediate_update_needed = true; TUIOutputBase::set_refresh_needed(); }
 
 	void HandleData (const char *, std::size_t);
+	bool IsKeyedBody() const { return keyed && data_nr >= header_count; }
+	Record & CurrentRecord();
+	void EndRecord();
+	void ApplyDelta(const Record &);
+	std::size_t FindRow(const Field &) const;
+	Record & Row(std::size_t id) { return id < relink_base ? table[id] : added_rows[id - relink_base]; }
+	Field & RowKey(std::size_t id) { return id < relink_base ? row_keys[id] : added_keys[id - relink_base]; }
+	void BeginRelinking();
+	std::size_t LastRow();
+	void EndRelinking();
+	void AbandonRelinking();
+	void InsertRow(std::size_t, const Field &, Record::const_iterator, Record::const_iterator);
+	void EraseRow(std::size_t);
+	void NoteFieldWidths(const Record &);
+	void NoteRowChanged(std::size_t);
 private:
 	char data_buffer[64U * 1024U];
 	char control_buffer[1U * 1024U];
@@ -180,6 +218,7 @@ TUI::TUI(
 	TUIDisplayCompositor & comp,
 	FILE * tty,
 	unsigned long c,
+	bool k,
 	const ParserCharacters & p,
 	const CharacterCell::colour_type & h_colour,
 	const CharacterCell::colour_type & b_colour,
@@ -216,7 +255,21 @@ TUI::TUI(
 	data_nf(0U),
 	current_nr(0U),
 	current_nf(0U),
-	unvisdec()
+	unvisdec(),
+	keyed(k),
+	scratch(),
+	row_keys(),
+	key_index(),
+	relinking(false),
+	relink_base(NO_ROW),
+	first_row(NO_ROW),
+	last_row(NO_ROW),
+	current_row(NO_ROW),
+	next_row(),
+	prev_row(),
+	changed_rows(),
+	added_rows(),
+	added_keys()
 {
 }
 
@@ -252,6 +305,10 @@ TUI::handle_data (
 		if (l >= n) break;
 		n -= l;
 	} while (n > 0);
+	// The rest of a batch that is still being written will arrive with the next event.
+	int pending(0);
+	if (0 > ioctl(fd, FIONREAD, &pending) || 0 >= pending)
+		EndRelinking();
 }
 
 void
@@ -263,7 +320,11 @@ TUI::HandleData (
 		unsigned char c(*buf++);
 		--len;
 		if (IsFileSeparator(c)) {
+			AbandonRelinking();
 			table.clear();
+			scratch.clear();
+			row_keys.clear();
+			key_index.clear();
 			// We keep the already determined columns, and just clear the automatically determined widths.
 			for (std::vector<ColumnInfo>::iterator b(info.begin()), e(info.end()), p(b); e != p; ++p)
 				p->clear_auto();
@@ -278,8 +339,9 @@ TUI::HandleData (
 					break;
 				} else
 				if (IsGroupSeparator(c) || IsRecordSeparator(c)) {
-					if (data_nf || AllowEmptyRecords()) ++data_nr;
+					if (data_nf || AllowEmptyRecords()) EndRecord();
 					data_nf = 0;
+					if (IsGroupSeparator(c)) EndRelinking();
 					break;
 				} else
 				if (IsUnitSeparator(c)) {
@@ -294,8 +356,8 @@ TUI::HandleData (
 				[[clang::fallthrough]];
 			case FIELD:
 			{
-				if (table.size() < data_nr + 1) table.resize(data_nr + 1);
-				Record & record(table[data_nr]);
+				const bool is_change(IsKeyedBody());
+				Record & record(CurrentRecord());
 				if (record.size() < data_nf + 1) record.resize(data_nf + 1);
 				Field & field(record[data_nf]);
 				if (info.size() < data_nf + 1) info.resize(data_nf + 1);
@@ -314,8 +376,9 @@ TUI::HandleData (
 						if (IsUnitSeparator(c)) {
 							++data_nf;
 						} else {
-							++data_nr;
+							EndRecord();
 							data_nf = 0;
+							if (IsGroupSeparator(c)) EndRelinking();
 						}
 						state = START;
 						break;
@@ -335,7 +398,8 @@ TUI::HandleData (
 					c = *buf++;
 					--len;
 				} while (true);
-				if (pushed) {
+				// Changes are accounted for when they are applied, as their first fields are not columns.
+				if (pushed && !is_change) {
 					UTF8DecoderHelper h;
 					h.Process(field);
 					ci.set_min_auto(h.str.length());
@@ -360,6 +424,221 @@ TUI::HandleData (
 	}
 }
 
+Record &
+TUI::CurrentRecord (
+) {
+	if (IsKeyedBody())
+		return scratch;
+	if (table.size() < data_nr + 1) table.resize(data_nr + 1);
+	return table[data_nr];
+}
+
+void
+TUI::EndRecord (
+) {
+	if (IsKeyedBody()) {
+		ApplyDelta(scratch);
+		scratch.clear();
+	}
+	++data_nr;
+}
+
+/// Apply one change record, which is one of:
+///  + key after fields...	insert a row after the row with key after
+///  ^ key fields...	insert a row as the first body row
+///  = key fields...	replace the fields of the row with key
+///  - key		delete the row with key
+void
+TUI::ApplyDelta (
+	const Record & r
+) {
+	if (r.size() < 2U || r[0].length() != 1U) return;
+	if (row_keys.size() < table.size()) row_keys.resize(table.size());
+	const Field & key(r[1]);
+	switch (r[0][0]) {
+		case '^':
+		{
+			// Header rows are never relinked, so the last of them is always the row before the first body row.
+			const std::size_t headers(header_count < table.size() ? header_count : table.size());
+			InsertRow(headers ? headers - 1U : NO_ROW, key, r.begin() + 2, r.end());
+			break;
+		}
+		case '+':
+		{
+			if (r.size() < 3U) return;
+			const std::size_t after(FindRow(r[2]));
+			InsertRow(NO_ROW != after ? after : LastRow(), key, r.begin() + 3, r.end());
+			break;
+		}
+		case '=':
+		{
+			const std::size_t row(FindRow(key));
+			if (NO_ROW == row) {
+				InsertRow(LastRow(), key, r.begin() + 2, r.end());
+				break;
+			}
+			Record & old(Row(row));
+			old.assign(r.begin() + 2, r.end());
+			NoteFieldWidths(old);
+			if (relinking)
+				changed_rows.push_back(row);
+			else
+				NoteRowChanged(row);
+			break;
+		}
+		case '-':
+		{
+			const std::size_t row(FindRow(key));
+			if (NO_ROW != row)
+				EraseRow(row);
+			break;
+		}
+	}
+}
+
+/// \returns the ID of the row with the given key, or NO_ROW if there is none
+std::size_t
+TUI::FindRow (
+	const Field & key
+) const {
+	const std::unordered_map<Field, std::size_t>::const_iterator i(key_index.find(key));
+	return key_index.end() == i ? std::size_t(NO_ROW) : i->second;
+}
+
+/// Switch from the table's order to the linked list of row IDs, for the rest of this batch of changes.
+void
+TUI::BeginRelinking (
+) {
+	if (relinking) return;
+	relinking = true;
+	relink_base = table.size();
+	next_row.resize(relink_base);
+	prev_row.resize(relink_base);
+	for (std::size_t i(0U); i < relink_base; ++i) {
+		next_row[i] = i + 1U < relink_base ? i + 1U : std::size_t(NO_ROW);
+		prev_row[i] = i > 0U ? i - 1U : std::size_t(NO_ROW);
+	}
+	first_row = relink_base ? 0U : std::size_t(NO_ROW);
+	last_row = relink_base ? relink_base - 1U : std::size_t(NO_ROW);
+	current_row = current_nr < relink_base ? current_nr : std::size_t(NO_ROW);
+}
+
+/// \returns the ID of the last row, in the linked order
+std::size_t
+TUI::LastRow (
+) {
+	BeginRelinking();
+	return last_row;
+}
+
+/// Rebuild the table, the row keys, and the index in the linked order, in one pass.
+void
+TUI::EndRelinking (
+) {
+	if (!relinking) return;
+	Table new_table;
+	std::vector<Field> new_keys;
+	std::vector<std::size_t> position(relink_base + added_rows.size(), NO_ROW);
+	new_table.reserve(relink_base + added_rows.size());
+	new_keys.reserve(relink_base + added_rows.size());
+	std::size_t first_moved(NO_ROW);
+	for (std::size_t id(first_row); NO_ROW != id; id = next_row[id]) {
+		const std::size_t row(new_table.size());
+		if (NO_ROW == first_moved && id != row) first_moved = row;
+		position[id] = row;
+		new_table.push_back(std::move(Row(id)));
+		new_keys.push_back(std::move(RowKey(id)));
+		if (row >= header_count)
+			key_index[new_keys.back()] = row;
+	}
+	// Rows appended or removed at the end leave nothing that differs in the walk, but still need redrawing.
+	if (NO_ROW == first_moved && new_table.size() != table.size()) first_moved = std::min(new_table.size(), table.size());
+	const std::size_t new_current_nr(NO_ROW != current_row ? position[current_row] : current_nr);
+	for (std::vector<std::size_t>::const_iterator i(changed_rows.begin()), e(changed_rows.end()); e != i; ++i)
+		if (NO_ROW != position[*i])
+			NoteRowChanged(position[*i]);
+	table.swap(new_table);
+	row_keys.swap(new_keys);
+	AbandonRelinking();
+	current_nr = new_current_nr < table.size() ? new_current_nr : table.size() ? table.size() - 1U : 0U;
+	if (NO_ROW != first_moved)
+		NoteRowChanged(first_moved);
+}
+
+void
+TUI::AbandonRelinking (
+) {
+	relinking = false;
+	relink_base = NO_ROW;
+	first_row = last_row = current_row = NO_ROW;
+	next_row.clear();
+	prev_row.clear();
+	changed_rows.clear();
+	added_rows.clear();
+	added_keys.clear();
+}
+
+/// Insert a new row after the row with ID after, or as the very first row if that is NO_ROW.
+/// Keys are unique, so a row that already has the key is replaced.
+void
+TUI::InsertRow (
+	std::size_t after,
+	const Field & key,
+	Record::const_iterator b,
+	Record::const_iterator e
+) {
+	BeginRelinking();
+	const std::size_t existing(FindRow(key));
+	if (NO_ROW != existing) {
+		if (existing == after) after = prev_row[existing];
+		EraseRow(existing);
+	}
+	const std::size_t id(relink_base + added_rows.size());
+	added_rows.push_back(Record(b, e));
+	added_keys.push_back(key);
+	next_row.push_back(NO_ROW != after ? next_row[after] : first_row);
+	prev_row.push_back(after);
+	if (NO_ROW != next_row[id]) prev_row[next_row[id]] = id; else last_row = id;
+	if (NO_ROW != after) next_row[after] = id; else first_row = id;
+	key_index[key] = id;
+	NoteFieldWidths(added_rows.back());
+}
+
+void
+TUI::EraseRow (
+	std::size_t id
+) {
+	BeginRelinking();
+	const std::size_t n(next_row[id]), p(prev_row[id]);
+	if (NO_ROW != p) next_row[p] = n; else first_row = n;
+	if (NO_ROW != n) prev_row[n] = p; else last_row = p;
+	next_row[id] = prev_row[id] = NO_ROW;
+	// The cursor stays on the row after a deleted one, or failing that the row before it.
+	if (current_row == id) current_row = NO_ROW != n ? n : p;
+	key_index.erase(RowKey(id));
+}
+
+void
+TUI::NoteFieldWidths (
+	const Record & r
+) {
+	if (info.size() < r.size()) info.resize(r.size());
+	for (std::size_t i(0U); i < r.size(); ++i) {
+		UTF8DecoderHelper h;
+		h.Process(r[i]);
+		info[i].set_min_auto(h.str.length());
+	}
+}
+
+/// Only changes to, or above, rows that are in the window need the display to be redrawn.
+void
+TUI::NoteRowChanged (
+	std::size_t row
+) {
+	if (row < header_count || row < window_y + c.query_h())
+		set_refresh_needed();
+}
+
 void
 TUI::handle_signal (
 	int signo
@@ -384,11 +663,9 @@ TUI::redraw_new (
 	// The window includes the cursor position.
 	{
 		if (window_y > y) {
-			optimize_scroll_up(window_y - y);
 			window_y = y;
 		} else
 		if (window_y + c.query_h() <= y) {
-			optimize_scroll_down(y - c.query_h() - window_y + 1);
 			window_y = y - c.query_h() + 1;
 		}
 		std::size_t nf(0U);
@@ -687,6 +964,7 @@ console_flat_table_viewer
 ) {
 	const char * prog(basename_of(args[0]));
 	unsigned long header_count(0UL);
+	bool keyed(false);
 	CharacterCell::colour_type header_colour(Map256Colour(COLOUR_YELLOW)), body_colour(Map256Colour(COLOUR_GREEN));
 	TUIOutputBase::Options oo;
 	format_definition format_option('\0', "format", "Specify the table file format.");
@@ -704,11 +982,13 @@ console_flat_table_viewer
 			&tui_level_option,
 		};
 		popt::unsigned_number_definition header_count_option('\0', "header-count", "number", "Specify how many of the initial records are headers.", header_count, 0);
+		popt::bool_definition keyed_option('\0', "keyed", "Treat records after the headers as keyed row changes.", keyed);
 		colour_definition header_colour_option('\0', "header-colour", "Specify the colour of header rows.", header_colour);
 		colour_definition body_colour_option('\0', "body-colour", "Specify the colour of body rows.", body_colour);
 		popt::table_definition tui_table_option(sizeof tui_table/sizeof *tui_table, tui_table, "Terminal quirks options");
 		popt::definition * top_table[] = {
 			&header_count_option,
+			&keyed_option,
 			&format_option,
 			&header_colour_option,
 			&body_colour_option,
@@ -804,7 +1084,7 @@ console_flat_table_viewer
 	Table table;
 
 	TUIDisplayCompositor compositor(false /* no software cursor */, 24, 80);
-	TUI ui(envs, table, compositor, control, header_count, format_option, header_colour, body_colour, oo);
+	TUI ui(envs, table, compositor, control, header_count, keyed, format_option, header_colour, body_colour, oo);
 
 	// How long to wait with updates pending.
 	const struct timespec short_timeout = { 0, 100000000L };
@@ -7,11 +7,9 @@ For copyright and licensing terms, see the file named COPYING.
 #define _XOPEN_SOURCE_EXTENDED
 #include <vector>
 #include <string>
-#include <map>
 #include <memory>
 #include <algorithm>
 #include <iostream>
-#include <fstream>
 #include <cstdio>
 #include <cstdlib>
 #include <cctype>
@@ -35,8 +33,8 @@ For copyright and licensing terms, see the file named COPYING.
 #include "TUIDisplayCompositor.h"
 #include "VirtualTerminalBackEnd.h"
 #include "InputFIFO.h"
-#include "UTF8Decoder.h"
 #include "UnicodeClassification.h"
+#include "CINTable.h"
 
 /* Realizing a virtual terminal *********************************************
 // **************************************************************************
@@ -49,57 +47,10 @@ typedef std::list<charvec> conversion_list;
 
 enum { CHINESE1_DATA_TABLE, CHINESE2_DATA_TABLE, KATAKANA_DATA_TABLE, HIRAGANA_DATA_TABLE, HANGEUL_DATA_TABLE, ROMAJI_DATA_TABLE, MAX_DATA_TABLES };
 
-class DataTable
-{
-public:
-	DataTable();
-	~DataTable();
-
-	void set_fold_case(bool v) { fold_case = v; }
-	bool query_fold_case() const { return fold_case; }
-	void add_raw_to_kana(const std::string & r, const charvec & c);
-	void add_engraving(char k, const charvec & c) { raw_to_engraving.insert(std::make_pair(k,c)); }
-
-	bool exceeds_max_conversion_length(std::size_t l) const { return l > max_conversion_length; }
-	bool find_conversions (const std::string &, conversion_list &) const;
-	charvec engraving_for(char) const;
-
-protected:
-	typedef std::multimap<std::string,charvec> conversion_map;
-	conversion_map raw_to_kana;
-	typedef std::map<char,charvec> engraving_map;
-	engraving_map raw_to_engraving;
-	bool fold_case;
-	std::size_t max_conversion_length;
-
-private:
-};
-
-class DataTableLoader :
-	public UTF8Decoder::UCS32CharacterSink
-{
-public:
-	DataTableLoader(DataTable & t, const char * p, const ProcessEnvironment & e, const char * f);
-	void load();
-protected:
-	DataTable & table;
-	UTF8Decoder decoder;
-	enum { FIRST, COMMENT_REST, DIRECTIVE_FIRST, DIRECTIVE_SPACE1, DIRECTIVE_SECOND, DIRECTIVE_REST, DATA_FIRST, DATA_SPACE1, DATA_SECOND, DATA_REST } state;
-	bool chardef, keyname;
-	const char * const prog;
-	const ProcessEnvironment & envs;
-	const char * const filename;
-	unsigned long line;
-	std::string first;
-	charvec second;
-
-	virtual void ProcessDecodedUTF8(char32_t character, bool decoder_error, bool overlong);
-};
-
 class Realizer
 {
 public:
-	Realizer(FILE *, VirtualTerminalBackEnd &, TUIDisplayCompositor &, const DataTable tables[MAX_DATA_TABLES]);
+	Realizer(FILE *, VirtualTerminalBackEnd &, TUIDisplayCompositor &, const CINTable tables[MAX_DATA_TABLES]);
 	~Realizer();
 
 	void set_refresh_needed() { refresh_needed = true; }
@@ -115,7 +66,7 @@ protected:
 	FileStar const buffer_file;
 	VirtualTerminalBackEnd & lower_vt;
 	TUIDisplayCompositor & comp;
-	const DataTable * const tables;
+	const CINTable * const tables;
 	bool active;
 
 	std::string raw;
@@ -141,9 +92,10 @@ protected:
 	void use_current_conversion ();
 	void reset_current_conversion ();
 	void copy_conversion_to_send (const charvec &);
-	void lookup_all_table_conversions (const charvec &, const DataTable &, const std::string &);
+	void lookup_all_table_conversions (const charvec &, const CINTable &, const std::string &);
+	bool lookup_table_conversions_from (const charvec &, const CINTable &, const std::string &, std::size_t, std::size_t, CINTable::state);
 	void create_all_fixed_romaji_conversions ();
-	const DataTable & current_table() const;
+	const CINTable & current_table() const;
 
 	enum { CELL_LENGTH = 16U, HEADER_LENGTH = 16U };
 };
@@ -157,270 +109,43 @@ const ColourPair status(status_fg, status_bg);
 const ColourPair converted(converted_fg, converted_bg);
 const ColourPair unconverted(unconverted_fg, unconverted_bg);
 
-inline
-bool
-is_begin (
-	const charvec & v
-) {
-	return 5 == v.size() && 'b' == v[0] && 'e' == v[1] && 'g' == v[2] && 'i' == v[3] && 'n' == v[4];
-}
-
-inline
-bool
-is_end (
-	const charvec & v
-) {
-	return 3 == v.size() && 'e' == v[0] && 'n' == v[1] && 'd' == v[2];
-}
-
-}
-
-DataTable::DataTable(
-) :
-	fold_case(true),
-	max_conversion_length(0U)
-{
-}
-
-DataTable::~DataTable() {}
-
-void
-DataTable::add_raw_to_kana(
-	const std::string & r,
-	const charvec & c
-) {
-	if (max_conversion_length < r.length())
-		max_conversion_length = r.length();
-	raw_to_kana.insert(std::make_pair(r,c));
-}
-
 charvec
-DataTable::engraving_for (
+engraving_for (
+	const CINTable & table,
 	char c
-) const {
-	engraving_map::const_iterator i(raw_to_engraving.find(c));
-	if (raw_to_engraving.end() != i)
-		return i->second;
+) {
+	const uint32_t * p;
+	std::size_t l;
+	if (table.engraving(c, p, l))
+		return charvec(p, p + l);
 	charvec r;
 	r.push_back(uint_fast32_t(c));
 	return r;
 }
 
-bool
-DataTable::find_conversions (
-	const std::string & ro_lo,
-	conversion_list & results
-) const {
-	results.clear();
-	conversion_map::const_iterator i(raw_to_kana.find(ro_lo));
-	if (raw_to_kana.end() == i) return false;
-	for (conversion_map::const_iterator e(raw_to_kana.upper_bound(i->first)); i != e; ++i)
-		results.push_back(i->second);
-	return true;
-}
-
-DataTableLoader::DataTableLoader(
-	DataTable & t,
-	const char * p,
-	const ProcessEnvironment & e,
-	const char * f
-) :
-	table(t),
-	decoder(*this),
-	state(FIRST),
-	chardef(false),
-	keyname(false),
-	prog(p),
-	envs(e),
-	filename(f),
-	line(0UL)
-{
-}
-
+/// Map the compiled form of a table, if it is current, falling back to parsing the CIN file itself.
 void
-DataTableLoader::load (
+load (
+	CINTable & table,
+	const char * prog,
+	const ProcessEnvironment & envs,
+	const char * name
 ) {
-	std::ifstream f(filename);
-	if (!f) {
-		die_errno(prog, envs, filename);
+	struct stat s;
+	if (0 > stat(name, &s)) {
+		die_errno(prog, envs, name);
 	}
-	line = 1UL;
-	for (int c(f.get()); EOF != c; c = f.get())
-		decoder.Process(c);
+	if (!table.load_compiled(name, s))
+		table.load(prog, envs, name, s);
 }
 
-void
-DataTableLoader::ProcessDecodedUTF8(
-	char32_t character,
-	bool decoder_error,
-	bool /*overlong*/
-) {
-	if (decoder_error)
-		die_parser_error(prog, envs, filename, line, "Invalid UTF-8 in file.");
-	if ('\n' == character) ++line;
-	switch (state) {
-		case FIRST:
-			if ('\n' == character)
-				break;
-			else
-			{
-				first.clear();
-				second.clear();
-				if ('%' == character)
-					state = DIRECTIVE_FIRST;
-				else
-				if ('#' == character)
-					state = COMMENT_REST;
-				else
-				if (character < 0x100 && std::isspace(character))
-					state = DATA_FIRST;
-				else
-				{
-					state = DATA_FIRST;
-					goto data1;
-				}
-			}
-			break;
-
-		case COMMENT_REST:
-			if ('\n' == character)
-				state = FIRST;
-			break;
-
-		// Parsing directives into a leading ASCII portion and a trailing Unicode portion.
-
-		case DIRECTIVE_FIRST:
-			if ('\n' == character)
-				goto directive_end;
-			if (0x100 <= character)
-				die_parser_error(prog, envs, filename, line, "Invalid directive name.");
-			else
-			if (!std::isspace(static_cast<char>(character)))
-				first.push_back(static_cast<char>(character));
-			else
-			if (first.empty())
-				die_parser_error(prog, envs, filename, line, "Invalid directive line with empty first field.");
-			else
-			{
-				state = DIRECTIVE_SPACE1;
-				goto directive_space;
-			}
-			break;
-		case DIRECTIVE_SPACE1:
-		directive_space:
-			if ('\n' == character)
-				goto directive_end;
-			else
-			if (0x100 <= character || !std::isspace(static_cast<char>(character))) {
-				state = DIRECTIVE_SECOND;
-				goto directive2;
-			}
-			break;
-		case DIRECTIVE_SECOND:
-			if ('\n' == character)
-				goto directive_end;
-			else
-		directive2:
-				second.push_back(character);
-			break;
-		case DIRECTIVE_REST:
-			if ('\n' == character)
-				goto directive_end;
-			break;
-		directive_end:
-			if ("keyname" == first) {
-				if (is_begin(second)) {
-					keyname = true;
-					chardef = false;
-				} else
-				if (is_end(second)) {
-					keyname = false;
-				} else
-					die_parser_error(prog, envs, filename, line, first.c_str(), "Directive followed by neither begin nor end.");
-			} else
-			if ("chardef" == first) {
-				if (is_begin(second)) {
-					chardef = true;
-					keyname = false;
-				} else
-				if (is_end(second)) {
-					chardef = false;
-				} else
-					die_parser_error(prog, envs, filename, line, first.c_str(), "Directive followed by neither begin nor end.");
-			} else
-			if ("keep_key_case" == first)
-				table.set_fold_case(false);
-			else
-			{
-			}
-			state = FIRST;
-			break;
-
-		// Parsing data lines into a leading ASCII field, a Unicode field, and a trailing portion that is ignored.
-
-		case DATA_FIRST:
-			if ('\n' == character)
-				die_parser_error(prog, envs, filename, line, "Invalid data line with only 1 field.");
-		data1:
-			if (0x100 <= character)
-				die_parser_error(prog, envs, filename, line, "Invalid raw data field.");
-			else
-			if (!std::isspace(static_cast<char>(character)))
-				first.push_back(static_cast<char>(character));
-			else
-			if (first.empty())
-				die_parser_error(prog, envs, filename, line, "Invalid data line with empty first field.");
-			else
-			{
-				state = DATA_SPACE1;
-				goto data_space;
-			}
-			break;
-		case DATA_SPACE1:
-		data_space:
-			if ('\n' == character)
-				die_parser_error(prog, envs, filename, line, "Invalid data line with only 1 field.");
-			else
-			if (0x100 <= character || !std::isspace(static_cast<char>(character))) {
-				state = DATA_SECOND;
-				goto data2;
-			}
-			break;
-		case DATA_SECOND:
-			if ('\n' == character)
-				goto data_end;
-		data2:
-			if (character < 0x100 && std::isspace(static_cast<char>(character))) {
-				state = DATA_REST;
-				goto data_rest;
-			} else
-				second.push_back(character);
-			break;
-		case DATA_REST:
-		data_rest:
-			if ('\n' == character)
-				goto data_end;
-			break;
-		data_end:
-			if (keyname) {
-				if (first.length() != 1U)
-					die_parser_error(prog, envs, filename, line, "Invalid key name that is not 1 character.");
-				table.add_engraving(first.front(), second);
-			} else
-			if (chardef)
-				table.add_raw_to_kana(first, second);
-			else
-				die_parser_error(prog, envs, filename, line, first.c_str(), "Bogus data not part of an engraving or a conversion.");
-			state = FIRST;
-			break;
-	}
 }
 
 Realizer::Realizer (
 	FILE * f,
 	VirtualTerminalBackEnd & l,
 	TUIDisplayCompositor & c,
-	const DataTable t[MAX_DATA_TABLES]
+	const CINTable t[MAX_DATA_TABLES]
 ) :
 	refresh_needed(true),
 	update_needed(true),
@@ -448,7 +173,7 @@ Realizer::~Realizer()
 	ftruncate(fileno(buffer_file), 0);
 }
 
-const DataTable &
+const CINTable &
 Realizer::current_table (
 ) const {
 	switch (conversion_mode) {
@@ -543,10 +268,43 @@ Realizer::create_all_fixed_romaji_conversions (
 	conversions.push_back(r);
 }
 
+/// \brief Walk the table's trie along to_convert from e, trying the longest keys first
+/// \returns whether any key starting from the state s had conversions
+bool
+Realizer::lookup_table_conversions_from (
+	const charvec & c,
+	const CINTable & table,
+	const std::string & to_convert,
+	std::size_t e,
+	std::size_t end_or_space,
+	CINTable::state s
+) {
+	if (end_or_space <= e || !table.walk(s, to_convert[e])) return false;
+	++e;
+	bool found(lookup_table_conversions_from(c, table, to_convert, e, end_or_space, s));
+	CINTable::cursor l;
+	if (table.conversions(s, l)) {
+		const std::size_t len(to_convert.length());
+		const std::string remainder(to_convert.substr(e));
+		const uint32_t * tail;
+		std::size_t tail_length;
+		while (l.next(tail, tail_length)) {
+			charvec r(c);
+			r.insert(r.end(), tail, tail + tail_length);
+			if (len <= e)
+				conversions.push_back(r);
+			else
+				lookup_all_table_conversions(r, table, remainder);
+		}
+		found = true;
+	}
+	return found;
+}
+
 void
 Realizer::lookup_all_table_conversions (
 	const charvec & c,
-	const DataTable & table,
+	const CINTable & table,
 	const std::string & to_convert		///< guaranteed to be non-empty by the caller
 ) {
 	const std::size_t len(to_convert.length());
@@ -564,29 +322,11 @@ Realizer::lookup_all_table_conversions (
 	std::size_t end_or_space(start);
 	while (end_or_space < len && !std::isspace(static_cast<unsigned char>(to_convert[end_or_space]))) ++end_or_space;
 
-	bool found(false);
-	for (std::size_t e(end_or_space); e > start; --e) {
-		if (table.exceeds_max_conversion_length(e - start)) continue;	// Avoid constructing and destroying lists and strings.
-		conversion_list l;
-		const std::string s(to_convert.substr(start, e - start));
-		if (table.find_conversions(s, l)) {
-			const std::string remainder(to_convert.substr(e));
-			for (conversion_list::const_iterator p(l.begin()); p != l.end(); ++p) {
-				const charvec & tail(*p);
-				charvec r(c);
-				r.insert(r.end(), tail.begin(), tail.end());
-				if (len <= e)
-					conversions.push_back(r);
-				else
-					lookup_all_table_conversions(r, table, remainder);
-			}
-			found = true;
-		}
-	}
-	if (!found) {
+	// A single walk down the trie finds every key that is a prefix of the raw input, without constructing any strings to look up.
+	if (!lookup_table_conversions_from(c, table, to_convert, start, end_or_space, CINTable::ROOT)) {
 		charvec r(c);
 		const char k(to_convert[start]);
-		const charvec s(table.engraving_for(k));
+		const charvec s(engraving_for(table, k));
 		r.insert(r.end(), s.begin(), s.end());
 		if (len <= start + 1U)
 			conversions.push_back(r);
@@ -632,7 +372,7 @@ Realizer::reset_current_conversion(
 void
 Realizer::convert (
 ) {
-	const DataTable & table(current_table());
+	const CINTable & table(current_table());
 	conversions.clear();
 	if (0U < rawpos) {
 		std::string to_convert(raw.substr(0U, rawpos));
@@ -645,7 +385,7 @@ Realizer::convert (
 	unconverted_engravings.clear();
 	for (std::size_t i(0U); i < raw.length(); ++i) {
 		const char k(raw[i]);
-		const charvec s(table.engraving_for(table.query_fold_case() ? tolower(k) : k));
+		const charvec s(engraving_for(table, table.query_fold_case() ? tolower(k) : k));
 		charvec & t (i < rawpos ? converted_engravings : unconverted_engravings);
 		t.insert(t.end(), s.begin(), s.end());
 	}
@@ -791,7 +531,8 @@ Realizer::paint_changed_cells (
 		std::fseek(buffer_file, HEADER_LENGTH, SEEK_SET);
 
 	for (unsigned row(0); row < rows; ++row) {
-		for (unsigned col(0); col < cols; ++col) {
+		if (!comp.is_dirty_row(row)) continue;
+		for (unsigned col(comp.query_dirty_begin(row)), end(comp.query_dirty_end(row)); col < end; ++col) {
 			TUIDisplayCompositor::DirtiableCell & cell(comp.cur_at(row, col));
 			if (!cell.touched()) continue;
 			unsigned char b[CELL_LENGTH] = {
@@ -809,6 +550,7 @@ Realizer::paint_changed_cells (
 			cell.untouch();
 		}
 	}
+	comp.clear_dirty();
 	const off_t pos(HEADER_LENGTH + CELL_LENGTH * (rows * cols));
 	if (pos != ftello(buffer_file))
 		std::fseek(buffer_file, pos, SEEK_SET);
@@ -1199,15 +941,14 @@ console_input_method [[gnu::noreturn]] (
 	const char * lvcname(args.front());
 	args.erase(args.begin());
 
-	DataTable tables[MAX_DATA_TABLES];
+	CINTable tables[MAX_DATA_TABLES];
 	if (chinese1_table) {
 		if (args.empty()) {
 			die_missing_argument(prog, envs, "chinese data table name");
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[CHINESE1_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[CHINESE1_DATA_TABLE], prog, envs, table_name);
 	}
 	if (chinese2_table) {
 		if (args.empty()) {
@@ -1215,8 +956,7 @@ console_input_method [[gnu::noreturn]] (
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[CHINESE2_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[CHINESE2_DATA_TABLE], prog, envs, table_name);
 	}
 	if (kana_table) {
 		if (args.empty()) {
@@ -1224,8 +964,7 @@ console_input_method [[gnu::noreturn]] (
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[HIRAGANA_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[HIRAGANA_DATA_TABLE], prog, envs, table_name);
 	}
 	if (kana_table) {
 		if (args.empty()) {
@@ -1233,8 +972,7 @@ console_input_method [[gnu::noreturn]] (
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[KATAKANA_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[KATAKANA_DATA_TABLE], prog, envs, table_name);
 	}
 	if (hangeul_table) {
 		if (args.empty()) {
@@ -1242,8 +980,7 @@ console_input_method [[gnu::noreturn]] (
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[HANGEUL_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[HANGEUL_DATA_TABLE], prog, envs, table_name);
 	}
 	if (romaji_table) {
 		if (args.empty()) {
@@ -1251,8 +988,7 @@ console_input_method [[gnu::noreturn]] (
 		}
 		const char * table_name(args.front());
 		args.erase(args.begin());
-		DataTableLoader loader(tables[ROMAJI_DATA_TABLE], prog, envs, table_name);
-		loader.load();
+		load(tables[ROMAJI_DATA_TABLE], prog, envs, table_name);
 	}
 	if (!args.empty()) die_unexpected_argument(prog, args, envs);
 
@@ -504,11 +504,9 @@ TUI::redraw_new (
 	TUIDisplayCompositor::coordinate y(current_row), x(current_col);
 	// The window includes the cursor position.
 	if (window_y > y) {
-		optimize_scroll_up(window_y - y);
 		window_y = y;
 	} else
 	if (window_y + c.query_h() <= y) {
-		optimize_scroll_down(y - c.query_h() - window_y + 1);
 		window_y = y - c.query_h() + 1;
 	}
 	if (window_x > x) {
@@ -110,17 +110,29 @@ is_preenable_type (
 	;
 }
 
+std::set<std::string> api_mountpoints;
+bool api_mountpoints_loaded(false);
+
+inline
+void
+load_api_mountpoints()
+{
+	if (api_mountpoints_loaded) return;
+	for (std::vector<api_mount>::const_iterator i(api_mounts.begin()); api_mounts.end() != i; ++i) {
+		const std::string fspath(fspath_from_mount(i->iov, i->ioc));
+		if (!fspath.empty())
+			api_mountpoints.insert(fspath);
+	}
+	api_mountpoints_loaded = true;
+}
+
 inline
 bool
 is_api_mountpoint(
 	const std::string & p
 ) {
-	for (std::vector<api_mount>::const_iterator i(api_mounts.begin()); api_mounts.end() != i; ++i) {
-		const std::string fspath(fspath_from_mount(i->iov, i->ioc));
-		if (!fspath.empty() && p == fspath)
-			return true;
-	}
-	return false;
+	load_api_mountpoints();
+	return api_mountpoints.end() != api_mountpoints.find(p);
 }
 
 /// Wrapper function because we never generate per-user stuff and anything fstab-related in /etc/service-bundles only ever links to services and targets that are also etc bundles.
@@ -721,6 +733,152 @@ create_regular_bundles (
 	create_mount_bundle(prog, envs, what, where, vfstype, options_list, local, overwrite, modules, is_gbde ? &gbde : nullptr, is_geli ? &geli : nullptr, services_and_targets_are_relative, mounts_are_relative, supervise_in_run, bundle_root_fd, bundle_root, mount_bundle_dirname);
 }
 
+/// A copy of an fstab database entry, which outlives the next call to getfsent()
+struct fstab_entry {
+	fstab_entry(const struct fstab & e) : what(e.fs_spec), where(e.fs_file), type(e.fs_type ? e.fs_type : ""), vfstype(e.fs_vfstype ? e.fs_vfstype : ""), mntops(e.fs_mntops ? e.fs_mntops : ""), passno(e.fs_passno) {}
+	std::string what, where, type, vfstype, mntops;
+	int passno;
+};
+
+void
+convert_fstab_entry (
+	const char * prog,
+	const ProcessEnvironment & envs,
+	const fstab_entry & entry,
+	const bool overwrite,
+	const bool etc_bundle,
+	const bool local_bundle,
+	const bool supervise_in_run,
+	const FileDescriptorOwner & bundle_root_fd,
+	const char * bundle_root
+) {
+	const char * what(entry.what.c_str());
+	const char * where(entry.where.c_str());
+	const char * type(entry.type.c_str());
+	const char * vfstype(entry.vfstype.c_str());
+
+	std::list<std::string> options_list(split_fstab_options(entry.mntops.c_str()));
+	const bool netdev(has_option(options_list, "_netdev"));
+	delete_fstab_option(options_list, "_netdev");
+	delete_fstab_option(options_list, "noauto");
+	delete_fstab_option(options_list, "nofail");
+	delete_fstab_option(options_list, "auto");
+
+#if defined(__LINUX__) || defined(__linux__)
+	const bool is_vfs_swap(!netdev && is_swap_type(vfstype));
+#endif
+	if (0 == std::strcmp(type, "xx")) {
+		return;
+	} else
+	if ((0 == std::strcmp(type, "rw"))
+	||  (0 == std::strcmp(type, "rq"))
+	||  (0 == std::strcmp(type, "ro"))
+#if defined(__LINUX__) || defined(__linux__)
+	||  (!is_vfs_swap && 0 == std::strcmp(type, "??"))
+#endif
+	) {
+		const bool want_fsck(entry.passno > 0);
+		create_regular_bundles(prog, envs, what, where, vfstype, overwrite, !local_bundle, etc_bundle, supervise_in_run, bundle_root_fd, bundle_root, netdev, want_fsck, options_list);
+	} else
+	if (0 == std::strcmp(type, "sw")
+#if defined(__LINUX__) || defined(__linux__)
+	||  (is_vfs_swap && 0 == std::strcmp(type, "??"))
+#endif
+	) {
+		const bool local(true);
+		const std::string swap_bundle_dirname("swap@" + systemd_name_escape(what));
+		std::string gbde, geli;
+		const bool is_gbde(ends_in(what, ".bde", gbde));
+		const bool is_geli(ends_in(what, ".eli", geli));
+		if (is_gbde)
+			create_gbde_bundle(prog, envs, what, local, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, gbde, nullptr, swap_bundle_dirname);
+		if (is_geli)
+			create_geli_bundle(prog, envs, what, local, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, geli, nullptr, swap_bundle_dirname, true, options_list);
+		create_swap_bundle(prog, envs, what, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, swap_bundle_dirname, options_list);
+		create_dump_bundle(prog, envs, what, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, swap_bundle_dirname);
+	} else
+		std::fprintf(stderr, "%s: WARNING: %s: %s: %s\n", prog, where, type, "Unrecognized type.");
+}
+
+struct fstab_batch : public conversion_batch {
+	fstab_batch(const char * p, const ProcessEnvironment & e, bool o, bool eb, bool lb, bool s, const FileDescriptorOwner & f, const char * r) : prog(p), envs(e), overwrite(o), etc_bundle(eb), local_bundle(lb), supervise_in_run(s), bundle_root_fd(f), bundle_root(r), entries(), group_numbers(), parents() {}
+	void add(const fstab_entry &);
+	bool run(const char * prog, std::size_t workers);
+protected:
+	typedef std::map<std::string, std::size_t> group_map;
+	const char * prog;
+	const ProcessEnvironment & envs;
+	const bool overwrite, etc_bundle, local_bundle, supervise_in_run;
+	const FileDescriptorOwner & bundle_root_fd;
+	const char * bundle_root;
+	std::vector<fstab_entry> entries;
+	group_map group_numbers;
+	std::vector<std::size_t> parents;	///< a disjoint-set forest of groups
+
+	virtual void convert(std::size_t item);
+	std::size_t find(std::size_t);
+	std::size_t join(std::size_t, const std::string &);
+};
+
+std::size_t
+fstab_batch::find (
+	std::size_t group
+) {
+	while (parents[group] != group) {
+		parents[group] = parents[parents[group]];
+		group = parents[group];
+	}
+	return group;
+}
+
+/// Merge the group of whatever has already been seen with this name into this group.
+std::size_t
+fstab_batch::join (
+	std::size_t group,
+	const std::string & name
+) {
+	const std::pair<group_map::iterator, bool> i(group_numbers.insert(group_map::value_type(name, group)));
+	if (!i.second) {
+		const std::size_t other(find(i.first->second));
+		if (other != group) {
+			parents[group] = other;
+			group = other;
+		}
+	}
+	return group;
+}
+
+void
+fstab_batch::add (
+	const fstab_entry & entry
+) {
+	// Entries that share a mount point or a device share bundles, and must not be converted simultaneously.
+	// An entry can link two groups that were separate until now, so groups are merged, and only finally settled by run().
+	std::size_t group(parents.size());
+	parents.push_back(group);
+	group = join(group, entry.where);
+	group = join(group, entry.what);
+	conversion_batch::add(group);
+	entries.push_back(entry);
+}
+
+bool
+fstab_batch::run (
+	const char * p,
+	std::size_t workers
+) {
+	for (std::vector<std::size_t>::iterator i(groups.begin()), e(groups.end()); e != i; ++i)
+		*i = find(*i);
+	return conversion_batch::run(p, workers);
+}
+
+void
+fstab_batch::convert (
+	std::size_t item
+) {
+	convert_fstab_entry(prog, envs, entries[item], overwrite, etc_bundle, local_bundle, supervise_in_run, bundle_root_fd, bundle_root);
+}
+
 }
 
 /* System control subcommands ***********************************************
@@ -736,18 +894,21 @@ convert_fstab_services [[gnu::noreturn]] (
 	const char * prog(basename_of(args[0]));
 	const char * bundle_root(nullptr);
 	bool overwrite(false), etc_bundle(false), local_bundle(false), supervise_in_run(false);
+	unsigned long jobs(1U);
 	try {
 		popt::bool_definition overwrite_option('o', "overwrite", "Update/overwrite an existing service bundle.", overwrite);
 		popt::string_definition bundle_option('\0', "bundle-root", "directory", "Root directory for bundles.", bundle_root);
 		popt::bool_definition etc_bundle_option('\0', "etc-bundle", "Consider this service to live in /etc/service-bundles/ with relative paths to mount services.", etc_bundle);
 		popt::bool_definition local_bundle_option('\0', "local-bundle", "Consider this service to live in a service bundle area like /var/local/sv/ with no relative paths.", local_bundle);
 		popt::bool_definition supervise_in_run_option('\0', "supervise-in-run", "Arrange for a supervise directory under /run/service-bundles/early-supervise/.", supervise_in_run);
+		popt::unsigned_number_definition jobs_option('j', "jobs", "number", "Convert the entries with this many worker processes.", jobs, 0);
 		popt::definition * main_table[] = {
 			&overwrite_option,
 			&bundle_option,
 			&etc_bundle_option,
 			&local_bundle_option,
 			&supervise_in_run_option,
+			&jobs_option,
 		};
 		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "");
 
@@ -774,58 +935,21 @@ convert_fstab_services [[gnu::noreturn]] (
 	if (0 > bundle_root_fd.get()) {
 		die_errno(prog, envs, bundle_root);
 	}
+	std::vector<fstab_entry> entries;
 	while (struct fstab * entry = getfsent()) {
-		const char * what(entry->fs_spec);
-		const char * where(entry->fs_file);
-		const char * type(entry->fs_type);
-
-		if (!what || !where) continue;
-
-		std::list<std::string> options_list(split_fstab_options(entry->fs_mntops));
-		const bool netdev(has_option(options_list, "_netdev"));
-		delete_fstab_option(options_list, "_netdev");
-		delete_fstab_option(options_list, "noauto");
-		delete_fstab_option(options_list, "nofail");
-		delete_fstab_option(options_list, "auto");
-
-#if defined(__LINUX__) || defined(__linux__)
-		const bool is_vfs_swap(!netdev && is_swap_type(entry->fs_vfstype));
-#endif
-		if (0 == std::strcmp(type, "xx")) {
-			continue;
-		} else
-		if ((0 == std::strcmp(type, "rw"))
-		||  (0 == std::strcmp(type, "rq"))
-		||  (0 == std::strcmp(type, "ro"))
-#if defined(__LINUX__) || defined(__linux__)
-		||  (!is_vfs_swap && 0 == std::strcmp(type, "??"))
-#endif
-		) {
-			const bool want_fsck(entry->fs_passno > 0);
-			create_regular_bundles(prog, envs, what, where, entry->fs_vfstype, overwrite, !local_bundle, etc_bundle, supervise_in_run, bundle_root_fd, bundle_root, netdev, want_fsck, options_list);
-		} else
-		if (0 == std::strcmp(type, "sw")
-#if defined(__LINUX__) || defined(__linux__)
-		||  (is_vfs_swap && 0 == std::strcmp(type, "??"))
-#endif
-		) {
-			const bool local(true);
-			const std::string swap_bundle_dirname("swap@" + systemd_name_escape(what));
-			std::string gbde, geli;
-			const bool is_gbde(ends_in(what, ".bde", gbde));
-			const bool is_geli(ends_in(what, ".eli", geli));
-			if (is_gbde)
-				create_gbde_bundle(prog, envs, what, local, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, gbde, nullptr, swap_bundle_dirname);
-			if (is_geli)
-				create_geli_bundle(prog, envs, what, local, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, geli, nullptr, swap_bundle_dirname, true, options_list);
-			create_swap_bundle(prog, envs, what, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, swap_bundle_dirname, options_list);
-			create_dump_bundle(prog, envs, what, overwrite, !local_bundle, supervise_in_run, bundle_root_fd, bundle_root, swap_bundle_dirname);
-		} else
-			std::fprintf(stderr, "%s: WARNING: %s: %s: %s\n", prog, where, type, "Unrecognized type.");
+		if (!entry->fs_spec || !entry->fs_file) continue;
+		entries.push_back(fstab_entry(*entry));
 	}
 	endfsent();
 
-	throw EXIT_SUCCESS;
+	// The workers all share the one list of API mount points, rather than each making its own.
+	load_api_mountpoints();
+
+	fstab_batch batch(prog, envs, overwrite, etc_bundle, local_bundle, supervise_in_run, bundle_root_fd, bundle_root);
+	for (std::vector<fstab_entry>::const_iterator i(entries.begin()); entries.end() != i; ++i)
+		batch.add(*i);
+
+	throw batch.run(prog, jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 void
@@ -5,6 +5,8 @@ For copyright and licensing terms, see the file named COPYING.
 
 #include <vector>
 #include <map>
+#include <set>
+#include <list>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -27,6 +29,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "service-manager-client.h"
 #include "popt.h"
 #include "FileStar.h"
+#include "ChunkedReader.h"
 #include "DirStar.h"
 #include "FileDescriptorOwner.h"
 #include "bundle_creation.h"
@@ -327,9 +330,84 @@ const char * systemd_prefixes[] = {
 	"",
 };
 
+/// \brief Things that a batch of conversions can share, rather than looking them up afresh for every unit
+/// Unit directories are listed once, so that searching for units and drop-in directories need not probe every directory.
+/// Template units are parsed once, along with their template-wide drop-ins, and copied for each instance.
+struct unit_cache {
+	unit_cache() : templates(), directories() {}
+	bool may_contain(const std::string & dir_name, const std::string & entry_name);
+
+	struct template_unit {
+		template_unit() : p(), source_filenames() {}
+		profile p;
+		std::list<std::string> source_filenames;
+	};
+	typedef std::map<std::string, template_unit> template_map;
+	template_map templates;
+protected:
+	struct listing {
+		listing() : error(0), names() {}
+		int error;
+		std::set<std::string> names;
+	};
+	typedef std::map<std::string, listing> directory_map;
+	directory_map directories;
+
+	static void load_listing(listing &, const char *);
+};
+
+void
+unit_cache::load_listing (
+	listing & l,
+	const char * dir_name
+) {
+	FileDescriptorOwner dir_fd(open_dir_at(AT_FDCWD, dir_name));
+	if (0 > dir_fd.get()) {
+		l.error = errno;
+		return;
+	}
+	const DirStar dir(dir_fd);
+	if (!dir) {
+		l.error = errno;
+		return;
+	}
+	for (;;) {
+		errno = 0;
+		const dirent * entry(readdir(dir));
+		if (!entry) {
+			if (errno) {
+				l.error = errno;
+				l.names.clear();
+			}
+			break;
+		}
+		l.names.insert(entry->d_name);
+	}
+}
+
+/// \returns false only if the entry is known not to exist, in which case errno is set to ENOENT
+bool
+unit_cache::may_contain (
+	const std::string & dir_name,
+	const std::string & entry_name
+) {
+	directory_map::iterator i(directories.find(dir_name));
+	if (directories.end() == i) {
+		i = directories.insert(directory_map::value_type(dir_name, listing())).first;
+		load_listing(i->second, dir_name.empty() ? "." : dir_name.c_str());
+	}
+	const listing & l(i->second);
+	// Anything other than a missing directory is reported by actually trying to open the entry.
+	if (l.error && ENOENT != l.error) return true;
+	if (!l.error && l.names.end() != l.names.find(entry_name)) return true;
+	errno = ENOENT;
+	return false;
+}
+
 inline
 FILE *
 find (
+	unit_cache & cache,
 	std::string & path,
 	const std::string & base
 ) {
@@ -338,6 +416,10 @@ find (
 	int error(ENOENT);	// the most interesting error encountered
 	for ( const char ** p(systemd_prefixes); p < systemd_prefixes + sizeof systemd_prefixes/sizeof *systemd_prefixes; ++p) {
 		path = (std::string(*p) + "systemd/") + (per_user_mode ? "user/" : "system/");
+		if (!cache.may_contain(path, base)) {
+			errno = error;
+			continue;
+		}
 		FILE * f = std::fopen((path + base).c_str(), "r");
 		if (f) return f;
 		if (ENOENT == errno)
@@ -386,7 +468,8 @@ load (
 	profile & p,
 	FILE * file
 ) {
-	for (std::string line, section; read_line(file, line); ) {
+	ChunkedReader r(fileno(file));
+	for (std::string line, section; read_line(r, line); ) {
 		line = ltrim(line);
 		if (line.length() < 1) continue;
 		if ('#' == line[0] || ';' == line[0]) continue;
@@ -394,7 +477,7 @@ load (
 		const std::string::size_type eq(line.find('='));
 		const std::string var(line.substr(0, eq));
 		std::string val(eq == std::string::npos ? std::string() : line.substr(eq + 1, std::string::npos));
-		while (val.length() > 0 && '\\' == val[val.length()-1] && read_line(file, line))
+		while (val.length() > 0 && '\\' == val[val.length()-1] && read_line(r, line))
 			val = val.substr(0, val.length() - 1) + ltrim(line);
 		if (val.length() > 0)
 			p.append(section, tolower(var), val);
@@ -441,11 +524,13 @@ void
 load (
 	const char * prog,
 	const ProcessEnvironment & envs,
+	unit_cache & cache,
 	profile & p,
 	std::list<std::string> & source_filenames,
 	const std::string & path_name,
 	const std::string & base_name
 ) {
+	if (!cache.may_contain(path_name, base_name)) return;
 	const std::string snippet_dir_name(path_name + base_name);
 	FileDescriptorOwner snippet_dir_fd(open_dir_at(AT_FDCWD, snippet_dir_name.c_str()));
 	if (0 > snippet_dir_fd.get()) {
@@ -500,6 +585,7 @@ void
 load (
 	const char * prog,
 	const ProcessEnvironment & envs,
+	unit_cache & cache,
 	profile & p,
 	FILE * file,
 	std::list<std::string> & source_filenames,
@@ -514,11 +600,26 @@ load (
 	if (!file) {
 		die_errno(prog, envs, filename.c_str());
 	}
-	source_filenames.push_back(filename);
-	load(prog, p, file, filename);
-	load(prog, envs, p, source_filenames, unit_path, unit_base + ".d");
+	std::string template_prefix;
+	if (ends_in(unit_base, "@" + suffix, template_prefix)) {
+		unit_cache::template_map::iterator t(cache.templates.find(filename));
+		if (cache.templates.end() == t) {
+			unit_cache::template_unit u;
+			u.source_filenames.push_back(filename);
+			load(prog, u.p, file, filename);
+			load(prog, envs, cache, u.p, u.source_filenames, unit_path, unit_base + ".d");
+			t = cache.templates.insert(unit_cache::template_map::value_type(filename, u)).first;
+		}
+		p = t->second.p;
+		source_filenames.insert(source_filenames.end(), t->second.source_filenames.begin(), t->second.source_filenames.end());
+	} else
+	{
+		source_filenames.push_back(filename);
+		load(prog, p, file, filename);
+		load(prog, envs, cache, p, source_filenames, unit_path, unit_base + ".d");
+	}
 	if (!instance.empty())
-		load(prog, envs, p, source_filenames, unit_path, prefix + "@" + instance + suffix + ".d");
+		load(prog, envs, cache, p, source_filenames, unit_path, prefix + "@" + instance + suffix + ".d");
 }
 
 void
@@ -944,69 +1045,30 @@ void escape_format_definition::action(popt::processor & /*proc*/, const char * t
 
 }
 
-/* Main function ************************************************************
+/* Converting a unit *******************************************************
 // **************************************************************************
 */
 
-void
-convert_systemd_units [[gnu::noreturn]] (
-	const char * & /*next_prog*/,
-	std::vector<const char *> & args,
-	ProcessEnvironment & envs
-) {
-	const char * prog(basename_of(args[0]));
-	std::string bundle_root;
-	bool escape_instance(false), escape_prefix(false), account_escape(false), etc_bundle(false), local_bundle(false), supervise_in_run(false), systemd_quirks(true), generation_comment(true);
-	try {
-		const char * bundle_root_str(nullptr);
-		bool no_systemd_quirks(false), no_generation_comment(false);
-
-		popt::bool_definition user_option('u', "user", "Create a bundle that runs under the per-user manager.", per_user_mode);
-		popt::string_definition bundle_option('\0', "bundle-root", "directory", "Root directory for bundles.", bundle_root_str);
-		popt::bool_definition escape_instance_option('\0', "escape-instance", "Escape the instance part of a template instantiation.", escape_instance);
-		popt::bool_definition escape_prefix_option('\0', "escape-prefix", "Escape the prefix part of a template instantiation.", escape_prefix);
-		escape_format_definition escape_format_option('\0', "escape-format", "Select the escape algorithm.", account_escape);
-		popt::bool_definition etc_bundle_option('\0', "etc-bundle", "Consider this service to live in /etc/service-bundles/ with relative paths to mount services.", etc_bundle);
-		popt::bool_definition local_bundle_option('\0', "local-bundle", "Consider this service to live in a service bundle area like /var/local/sv/ with no relative paths.", local_bundle);
-		popt::bool_definition supervise_in_run_option('\0', "supervise-in-run", "Arrange for a supervise directory under /run/service-bundles/early-supervise/.", supervise_in_run);
-		popt::bool_definition no_systemd_quirks_option('\0', "no-systemd-quirks", "Turn off systemd quirks.", no_systemd_quirks);
-		popt::bool_definition no_generation_comment_option('\0', "no-generation-comment", "Turn off the comment that mentions the source file.", no_generation_comment);
-		popt::definition * main_table[] = {
-			&user_option,
-			&bundle_option,
-			&escape_instance_option,
-			&escape_prefix_option,
-			&escape_format_option,
-			&etc_bundle_option,
-			&local_bundle_option,
-			&supervise_in_run_option,
-			&no_systemd_quirks_option,
-			&no_generation_comment_option
-		};
-		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "{unit}");
-
-		std::vector<const char *> new_args;
-		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
-		p.process(true /* strictly options before arguments */);
-		args = new_args;
-		if (p.stopped()) throw EXIT_SUCCESS;
-		if (bundle_root_str) bundle_root = bundle_root_str + slash;
-		systemd_quirks = !no_systemd_quirks;
-		generation_comment = !no_generation_comment;
-	} catch (const popt::error & e) {
-		die(prog, envs, e);
-	}
+namespace {
 
-	if (args.empty()) {
-		die_missing_argument(prog, envs, "argument(s)");
-	}
+struct conversion_options {
+	conversion_options() : bundle_root(), escape_instance(false), escape_prefix(false), account_escape(false), etc_bundle(false), local_bundle(false), supervise_in_run(false), systemd_quirks(true), generation_comment(true) {}
+	std::string bundle_root;
+	bool escape_instance, escape_prefix, account_escape, etc_bundle, local_bundle, supervise_in_run, systemd_quirks, generation_comment;
+};
 
-	struct names names(args.front());
+void
+convert_unit (
+	const char * prog,
+	const ProcessEnvironment & envs,
+	unit_cache & cache,
+	const conversion_options & options,
+	const char * unit
+) {
+	const std::string & bundle_root(options.bundle_root);
+	const bool escape_instance(options.escape_instance), escape_prefix(options.escape_prefix), account_escape(options.account_escape), etc_bundle(options.etc_bundle), local_bundle(options.local_bundle), supervise_in_run(options.supervise_in_run), systemd_quirks(options.systemd_quirks), generation_comment(options.generation_comment);
 
-	args.erase(args.begin());
-	if (!args.empty()) {
-		die_unexpected_argument(prog, args, envs);
-	}
+	struct names names(unit);
 
 	// Calculate the type of unit file and the output bundle basename.
 
@@ -1049,7 +1111,7 @@ convert_systemd_units [[gnu::noreturn]] (
 
 			std::string socket_unit_path(names.query_unit_dirname());
 			std::string socket_unit_base(prefix  + suffix);
-			FileStar socket_file(find(socket_unit_path, socket_unit_base));
+			FileStar socket_file(find(cache, socket_unit_path, socket_unit_base));
 			if (!socket_file) {
 				std::string::size_type atc(prefix.find('@'));
 				if (ENOENT == errno && std::string::npos != atc) {
@@ -1060,10 +1122,10 @@ convert_systemd_units [[gnu::noreturn]] (
 
 					socket_unit_path = names.query_unit_dirname();
 					socket_unit_base = prefix + "@" + suffix;
-					socket_file = find(socket_unit_path, socket_unit_base);
+					socket_file = find(cache, socket_unit_path, socket_unit_base);
 				}
 			}
-			load(prog, envs, socket_profile, socket_file, source_filenames, socket_filename, socket_unit_path, socket_unit_base, prefix, instance, suffix);
+			load(prog, envs, cache, socket_profile, socket_file, source_filenames, socket_filename, socket_unit_path, socket_unit_base, prefix, instance, suffix);
 
 			names.set_prefix(prefix, escape_prefix, account_escape);
 
@@ -1073,8 +1135,8 @@ convert_systemd_units [[gnu::noreturn]] (
 			std::string service_unit_path(names.query_unit_dirname());
 			std::string service_unit_base(prefix + std::string(is_socket_accept ? "@" : "") + ".service");
 			instance = "";
-			FileStar service_file(find(service_unit_path, service_unit_base));
-			load(prog, envs, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, ".service");
+			FileStar service_file(find(cache, service_unit_path, service_unit_base));
+			load(prog, envs, cache, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, ".service");
 		} else
 		if (is_timer_activated) {
 			const std::string suffix(".timer");
@@ -1082,7 +1144,7 @@ convert_systemd_units [[gnu::noreturn]] (
 
 			std::string timer_unit_path(names.query_unit_dirname());
 			std::string timer_unit_base(prefix + suffix);
-			FileStar timer_file(find(timer_unit_path, timer_unit_base));
+			FileStar timer_file(find(cache, timer_unit_path, timer_unit_base));
 			if (!timer_file) {
 				std::string::size_type atc(prefix.find('@'));
 				if (ENOENT == errno && std::string::npos != atc) {
@@ -1093,18 +1155,18 @@ convert_systemd_units [[gnu::noreturn]] (
 
 					timer_unit_path = names.query_unit_dirname();
 					timer_unit_base = prefix + "@.timer";
-					timer_file = find(timer_unit_path, timer_unit_base);
+					timer_file = find(cache, timer_unit_path, timer_unit_base);
 				}
 			}
-			load(prog, envs, timer_profile, timer_file, source_filenames, timer_filename, timer_unit_path, timer_unit_base, prefix, instance, suffix);
+			load(prog, envs, cache, timer_profile, timer_file, source_filenames, timer_filename, timer_unit_path, timer_unit_base, prefix, instance, suffix);
 
 			names.set_prefix(prefix, escape_prefix, account_escape);
 
 			std::string service_unit_path(names.query_unit_dirname());
 			std::string service_unit_base(prefix + ".service");
 			instance = "";
-			FileStar service_file(find(service_unit_path, service_unit_base));
-			load(prog, envs, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, ".service");
+			FileStar service_file(find(cache, service_unit_path, service_unit_base));
+			load(prog, envs, cache, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, ".service");
 		} else
 		{
 			const std::string suffix(is_target ? ".target" : ".service");
@@ -1112,7 +1174,7 @@ convert_systemd_units [[gnu::noreturn]] (
 
 			std::string service_unit_path(names.query_unit_dirname());
 			std::string service_unit_base(prefix + suffix);
-			FileStar service_file(find(service_unit_path, service_unit_base));
+			FileStar service_file(find(cache, service_unit_path, service_unit_base));
 			if (!service_file) {
 				std::string::size_type atc(prefix.find('@'));
 				if (ENOENT == errno && std::string::npos != atc) {
@@ -1123,10 +1185,10 @@ convert_systemd_units [[gnu::noreturn]] (
 
 					service_unit_path = names.query_unit_dirname();
 					service_unit_base = prefix + "@" + suffix;
-					service_file = find(service_unit_path, service_unit_base);
+					service_file = find(cache, service_unit_path, service_unit_base);
 				}
 			}
-			load(prog, envs, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, suffix);
+			load(prog, envs, cache, service_profile, service_file, source_filenames, service_filename, service_unit_path, service_unit_base, prefix, instance, suffix);
 
 			names.set_prefix(prefix, escape_prefix, account_escape);
 		}
@@ -2929,6 +2991,201 @@ convert_systemd_units [[gnu::noreturn]] (
 	report_unused(prog, socket_profile, socket_filename);
 	report_unused(prog, timer_profile, timer_filename);
 	report_unused(prog, service_profile, service_filename);
+}
+
+inline
+bool
+is_directory (
+	const char * name
+) {
+	struct stat s;
+	return 0 <= stat(name, &s) && S_ISDIR(s.st_mode);
+}
+
+/// The name of the bundle that a unit converts to, which is also the name that units are grouped by in a batch
+std::string
+bundle_name_of (
+	const std::string & unit_basename
+) {
+	std::string bundle_basename;
+	if (ends_in(unit_basename, ".target", bundle_basename)
+	||  ends_in(unit_basename, ".socket", bundle_basename)
+	||  ends_in(unit_basename, ".timer", bundle_basename)
+	||  ends_in(unit_basename, ".service", bundle_basename)
+	)
+		return bundle_basename;
+	return unit_basename;
+}
+
+/// The precedence of a unit in a directory when several of them convert to the same bundle; lower is better and 0 is not a unit at all.
+inline
+int
+unit_precedence (
+	const std::string & unit_basename
+) {
+	std::string bundle_basename;
+	if (ends_in(unit_basename, ".socket", bundle_basename)) return 1;
+	if (ends_in(unit_basename, ".timer", bundle_basename)) return 2;
+	if (ends_in(unit_basename, ".service", bundle_basename)) return 3;
+	if (ends_in(unit_basename, ".target", bundle_basename)) return 3;
+	return 0;
+}
+
+/// \brief Add all of the non-template units in a directory, a socket or timer unit being preferred to the service unit that it activates
+void
+add_directory_units (
+	const char * prog,
+	const ProcessEnvironment & envs,
+	std::list<std::string> & units,
+	const char * dir_name
+) {
+	FileDescriptorOwner dir_fd(open_dir_at(AT_FDCWD, dir_name));
+	if (0 > dir_fd.get()) {
+		die_errno(prog, envs, dir_name);
+	}
+	const DirStar dir(dir_fd);
+	if (!dir) {
+abort_scan:
+		die_errno(prog, envs, dir_name);
+	}
+	std::map<std::string, std::string> best;
+	for (;;) {
+		errno = 0;
+		const dirent * entry(readdir(dir));
+		if (!entry) {
+			if (errno) goto abort_scan;
+			break;
+		}
+		if ('.' == entry->d_name[0]) continue;
+		const std::string unit_basename(entry->d_name);
+		const int precedence(unit_precedence(unit_basename));
+		if (!precedence) continue;
+		const std::string bundle_basename(bundle_name_of(unit_basename));
+		// Templates are not converted without instances.
+		if (!bundle_basename.empty() && '@' == bundle_basename[bundle_basename.length() - 1]) continue;
+		std::string & b(best[bundle_basename]);
+		if (b.empty() || precedence < unit_precedence(b))
+			b = unit_basename;
+	}
+	const std::string d(ends_with(dir_name, "/") ? dir_name : dir_name + slash);
+	for (std::map<std::string, std::string>::const_iterator i(best.begin()); best.end() != i; ++i)
+		units.push_back(d + i->second);
+}
+
+struct unit_batch : public conversion_batch {
+	unit_batch(const char * p, const ProcessEnvironment & e, unit_cache & c, const conversion_options & o) : prog(p), envs(e), cache(c), options(o), units(), group_numbers() {}
+	void add(const std::string &);
+protected:
+	typedef std::map<std::string, std::size_t> group_map;
+	const char * prog;
+	const ProcessEnvironment & envs;
+	unit_cache & cache;
+	const conversion_options & options;
+	std::vector<std::string> units;
+	group_map group_numbers;
+
+	virtual void convert(std::size_t item);
+};
+
+void
+unit_batch::add (
+	const std::string & unit
+) {
+	std::string dirname, basename;
+	split_name(unit.c_str(), dirname, basename);
+	// Units that convert to the same bundle must not be converted simultaneously.
+	const group_map::value_type v(bundle_name_of(basename), group_numbers.size());
+	conversion_batch::add(group_numbers.insert(v).first->second);
+	units.push_back(unit);
+}
+
+void
+unit_batch::convert (
+	std::size_t item
+) {
+	convert_unit(prog, envs, cache, options, units[item].c_str());
+}
+
+}
+
+/* Main function ************************************************************
+// **************************************************************************
+*/
+
+void
+convert_systemd_units [[gnu::noreturn]] (
+	const char * & /*next_prog*/,
+	std::vector<const char *> & args,
+	ProcessEnvironment & envs
+) {
+	const char * prog(basename_of(args[0]));
+	conversion_options options;
+	unsigned long jobs(1U);
+	try {
+		const char * bundle_root_str(nullptr);
+		bool no_systemd_quirks(false), no_generation_comment(false);
+
+		popt::bool_definition user_option('u', "user", "Create a bundle that runs under the per-user manager.", per_user_mode);
+		popt::string_definition bundle_option('\0', "bundle-root", "directory", "Root directory for bundles.", bundle_root_str);
+		popt::bool_definition escape_instance_option('\0', "escape-instance", "Escape the instance part of a template instantiation.", options.escape_instance);
+		popt::bool_definition escape_prefix_option('\0', "escape-prefix", "Escape the prefix part of a template instantiation.", options.escape_prefix);
+		escape_format_definition escape_format_option('\0', "escape-format", "Select the escape algorithm.", options.account_escape);
+		popt::bool_definition etc_bundle_option('\0', "etc-bundle", "Consider this service to live in /etc/service-bundles/ with relative paths to mount services.", options.etc_bundle);
+		popt::bool_definition local_bundle_option('\0', "local-bundle", "Consider this service to live in a service bundle area like /var/local/sv/ with no relative paths.", options.local_bundle);
+		popt::bool_definition supervise_in_run_option('\0', "supervise-in-run", "Arrange for a supervise directory under /run/service-bundles/early-supervise/.", options.supervise_in_run);
+		popt::bool_definition no_systemd_quirks_option('\0', "no-systemd-quirks", "Turn off systemd quirks.", no_systemd_quirks);
+		popt::bool_definition no_generation_comment_option('\0', "no-generation-comment", "Turn off the comment that mentions the source file.", no_generation_comment);
+		popt::unsigned_number_definition jobs_option('j', "jobs", "number", "Convert a batch of units with this many worker processes.", jobs, 0);
+		popt::definition * main_table[] = {
+			&user_option,
+			&bundle_option,
+			&escape_instance_option,
+			&escape_prefix_option,
+			&escape_format_option,
+			&etc_bundle_option,
+			&local_bundle_option,
+			&supervise_in_run_option,
+			&no_systemd_quirks_option,
+			&no_generation_comment_option,
+			&jobs_option
+		};
+		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "{unit|directory}...");
+
+		std::vector<const char *> new_args;
+		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
+		p.process(true /* strictly options before arguments */);
+		args = new_args;
+		if (p.stopped()) throw EXIT_SUCCESS;
+		if (bundle_root_str) options.bundle_root = bundle_root_str + slash;
+		options.systemd_quirks = !no_systemd_quirks;
+		options.generation_comment = !no_generation_comment;
+	} catch (const popt::error & e) {
+		die(prog, envs, e);
+	}
+
+	if (args.empty()) {
+		die_missing_argument(prog, envs, "argument(s)");
+	}
+
+
+	unit_cache cache;
+
+	// A single unit is converted exactly as it always has been, with its exit status.
+	if (1U == args.size() && !is_directory(args.front())) {
+		convert_unit(prog, envs, cache, options, args.front());
+		throw EXIT_SUCCESS;
+	}
+
+	std::list<std::string> units;
+	for (std::vector<const char *>::const_iterator i(args.begin()); args.end() != i; ++i) {
+		if (is_directory(*i))
+			add_directory_units(prog, envs, units, *i);
+		else
+			units.push_back(*i);
+	}
+	unit_batch batch(prog, envs, cache, options);
+	for (std::list<std::string>::const_iterator i(units.begin()); units.end() != i; ++i)
+		batch.add(*i);
 
-	throw EXIT_SUCCESS;
+	throw batch.run(prog, jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -5,6 +5,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <algorithm>
 #include <iostream>
@@ -25,6 +26,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "service-manager-client.h"
 #include "popt.h"
 #include "FileStar.h"
+#include "ChunkedReader.h"
 #include "FileDescriptorOwner.h"
 #include "DirStar.h"
 #include "terminal_database.h"
@@ -189,13 +191,15 @@ rcconf_filev = default_rcconf_files;
 std::size_t
 rcconf_filec = sizeof default_rcconf_files/sizeof *default_rcconf_files;
 
+/// rc.conf settings, keyed by variable name, holding the first value found for each
+typedef std::unordered_map<std::string, std::string> rcconf_settings;
+
 inline
-bool
-scan_rcconf_file (
-	bool & wants_enable,	///< only set to a value when true is returned
+void
+load_rcconf_file (
+	rcconf_settings & settings,
 	const char * prog,
 	const ProcessEnvironment & envs,
-	const std::string & wanted,
 	const FileStar & f,
 	const std::string & rcconf_file
 ) {
@@ -204,24 +208,19 @@ scan_rcconf_file (
 		const std::string & s(*j);
 		const std::string::size_type p(s.find('='));
 		const std::string var(s.substr(0, p));
-		if (var == wanted) {
-			const std::string val(p == std::string::npos ? std::string() : s.substr(p + 1, std::string::npos));
-			wants_enable = checkyesno(val);
-			return true;
-		}
+		const std::string val(p == std::string::npos ? std::string() : s.substr(p + 1, std::string::npos));
+		// Earlier files, and earlier settings within a file, take precedence.
+		settings.insert(rcconf_settings::value_type(var, val));
 	}
-	return false;
 }
 
 inline
-bool	/// \returns setting \retval true explicit \retval false defaulted
-query_rcconf_preset (
-	bool & wants_enable,	///< only set to a value when true is returned
+void
+load_rcconf_presets (
+	rcconf_settings & settings,
 	const char * prog,
-	const ProcessEnvironment & envs,
-	const std::string & name
+	const ProcessEnvironment & envs
 ) {
-	const std::string wanted(name + "_enable");
 	if (per_user_mode) {
 		const std::string h(effective_user_home_dir(envs));
 		const std::string
@@ -231,23 +230,32 @@ query_rcconf_preset (
 		for (const std::string * q(user_rcconf_files); q < user_rcconf_files + sizeof user_rcconf_files/sizeof *user_rcconf_files; ++q) {
 			const FileStar f(std::fopen(q->c_str(), "r"));
 			if (!f) continue;
-			if (scan_rcconf_file(wants_enable, prog, envs, wanted, f, *q))
-				return true;
+			load_rcconf_file(settings, prog, envs, f, *q);
 		}
 	} else {
 		if (const FileStar f = std::fopen(amalgamated_rc_conf_file, "r")) {
-			if (scan_rcconf_file(wants_enable, prog, envs, wanted, f, amalgamated_rc_conf_file))
-				return true;
+			load_rcconf_file(settings, prog, envs, f, amalgamated_rc_conf_file);
 		} else
 		for (size_t i(0); i < rcconf_filec; ++i) {
 			const std::string rcconf_file(rcconf_filev[i]);
 			const FileStar rf(std::fopen(rcconf_file.c_str(), "r"));
 			if (!rf) continue;
-			if (scan_rcconf_file(wants_enable, prog, envs, wanted, rf, rcconf_file))
-				return true;
+			load_rcconf_file(settings, prog, envs, rf, rcconf_file);
 		}
 	}
-	return false;
+}
+
+inline
+bool	/// \returns setting \retval true explicit \retval false defaulted
+query_rcconf_preset (
+	bool & wants_enable,	///< only set to a value when true is returned
+	const rcconf_settings & settings,
+	const std::string & name
+) {
+	const rcconf_settings::const_iterator i(settings.find(name + "_enable"));
+	if (settings.end() == i) return false;
+	wants_enable = checkyesno(i->second);
+	return true;
 }
 
 inline
@@ -371,44 +379,49 @@ matches (
 	}
 }
 
+/// One enable or disable line from a preset file.
+struct preset_rule {
+	preset_rule(bool e, const std::string & p) : enable(e), pattern(p) {}
+	bool enable;
+	std::string pattern;
+};
+typedef std::vector<preset_rule> preset_rules;
+
+inline
 bool
-scan (
-	const std::string & name,
-	const std::string & suffix,
-	FILE * file,
-	bool & wants_enable
+is_wildcard (
+	const std::string & pattern
 ) {
-	for (std::string line; read_line(file, line); ) {
+	return std::string::npos != pattern.find_first_of("*?[\\");
+}
+
+void
+load_preset_file (
+	preset_rules & rules,
+	FILE * file
+) {
+	ChunkedReader r(fileno(file));
+	for (std::string line; read_line(r, line); ) {
 		line = ltrim(line);
 		if (line.length() < 1) continue;
 		if ('#' == line[0] || ';' == line[0]) continue;
 		std::string remainder;
-		if (begins_with(line, "enable", remainder) && initial_space(remainder)) {
-			remainder = rtrim(ltrim(remainder));
-			if (matches(remainder, name, suffix)) {
-				wants_enable = true;
-				return true;
-			}
-		} else
-		if (begins_with(line, "disable", remainder) && initial_space(remainder)) {
-			remainder = rtrim(ltrim(remainder));
-			if (matches(remainder, name, suffix)) {
-				wants_enable = false;
-				return true;
-			}
-		}
+		if (begins_with(line, "enable", remainder) && initial_space(remainder))
+			rules.push_back(preset_rule(true, rtrim(ltrim(remainder))));
+		else
+		if (begins_with(line, "disable", remainder) && initial_space(remainder))
+			rules.push_back(preset_rule(false, rtrim(ltrim(remainder))));
 	}
-	return false;
 }
 
+/// Preset files by name, each holding the rules from all same-named files in precedence order of directory
+typedef std::map<std::string, preset_rules> preset_files;
+
 inline
 void
-scan_preset_files (
-	std::string & earliest,
-	const std::string & preset_dir_name,
-	const std::string & name,
-	const std::string & suffix,
-	bool & wants_enable
+load_preset_files (
+	preset_files & files,
+	const std::string & preset_dir_name
 ) {
 	FileDescriptorOwner preset_dir_fd(open_dir_at(AT_FDCWD, preset_dir_name.c_str()));
 	if (preset_dir_fd.get() < 0) return;
@@ -424,15 +437,11 @@ scan_preset_files (
 #if defined(_DIRENT_HAVE_D_TYPE)
 		if (DT_REG != entry->d_type && DT_LNK != entry->d_type) continue;
 #endif
-		const std::string d_name(entry->d_name);
-		if (!earliest.empty() && earliest <= d_name) continue;
-		const std::string p(preset_dir_name + d_name);
 		const int f(open_read_at(preset_dir.fd(), entry->d_name));
 		if (0 > f) continue;
 		FileStar preset_file(fdopen(f, "rt"));
 		if (!preset_file) continue;
-		if (scan(name, suffix, preset_file, wants_enable))
-			earliest = d_name;
+		load_preset_file(files[entry->d_name], preset_file);
 	}
 }
 
@@ -454,15 +463,28 @@ preset_directories[] = {
 	"/lib/systemd/system-preset/",		// mis-use of lib by systemd
 };
 
-inline
-bool	/// \returns setting \retval true explicit \retval false defaulted
-query_systemd_preset (
-	bool & wants_enable,	///< only set to a value when true is returned
-	const ProcessEnvironment & envs,
-	const std::string & name,
-	const std::string & suffix
+/// \brief All of the preset files, compiled into a single ordered list of rules where the first matching rule wins
+/// Rules come from the lexically earliest file name first, and for the same name from the highest precedence directory first.
+/// Rules with literal patterns are indexed by pattern, so that only the rules with genuine wildcards have to be tried one by one.
+class systemd_presets {
+public:
+	systemd_presets() : rules(), wildcards(), literals() {}
+	void load(const ProcessEnvironment & envs);
+	bool query(bool & wants_enable, const std::string & name, const std::string & suffix) const;
+protected:
+	typedef std::unordered_map<std::string, std::size_t> literal_map;
+	preset_rules rules;
+	std::vector<std::size_t> wildcards;	///< indices into rules, in order
+	literal_map literals;	///< the first rule for each literal pattern
+
+	void find_literal(std::size_t & best, const std::string & pattern) const;
+};
+
+void
+systemd_presets::load (
+	const ProcessEnvironment & envs
 ) {
-	std::string earliest;
+	preset_files files;
 	if (per_user_mode) {
 		const std::string h(effective_user_home_dir(envs));
 		const std::string
@@ -485,29 +507,92 @@ query_systemd_preset (
 			"/lib/systemd/user-preset/",		// mis-use of lib by systemd
 		};
 		for (const std::string * q(user_preset_directories); q < user_preset_directories + sizeof user_preset_directories/sizeof *user_preset_directories; ++q)
-			scan_preset_files (earliest, *q, name, suffix, wants_enable);
+			load_preset_files(files, *q);
 	} else {
 		for (size_t i(0); i < sizeof preset_directories/sizeof *preset_directories; ++i)
-			scan_preset_files (earliest, preset_directories[i], name, suffix, wants_enable);
+			load_preset_files(files, preset_directories[i]);
+	}
+	for (preset_files::const_iterator f(files.begin()); files.end() != f; ++f)
+		rules.insert(rules.end(), f->second.begin(), f->second.end());
+	for (std::size_t i(0U); i < rules.size(); ++i) {
+		if (is_wildcard(rules[i].pattern))
+			wildcards.push_back(i);
+		else
+			literals.insert(literal_map::value_type(rules[i].pattern, i));
 	}
-	return !earliest.empty();
+}
+
+inline
+void
+systemd_presets::find_literal (
+	std::size_t & best,
+	const std::string & pattern
+) const {
+	const literal_map::const_iterator i(literals.find(pattern));
+	if (literals.end() != i && i->second < best)
+		best = i->second;
+}
+
+/// \returns setting \retval true explicit \retval false defaulted
+bool
+systemd_presets::query (
+	bool & wants_enable,	///< only set to a value when true is returned
+	const std::string & name,
+	const std::string & suffix
+) const {
+	// These are exactly the literal patterns that matches() would match against name.
+	std::size_t best(rules.size());
+	std::string base;
+	if (suffix.empty()) {
+		find_literal(best, name + ".target");
+		find_literal(best, name + ".service");
+		find_literal(best, name + ".socket");
+		find_literal(best, name + ".timer");
+		if (!ends_in(name, ".target", base) && !ends_in(name, ".service", base) && !ends_in(name, ".socket", base) && !ends_in(name, ".timer", base))
+			find_literal(best, name);
+	} else {
+		find_literal(best, name + suffix);
+		if (!ends_in(name, suffix, base))
+			find_literal(best, name);
+	}
+	for (std::vector<std::size_t>::const_iterator i(wildcards.begin()); wildcards.end() != i && *i < best; ++i) {
+		const preset_rule & rule(rules[*i]);
+		if (matches(rule.pattern, name, suffix)) {
+			wants_enable = rule.enable;
+			return true;
+		}
+	}
+	if (best >= rules.size()) return false;
+	wants_enable = rules[best].enable;
+	return true;
+}
+
+/// ttys settings, keyed by terminal name, holding whether the first entry for each is on
+typedef std::unordered_map<std::string, bool> ttys_settings;
+
+inline
+bool	/// \returns whether there is a ttys file
+load_ttys_presets (
+	ttys_settings & settings
+) {
+	if (!setttyent()) return false;
+	while (const struct ttyent *entry = getttyent())
+		settings.insert(ttys_settings::value_type(entry->ty_name, is_on(*entry)));
+	endttyent();
+	return true;
 }
 
 inline
 bool	/// \returns setting \retval true explicit \retval false defaulted
 query_ttys_preset (
 	bool & wants_enable,	///< always set to a value
+	const ttys_settings & settings,
 	const std::string & name
 ) {
-	if (!setttyent()) {
-		// A missing ttys file causes a default preset of disabled.
-		wants_enable = false;
-		return false;
-	}
-	const struct ttyent *entry(getttynam(name.c_str()));
-	wants_enable = entry && is_on(*entry);
-	endttyent();
-	return entry != nullptr;
+	// A missing ttys file causes a default preset of disabled, as does a missing entry.
+	const ttys_settings::const_iterator i(settings.find(name));
+	wants_enable = settings.end() != i && i->second;
+	return settings.end() != i;
 }
 
 inline
@@ -557,45 +642,86 @@ is_auto (
 	return !has_option(options, "noauto");
 }
 
+/// fstab settings, keyed by mount point and separately by device, holding whether the first entry for each is automatic
+struct fstab_settings {
+	fstab_settings() : files(), specs() {}
+	typedef std::unordered_map<std::string, bool> map;
+	map files, specs;
+};
+
+inline
+void
+load_fstab_presets (
+	fstab_settings & settings
+) {
+	// A missing fstab does not cause a default preset.
+	if (!setfsent()) return;
+	while (const struct fstab *entry = getfsent()) {
+		const bool a(is_auto(*entry));
+		settings.files.insert(fstab_settings::map::value_type(entry->fs_file, a));
+		settings.specs.insert(fstab_settings::map::value_type(entry->fs_spec, a));
+	}
+	endfsent();
+}
+
 inline
 bool	/// \returns setting \retval true explicit \retval false defaulted
 query_fstab_preset (
 	bool & wants_enable,	///< only set to a value when true is returned
+	const fstab_settings & settings,
 	const std::string & escaped_name
 ) {
-	// A missing fstab does not cause a default preset.
-	if (!setfsent()) return false;
 	const std::string name(unescape(escaped_name));
-	const struct fstab *entry(getfsfile(name.c_str()));
-	if (!entry) entry = getfsspec(name.c_str());
-	if (entry) wants_enable = is_auto(*entry);
-	endfsent();
-	return entry != nullptr;
+	fstab_settings::map::const_iterator i(settings.files.find(name));
+	if (settings.files.end() == i) {
+		i = settings.specs.find(name);
+		if (settings.specs.end() == i) return false;
+	}
+	wants_enable = i->second;
+	return true;
+}
+
+/// \brief Everything that determines presets, loaded once and then queried for each bundle
+struct preset_database {
+	preset_database(bool s, bool r, bool t, bool f) : system(s), rcconf(r), ttys(t), fstab(f), systemd(), rcconf_vars(), ttys_entries(), fstab_entries() {}
+	const bool system, rcconf, ttys, fstab;
+	systemd_presets systemd;
+	rcconf_settings rcconf_vars;
+	ttys_settings ttys_entries;
+	fstab_settings fstab_entries;
+
+	void load(const char * prog, const ProcessEnvironment & envs);
+};
+
+void
+preset_database::load (
+	const char * prog,
+	const ProcessEnvironment & envs
+) {
+	if (system) systemd.load(envs);
+	if (rcconf) load_rcconf_presets(rcconf_vars, prog, envs);
+	if (ttys) load_ttys_presets(ttys_entries);
+	if (fstab) load_fstab_presets(fstab_entries);
 }
 
 inline
 bool
 determine_preset (
-	const char * prog,
-	const ProcessEnvironment & envs,
-	bool system,
-	bool rcconf,
-	bool ttys,
-	bool fstab,
+	const preset_database & presets,
 	const std::string & prefix,
 	const std::string & name,
 	const std::string & suffix
 ) {
 	bool wants_enable(false);
 	// systemd (and system-manager) settings take precedence over compatibility ones.
-	if (system && query_systemd_preset(wants_enable, envs, prefix + name, suffix))
+	if (presets.system && presets.systemd.query(wants_enable, prefix + name, suffix))
 		return wants_enable;
 	// The newer BSD rc.conf takes precedence over the older Sixth Edition ttys .
-	if (rcconf && query_rcconf_preset(wants_enable, prog, envs, name))
+	if (presets.rcconf && query_rcconf_preset(wants_enable, presets.rcconf_vars, name))
 		return wants_enable;
-	if (ttys && query_ttys_preset(wants_enable, name))
+	if (presets.ttys && query_ttys_preset(wants_enable, presets.ttys_entries, name))
 		return wants_enable;
-	if (fstab && query_fstab_preset(wants_enable, name))
+	if (presets.fstab && query_fstab_preset(wants_enable, presets.fstab_entries, name))
 		return wants_enable;
 	return wants_enable;
 }
@@ -739,6 +865,9 @@ preset [[gnu::noreturn]] (
 		die(prog, envs, e);
 	}
 
+	preset_database presets(!no_system, !no_rcconf, ttys, fstab);
+	presets.load(prog, envs);
+
 	bool failed(false);
 	const std::string p(prefix);
 	for (std::vector<const char *>::const_iterator i(args.begin()); args.end() != i; ++i) {
@@ -750,7 +879,7 @@ preset [[gnu::noreturn]] (
 			failed = true;
 			continue;
 		}
-		const bool make(determine_preset(prog, envs, !no_system, !no_rcconf, ttys, fstab, p, name, suffix));
+		const bool make(determine_preset(presets, p, name, suffix));
 		if (dry_run)
 			std::fprintf(stdout, "%s %s\n", make ? "enable" : "disable", (path + p + name).c_str());
 		else
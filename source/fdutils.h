@@ -90,6 +90,16 @@ open_writetrunc_at (
 	return openat(fd, name, O_NOCTTY|O_CLOEXEC|O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK, mode);
 }
 
+extern inline
+int
+open_writecreateexclusive_at (
+	int fd,
+	const char * name,
+	int mode
+) {
+	return openat(fd, name, O_NOCTTY|O_CLOEXEC|O_WRONLY|O_CREAT|O_EXCL|O_NONBLOCK, mode);
+}
+
 extern inline
 int
 open_writetruncexisting_at (
@@ -9,8 +9,9 @@ For copyright and licensing terms, see the file named COPYING.
 #include <csignal>
 #include <cstring>
 #include <cerrno>
-#include <iostream>
-#include <ostream>
+#include <cstdio>
+#include <cstddef>
+#include <ctime>
 #include <sys/types.h>
 #if defined(__LINUX__) || defined(__linux__)
 #include "kqueue_linux.h"
@@ -28,20 +29,60 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
-static inline
+namespace {
+
+/// Kernel log text is read straight into the tail of a block buffer, which is written out whole.
+class Buffer
+{
+public:
+	Buffer() : buffer(SIZE), length(0U) {}
+	bool empty() const { return 0U == length; }
+	bool full() const { return buffer.size() - length < MINIMUM_ROOM; }
+	void read(const char * prog, int fifo_fd);
+	void flush(const char * prog);
+	const timespec & first_received() const { return first; }
+protected:
+	enum { SIZE = 256U * 1024U, MINIMUM_ROOM = 4U * 1024U };
+	std::vector<char> buffer;
+	std::size_t length;
+	timespec first;
+};
+
 void
-process_message (
+Buffer::read (
 	const char * prog,
 	int fifo_fd
 ) {
-	char msg[65536];
-	const int rc(read(fifo_fd, &msg, sizeof msg));
+	const int rc(::read(fifo_fd, buffer.data() + length, buffer.size() - length));
 	if (0 > rc) {
 		const int error(errno);
 		std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, "read", std::strerror(error));
 		return;
 	}
-	std::cout.write(msg, rc).flush();
+	if (empty() && 0 < rc)
+		clock_gettime(CLOCK_MONOTONIC, &first);
+	length += rc;
+}
+
+void
+Buffer::flush (
+	const char * prog
+) {
+	const char * p(buffer.data());
+	while (length) {
+		const ssize_t rc(write(STDOUT_FILENO, p, length));
+		if (0 > rc) {
+			const int error(errno);
+			if (EINTR == error) continue;
+			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, "write", std::strerror(error));
+			break;
+		}
+		p += rc;
+		length -= rc;
+	}
+	length = 0U;
+}
+
 }
 
 /* Main function ************************************************************
@@ -55,8 +96,13 @@ klog_read [[gnu::noreturn]] (
 	ProcessEnvironment & envs
 ) {
 	const char * prog(basename_of(args[0]));
+	unsigned long flush_latency(0UL);
 	try {
-		popt::top_table_definition main_option(0, nullptr, "Main options", "");
+		popt::unsigned_number_definition flush_latency_option('\0', "flush-latency", "milliseconds", "Allow output to be held back this long, to write it in larger blocks.", flush_latency, 0);
+		popt::definition * top_table[] = {
+			&flush_latency_option
+		};
+		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "");
 
 		std::vector<const char *> new_args;
 		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
@@ -99,20 +145,39 @@ klog_read [[gnu::noreturn]] (
 		}
 	}
 
+	Buffer buffer;
 	bool in_shutdown(false);
 	for (;;) {
 		try {
 			if (in_shutdown) break;
+			// Output is held back no longer than the flush latency after the first text that is waiting.
+			timespec timeout;
+			if (!buffer.empty()) {
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				const timespec & first(buffer.first_received());
+				const long long remaining(static_cast<long long>(flush_latency) * 1000000LL - ((now.tv_sec - first.tv_sec) * 1000000000LL + (now.tv_nsec - first.tv_nsec)));
+				if (0 >= remaining) {
+					buffer.flush(prog);
+					continue;
+				}
+				timeout.tv_sec = remaining / 1000000000LL;
+				timeout.tv_nsec = remaining % 1000000000LL;
+			}
 			struct kevent e;
-			if (0 > kevent(queue, nullptr, 0, &e, 1, nullptr)) {
+			const int rc(kevent(queue, nullptr, 0, &e, 1, buffer.empty() ? nullptr : &timeout));
+			if (0 > rc) {
 				if (EINTR == errno) continue;
 				die_errno(prog, envs, "kevent");
 			}
+			if (0 == rc) continue;
 			switch (e.filter) {
 				case EVFILT_READ:
-					if (LISTEN_SOCKET_FILENO <= static_cast<int>(e.ident) && LISTEN_SOCKET_FILENO + static_cast<int>(listen_fds) > static_cast<int>(e.ident))
-						process_message(prog, e.ident);
-					else
+					if (LISTEN_SOCKET_FILENO <= static_cast<int>(e.ident) && LISTEN_SOCKET_FILENO + static_cast<int>(listen_fds) > static_cast<int>(e.ident)) {
+						buffer.read(prog, e.ident);
+						if (0UL == flush_latency || buffer.full())
+							buffer.flush(prog);
+					} else
 						std::fprintf(stderr, "%s: DEBUG: read event ident %lu\n", prog, e.ident);
 					break;
 				case EVFILT_SIGNAL:
@@ -147,5 +212,7 @@ klog_read [[gnu::noreturn]] (
 			std::fprintf(stderr, "%s: ERROR: exception: %s\n", prog, e.what());
 		}
 	}
+	if (!buffer.empty())
+		buffer.flush(prog);
 	throw EXIT_SUCCESS;
 }
@@ -4,7 +4,9 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
-#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
@@ -14,6 +16,11 @@ For copyright and licensing terms, see the file named COPYING.
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <list>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <ctime>
 #include <inttypes.h>
 #include <unistd.h>
 #if defined(__FreeBSD__) || defined(__DragonFly__)
@@ -45,12 +52,124 @@ For copyright and licensing terms, see the file named COPYING.
 namespace {
 
 typedef std::list<std::string> FieldList;
-typedef std::map<std::string, std::string> ProcessRecord;
-typedef std::list<ProcessRecord> ProcessTable;
+
+/// \brief The process table, held as columns with one entry per process
+/// Only the fields that are to be output are kept, as columns of strings; every other field that is read is discarded.
+/// The process and parent process IDs are always kept, and are additionally held as integers for constructing the tree and selecting processes.
+class ProcessTable {
+public:
+	class Row;
+
+	explicit ProcessTable(const FieldList &);
+
+	std::size_t size() const { return pids.size(); }
+	void resize(std::size_t);
+	Row row(std::size_t);
+	void retain(const std::vector<char> &);
+	void index();
+
+	bool identified(std::size_t r) const { return identifieds[r]; }
+	pid_t pid(std::size_t r) const { return pids[r]; }
+	pid_t ppid(std::size_t r) const { return ppids[r]; }
+	const std::string & pid_string(std::size_t r) const { return columns[PID_COLUMN][r]; }
+	std::size_t output_column_count() const { return output_columns.size(); }
+	const std::string & output(std::size_t c, std::size_t r) const { return columns[output_columns[c]][r]; }
+protected:
+	enum { PID_COLUMN, PPID_COLUMN };
+	typedef std::unordered_map<std::string, std::size_t> ColumnIndex;
+	ColumnIndex column_for_field;
+	std::vector<std::size_t> output_columns;	///< the columns for the fields to be output, in output order
+	std::vector<std::vector<std::string> > columns;
+	std::vector<pid_t> pids, ppids;
+	std::vector<char> identifieds;	///< whether the process has both a process ID and a parent process ID
+};
+
+/// \brief A writer for the fields of one process in the table
+/// The set of columns is fixed when the table is constructed, so rows can be written concurrently by several threads.
+class ProcessTable::Row {
+public:
+	Row(ProcessTable & t, std::size_t r) : table(t), row(r) {}
+	std::string & operator[] (const std::string &);
+protected:
+	ProcessTable & table;
+	std::size_t row;
+	std::string discard;	///< where fields that are not kept are written
+};
+
+ProcessTable::ProcessTable(
+	const FieldList & fields
+) {
+	column_for_field["pid"] = PID_COLUMN;
+	column_for_field["ppid"] = PPID_COLUMN;
+	for (FieldList::const_iterator i(fields.begin()), e(fields.end()); i != e; ++i) {
+		const std::pair<ColumnIndex::iterator, bool> c(column_for_field.insert(ColumnIndex::value_type(*i, column_for_field.size())));
+		output_columns.push_back(c.first->second);
+	}
+	columns.resize(column_for_field.size());
+}
+
+void
+ProcessTable::resize(
+	std::size_t n
+) {
+	for (std::vector<std::vector<std::string> >::iterator c(columns.begin()), e(columns.end()); e != c; ++c)
+		c->resize(n);
+	pids.resize(n);
+	ppids.resize(n);
+	identifieds.resize(n);
+}
+
+inline
+ProcessTable::Row
+ProcessTable::row(
+	std::size_t r
+) {
+	return Row(*this, r);
+}
+
+/// Keep only the rows that are flagged, closing up the gaps in every column.
+void
+ProcessTable::retain(
+	const std::vector<char> & keep
+) {
+	std::size_t n(0U);
+	for (std::size_t r(0U); r < size(); ++r) {
+		if (!keep[r]) continue;
+		if (n != r)
+			for (std::vector<std::vector<std::string> >::iterator c(columns.begin()), e(columns.end()); e != c; ++c)
+				(*c)[n].swap((*c)[r]);
+		++n;
+	}
+	resize(n);
+}
+
+/// Convert the process and parent process IDs of every row to integers, in one pass once the rows have been written.
+void
+ProcessTable::index()
+{
+	for (std::size_t r(0U); r < size(); ++r) {
+		const std::string & pid(columns[PID_COLUMN][r]), & ppid(columns[PPID_COLUMN][r]);
+		identifieds[r] = !pid.empty() && !ppid.empty();
+		pids[r] = identifieds[r] ? pid_t(val(pid)) : -1;
+		ppids[r] = identifieds[r] ? pid_t(val(ppid)) : -1;
+	}
+}
+
+std::string &
+ProcessTable::Row::operator[] (
+	const std::string & name
+) {
+	const ColumnIndex::const_iterator c(table.column_for_field.find(name));
+	if (table.column_for_field.end() == c) {
+		discard.clear();
+		return discard;
+	}
+	return table.columns[c->second][row];
+}
 
 struct wanted {
-	wanted() : auxv(false), cmdline(false), environ(false), cwd(false), root(false), stat(false), cpuset(false) {}
-	bool auxv, cmdline, environ, cwd, root, stat, statm, status, cpuset;
+	wanted() : auxv(false), cmdline(false), environ(false), cwd(false), root(false), stat(true), cpuset(false) {}
+	bool auxv, cmdline, environ, cwd, root, stat, cpuset;
 } ;
 
 wanted
@@ -63,11 +182,8 @@ CheckFields (
 		if (!w.cmdline && "args" == *i) w.cmdline = true;
 		if (!w.environ && "envs" == *i) w.environ = true;
 		if (!w.cwd && "cwd" == *i) w.cwd = true;
-		if (!w.root && "root" == *i) w.cwd = true;
-		// FIXME: Be more specific here.
-		if (!w.stat) w.stat = true;
-		if (!w.statm) w.statm = true;
-		if (!w.status) w.status = false;
+		if (!w.root && "root" == *i) w.root = true;
+		// stat is always wanted, as the tree cannot be constructed without the parent process IDs that come from it.
 		if (!w.cpuset && ("csid" == *i || "rcsid" == *i || "csmask" == *i)) w.cpuset = true;
 	}
 	return w;
@@ -477,7 +593,7 @@ cpustr (
 inline
 void
 populate_record (
-	ProcessRecord & b,
+	ProcessTable::Row & b,
 	const kinfo_proc & k,
 	const char * time_format
 ) {
@@ -637,7 +753,7 @@ void
 populate_cpuset (
 	const char * prog,
 	const ProcessEnvironment & envs,
-	ProcessRecord & b,
+	ProcessTable::Row & b,
 	bool threads,
 	const kinfo_proc & k
 ) {
@@ -662,7 +778,9 @@ read_table (
 	const ProcessEnvironment & envs,
 	const FieldList & fields,
 	bool threads,
-	const char * time_format
+	const char * time_format,
+	unsigned long /*jobs*/,
+	bool /*verbose*/
 ) {
 	const int oid[3] = {
 		CTL_KERN,
@@ -687,7 +805,7 @@ read_table (
 	}
 
 	const wanted w(CheckFields(fields));
-	ProcessTable r;
+	ProcessTable r(fields);
 	for (const kinfo_proc * k(reinterpret_cast<const kinfo_proc *>(buf)),
 			* e(reinterpret_cast<const kinfo_proc *>(buf + len));
 	     k < e;
@@ -696,8 +814,8 @@ read_table (
 			std::fprintf(stderr, "%s: FATAL: Mismatch between kernel struct size %d and library header struct size %zu; application should be built with correct library.\n", prog, k->ki_structsize, sizeof *k);
 			throw EXIT_FAILURE;
 		}
-		r.push_back(ProcessRecord());
-		ProcessRecord & b(r.back());
+		r.resize(r.size() + 1U);
+		ProcessTable::Row b(r.row(r.size() - 1U));
 		populate_record(b, *k, time_format);
 		if (w.cmdline)
 			b["args"] = getprocargs(prog, envs, k->ki_pid);
@@ -708,6 +826,7 @@ read_table (
 	}
 	delete[] buf;
 
+	r.index();
 	return r;
 }
 
@@ -810,7 +929,7 @@ getprocenvs (
 inline
 void
 populate_record (
-	ProcessRecord & b,
+	ProcessTable::Row & b,
 	const kinfo_proc2 & k,
 	const char * time_format
 ) {
@@ -899,7 +1018,9 @@ read_table (
 	const ProcessEnvironment & envs,
 	const FieldList & fields,
 	bool /*threads*/,
-	const char * time_format
+	const char * time_format,
+	unsigned long /*jobs*/,
+	bool /*verbose*/
 ) {
 	int oid[6] = {
 		CTL_KERN,
@@ -928,13 +1049,13 @@ read_table (
 	}
 
 	const wanted w(CheckFields(fields));
-	ProcessTable r;
+	ProcessTable r(fields);
 	for (const kinfo_proc2 * k(reinterpret_cast<const kinfo_proc2 *>(buf)),
 			* e(reinterpret_cast<const kinfo_proc2 *>(buf + len));
 	     k < e;
 	     ++k) {
-		r.push_back(ProcessRecord());
-		ProcessRecord & b(r.back());
+		r.resize(r.size() + 1U);
+		ProcessTable::Row b(r.row(r.size() - 1U));
 		populate_record(b, *k, time_format);
 		if (w.cmdline)
 			b["args"] = getprocargs(prog, envs, k->p_pid);
@@ -943,6 +1064,7 @@ read_table (
 	}
 	delete[] buf;
 
+	r.index();
 	return r;
 }
 
@@ -1030,18 +1152,89 @@ read_environ_file (
 	return r;
 }
 
-std::string
-GetField (
-	FILE * f
+/// The kinds of /proc file that are read, for cost accounting.
+enum { DIRECTORY, STAT, CMDLINE, ENVIRON, FILE_KINDS };
+const char * const file_kind_names[FILE_KINDS] = { "directory", "stat", "cmdline", "environ" };
+
+struct scan_costs {
+	scan_costs() { for (std::size_t i(0U); i < FILE_KINDS; ++i) { count[i] = 0UL; nanoseconds[i] = 0ULL; } }
+	unsigned long count[FILE_KINDS];
+	unsigned long long nanoseconds[FILE_KINDS];
+	void add(const scan_costs & o) { for (std::size_t i(0U); i < FILE_KINDS; ++i) { count[i] += o.count[i]; nanoseconds[i] += o.nanoseconds[i]; } }
+} ;
+
+/// Charge the time from construction to destruction to one kind of file, if accounting is turned on.
+class CostTimer
+{
+public:
+	CostTimer(scan_costs * c, std::size_t k) : costs(c), kind(k) { if (costs) clock_gettime(CLOCK_MONOTONIC, &start); }
+	~CostTimer() {
+		if (!costs) return;
+		timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		++costs->count[kind];
+		costs->nanoseconds[kind] += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	}
+protected:
+	scan_costs * const costs;
+	const std::size_t kind;
+	timespec start;
+private:
+	CostTimer(const CostTimer &);
+	CostTimer & operator = (const CostTimer &);
+};
+
+/// Read a whole small file in one go, rather than a character at a time through stdio.
+bool
+read_small_file (
+	int fd,
+	std::string & r
 ) {
-	std::string s;
+	char buf[4096];
 	for (;;) {
-		const int c(std::fgetc(f));
-		if (std::feof(f)) break;
-		if (std::isspace(c)) break;
-		s += char(c);
+		const ssize_t n(read(fd, buf, sizeof buf));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			return false;
+		}
+		if (0 == n) return true;
+		r.append(buf, n);
+	}
+}
+
+/// The fields of the stat file, in order, after the process ID and the command name, which are handled specially.
+/// Empty names are fields that are skipped.
+const char * const stat_field_names[] = {
+	"state", "ppid", "pgid", "sid", "tdev", "tpgid", "flags",
+	"minflt", "cminflt", "majflt", "cmajflt",
+	"usertime", "systime", "cusertime", "csystime",
+	"pri", "nice", "", "itrealvalue", "start",
+	"vsz", "rss", "rlim", "startcode", "endcode", "startstack", "kstkesp", "kstkeip",
+	"signal", "blocked", "sigignore", "sigcatch", "wchan", "nswap", "cnswap",
+	"exitsignal", "processor", "rt_priority", "policy",
+};
+
+/// Split a stat file into fields.
+/// The command name is delimited by the first opening and the last closing parenthesis, as it can itself contain spaces and parentheses.
+void
+parse_stat (
+	const std::string & stat,
+	ProcessTable::Row & b
+) {
+	const std::string::size_type open(stat.find('(')), close(stat.rfind(')'));
+	if (std::string::npos == open || std::string::npos == close || close < open) return;
+	std::string::size_type q(stat.find_first_not_of(' '));
+	b["stat_pid"] = stat.substr(q, stat.find(' ', q) - q);
+	b["command"] = b["comm"] = stat.substr(open, close - open + 1U); // including the brackets
+	q = close + 1U;
+	for (std::size_t i(0U); i < sizeof stat_field_names/sizeof *stat_field_names; ++i) {
+		q = stat.find_first_not_of(" \n", q);
+		if (std::string::npos == q) break;
+		const std::string::size_type e(stat.find_first_of(" \n", q));
+		if (*stat_field_names[i])
+			b[stat_field_names[i]] = stat.substr(q, e - q);
+		q = e;
 	}
-	return s;
 }
 
 bool
@@ -1051,9 +1244,11 @@ populate_record (
 	const char * subdir,
 	const FileDescriptorOwner & proc_subdir_fd,
 	const wanted & w,
-	ProcessRecord & b
+	scan_costs * costs,
+	ProcessTable::Row & b
 ) {
 	if (w.environ) {
+		const CostTimer timer(costs, ENVIRON);
 		FileDescriptorOwner environ_fd(open_read_at(proc_subdir_fd.get(), "environ"));
 		if (0 > environ_fd.get()) {
 			if (EACCES == errno || EPERM == errno) {
@@ -1064,6 +1259,7 @@ populate_record (
 			b["envs"] = read_environ_file(prog, envs, procdir, subdir, "environ", environ_fd);
 	}
 	if (w.cmdline) {
+		const CostTimer timer(costs, CMDLINE);
 		FileDescriptorOwner cmdline_fd(open_read_at(proc_subdir_fd.get(), "cmdline"));
 		if (0 > cmdline_fd.get()) {
 			if (EACCES == errno || EPERM == errno) {
@@ -1074,111 +1270,91 @@ populate_record (
 			b["args"] = read_cmdline_file(prog, envs, procdir, subdir, "cmdline", cmdline_fd);
 	}
 	if (w.stat) {
-		FileDescriptorOwner stat_fd(open_read_at(proc_subdir_fd.get(), "stat"));
-		if (0 > stat_fd.get()) {
-	bad_stat_file:
-			if (ENOENT == errno) return false;
+		const CostTimer timer(costs, STAT);
+		const FileDescriptorOwner stat_fd(open_read_at(proc_subdir_fd.get(), "stat"));
+		std::string stat;
+		if (0 > stat_fd.get() || !read_small_file(stat_fd.get(), stat)) {
+			// The process can terminate after its directory has been opened.
+			if (ENOENT == errno || ESRCH == errno) return false;
 			die_errno(prog, envs, procdir, subdir, "stat");
 		}
-		FileStar stat_file(fdopen(stat_fd.get(), "r"));
-		if (!stat_file) goto bad_stat_file;
-		stat_fd.release();
-		b["stat_pid"] = GetField(stat_file);
-		b["command"] = b["comm"] = GetField(stat_file); // including the brackets
-		b["state"] = GetField(stat_file);
-		b["ppid"] = GetField(stat_file);
-		b["pgid"] = GetField(stat_file);
-		b["sid"] = GetField(stat_file);
-		b["tdev"] = GetField(stat_file); //tty
-		b["tpgid"] = GetField(stat_file);
-		b["flags"] = GetField(stat_file);
-		b["minflt"] = GetField(stat_file);
-		b["cminflt"] = GetField(stat_file);
-		b["majflt"] = GetField(stat_file);
-		b["cmajflt"] = GetField(stat_file);
-		b["usertime"] = GetField(stat_file); //utime
-		b["systime"] = GetField(stat_file); //stime
-		b["cusertime"] = GetField(stat_file); //cutime
-		b["csystime"] = GetField(stat_file); //cstime
-		b["pri"] = GetField(stat_file); //priority
-		b["nice"] = GetField(stat_file);
-		GetField(stat_file);
-		b["itrealvalue"] = GetField(stat_file);
-		b["start"] = GetField(stat_file);
-		b["vsz"] = GetField(stat_file); //vsize
-		b["rss"] = GetField(stat_file);
-		b["rlim"] = GetField(stat_file);
-		b["startcode"] = GetField(stat_file);
-		b["endcode"] = GetField(stat_file);
-		b["startstack"] = GetField(stat_file);
-		b["kstkesp"] = GetField(stat_file);
-		b["kstkeip"] = GetField(stat_file);
-		b["signal"] = GetField(stat_file);
-		b["blocked"] = GetField(stat_file);
-		b["sigignore"] = GetField(stat_file);
-		b["sigcatch"] = GetField(stat_file);
-		b["wchan"] = GetField(stat_file);
-		b["nswap"] = GetField(stat_file);
-		b["cnswap"] = GetField(stat_file);
-		b["exitsignal"] = GetField(stat_file);
-		b["processor"] = GetField(stat_file);
-		b["rt_priority"] = GetField(stat_file);
-		b["policy"] = GetField(stat_file);
+		parse_stat(stat, b);
 	}
-	if (w.statm) {
-		FileDescriptorOwner statm_fd(open_read_at(proc_subdir_fd.get(), "statm"));
-		if (0 > statm_fd.get()) {
-	bad_statm_file:
-			if (ENOENT == errno) return false;
-			die_errno(prog, envs, procdir, subdir, "statm");
+	b["pid"] = subdir;
+	return true;
+}
+
+/// Open and read one process directory, returning false if the process has gone away.
+bool
+read_process (
+	const char * prog,
+	const ProcessEnvironment & envs,
+	int proc_dir_fd,
+	const char * subdir,
+	const wanted & w,
+	scan_costs * costs,
+	ProcessTable::Row & b
+) {
+	FileDescriptorOwner proc_subdir_fd(-1);
+	{
+		const CostTimer timer(costs, DIRECTORY);
+		proc_subdir_fd.reset(open_dir_at(proc_dir_fd, subdir));
+		if (0 > proc_subdir_fd.get()) {
+bad_subdir:
+			if (ENOTDIR == errno || ENOENT == errno) return false;
+			die_errno(prog, envs, procdir, subdir);
 		}
-		FileStar statm_file(fdopen(statm_fd.get(), "r"));
-		if (!statm_file) goto bad_statm_file;
-		statm_fd.release();
-		GetField(statm_file);
-		GetField(statm_file);
-		GetField(statm_file);
-		GetField(statm_file);
-		GetField(statm_file);
-		GetField(statm_file);
-		GetField(statm_file);
+		struct stat s;
+		if (0 > fstat(proc_subdir_fd.get(), &s)) goto bad_subdir;
+		if (!S_ISDIR(s.st_mode))
+			return false;
 	}
-	if (w.status) {
-		FileDescriptorOwner status_fd(open_read_at(proc_subdir_fd.get(), "status"));
-		if (0 > status_fd.get()) {
-	bad_status_file:
-			if (ENOENT == errno) return false;
-			die_errno(prog, envs, procdir, subdir, "status");
+	return populate_record(prog, envs, subdir, proc_subdir_fd, w, costs, b);
+}
+
+/// A worker that reads process directories, sharing out the work with other workers by a common counter.
+struct ScanWorker {
+	ScanWorker(const char * p, const ProcessEnvironment & e, int d, const std::vector<std::string> & n, const wanted & wa, ProcessTable & t, std::vector<char> & o, std::atomic<std::size_t> & x, bool v) :
+		prog(p), envs(e), proc_dir_fd(d), names(n), w(wa), table(t), ok(o), next(x), verbose(v), failed(false), status(0) {}
+	const char * prog;
+	const ProcessEnvironment & envs;
+	const int proc_dir_fd;
+	const std::vector<std::string> & names;
+	const wanted & w;
+	ProcessTable & table;
+	std::vector<char> & ok;
+	std::atomic<std::size_t> & next;
+	const bool verbose;
+	scan_costs costs;
+	bool failed;
+	int status;
+
+	void operator() () {
+		try {
+			for (;;) {
+				const std::size_t i(next++);
+				if (i >= names.size()) break;
+				ProcessTable::Row b(table.row(i));
+				ok[i] = read_process(prog, envs, proc_dir_fd, names[i].c_str(), w, verbose ? &costs : nullptr, b);
+			}
+		} catch (int s) {
+			// The error has already been reported; it is passed on to the main thread once all workers have finished.
+			failed = true;
+			status = s;
+			next = names.size();
 		}
-		FileStar status_file(fdopen(status_fd.get(), "r"));
-		if (!status_file) goto bad_status_file;
-		status_fd.release();
-		GetField(status_file);
-		GetField(status_file);
-		GetField(status_file);
-		GetField(status_file);	// pid
-		GetField(status_file);	// pid?
-		GetField(status_file);	// ttdev?
-		GetField(status_file);	// flags for ctty and sldr
-		GetField(status_file);	// stime as a timeval?
-		GetField(status_file);	// ? as a timeval?
-		GetField(status_file);	// ? as a timeval?
-		GetField(status_file);
-		GetField(status_file);
-		GetField(status_file);
-		GetField(status_file);
 	}
-	b["pid"] = subdir;
-	return true;
-}
+};
 
 ProcessTable
 read_table (
 	const char * prog,
 	const ProcessEnvironment & envs,
 	const FieldList & fields,
-	bool threads,
-	const char * /*time_format*/
+	bool /*threads*/,
+	const char * /*time_format*/,
+	unsigned long jobs,
+	bool verbose
 ) {
 	const wanted w(CheckFields(fields));
 	FileDescriptorOwner proc_dir_fd(open_dir_at(AT_FDCWD, procdir));
@@ -1188,7 +1364,9 @@ exit_scan:
 		die_errno(prog, envs, procdir);
 	}
 	proc_dir_fd.release();
-	ProcessTable r;
+
+	// Take a snapshot of the directory first, so that the process directories can be shared out amongst several workers.
+	std::vector<std::string> names;
 	for (;;) {
 		errno = 0;
 		const dirent * entry(readdir(proc_dir));
@@ -1203,22 +1381,43 @@ exit_scan:
 		if (DT_DIR != entry->d_type) continue;
 #endif
 		if (!is_numeric(entry->d_name)) continue;
-		const FileDescriptorOwner proc_subdir_fd(open_dir_at(proc_dir.fd(), entry->d_name));
-		if (0 > proc_subdir_fd.get()) {
-bad_subdir:
-			if (ENOTDIR == errno) continue;
-			die_errno(prog, envs, procdir, entry->d_name);
-		}
-		struct stat s;
-		if (0 > fstat(proc_subdir_fd.get(), &s)) goto bad_subdir;
-		if (!S_ISDIR(s.st_mode))
-			continue;
-		r.push_back(ProcessRecord());
-		if (!populate_record(prog, envs, entry->d_name, proc_subdir_fd, w, r.back())) {
-			r.pop_back();
-			continue;
-		}
+		names.push_back(entry->d_name);
+	}
+
+	ProcessTable r(fields);
+	r.resize(names.size());
+	std::vector<char> ok(names.size());
+	std::atomic<std::size_t> next(0U);
+	if (jobs < 1UL) jobs = 1UL;
+	if (jobs > names.size()) jobs = names.size();
+	std::list<ScanWorker> workers;
+	for (unsigned long j(0UL); j < jobs; ++j)
+		workers.push_back(ScanWorker(prog, envs, proc_dir.fd(), names, w, r, ok, next, verbose));
+	if (1UL >= jobs) {
+		if (!workers.empty()) workers.front()();
+	} else {
+		std::vector<std::thread> threads;
+		for (std::list<ScanWorker>::iterator i(workers.begin()), e(workers.end()); e != i; ++i)
+			threads.push_back(std::thread(std::ref(*i)));
+		for (std::vector<std::thread>::iterator i(threads.begin()), e(threads.end()); e != i; ++i)
+			i->join();
+	}
+
+	scan_costs costs;
+	for (std::list<ScanWorker>::const_iterator i(workers.begin()), e(workers.end()); e != i; ++i) {
+		if (i->failed) throw i->status;
+		costs.add(i->costs);
 	}
+	if (verbose) {
+		std::fprintf(stderr, "%s: INFO: %zu process directories scanned by %lu worker(s)\n", prog, names.size(), jobs);
+		for (std::size_t k(0U); k < FILE_KINDS; ++k)
+			if (costs.count[k])
+				std::fprintf(stderr, "%s: INFO: %s: %lu read(s) %llu.%06llus total %lluus each\n", prog, file_kind_names[k], costs.count[k], costs.nanoseconds[k] / 1000000000ULL, costs.nanoseconds[k] / 1000ULL % 1000000ULL, costs.nanoseconds[k] / 1000ULL / costs.count[k]);
+	}
+
+	// Processes that went away whilst being read leave gaps.
+	r.retain(ok);
+	r.index();
 	return r;
 }
 
@@ -1226,6 +1425,187 @@ bad_subdir:
 
 }
 
+/* Tree construction and output *******************************************
+// **************************************************************************
+*/
+
+namespace {
+
+/// Sort the table into tree display order, constructing the tree field as we go, and select the wanted process IDs.
+/// \returns the rows of the table in display order
+std::vector<std::size_t>
+sort_into_tree (
+	ProcessTable & t,
+	bool non_unicode,
+	const std::vector<const char *> & args
+) {
+	// Rows lacking process IDs go first, and are not part of the tree.
+	std::vector<std::size_t> sorted, roots, others;
+	for (std::size_t row(0U); row < t.size(); ++row) {
+		if (!t.identified(row)) {
+			sorted.push_back(row);	// should never happen; eliminates need for later sanity checking
+			t.row(row)["tree"] = "!!";
+			continue;
+		}
+		const pid_t id(t.pid(row));
+		(
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+			0 == id
+#elif defined(__LINUX__) || defined(__linux__)
+			2 == id || 1 == id
+#else
+			1 == id
+#endif
+			? roots : others
+		).push_back(row);
+	}
+
+	// Build the parent to children adjacency in one pass, with children in ascending process ID order under each parent.
+	struct by_id {
+		by_id(const ProcessTable & tt) : table(tt) {}
+		bool operator() (std::size_t a, std::size_t b) const { return table.pid(a) < table.pid(b); }
+		const ProcessTable & table;
+	} ;
+	std::stable_sort(others.begin(), others.end(), by_id(t));
+	typedef std::unordered_map<pid_t, std::vector<std::size_t> > ChildrenIndex;
+	ChildrenIndex children;
+	for (std::vector<std::size_t>::const_iterator e(others.end()), p(others.begin()); p != e; ++p)
+		children[t.ppid(*p)].push_back(*p);
+
+	// Walk the tree depth first from each root in turn, constructing the tree drawing as we go.
+	// Processes that are not descendants of a root are not listed.
+	struct PendingEntry {
+		PendingEntry(std::size_t r, const std::string & d) : row(r), tree(d) {}
+		std::size_t row;
+		std::string tree;
+	} ;
+	std::vector<PendingEntry> pending;
+	for (std::vector<std::size_t>::const_reverse_iterator e(roots.rend()), p(roots.rbegin()); p != e; ++p)
+		pending.push_back(PendingEntry(*p, "*-"));
+	while (!pending.empty()) {
+		PendingEntry r(pending.back());
+		pending.pop_back();
+		sorted.push_back(r.row);
+		const ChildrenIndex::iterator c(children.find(t.pid(r.row)));
+		if (children.end() != c) {
+			const std::vector<std::size_t> & kids(c->second);
+			std::string parent_tree(r.tree.substr(0, r.tree.length() - 1) + " ");
+			char & finalc(parent_tree[parent_tree.length() - 2]);
+			if ('-' == finalc || '`' == finalc || '*' == finalc)
+				finalc = ' ';
+			else if ('+' == finalc)
+				finalc = '|';
+			// Pushed in reverse, so that the first child is processed next.
+			for (std::size_t i(kids.size()); i-- > 0U; ) {
+				const char mark(kids.size() - 1U == i ? '`' : 0U == i ? '+' : '|');
+				pending.push_back(PendingEntry(kids[i], parent_tree + mark + "-"));
+			}
+			// Each process is only listed once, even if process IDs are duplicated.
+			children.erase(c);
+			r.tree += ". ";
+		} else
+			r.tree += "- ";
+		t.row(r.row)["tree"] = non_unicode ? r.tree : make_graphical_tree(r.tree);
+	}
+
+	// Select the processes that are wanted, by integer process ID.
+	if (!args.empty()) {
+		std::unordered_set<pid_t> wanted;
+		for (std::vector<const char *>::const_iterator e(args.end()), p(args.begin()); p != e; ++p) {
+			const char * a(*p), * end(a);
+			const long id(std::strtol(a, const_cast<char **>(&end), 10));
+			// Anything that is not a process ID cannot match one.
+			if (*a && !*end)
+				wanted.insert(pid_t(id));
+		}
+		std::vector<std::size_t> filtered;
+		for (std::vector<std::size_t>::const_iterator te(sorted.end()), tp(sorted.begin()); tp != te; ++tp)
+			if (t.identified(*tp) && wanted.end() != wanted.find(t.pid(*tp)))
+				filtered.push_back(*tp);
+		sorted.swap(filtered);
+	}
+	return sorted;
+}
+
+std::string
+format_row (
+	const ProcessTable & t,
+	std::size_t row
+) {
+	std::string s;
+	for (std::size_t c(0U); c < t.output_column_count(); ++c) {
+		if (c) s += '\t';
+		s += VisEncoder::process(t.output(c, row));
+	}
+	return s;
+}
+
+typedef std::vector<std::pair<std::string, std::string> > KeyedRows;
+
+/// Output the changes that turn the previous rows into the current rows, as keyed insert, update, and delete records.
+/// The longest sequence of surviving rows that are still in the same order as before stays put, and rows in it only have records if their contents have changed.
+/// Every other surviving row has moved, and is deleted and re-inserted.
+void
+write_deltas (
+	const KeyedRows & previous,
+	const KeyedRows & current
+) {
+	enum { NONE = static_cast<std::size_t>(-1) };
+	std::unordered_map<std::string, std::size_t> old_positions;
+	for (std::size_t i(0U); i < previous.size(); ++i)
+		old_positions[previous[i].first] = i;
+
+	// Each surviving row, in the current order, with where it was previously.
+	std::vector<std::size_t> survivors, was;
+	std::vector<std::size_t> old_of(current.size(), NONE);
+	for (std::size_t i(0U); i < current.size(); ++i) {
+		const std::unordered_map<std::string, std::size_t>::const_iterator o(old_positions.find(current[i].first));
+		if (old_positions.end() == o) continue;
+		old_of[i] = o->second;
+		survivors.push_back(i);
+		was.push_back(o->second);
+	}
+
+	// The longest increasing sequence of previous positions, found by patience sorting in O(n log n).
+	std::vector<std::size_t> tails, link(survivors.size(), NONE);
+	for (std::size_t i(0U); i < survivors.size(); ++i) {
+		std::size_t lo(0U), hi(tails.size());
+		while (lo < hi) {
+			const std::size_t mid(lo + (hi - lo) / 2U);
+			if (was[tails[mid]] < was[i]) lo = mid + 1U; else hi = mid;
+		}
+		if (lo) link[i] = tails[lo - 1U];
+		if (tails.size() == lo) tails.push_back(i); else tails[lo] = i;
+	}
+	std::vector<bool> stays(current.size(), false);
+	for (std::size_t i(tails.empty() ? std::size_t(NONE) : tails.back()); NONE != i; i = link[i])
+		stays[survivors[i]] = true;
+
+	std::vector<bool> survives(previous.size(), false);
+	for (std::vector<std::size_t>::const_iterator e(was.end()), p(was.begin()); p != e; ++p)
+		survives[*p] = true;
+	for (std::size_t i(0U); i < previous.size(); ++i)
+		if (!survives[i])
+			std::cout << "-\t" << VisEncoder::process(previous[i].first) << '\n';
+
+	for (std::size_t i(0U); i < current.size(); ++i) {
+		const KeyedRows::value_type & row(current[i]);
+		if (stays[i]) {
+			if (previous[old_of[i]].second != row.second)
+				std::cout << "=\t" << VisEncoder::process(row.first) << '\t' << row.second << '\n';
+			continue;
+		}
+		if (NONE != old_of[i])
+			std::cout << "-\t" << VisEncoder::process(row.first) << '\n';
+		if (0U == i)
+			std::cout << "^\t" << VisEncoder::process(row.first) << '\t' << row.second << '\n';
+		else
+			std::cout << "+\t" << VisEncoder::process(row.first) << '\t' << VisEncoder::process(current[i - 1U].first) << '\t' << row.second << '\n';
+	}
+}
+
+}
+
 /* Main function ************************************************************
 // **************************************************************************
 */
@@ -1239,10 +1619,14 @@ list_process_table [[gnu::noreturn]]  (
 	const char * prog(basename_of(args[0]));
 	std::vector<const char *> next_args;
 	FieldList fields;
-	bool threads(false), non_unicode(false);
+	bool threads(false), non_unicode(false), verbose(false);
+	unsigned long jobs(1UL), refresh_interval(0UL);
 	const char * time_format("%F %T %z");
 	try {
 		popt::bool_definition threads_option('H', "threads", "List threads of processes.", threads);
+		popt::bool_definition verbose_option('v', "verbose", "Report where the time goes in reading the process table.", verbose);
+		popt::unsigned_number_definition jobs_option('\0', "scan-jobs", "number", "Read the process table with this many threads.", jobs, 0);
+		popt::unsigned_number_definition refresh_interval_option('\0', "refresh-interval", "milliseconds", "Keep listing, outputting changes keyed by process ID at this interval.", refresh_interval, 0);
 		popt::string_list_definition field_option('F', "field", "field", "Include this field.", fields);
 		popt::string_definition time_format_option('\0', "time-format", "format-string", "Use an alternative time display format.", time_format);
 		popt::tui_level_definition tui_level_option('T', "tui-level", "Specify the level of TUI character set.");
@@ -1251,6 +1635,9 @@ list_process_table [[gnu::noreturn]]  (
 			&threads_option,
 			&tui_level_option,
 			&time_format_option,
+			&verbose_option,
+			&jobs_option,
+			&refresh_interval_option,
 		};
 		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "PIDs");
 
@@ -1265,7 +1652,7 @@ list_process_table [[gnu::noreturn]]  (
 		die(prog, envs, e);
 	}
 
-	ProcessTable t(read_table(prog, envs, fields, threads, time_format));
+	ProcessTable t(read_table(prog, envs, fields, threads, time_format, jobs, verbose));
 
 	// Print the headings.
 	for (FieldList::const_iterator b(fields.begin()), e(fields.end()), i(b); i != e; ++i) {
@@ -1274,126 +1661,29 @@ list_process_table [[gnu::noreturn]]  (
 	}
 	std::cout.put('\n');
 
-	// Sort the table into tree form and construct the tree.
-	struct TableIndexEntry {
-		TableIndexEntry(ProcessRecord & e) : record(e) {}
-		ProcessRecord & record;
-	} ;
-	struct SortIndexEntry : public TableIndexEntry {
-		SortIndexEntry(ProcessRecord & r, pid_t p, pid_t pp) : TableIndexEntry(r), id(p), parent(pp) {}
-		pid_t id, parent;
-		std::string tree;
-	} ;
-	typedef std::list<SortIndexEntry> SortingIndex;
-	typedef std::list<TableIndexEntry> TableIndex;
-	SortingIndex pending, presorted;
-	TableIndex sorted;
-	for (ProcessTable::iterator te(t.end()), p(t.begin()); p != te; ++p) {
-		ProcessRecord & r(*p);
-		const ProcessRecord::const_iterator pid_p(p->find("pid"));
-		const ProcessRecord::const_iterator ppid_p(p->find("ppid"));
-		if (pid_p == p->end() || ppid_p == p->end() || "" == pid_p->second || "" == ppid_p->second) {
-			sorted.push_back(r);	// should never happen; eliminates need for later sanity checking
-			sorted.back().record["tree"] = "!!";
-		} else {
-			SortIndexEntry e(r, val(pid_p->second), val(ppid_p->second));
-			if (
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-			0 == e.id
-#elif defined(__LINUX__) || defined(__linux__)
-			2 == e.id || 1 == e.id
-#else
-			1 == e.id
-#endif
-			) {
-				e.tree = "*-";
-				pending.push_back(e);
-			} else {
-				bool done(false);
-				for (SortingIndex::const_iterator pe(presorted.end()), pp(presorted.begin()); pp != pe; ++pp) {
-					const SortIndexEntry & o(*pp);
-					if (o.id > e.id) {
-						presorted.insert(pp, e);
-						done = true;
-						break;
-					}
-				}
-				if (!done)
-					presorted.push_back(e);
-			}
-		}
-	}
-	while (!pending.empty()) {
-		// Take the first item off the pending lists and append it to the sorted list.
-		SortIndexEntry r(pending.front());
-		pending.pop_front();
-		sorted.push_back(r);
-		// Find all of the immediate children of that item and prepend them to the pending list, so that they are processed next.
-		SortingIndex::iterator insertion_point(pending.begin()), sentinel(pending.end()), last(sentinel), first(sentinel);
-		for (SortingIndex::iterator e(presorted.end()), p(presorted.begin()); p != e; ) {
-			SortIndexEntry & o(*p);
-			if (o.parent == r.id) {
-				std::string parent_tree(r.tree.substr(0, r.tree.length() - 1) + " ");
-				char & finalc(parent_tree[parent_tree.length() - 2]);
-				if ('-' == finalc || '`' == finalc || '*' == finalc)
-					finalc = ' ';
-				else if ('+' == finalc)
-					finalc = '|';
-				o.tree = parent_tree + "|-";
-				insertion_point = pending.insert(insertion_point, o);
-				if (first == sentinel) first = insertion_point;
-				last = insertion_point;
-				++insertion_point;
-				p = presorted.erase(p);
-			} else
-				++p;
-		}
-		r.tree += "- ";
-		if (first != sentinel) {
-			// If we appended some children, make appropriate modifications to the trees in the parent and first and last child.
-			r.tree[r.tree.length() - 2] = '.';
-			if (first != last)
-				first->tree[first->tree.length() - 2] = '+';
-			last->tree[last->tree.length() - 2] = '`';
-		}
-		// Transfer the tree of the item just appended to the sorted list.
-		sorted.back().record["tree"] = non_unicode ? r.tree : make_graphical_tree(r.tree);
-	}
+	std::vector<std::size_t> sorted(sort_into_tree(t, non_unicode, args));
 
-	// Filter the processes that are wanted.
-	if (!args.empty()) {
-		for (TableIndex::const_iterator te(sorted.end()), tb(sorted.begin()), tp(tb); tp != te; ) {
-			const ProcessRecord & r(tp->record);
-			const ProcessRecord::const_iterator pid(r.find("pid"));
-			if (pid == r.end()) {
-				std::fprintf(stderr, "%s: ERROR: No PID field to match %zu process IDs.\n", prog, args.size());
-				tp = sorted.erase(tp);
-				continue;
-			}
-			bool wanted(false);
-			for (std::vector<const char *>::const_iterator ap(args.begin()), ae(args.end()); ap != ae; ++ap) {
-				if (pid->second == *ap) {
-					wanted = true;
-					break;
-				}
-			}
-			if (wanted)
-				++tp;
-			else
-				tp = sorted.erase(tp);
-		}
+	if (0UL == refresh_interval) {
+		for (std::vector<std::size_t>::const_iterator te(sorted.end()), p(sorted.begin()); p != te; ++p)
+			std::cout << format_row(t, *p) << '\n';
+		throw EXIT_SUCCESS;
 	}
 
-	// Print the table rows.
-	for (TableIndex::const_iterator te(sorted.end()), tb(sorted.begin()), p(tb); p != te; ++p) {
-		const ProcessRecord & r(p->record);
-		for (FieldList::const_iterator fb(fields.begin()), fe(fields.end()), f(fb); f != fe; ++f) {
-			if (f != fb) std::cout.put('\t');
-			const ProcessRecord::const_iterator v(r.find(*f));
-			if (v != r.end()) std::cout << VisEncoder::process(v->second);
+	// In refresh mode, the rows are keyed by process ID and only the changes are output at each interval.
+	KeyedRows previous;
+	for (;;) {
+		KeyedRows current;
+		for (std::vector<std::size_t>::const_iterator te(sorted.end()), p(sorted.begin()); p != te; ++p) {
+			if (t.identified(*p))
+				current.push_back(KeyedRows::value_type(t.pid_string(*p), format_row(t, *p)));
 		}
-		std::cout.put('\n');
+		write_deltas(previous, current);
+		std::cout.flush();
+		if (!std::cout) throw EXIT_FAILURE;
+		previous.swap(current);
+		const timespec interval = { static_cast<std::time_t>(refresh_interval / 1000UL), static_cast<long>(refresh_interval % 1000UL) * 1000000L };
+		nanosleep(&interval, nullptr);
+		t = read_table(prog, envs, fields, threads, time_format, jobs, verbose);
+		sorted = sort_into_tree(t, non_unicode, args);
 	}
-
-	throw EXIT_SUCCESS;
 }
@@ -17,6 +17,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <new>
 #include <memory>
 #include <inttypes.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -26,6 +27,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "unpack.h"
 #include "service-manager-client.h"
 #include "service-manager.h"
+#include "ServiceStatusTable.h"
 #include "popt.h"
 
 /* Nagios check subcommands *************************************************
@@ -71,6 +73,7 @@ inline
 void
 check (
 	const ProcessEnvironment & envs,
+	ServiceStatusTable & status_table,
 	const int bundle_dir_fd,
 	const std::string & name,
 	std::vector<std::string> & not_loaded,
@@ -105,26 +108,33 @@ check (
 	const bool initially_up(is_initially_up(service_dir_fd.get()));
 	const bool ready_after_run(is_ready_after_run(service_dir_fd.get()));
 
-	if (!is_ok(supervise_dir_fd.get())) {
-		const int error(errno);
-		if (ENXIO == error)
-			not_loaded.push_back(name);
-		else {
-			std::fprintf(stdout, "ERROR: %s/%s: %s\n", name.c_str(), "supervise/ok", std::strerror(error));
-			set(rc, EXIT_NAGIOS_CRITICAL);
+	char status[STATUS_BLOCK_SIZE];
+	ssize_t b;
+	struct stat supervise_dir_s;
+	if (0 <= fstat(supervise_dir_fd.get(), &supervise_dir_s) && status_table.query(supervise_dir_s, status))
+		b = sizeof status;
+	else
+	{
+		if (!is_ok(supervise_dir_fd.get())) {
+			const int error(errno);
+			if (ENXIO == error)
+				not_loaded.push_back(name);
+			else {
+				std::fprintf(stdout, "ERROR: %s/%s: %s\n", name.c_str(), "supervise/ok", std::strerror(error));
+				set(rc, EXIT_NAGIOS_CRITICAL);
+			}
+			return;
 		}
-		return;
-	}
 
-	const FileDescriptorOwner status_fd(open_read_at(supervise_dir_fd.get(), "status"));
-	if (0 > status_fd.get()) {
-		const int error(errno);
-		std::fprintf(stdout, "ERROR: %s/%s: %s\n", name.c_str(), "status", std::strerror(error));
-		set(rc, EXIT_NAGIOS_CRITICAL);
-		return;
+		const FileDescriptorOwner status_fd(open_read_at(supervise_dir_fd.get(), "status"));
+		if (0 > status_fd.get()) {
+			const int error(errno);
+			std::fprintf(stdout, "ERROR: %s/%s: %s\n", name.c_str(), "status", std::strerror(error));
+			set(rc, EXIT_NAGIOS_CRITICAL);
+			return;
+		}
+		b = read(status_fd.get(), status, sizeof status);
 	}
-	char status[STATUS_BLOCK_SIZE];
-	const ssize_t b(read(status_fd.get(), status, sizeof status));
 
 	if (b < DAEMONTOOLS_STATUS_BLOCK_SIZE) {
 		loading.push_back(name);
@@ -246,6 +256,7 @@ nagios_check [[gnu::noreturn]] (
 
 	int rc(EXIT_NAGIOS_OK);
 	std::vector<std::string> not_loaded, loading, clock_skewed, stopped, started, disabled, below_min_seconds, failed;
+	ServiceStatusTable status_table;
 	for (std::vector<const char *>::const_iterator i(args.begin()); args.end() != i; ++i) {
 		std::string path, name, suffix;
 		const int bundle_dir_fd(open_bundle_directory(envs, "", *i, path, name, suffix));
@@ -256,7 +267,7 @@ nagios_check [[gnu::noreturn]] (
 			set(rc, EXIT_NAGIOS_CRITICAL);
 			continue;
 		}
-		check(envs, bundle_dir_fd, p, not_loaded, loading, clock_skewed, stopped, started, disabled, below_min_seconds, failed, rc);
+		check(envs, status_table, bundle_dir_fd, p, not_loaded, loading, clock_skewed, stopped, started, disabled, below_min_seconds, failed, rc);
 		close(bundle_dir_fd);
 	}
 	print("not loaded", not_loaded, rc, EXIT_NAGIOS_CRITICAL);
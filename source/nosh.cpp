@@ -10,8 +10,11 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cstring>
 #include <cerrno>
 #include <cctype>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "utils.h"
 #include "fdutils.h"
+#include "compiled-script.h"
 
 /* Main function ************************************************************
 // **************************************************************************
@@ -19,28 +22,34 @@ For copyright and licensing terms, see the file named COPYING.
 
 namespace {
 
+// fexecve() gives a script's interpreter a name for the script that refers to the open file descriptor, in one of these forms.
+const char * const fd_prefixes[] = {
+	"/dev/fd/",
 #if defined(__LINUX__) || defined(__linux__)
-#	define FD_PREFIX "/proc/self/fd/"
-#else
-#	define FD_PREFIX "/dev/fd/"
+	"/proc/self/fd/",
 #endif
+};
 
+/// \returns the file descriptor that name refers to, if it is one of those, or -1 if it is an ordinary name
 inline
-void
-undo_open_exec_fd_bodge(
+int
+fd_of_name (
 	const char * name
 ) {
-	const std::size_t l(std::strlen(name));
-	if (l < sizeof FD_PREFIX) return;	// It must have at least 1 digit character after the prefix.
-	if (0 != std::strncmp(name, FD_PREFIX, sizeof FD_PREFIX - 1)) return;
-	name += sizeof FD_PREFIX - 1;
-	int fd(0);
-	while (const int c = *name) {
-		if (!std::isdigit(c)) return;
-		fd = fd * 10 + (c - '0');
-		++name;
+	for (const char * const * p(fd_prefixes); p < fd_prefixes + sizeof fd_prefixes/sizeof *fd_prefixes; ++p) {
+		const std::size_t l(std::strlen(*p));
+		if (0 != std::strncmp(name, *p, l)) continue;
+		const char * digits(name + l);
+		if (!*digits) return -1;	// It must have at least 1 digit character after the prefix.
+		int fd(0);
+		while (const int c = *digits) {
+			if (!std::isdigit(c)) return -1;
+			fd = fd * 10 + (c - '0');
+			++digits;
+		}
+		return fd;
 	}
-	set_close_on_exec(fd, true);
+	return -1;
 }
 
 }
@@ -61,12 +70,22 @@ nosh (
 
 	// These must have static storage duration as we are using them in args.
 	static std::vector<std::string> args_storage;
-	args_storage = read_file(prog, envs, name);
-	const std::vector<const char *> new_args(convert_args_storage(args_storage));
+	std::vector<const char *> new_args;
+	const int fd(fd_of_name(name));
+	struct stat s;
+	// A current compiled form, if there is one, points new_args into a mapping that also persists.
+	// A script that is only known by its open file descriptor, as when the service manager runs it, has no name to put a compiled form alongside; so its compiled form is found by its device and i-node.
+	if (0 > (0 <= fd ? fstat(fd, &s) : stat(name, &s))
+	||  !load_compiled_script((0 <= fd ? compiled_script_runtime_name(s) : compiled_script_name(name)).c_str(), s, new_args)
+	) {
+		args_storage = read_file(prog, envs, name);
+		new_args = convert_args_storage(args_storage);
+	}
 	if (new_args.empty()) {
 		die_usage(prog, envs, "No arguments in script.");
 	}
-	undo_open_exec_fd_bodge(name);
+	// Undo the bodge of open_exec() leaving the script's file descriptor open across execve() for fexecve() to work.
+	if (0 <= fd) set_close_on_exec(fd, true);
 	args = new_args;
 	next_prog = arg0_of(args);
 }
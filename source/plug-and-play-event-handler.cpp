@@ -4,6 +4,10 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -43,22 +47,170 @@ handle_signal (
 	}
 }
 
+/// A plug and play event message, as read from the socket, along with the device that it is about.
+struct event {
+	std::vector<char> message;
+	std::string devpath, action;
+};
+
+typedef std::list<event> event_queue;
+typedef std::map<pid_t, std::string> running_map;
+
+enum { MAX_PENDING = 4096U };
+
+inline
+std::string
+find_variable (
+	const std::vector<char> & message,
+	const char * name
+) {
+	const std::size_t nl(std::strlen(name));
+	for (std::vector<char>::const_iterator b(message.begin()), e(message.end()); b != e; ) {
+		const std::vector<char>::const_iterator z(std::find(b, e, '\0'));
+		if (std::size_t(z - b) > nl && 0 == std::memcmp(&*b, name, nl) && '=' == b[nl])
+			return std::string(b + nl + 1, z);
+		b = z == e ? e : z + 1;
+	}
+	return std::string();
+}
+
+/// Events about the same device, or about a device and any device above or below it in the device tree, are related and must be handled in order.
+/// An event that names no device at all is related to everything.
+/// \brief Counts of outstanding events by device, arranged so that whether an event is related to any of them costs a lookup per level of the device tree rather than a comparison against each one
+struct device_counts {
+	device_counts() : at(), under(), anonymous(0UL), total(0UL) {}
+	void add(const std::string &);
+	void remove(const std::string &);
+	bool blocks(const std::string &) const;
+protected:
+	typedef std::map<std::string, unsigned long> count_map;
+	count_map at;		///< events about exactly this device
+	count_map under;	///< events about this device or any device below it
+	unsigned long anonymous, total;
+};
+
+void
+device_counts::add (
+	const std::string & devpath
+) {
+	++total;
+	if (devpath.empty()) {
+		++anonymous;
+		return;
+	}
+	++at[devpath];
+	for (std::string::size_type p(devpath.find('/', 1U)); std::string::npos != p; p = devpath.find('/', p + 1U))
+		++under[devpath.substr(0, p)];
+	++under[devpath];
+}
+
+void
+device_counts::remove (
+	const std::string & devpath
+) {
+	--total;
+	if (devpath.empty()) {
+		--anonymous;
+		return;
+	}
+	const count_map::iterator i(at.find(devpath));
+	if (at.end() != i && 0UL == --i->second) at.erase(i);
+	for (std::string::size_type p(devpath.find('/', 1U)); ; p = devpath.find('/', p + 1U)) {
+		const count_map::iterator j(under.find(std::string::npos == p ? devpath : devpath.substr(0, p)));
+		if (under.end() != j && 0UL == --j->second) under.erase(j);
+		if (std::string::npos == p) break;
+	}
+}
+
+/// Whether an event about this device is related to any of the counted events.
+bool
+device_counts::blocks (
+	const std::string & devpath
+) const {
+	if (anonymous) return true;
+	if (devpath.empty()) return 0UL != total;
+	if (under.count(devpath)) return true;
+	for (std::string::size_type p(devpath.find('/', 1U)); std::string::npos != p; p = devpath.find('/', p + 1U))
+		if (at.count(devpath.substr(0, p))) return true;
+	return false;
+}
+
+/// \brief The latest queued change event for each device that has nothing related queued after it, so that coalescing a new change event costs a lookup rather than a scan of the queue
+struct change_index {
+	change_index() : latest() {}
+	bool coalesce(event &);
+	void enqueued(event_queue::iterator);
+	void dequeued(event_queue::iterator);
+protected:
+	typedef std::map<std::string, event_queue::iterator> latest_map;
+	latest_map latest;
+	void forget_related(const std::string &);
+};
+
+/// A change event for a device supersedes a change event for the same device that has not yet been handled, as long as nothing about that device or its relatives has been queued in between.
+bool
+change_index::coalesce (
+	event & e
+) {
+	if ("change" != e.action || e.devpath.empty()) return false;
+	const latest_map::iterator i(latest.find(e.devpath));
+	if (latest.end() == i) return false;
+	i->second->message.swap(e.message);
+	return true;
+}
+
+void
+change_index::enqueued (
+	event_queue::iterator i
+) {
+	forget_related(i->devpath);
+	if ("change" == i->action && !i->devpath.empty())
+		latest[i->devpath] = i;
+}
+
+void
+change_index::dequeued (
+	event_queue::iterator i
+) {
+	const latest_map::iterator j(latest.find(i->devpath));
+	if (latest.end() != j && i == j->second) latest.erase(j);
+}
+
+void
+change_index::forget_related (
+	const std::string & devpath
+) {
+	if (devpath.empty()) {
+		latest.clear();
+		return;
+	}
+	latest.erase(devpath);
+	for (std::string::size_type p(devpath.find('/', 1U)); std::string::npos != p; p = devpath.find('/', p + 1U))
+		latest.erase(devpath.substr(0, p));
+	const std::string below(devpath + '/');
+	for (latest_map::iterator i(latest.lower_bound(below)); latest.end() != i && 0 == i->first.compare(0, below.length(), below); )
+		i = latest.erase(i);
+}
+
 inline
 void
 reap (
 	const char * prog,
 	bool verbose,
-	unsigned long & children,
+	running_map & running,
+	device_counts & running_devices,
 	unsigned long max_children
 ) {
 	for (;;) {
 		int status, code;
 		pid_t c;
 		if (0 >= wait_nonblocking_for_anychild_exit(c, status, code)) break;
-		if (children) {
-			--children;
+		const running_map::iterator i(running.find(c));
+		if (running.end() != i) {
+			running_devices.remove(i->second);
+			running.erase(i);
 			if (verbose)
-				std::fprintf(stderr, "%s: %u ended status %i code %i %lu/%lu\n", prog, c, status, code, children, max_children);
+				std::fprintf(stderr, "%s: %u ended status %i code %i %zu/%lu\n", prog, c, status, code, running.size(), max_children);
 		}
 	}
 }
@@ -76,11 +228,16 @@ plug_and_play_event_handler (
 	ProcessEnvironment & envs
 ) {
 	const char * prog(basename_of(args[0]));
-	bool verbose(false);
+	bool verbose(false), coalesce_changes(false);
+	unsigned long max_children(1);
 	try {
 		popt::bool_definition verbose_option('v', "verbose", "Print status information.", verbose);
+		popt::unsigned_number_definition max_children_option('\0', "max-children", "number", "Specify the limit on the number of simultaneous handlers.", max_children, 0);
+		popt::bool_definition coalesce_changes_option('\0', "coalesce-changes", "Merge queued change events for the same device.", coalesce_changes);
 		popt::definition * top_table[] = {
-			&verbose_option
+			&verbose_option,
+			&max_children_option,
+			&coalesce_changes_option
 		};
 		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "{prog}");
 
@@ -95,6 +252,7 @@ plug_and_play_event_handler (
 	}
 
 	if (args.empty()) die_missing_next_program(prog, envs);
+	if (1UL > max_children) max_children = 1UL;
 
 	const unsigned listen_fds(query_listen_fds_or_daemontools(envs));
 	if (1U > listen_fds) {
@@ -117,23 +275,74 @@ plug_and_play_event_handler (
 	append_event(ip, SIGTERM, EVFILT_SIGNAL, EV_ADD, 0, 0, nullptr);
 	append_event(ip, SIGHUP, EVFILT_SIGNAL, EV_ADD, 0, 0, nullptr);
 
-	const unsigned long max_children(1);
-	unsigned long children(0);
+	event_queue pending;
+	change_index changes;
+	running_map running;
+	device_counts running_devices;
 
 	if (verbose)
 		std::fprintf(stderr, "%s: startup\n", prog);
 	for (;;) {
 		if (child_signalled) {
-			reap(prog, verbose, children, max_children);
+			reap(prog, verbose, running, running_devices, max_children);
 			child_signalled = false;
 		}
-		if (halt_signalled && children <= 0) {
+		if (halt_signalled && running.empty()) {
 			if (verbose)
 				std::fprintf(stderr, "%s: shutdown\n", prog);
 			throw EXIT_SUCCESS;
 		}
+
+		// Start as many queued events as the limit allows, in order, skipping over any whose device, or a relative of it, has an earlier event still outstanding.
+		// Every event passed over, started or not, then blocks later ones for its device and relatives.
+		if (!halt_signalled && running.size() < max_children) {
+			device_counts outstanding(running_devices);
+			for (event_queue::iterator i(pending.begin()); pending.end() != i && running.size() < max_children; ) {
+				const bool is_blocked(outstanding.blocks(i->devpath));
+				outstanding.add(i->devpath);
+				if (is_blocked) {
+					++i;
+					continue;
+				}
+				const pid_t child(fork());
+				if (0 > child) die_errno(prog, envs, "fork");
+				if (0 != child) {
+					running[child] = i->devpath;
+					running_devices.add(i->devpath);
+					changes.dequeued(i);
+					i = pending.erase(i);
+					if (verbose)
+						std::fprintf(stderr, "%s: %u started %zu/%lu\n", prog, child, running.size(), max_children);
+					continue;
+				}
+
+				for (unsigned j(0U); j < listen_fds; ++j)
+					close(LISTEN_SOCKET_FILENO + j);
+
+				const std::vector<char> & buf(i->message);
+				const std::size_t r(buf.size());
+				for (std::size_t e(0), b(e); ;) {
+					if (e >= r || !buf[e]) {
+						if (e > b) {
+							const std::string s(buf.data() + b, buf.data() + e);
+							const std::string::size_type q(s.find('='));
+							const std::string var(s.substr(0, q));
+							const std::string val(q == std::string::npos ? std::string() : s.substr(q + 1, std::string::npos));
+							envs.set(var, val);
+						}
+						if (e >= r) break;
+						++e;
+						b = e;
+					} else
+						++e;
+				}
+
+				return;
+			}
+		}
+
 		for (unsigned i(0U); i < listen_fds; ++i)
-			append_event(ip, LISTEN_SOCKET_FILENO + i, EVFILT_READ, children < max_children ? EV_ENABLE : EV_DISABLE, 0, 0, nullptr);
+			append_event(ip, LISTEN_SOCKET_FILENO + i, EVFILT_READ, !halt_signalled && pending.size() < MAX_PENDING ? EV_ENABLE : EV_DISABLE, 0, 0, nullptr);
 		struct kevent p[128];
 		const int rc(kevent(queue, ip.data(), ip.size(), p, sizeof p/sizeof *p, nullptr));
 		ip.clear();
@@ -155,35 +364,21 @@ exit_error:
 			const ssize_t r(read(l, buf, sizeof buf));
 			if (0 > r) goto exit_error;
 
-			const pid_t child(fork());
-			if (0 > child) goto exit_error;
-			if (0 != child) {
-				++children;
+			event e;
+			e.message.assign(buf, buf + r);
+			e.devpath = find_variable(e.message, "DEVPATH");
+			e.action = find_variable(e.message, "ACTION");
+			if (coalesce_changes && changes.coalesce(e)) {
 				if (verbose)
-					std::fprintf(stderr, "%s: %u started %lu/%lu\n", prog, child, children, max_children);
+					std::fprintf(stderr, "%s: coalesced change %s\n", prog, e.devpath.c_str());
 				continue;
 			}
-
-			for (unsigned j(0U); j < listen_fds; ++j)
-				close(LISTEN_SOCKET_FILENO + j);
-
-			for (int e(0), b(e); ;) {
-				if (e >= r || !buf[e]) {
-					if (e > b) {
-						const std::string s(buf + b, buf + e);
-						const std::string::size_type q(s.find('='));
-						const std::string var(s.substr(0, q));
-						const std::string val(q == std::string::npos ? std::string() : s.substr(q + 1, std::string::npos));
-						envs.set(var, val);
-					}
-					if (e >= r) break;
-					++e;
-					b = e;
-				} else
-					++e;
-			}
-
-			return;
+			pending.push_back(event());
+			pending.back().message.swap(e.message);
+			pending.back().devpath.swap(e.devpath);
+			pending.back().action.swap(e.action);
+			if (coalesce_changes)
+				changes.enqueued(--pending.end());
 		}
 	}
 }
@@ -4,6 +4,7 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <cstdio>
 #include <cerrno>
@@ -12,10 +13,11 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cctype>
 #include "utils.h"
 #include "FileStar.h"
+#include "ChunkedReader.h"
 
 std::vector<std::string>
 read_file (
-	FILE * f,
+	ChunkedReader & r,
 	unsigned long & line
 ) {
 	line = 0UL;
@@ -23,64 +25,75 @@ read_file (
 	std::string * current = nullptr;
 	enum { UNQUOTED, DOUBLE, SINGLE } quote(UNQUOTED);
 	bool slash(false), comment(false);
-	for (;;) {
-		const int c(std::fgetc(f));
-		if (std::feof(f)) break;
-		if (UNQUOTED == quote && !slash) {
-			if (comment) {
-				if ('\n' == c) {
+	for (ChunkedReader::span chunk; r.read_chunk(chunk); ) {
+		for (const char * p(chunk.data), * const e(chunk.data + chunk.length); p < e; ++p) {
+			const unsigned char c(*p);
+			if (UNQUOTED == quote && !slash) {
+				if (comment) {
+					// Skip straight to the end of the comment, which might be in a later chunk.
+					const void * nl(std::memchr(p, '\n', e - p));
+					if (!nl) break;
+					p = static_cast<const char *>(nl);
 					comment = false;
 					++line;
+					continue;
+				} else if ('#' == c && !current) {
+					comment = true;
+					continue;
+				} else if (std::isspace(c)) {
+					current = nullptr;
+					continue;
 				}
-				continue;
-			} else if ('#' == c && !current) {
-				comment = true;
-				continue;
-			} else if (std::isspace(c)) {
-				current = nullptr;
+			}
+			if (slash && '\n' == c) {
+				++line;
+				slash = false;
 				continue;
 			}
-		}
-		if (slash && '\n' == c) {
-			++line;
-			slash = false;
-			continue;
-		}
-		if (!current) {
-			a.push_back(std::string());
-			current = &a.back();
-		}
-		if (slash) {
-			*current += char(c);
-			slash = false;
-		} else {
-			switch (quote) {
-				case SINGLE:
-					if ('\'' == c)
-						quote = UNQUOTED;
-					else
-						*current += char(c);
-					break;
-				case DOUBLE:
-					if ('\\' == c)
-						slash = true;
-					else if ('\"' == c)
-						quote = UNQUOTED;
-					else
-						*current += char(c);
-					break;
-				case UNQUOTED:
-					if ('\\' == c)
-						slash = true;
-					else if ('\"' == c)
-						quote = DOUBLE;
-					else if ('\'' == c)
-						quote = SINGLE;
-					else
-						*current += char(c);
-					break;
+			if (!current) {
+				a.push_back(std::string());
+				current = &a.back();
+			}
+			if (slash) {
+				*current += char(c);
+				slash = false;
+			} else {
+				switch (quote) {
+					case SINGLE:
+						if ('\'' == c)
+							quote = UNQUOTED;
+						else
+						{
+							// Single-quoted text has no escapes, so take everything up to the closing quote in one go.
+							const void * q(std::memchr(p, '\'', e - p));
+							const char * const end(q ? static_cast<const char *>(q) : e);
+							line += std::count(p, end, '\n');
+							current->append(p, end);
+							p = end - 1;
+							continue;
+						}
+						break;
+					case DOUBLE:
+						if ('\\' == c)
+							slash = true;
+						else if ('\"' == c)
+							quote = UNQUOTED;
+						else
+							*current += char(c);
+						break;
+					case UNQUOTED:
+						if ('\\' == c)
+							slash = true;
+						else if ('\"' == c)
+							quote = DOUBLE;
+						else if ('\'' == c)
+							quote = SINGLE;
+						else
+							*current += char(c);
+						break;
+				}
+				if ('\n' == c) ++line;
 			}
-			if ('\n' == c) ++line;
 		}
 	}
 	if (slash)
@@ -98,9 +111,9 @@ read_file (
 ) {
 	unsigned long line;
 	try {
-		std::vector<std::string> v(read_file(f, line));
-		if (std::ferror(f)) {
-			const int error(errno);
+		ChunkedReader r(fileno(f));
+		std::vector<std::string> v(read_file(r, line));
+		if (const int error = r.error()) {
 			std::fclose(f);
 			std::fprintf(stderr, "%s: ERROR: %s(%lu): %s\n", prog, filename, line, std::strerror(error));
 			throw EXIT_FAILURE;
@@ -126,9 +139,12 @@ read_file (
 ) {
 	unsigned long line;
 	try {
-		std::vector<std::string> v(read_file(f.operator FILE *(), line));
-		if (std::ferror(f.operator FILE *()))
+		ChunkedReader r(fileno(f.operator FILE *()));
+		std::vector<std::string> v(read_file(r, line));
+		if (const int error = r.error()) {
+			errno = error;
 			die_errno(prog, envs, filename);
+		}
 		return v;
 	} catch (const char * r) {
 		die_parser_error(prog, envs, filename, line, r);
@@ -9,12 +9,13 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
+#include <cctype>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
 #include "utils.h"
 #include "fdutils.h"
-#include "FileStar.h"
+#include "ChunkedReader.h"
 
 std::string
 read_env_file (
@@ -27,27 +28,30 @@ read_env_file (
 	bool chomp
 ) {
 	std::string r;
-	FileStar f(fdopen(fd, "r"));
-	if (!f) {
-exit_error:
-		die_errno(prog, envs, dir, basename);
-	}
+	ChunkedReader f(fd);
 	for (bool ltrim(chomp);;) {
-		int c(std::fgetc(f));
-		if (std::feof(f)) break;
-		if ('\n' == c) {
-			if (chomp) r = rtrim(r);
-			if (!full) break;
-			ltrim = chomp;
-		} else {
-			if ('\0' == c) c = '\n';
-			if (ltrim) {
-				if (std::isspace(c)) continue;
-				ltrim = false;
+		ChunkedReader::span chunk;
+		if (!f.read_chunk(chunk)) break;
+		for (const char * p(chunk.data), * const e(chunk.data + chunk.length); p < e; ++p) {
+			char c(*p);
+			if ('\n' == c) {
+				if (chomp) r = rtrim(r);
+				if (!full) goto done;
+				ltrim = chomp;
+			} else {
+				if ('\0' == c) c = '\n';
+				if (ltrim) {
+					if (std::isspace(static_cast<unsigned char>(c))) continue;
+					ltrim = false;
+				}
 			}
+			r += c;
 		}
-		r += char(c);
 	}
-	if (std::ferror(f)) goto exit_error;
+done:
+	if (const int error = f.error()) {
+		errno = error;
+		die_errno(prog, envs, dir, basename);
+	}
 	return r;
 }
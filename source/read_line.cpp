@@ -7,6 +7,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cstdio>
 #include <cstring>
 #include "utils.h"
+#include "ChunkedReader.h"
 
 bool
 read_line (
@@ -21,3 +22,17 @@ read_line (
 		l += static_cast<unsigned char>(c);
 	}
 }
+
+bool
+read_line (
+	ChunkedReader & r,
+	std::string & l
+) {
+	ChunkedReader::span s;
+	if (!r.read_line(s)) {
+		l.clear();
+		return false;
+	}
+	l.assign(s.data, s.length);
+	return true;
+}
@@ -4,6 +4,9 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
+#include <string>
+#include <map>
+#include <ctime>
 #include <cstdio>
 #include <cstring>
 #include <csignal>
@@ -25,6 +28,143 @@ For copyright and licensing terms, see the file named COPYING.
 #include "FileDescriptorOwner.h"
 #include "DirStar.h"
 
+/* Waiting for loads ********************************************************
+// **************************************************************************
+*/
+
+namespace {
+
+enum { LOAD_TIMEOUT = 5000, MAX_LOADING = 256U };
+
+/// A service that has been asked to be loaded and that is to be started once its supervisor is seen to be running.
+struct loading {
+	loading(const std::string & n, int s) : name(n), supervise_dir_fd(s), status_fd(-1), ok(false) {}
+	std::string name;
+	int supervise_dir_fd, status_fd;
+	bool ok;
+};
+typedef std::vector<loading> loading_list;
+
+/// Watch for the things that a service manager does when it loads a service.
+/// It creates or truncates the status file, then opens the ok FIFO, then writes the status file.
+/// So watching the directory for the creation and the status file for writes always gets an event after the ok FIFO is open.
+void
+watch (
+	std::vector<struct kevent> & changes,
+	std::map<int, std::size_t> & index,
+	loading & l,
+	std::size_t i
+) {
+	if (0 > l.status_fd) {
+		l.status_fd = open_read_at(l.supervise_dir_fd, "status");
+		if (0 <= l.status_fd) {
+			struct kevent e;
+			set_event(e, l.status_fd, EVFILT_VNODE, EV_ADD|EV_CLEAR, NOTE_WRITE|NOTE_EXTEND, 0, nullptr);
+			changes.push_back(e);
+			index[l.status_fd] = i;
+		}
+	}
+}
+
+/// Wait concurrently for all of the services to be loaded, and then start them all in one pass.
+/// This is bounded by the slowest service to load, rather than by the sum of them all.
+void
+start_when_loaded (
+	const char * prog,
+	const int queue,
+	ServiceManagerBatch & batch,
+	loading_list & pending
+) {
+	batch.flush();
+	if (pending.empty()) return;
+	std::vector<struct kevent> changes;
+	std::map<int, std::size_t> index;
+	std::size_t outstanding(0U);
+	for (std::size_t i(0U); i < pending.size(); ++i) {
+		loading & l(pending[i]);
+		struct kevent e;
+		set_event(e, l.supervise_dir_fd, EVFILT_VNODE, EV_ADD|EV_CLEAR, NOTE_WRITE, 0, nullptr);
+		changes.push_back(e);
+		index[l.supervise_dir_fd] = i;
+		watch(changes, index, l, i);
+	}
+	if (0 > kevent(queue, changes.data(), changes.size(), nullptr, 0, nullptr)) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, "kevent", std::strerror(error));
+	}
+	changes.clear();
+	// Only now that everything is being watched can we test without missing anything.
+	for (loading_list::iterator i(pending.begin()), e(pending.end()); e != i; ++i)
+		if (!(i->ok = is_ok(i->supervise_dir_fd)))
+			++outstanding;
+
+	timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += LOAD_TIMEOUT / 1000;
+	deadline.tv_nsec += (LOAD_TIMEOUT % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_nsec -= 1000000000L;
+		++deadline.tv_sec;
+	}
+	while (outstanding) {
+		timespec now, timeout;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+		timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if (timeout.tv_nsec < 0) {
+			timeout.tv_nsec += 1000000000L;
+			--timeout.tv_sec;
+		}
+		if (timeout.tv_sec < 0) break;
+		struct kevent p[64];
+		const int rc(kevent(queue, changes.data(), changes.size(), p, sizeof p/sizeof *p, &timeout));
+		changes.clear();
+		if (0 > rc) {
+			if (EINTR == errno) continue;
+			const int error(errno);
+			std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, "kevent", std::strerror(error));
+			break;
+		}
+		// Zero events does not necessarily mean a timeout, so it is the deadline that ends this loop.
+		for (std::size_t j(0); j < static_cast<std::size_t>(rc); ++j) {
+			const struct kevent & e(p[j]);
+			if (EVFILT_VNODE != e.filter) continue;
+			const std::map<int, std::size_t>::const_iterator x(index.find(static_cast<int>(e.ident)));
+			if (index.end() == x) continue;
+			loading & l(pending[x->second]);
+			if (l.ok) continue;
+			watch(changes, index, l, x->second);
+			if (is_ok(l.supervise_dir_fd)) {
+				l.ok = true;
+				--outstanding;
+			}
+		}
+	}
+	// Anything that still has not been seen gets one last look, in case a notification was missed.
+	for (loading_list::iterator i(pending.begin()), e(pending.end()); e != i; ++i)
+		if (!i->ok)
+			i->ok = is_ok(i->supervise_dir_fd);
+	// The queue outlives the batch, so nothing must be left watching descriptors that are about to be closed.
+	changes.clear();
+	for (std::map<int, std::size_t>::const_iterator i(index.begin()), e(index.end()); e != i; ++i) {
+		struct kevent d;
+		set_event(d, i->first, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
+		changes.push_back(d);
+	}
+	kevent(queue, changes.data(), changes.size(), nullptr, 0, nullptr);
+	for (loading_list::iterator i(pending.begin()), e(pending.end()); e != i; ++i) {
+		if (i->ok)
+			start(i->supervise_dir_fd);
+		else
+			std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, i->name.c_str(), "supervise/ok", "Unable to load service bundle.");
+		if (0 <= i->status_fd) close(i->status_fd);
+		close(i->supervise_dir_fd);
+	}
+	pending.clear();
+}
+
+}
+
 /* Scanning *****************************************************************
 // **************************************************************************
 */
@@ -37,6 +177,7 @@ rescan (
 	const char * name,
 	const int socket_fd,
 	const int retained_scan_dir_fd,
+	const int load_queue,
 	const bool input_activation
 ) {
 	FileDescriptorOwner scan_dir_fd(dup(retained_scan_dir_fd));
@@ -48,11 +189,22 @@ exit_scan:
 	const DirStar scan_dir(scan_dir_fd);
 	if (!scan_dir) goto exit_scan;
 	rewinddir(scan_dir);	// because the last pass left it at EOF.
+	// Loads are issued without waiting for each to complete, and the waiting is done for whole batches at once.
+	ServiceManagerBatch batch(prog, socket_fd);
+	loading_list pending;
+	pending.reserve(MAX_LOADING);
 	for (;;) {
+		if (pending.size() >= MAX_LOADING)
+			start_when_loaded(prog, load_queue, batch, pending);
 		errno = 0;
 		const dirent * entry(readdir(scan_dir));
 		if (!entry) {
-			if (errno) goto exit_scan;
+			if (errno) {
+				const int error(errno);
+				start_when_loaded(prog, load_queue, batch, pending);
+				errno = error;
+				goto exit_scan;
+			}
 			break;
 		}
 #if defined(_DIRENT_HAVE_D_NAMLEN)
@@ -74,7 +226,7 @@ exit_scan:
 					const bool was_already_loaded(is_ok(supervise_dir_fd));
 					if (!was_already_loaded) {
 						make_supervise_fifos(supervise_dir_fd);
-						load(prog, socket_fd, entry->d_name, supervise_dir_fd, service_dir_fd);
+						batch.load(entry->d_name, supervise_dir_fd, service_dir_fd);
 					}
 					const int log_bundle_dir_fd(open_dir_at(bundle_dir_fd, "log/"));
 					if (0 <= log_bundle_dir_fd) {
@@ -93,19 +245,20 @@ exit_scan:
 								const bool log_was_already_loaded(is_ok(log_supervise_dir_fd));
 								if (!log_was_already_loaded) {
 									make_supervise_fifos(log_supervise_dir_fd);
-									load(prog, socket_fd, log_name, log_supervise_dir_fd, log_service_dir_fd);
-									make_pipe_connectable(prog, socket_fd, log_supervise_dir_fd);
+									batch.load(log_name, log_supervise_dir_fd, log_service_dir_fd);
+									batch.make_pipe_connectable(log_supervise_dir_fd);
 								}
-								plumb(prog, socket_fd, supervise_dir_fd, log_supervise_dir_fd);
+								batch.plumb(supervise_dir_fd, log_supervise_dir_fd);
 								if (!log_was_already_loaded) {
 									if (input_activation)
-										make_input_activated(prog, socket_fd, log_supervise_dir_fd);
+										batch.make_input_activated(log_supervise_dir_fd);
 									else {
 										if (is_initially_up(log_service_dir_fd)) {
-											if (!wait_ok(log_supervise_dir_fd, 5000))
-												std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, entry->d_name, "log/supervise/ok", "Unable to load service bundle.");
+											const int fd(dup(log_supervise_dir_fd));
+											if (0 <= fd)
+												pending.push_back(loading(log_name, fd));
 											else
-												start(log_supervise_dir_fd);
+												std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, entry->d_name, "log/supervise", std::strerror(errno));
 										} else
 											std::fprintf(stderr, "%s: INFO: %s/%s: %s\n", prog, entry->d_name, "log", "Service is initially down.");
 									}
@@ -121,10 +274,11 @@ exit_scan:
 						std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, entry->d_name, "log", std::strerror(errno));
 					if (!was_already_loaded) {
 						if (is_initially_up(service_dir_fd)) {
-							if (!wait_ok(supervise_dir_fd, 5000))
-								std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, entry->d_name, "supervise/ok", "Unable to load service bundle.");
+							const int fd(dup(supervise_dir_fd));
+							if (0 <= fd)
+								pending.push_back(loading(entry->d_name, fd));
 							else
-								start(supervise_dir_fd);
+								std::fprintf(stderr, "%s: ERROR: %s/%s: %s\n", prog, entry->d_name, "supervise", std::strerror(errno));
 						} else
 							std::fprintf(stderr, "%s: INFO: %s: %s\n", prog, entry->d_name, "Service is initially down.");
 					}
@@ -138,6 +292,7 @@ exit_scan:
 		} else
 			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, entry->d_name, std::strerror(errno));
 	}
+	start_when_loaded(prog, load_queue, batch, pending);
 }
 
 /* Main function ************************************************************
@@ -180,6 +335,11 @@ service_dt_scanner [[gnu::noreturn]] (
 	if (0 > queue) {
 		die_errno(prog, envs, "kqueue");
 	}
+	// Waiting for services to load is done on a queue of its own, so that it does not see scan directory events.
+	const int load_queue(kqueue());
+	if (0 > load_queue) {
+		die_errno(prog, envs, "kqueue");
+	}
 
 	const FileDescriptorOwner scan_dir_fd(open_dir_at(AT_FDCWD, scan_directory));
 	if (0 > scan_dir_fd.get()) {
@@ -198,7 +358,7 @@ service_dt_scanner [[gnu::noreturn]] (
 
 	const int socket_fd(connect_service_manager_socket(is_system, prog));
 	if (0 > socket_fd) throw EXIT_FAILURE;
-	rescan(prog, envs, scan_directory, socket_fd, scan_dir_fd.get(), input_activation);
+	rescan(prog, envs, scan_directory, socket_fd, scan_dir_fd.get(), load_queue, input_activation);
 
 	for (;;) {
 		try {
@@ -213,7 +373,7 @@ service_dt_scanner [[gnu::noreturn]] (
 				switch (e.filter) {
 					case EVFILT_VNODE:
 						if (e.ident == static_cast<uintptr_t>(scan_dir_fd.get()))
-							rescan(prog, envs, scan_directory, socket_fd, scan_dir_fd.get(), input_activation);
+							rescan(prog, envs, scan_directory, socket_fd, scan_dir_fd.get(), load_queue, input_activation);
 						else {
 #if defined(DEBUG)
 							std::fprintf(stderr, "%s: DEBUG: vnode event ident %lu fflags %x\n", prog, e.ident, e.fflags);
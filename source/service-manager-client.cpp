@@ -8,8 +8,11 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cstdio>
 #include <cerrno>
 #include <vector>
+#include <string>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/poll.h>
 #include <unistd.h>
 #include "fdutils.h"
 #include "FileDescriptorOwner.h"
@@ -18,7 +21,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 namespace {
 
-void
+bool
 do_rpc_call (
 	const char * prog,
 	int socket_fd,
@@ -42,14 +45,16 @@ do_rpc_call (
 	memcpy(CMSG_DATA(cmsg), fds, count_fds * sizeof *fds);
 	for (unsigned retries(0U); retries < 5U; ++retries) {
 		const int rc(sendmsg(socket_fd, &msg, 0));
-		if (0 <= rc) break;
-		if (ENOBUFS != errno) {
-			const int error(errno);
-			std::fprintf(stderr, "%s: FATAL: %s\n", prog, std::strerror(error));
-			break;
-		}
-		sleep(1);
+		if (0 <= rc) return true;
+		if (EINTR == errno) continue;
+		if (ENOBUFS != errno) break;
+		// Rather than sleep for a fixed time, wait only until the service manager has drained some of its queue.
+		pollfd p[1] = { { socket_fd, POLLOUT, 0 } };
+		poll(p, sizeof p/sizeof *p, 1000);
 	}
+	const int error(errno);
+	std::fprintf(stderr, "%s: FATAL: %s\n", prog, std::strerror(error));
+	return false;
 }
 
 }
@@ -122,6 +127,188 @@ make_run_on_empty (
 	do_rpc_call(prog, socket_fd, &m, sizeof m, fds, sizeof fds/sizeof *fds);
 }
 
+/* Batched service manager control API RPCs *******************************
+// **************************************************************************
+*/
+
+ServiceManagerBatch::ServiceManagerBatch(
+	const char * p,
+	int s
+) :
+	prog(p),
+	socket_fd(s),
+	commands(),
+	fds(),
+	failed(false)
+{
+}
+
+ServiceManagerBatch::~ServiceManagerBatch()
+{
+	flush();
+}
+
+void
+ServiceManagerBatch::add (
+	uint8_t code,
+	const char * name,
+	int fd0,
+	int fd1
+) {
+	const std::size_t n(0 > fd1 ? 1U : 2U);
+	// One descriptor is always kept in reserve for the reply pipe.
+	if (fds.size() + n + 1U > service_manager_rpc_batch_header::MAX_FDS)
+		flush();
+	const int d0(dup(fd0));
+	const int d1(1U < n ? dup(fd1) : -1);
+	if (0 > d0 || (1U < n && 0 > d1)) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, name, std::strerror(error));
+		if (0 <= d0) close(d0);
+		if (0 <= d1) close(d1);
+		failed = true;
+		return;
+	}
+	commands.push_back(command(code, name, fds.size(), n));
+	fds.push_back(d0);
+	if (0 <= d1) fds.push_back(d1);
+}
+
+void
+ServiceManagerBatch::plumb (
+	int out_supervise_dir_fd,
+	int in_supervise_dir_fd
+) {
+	add(service_manager_rpc_message::PLUMB, "plumb", out_supervise_dir_fd, in_supervise_dir_fd);
+}
+
+void
+ServiceManagerBatch::load (
+	const char * name,
+	int supervise_dir_fd,
+	int service_dir_fd
+) {
+	add(service_manager_rpc_message::LOAD, name, supervise_dir_fd, service_dir_fd);
+}
+
+void
+ServiceManagerBatch::make_pipe_connectable (
+	int supervise_dir_fd
+) {
+	add(service_manager_rpc_message::MAKE_PIPE_CONNECTABLE, "make pipe connectable", supervise_dir_fd, -1);
+}
+
+void
+ServiceManagerBatch::make_input_activated (
+	int supervise_dir_fd
+) {
+	add(service_manager_rpc_message::MAKE_INPUT_ACTIVATED, "make input activated", supervise_dir_fd, -1);
+}
+
+void
+ServiceManagerBatch::make_run_on_empty (
+	int supervise_dir_fd
+) {
+	add(service_manager_rpc_message::MAKE_RUN_ON_EMPTY, "make run on empty", supervise_dir_fd, -1);
+}
+
+/// A service manager that predates batches closes the reply pipe without replying, and then each command is sent on its own.
+void
+ServiceManagerBatch::send_singly (
+) {
+	for (std::vector<command>::const_iterator i(commands.begin()), e(commands.end()); e != i; ++i) {
+		const int * f(fds.data() + i->first_fd);
+		switch (i->code) {
+			case service_manager_rpc_message::PLUMB:		::plumb(prog, socket_fd, f[0], f[1]); break;
+			case service_manager_rpc_message::LOAD:			::load(prog, socket_fd, i->name.c_str(), f[0], f[1]); break;
+			case service_manager_rpc_message::MAKE_PIPE_CONNECTABLE:	::make_pipe_connectable(prog, socket_fd, f[0]); break;
+			case service_manager_rpc_message::MAKE_INPUT_ACTIVATED:	::make_input_activated(prog, socket_fd, f[0]); break;
+			case service_manager_rpc_message::MAKE_RUN_ON_EMPTY:	::make_run_on_empty(prog, socket_fd, f[0]); break;
+		}
+	}
+}
+
+/// Send everything accumulated so far as one message, and wait for the service manager to have acted upon all of it.
+/// \returns false if any command in this or any earlier automatically sent batch failed
+bool
+ServiceManagerBatch::flush (
+) {
+	if (!commands.empty()) {
+		service_manager_rpc_batch_header h;
+		h.command = service_manager_rpc_message::BATCH;
+		h.version = h.VERSION;
+		h.flags = 0;
+		h.reserved = 0;
+		h.count = commands.size();
+		std::string data(reinterpret_cast<const char *>(&h), sizeof h);
+		for (std::vector<command>::const_iterator i(commands.begin()), e(commands.end()); e != i; ++i) {
+			service_manager_rpc_batch_entry entry;
+			entry.command = i->code;
+			entry.reserved = 0;
+			entry.name_length = service_manager_rpc_message::LOAD == i->code ? i->name.length() : 0U;
+			data.append(reinterpret_cast<const char *>(&entry), sizeof entry);
+			data.append(i->name.data(), entry.name_length);
+		}
+		int reply[2] = { -1, -1 };
+		if (0 <= pipe_close_on_exec(reply)) {
+			reinterpret_cast<service_manager_rpc_batch_header *>(&data[0])->flags |= h.REPLY;
+			fds.push_back(reply[1]);
+		}
+		const bool sent(do_rpc_call(prog, socket_fd, data.data(), data.length(), fds.data(), fds.size()));
+		if (0 <= reply[1]) {
+			fds.pop_back();
+			close(reply[1]);
+		}
+		if (!sent)
+			failed = true;
+		else
+		if (0 <= reply[0]) {
+			std::vector<int32_t> statuses(commands.size());
+			char * const p(reinterpret_cast<char *>(statuses.data()));
+			const std::size_t want(statuses.size() * sizeof *statuses.data());
+			std::size_t got(0U);
+			while (got < want) {
+				pollfd r[1] = { { reply[0], POLLIN, 0 } };
+				const int rc(poll(r, sizeof r/sizeof *r, REPLY_TIMEOUT));
+				if (0 > rc) {
+					if (EINTR == errno) continue;
+					break;
+				}
+				if (0 == rc) {
+					std::fprintf(stderr, "%s: ERROR: %s\n", prog, "Timed out waiting for the service manager to reply.");
+					failed = true;
+					break;
+				}
+				const ssize_t n(read(reply[0], p + got, want - got));
+				if (0 > n) {
+					if (EINTR == errno) continue;
+					break;
+				}
+				if (0 == n) break;
+				got += n;
+			}
+			if (0U == got && !failed)
+				send_singly();
+			else
+			for (std::size_t i(0U); i < statuses.size(); ++i) {
+				const int error(i < got / sizeof *statuses.data() ? statuses[i] : EPROTO);
+				if (0 != error) {
+					std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, commands[i].name.c_str(), std::strerror(error));
+					failed = true;
+				}
+			}
+			close(reply[0]);
+		}
+		for (std::vector<int>::const_iterator i(fds.begin()), e(fds.end()); e != i; ++i)
+			close(*i);
+		fds.clear();
+		commands.clear();
+	}
+	const bool r(!failed);
+	failed = false;
+	return r;
+}
+
 namespace {
 
 int
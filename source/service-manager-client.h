@@ -7,6 +7,8 @@ For copyright and licensing terms, see the file named COPYING.
 #define INCLUDE_SERVICE_MANAGER_CLIENT_H
 
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 extern bool per_user_mode;	// Shared with the system manager client API.
 
@@ -192,4 +194,39 @@ connect_service_manager_socket (
 	const char * prog
 ) ;
 
+/// \brief Service manager control API commands, accumulated so that they can all be sent in a single batch message.
+/// The file descriptors are duplicated, so callers may close their own as soon as a command has been added.
+/// Batches are sent automatically as they fill up, and in any event by flush() or the destructor.
+class ServiceManagerBatch
+{
+public:
+	ServiceManagerBatch(const char * prog, int socket_fd);
+	~ServiceManagerBatch();
+	void plumb(int out_supervise_dir_fd, int in_supervise_dir_fd);
+	void load(const char * name, int supervise_dir_fd, int service_dir_fd);
+	void make_pipe_connectable(int supervise_dir_fd);
+	void make_input_activated(int supervise_dir_fd);
+	void make_run_on_empty(int supervise_dir_fd);
+	bool flush();
+protected:
+	enum { REPLY_TIMEOUT = 5000 };
+	struct command {
+		command(uint8_t c, const char * n, std::size_t f, std::size_t k) : code(c), name(n), first_fd(f), count_fds(k) {}
+		uint8_t code;
+		std::string name;
+		std::size_t first_fd, count_fds;
+	};
+	const char * const prog;
+	const int socket_fd;
+	std::vector<command> commands;
+	std::vector<int> fds;
+	bool failed;
+
+	void add(uint8_t, const char *, int, int);
+	void send_singly();
+private:
+	ServiceManagerBatch(const ServiceManagerBatch &);
+	ServiceManagerBatch & operator = (const ServiceManagerBatch &);
+};
+
 #endif
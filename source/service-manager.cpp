@@ -4,11 +4,14 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
+#include <string>
 #include <map>
 #include <set>
 #include <utility>
 #include <memory>
+#include <algorithm>
 #include <cstdio>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <climits>
@@ -27,6 +30,7 @@ For copyright and licensing terms, see the file named COPYING.
 #endif
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/un.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -77,6 +81,7 @@ struct service : public index {
 	bool unloadable() const { return unload_after_stop && (NONE == activity) && !has_processes(); }
 
 	int in, out, err, pipe_fds[2], lock_fd, ok_fd, control_fd, status_fd, service_dir_fd;
+	uint32_t status_slot;	///< in the shared memory status table
 #if !HAS_FIFO_EXTENSION
 	int control_client_fd;
 #endif
@@ -216,6 +221,151 @@ delete_input_ready_event (int fd)
 
 }
 
+/* The shared memory status table *******************************************
+// **************************************************************************
+*/
+
+namespace {
+
+enum { NO_STATUS_SLOT = UINT32_MAX, INITIAL_STATUS_SLOTS = 256U };
+
+int status_table_fd(-1);
+service_manager_status_table_header * status_table(nullptr);
+std::size_t status_table_length(0U);
+std::vector<uint32_t> free_status_slots;
+
+inline
+service_manager_status_table_slot *
+status_table_slots ()
+{
+	return reinterpret_cast<service_manager_status_table_slot *>(status_table + 1);
+}
+
+/// Grow the table, extending the file before announcing the new slot count so that readers never map beyond its end.
+bool
+resize_status_table (
+	uint32_t count
+) {
+	const std::size_t length(sizeof *status_table + std::size_t(count) * sizeof(service_manager_status_table_slot));
+	if (0 > ftruncate(status_table_fd, length)) return false;
+	void * const p(mmap(nullptr, length, PROT_READ|PROT_WRITE, MAP_SHARED, status_table_fd, 0));
+	if (MAP_FAILED == p) return false;
+	if (status_table) munmap(status_table, status_table_length);
+	status_table = static_cast<service_manager_status_table_header *>(p);
+	const uint32_t old_count(status_table_length > sizeof *status_table ? status_table->slot_count : 0U);
+	status_table_length = length;
+	// New slots are zero-filled by the file extension, which makes them free slots.
+	for (uint32_t i(count); i > old_count; --i)
+		free_status_slots.push_back(i - 1U);
+	__atomic_store_n(&status_table->slot_count, count, __ATOMIC_RELEASE);
+	return true;
+}
+
+/// Create the table afresh alongside the control socket, if that is a local socket with a name.
+/// The table is an optimization for readers, so failure here is not fatal; the status files are the fallback.
+void
+open_status_table (
+	int socket_fd
+) {
+	sockaddr_un addr;
+	socklen_t len(sizeof addr);
+	if (0 > getsockname(socket_fd, reinterpret_cast<sockaddr *>(&addr), &len)
+	||  AF_UNIX != addr.sun_family
+	||  len <= offsetof(sockaddr_un, sun_path)
+	)
+		return;
+	const std::string socket_name(addr.sun_path, strnlen(addr.sun_path, len - offsetof(sockaddr_un, sun_path)));
+	const std::string::size_type slash(socket_name.rfind('/'));
+	if (std::string::npos == slash) return;
+	const std::string name(socket_name.substr(0, slash + 1U) + "status-table");
+	// Replacing rather than truncating leaves readers of any old table with a stale but intact mapping.
+	unlinkat(AT_FDCWD, name.c_str(), 0);
+	FileDescriptorOwner fd(open_readwritecreate_at(AT_FDCWD, name.c_str(), 0644));
+	if (0 > fd.get()) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, name.c_str(), std::strerror(error));
+		return;
+	}
+	fchmod(fd.get(), 0644);
+	// Readers take the absence of this lock to mean that we are no longer running.
+	if (0 > flock(fd.get(), LOCK_EX|LOCK_NB)) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, name.c_str(), std::strerror(error));
+		return;
+	}
+	status_table_fd = fd.release();
+	if (!resize_status_table(INITIAL_STATUS_SLOTS)) {
+		const int error(errno);
+		std::fprintf(stderr, "%s: WARNING: %s: %s\n", prog, name.c_str(), std::strerror(error));
+		if (status_table) munmap(status_table, status_table_length);
+		status_table = nullptr;
+		close(status_table_fd);
+		status_table_fd = -1;
+		return;
+	}
+	status_table->version = service_manager_status_table_header::VERSION;
+	status_table->slot_size = sizeof(service_manager_status_table_slot);
+	__atomic_store_n(&status_table->generation, 0U, __ATOMIC_RELAXED);
+	// The magic number goes last, so that readers do not trust a half-initialized header.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	std::memcpy(status_table->magic, service_manager_status_table_magic, sizeof status_table->magic);
+}
+
+/// Write a slot's content, with the sequence number odd for the duration.
+void
+publish_status_slot (
+	uint32_t i,
+	uint64_t dev,
+	uint64_t ino,
+	const unsigned char (& status)[STATUS_BLOCK_SIZE]
+) {
+	service_manager_status_table_slot & s(status_table_slots()[i]);
+	const uint32_t sequence(s.sequence);
+	__atomic_store_n(&s.sequence, sequence + 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s.dev, dev, __ATOMIC_RELAXED);
+	__atomic_store_n(&s.ino, ino, __ATOMIC_RELAXED);
+	std::memcpy(s.status, status, sizeof s.status);
+	__atomic_store_n(&s.sequence, sequence + 2U, __ATOMIC_RELEASE);
+}
+
+/// Readers re-index the table whenever its generation number changes.
+inline
+void
+status_table_changed ()
+{
+	if (status_table)
+		__atomic_add_fetch(&status_table->generation, 1U, __ATOMIC_RELEASE);
+}
+
+/// Take a slot, which stays free as far as readers are concerned until the first status is published to it.
+uint32_t
+allocate_status_slot ()
+{
+	if (!status_table) return NO_STATUS_SLOT;
+	if (free_status_slots.empty()) {
+		const uint32_t count(status_table->slot_count);
+		if (count > UINT32_MAX / 2U || !resize_status_table(count * 2U)) return NO_STATUS_SLOT;
+	}
+	// Freed slots are reused before new ones, keeping the live part of the table compact for readers.
+	const uint32_t slot(free_status_slots.back());
+	free_status_slots.pop_back();
+	return slot;
+}
+
+void
+free_status_slot (
+	uint32_t slot
+) {
+	if (!status_table || NO_STATUS_SLOT == slot) return;
+	static const unsigned char empty[STATUS_BLOCK_SIZE] = {};
+	publish_status_slot(slot, 0U, 0U, empty);
+	status_table_changed();
+	free_status_slots.push_back(slot);
+}
+
+}
+
 /* Supervision **************************************************************
 // **************************************************************************
 */
@@ -230,6 +380,7 @@ service::service(const struct stat & s, ProcessEnvironment & e) :
 	control_fd(-1),
 	status_fd(-1),
 	service_dir_fd(-1),
+	status_slot(NO_STATUS_SLOT),
 #if !HAS_FIFO_EXTENSION
 	control_client_fd(-1),
 #endif
@@ -257,6 +408,7 @@ service::~service()
 	close(pipe_fds[0]);
 	close(pipe_fds[1]);
 	close(status_fd);
+	free_status_slot(status_slot);
 #if !HAS_FIFO_EXTENSION
 	close(control_client_fd);
 #endif
@@ -268,6 +420,7 @@ service::~service()
 	control_client_fd = -1;
 #endif
 	pipe_fds[0] = pipe_fds[1] = service_dir_fd = status_fd = control_fd = ok_fd = lock_fd = -1;
+	status_slot = NO_STATUS_SLOT;
 }
 
 inline
@@ -381,6 +534,8 @@ service::del_process (
 void
 service::write_status()
 {
+	if (NO_STATUS_SLOT != status_slot)
+		publish_status_slot(status_slot, first, second, status);
 	const ssize_t rc(pwrite(status_fd, status, sizeof status, 0));
 	if (0 > rc) {
 		const int error(errno);
@@ -869,21 +1024,21 @@ static void sig_ignore ( int ) {}
 
 namespace {
 
-void
+int
 plumb (
 	int out_supervise_dir_fd,
 	int in_supervise_dir_fd
 ) {
 	struct stat in_supervise_dir_s;
-	if (!is_directory(in_supervise_dir_fd, in_supervise_dir_s)) return;
+	if (!is_directory(in_supervise_dir_fd, in_supervise_dir_s)) return ENOTDIR;
 	service_map::iterator in_supervise_dir_i(services.find(in_supervise_dir_s));
-	if (in_supervise_dir_i == services.end()) return;
+	if (in_supervise_dir_i == services.end()) return ENOENT;
 	service & in_s(*(in_supervise_dir_i->second));
 
 	struct stat out_supervise_dir_s;
-	if (!is_directory(out_supervise_dir_fd, out_supervise_dir_s)) return;
+	if (!is_directory(out_supervise_dir_fd, out_supervise_dir_s)) return ENOTDIR;
 	service_map::iterator out_supervise_dir_i(services.find(out_supervise_dir_s));
-	if (out_supervise_dir_i == services.end()) return;
+	if (out_supervise_dir_i == services.end()) return ENOENT;
 	service & out_s(*(out_supervise_dir_i->second));
 
 #if defined(DEBUG)
@@ -891,9 +1046,10 @@ plumb (
 #endif
 	if (-1 != in_s.pipe_fds[1])
 		out_s.err = out_s.out = in_s.pipe_fds[1];
+	return 0;
 }
 
-void
+int
 load (
 	ProcessEnvironment & envs,
 	const char * name,
@@ -901,19 +1057,19 @@ load (
 	int service_dir_fd
 ) {
 	struct stat service_dir_s;
-	if (!is_directory(service_dir_fd, service_dir_s)) return;
+	if (!is_directory(service_dir_fd, service_dir_s)) return ENOTDIR;
 	struct stat supervise_dir_s;
-	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return;
+	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return ENOTDIR;
 
 	service_map::iterator i(services.find(service_dir_s));
 	if (i == services.end()) {
 		FileDescriptorOwner service_dir_fd2(dup(service_dir_fd));
-		if (0 > service_dir_fd2.get()) return;
+		if (0 > service_dir_fd2.get()) return errno;
 		set_close_on_exec(service_dir_fd2.get(), true);
 		//
 		// We need an explicit lock file, because we cannot lock FIFOs.
 		FileDescriptorOwner lock_fd(open_lockfile_at(supervise_dir_fd, "lock"));
-		if (0 > lock_fd.get()) return;
+		if (0 > lock_fd.get()) return errno;
 		//
 		// We are allowed to open the read end of a FIFO in non-blocking mode without having to wait for a writer.
 		mkfifoat(supervise_dir_fd, "control", 0600);
@@ -922,20 +1078,20 @@ load (
 #else
 		FileDescriptorOwner control_fd(open_read_at(supervise_dir_fd, "control"));
 #endif
-		if (0 > control_fd.get()) return;
+		if (0 > control_fd.get()) return errno;
 #if !HAS_FIFO_EXTENSION
 		//
 		// We have to keep a client (write) end descriptor open to the control FIFO.
 		// Otherwise, the first control client process triggers POLLHUP when it closes its end.
 		// Opening the FIFO for read+write isn't standard, although it does work on Linux.
 		FileDescriptorOwner control_client_fd(open_writeexisting_at(supervise_dir_fd, "control"));
-		if (0 > control_client_fd.get()) return;
+		if (0 > control_client_fd.get()) return errno;
 #endif
 		//
 		// Unlike daemontools, but like daemontools-encore, we keep the status file open continually.
 		// This permits the supervise directory to be read-only.
 		FileDescriptorOwner status_fd(open_writetrunc_at(supervise_dir_fd, "status", 0644));
-		if (0 > status_fd.get()) return;
+		if (0 > status_fd.get()) return errno;
 		//
 		// The existence of a reader at this FIFO indicates that a supervisor is active.
 		// We must open this after the rest of the control/status API is initialized.
@@ -948,7 +1104,7 @@ load (
 		fchmodat(supervise_dir_fd, "ok", 0666, 0);
 #endif
 		FileDescriptorOwner ok_fd(open_read_at(supervise_dir_fd, "ok"));
-		if (0 > ok_fd.get()) return;
+		if (0 > ok_fd.get()) return errno;
 
 		timespec now;
 		clock_gettime(CLOCK_REALTIME, &now);
@@ -969,39 +1125,43 @@ load (
 		s.stamp_pending_command();
 		for (unsigned state(0U); state < 4U; ++state)
 			s.stamp_process_status(state, WAIT_STATUS_RUNNING, 0, now);
+		s.status_slot = allocate_status_slot();
 		s.write_status();
+		status_table_changed();
 		s.add_to_control_fifo_list();
 #if defined(DEBUG)
 		std::fprintf(stderr, "%s: DEBUG: load %s\n", prog, s.name);
 #endif
 	}
+	return 0;
 }
 
-void
+int
 make_input_activated (
 	int supervise_dir_fd
 ) {
 	struct stat supervise_dir_s;
-	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return;
+	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return ENOTDIR;
 	service_map::iterator supervise_dir_i(services.find(supervise_dir_s));
-	if (supervise_dir_i == services.end()) return;
+	if (supervise_dir_i == services.end()) return ENOENT;
 	service & s(*(supervise_dir_i->second));
 
 #if defined(DEBUG)
 	std::fprintf(stderr, "%s: DEBUG: make input activated %s\n", prog, s.name);
 #endif
 	s.add_to_input_activation_list();
+	return 0;
 }
 
 /// \bug FIXME: Remove this, no clients use this mechanism now.
-void
+int
 set_unload (
 	int supervise_dir_fd
 ) {
 	struct stat supervise_dir_s;
-	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return;
+	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return ENOTDIR;
 	service_map::iterator supervise_dir_i(services.find(supervise_dir_s));
-	if (supervise_dir_i == services.end()) return;
+	if (supervise_dir_i == services.end()) return ENOENT;
 
 	service & s(*(supervise_dir_i->second));
 #if defined(DEBUG)
@@ -1014,41 +1174,45 @@ set_unload (
 #endif
 		services.erase(supervise_dir_i);
 	}
+	return 0;
 }
 
-void
+int
 make_pipe_connectable (
 	int supervise_dir_fd
 ) {
 	struct stat supervise_dir_s;
-	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return;
+	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return ENOTDIR;
 	service_map::iterator supervise_dir_i(services.find(supervise_dir_s));
-	if (supervise_dir_i == services.end()) return;
+	if (supervise_dir_i == services.end()) return ENOENT;
 	service & s(*(supervise_dir_i->second));
 
 #if defined(DEBUG)
 	std::fprintf(stderr, "%s: DEBUG: add pipe for %s\n", prog, s.name);
 #endif
 	if (-1 == s.pipe_fds[1] && -1 == s.pipe_fds[0]) {
-		if (0 <= pipe_close_on_exec(s.pipe_fds))
-			s.in = s.pipe_fds[0];
+		if (0 > pipe_close_on_exec(s.pipe_fds))
+			return errno;
+		s.in = s.pipe_fds[0];
 	}
+	return 0;
 }
 
-void
+int
 make_run_on_empty (
 	int supervise_dir_fd
 ) {
 	struct stat supervise_dir_s;
-	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return;
+	if (!is_directory(supervise_dir_fd, supervise_dir_s)) return ENOTDIR;
 	service_map::iterator supervise_dir_i(services.find(supervise_dir_s));
-	if (supervise_dir_i == services.end()) return;
+	if (supervise_dir_i == services.end()) return ENOENT;
 	service & s(*(supervise_dir_i->second));
 
 #if defined(DEBUG)
 	std::fprintf(stderr, "%s: DEBUG: run-on-empty set for %s\n", prog, s.name);
 #endif
 	s.run_on_empty = true;
+	return 0;
 }
 
 }
@@ -1209,6 +1373,112 @@ input_ready_event (
 	}
 }
 
+inline
+std::size_t
+fds_for_command (
+	uint8_t command
+) {
+	switch (command) {
+		case service_manager_rpc_message::PLUMB:
+		case service_manager_rpc_message::LOAD:
+			return 2U;
+		case service_manager_rpc_message::MAKE_INPUT_ACTIVATED:
+		case service_manager_rpc_message::UNLOAD:
+		case service_manager_rpc_message::MAKE_PIPE_CONNECTABLE:
+		case service_manager_rpc_message::MAKE_RUN_ON_EMPTY:
+			return 1U;
+		default:
+			return 0U;
+	}
+}
+
+int
+execute_command (
+	ProcessEnvironment & envs,
+	uint8_t command,
+	const char * name,
+	const int * fds,
+	std::size_t count_fds
+) {
+	if (count_fds < fds_for_command(command)) return EINVAL;
+	switch (command) {
+		case service_manager_rpc_message::PLUMB:
+			return plumb(fds[0], fds[1]);
+		case service_manager_rpc_message::LOAD:
+			return load(envs, name, fds[0], fds[1]);
+		case service_manager_rpc_message::MAKE_INPUT_ACTIVATED:
+			return make_input_activated(fds[0]);
+		/// \bug FIXME: Remove this, no clients use this mechanism now.
+		case service_manager_rpc_message::UNLOAD:
+			return set_unload(fds[0]);
+		case service_manager_rpc_message::MAKE_PIPE_CONNECTABLE:
+			return make_pipe_connectable(fds[0]);
+		case service_manager_rpc_message::MAKE_RUN_ON_EMPTY:
+			return make_run_on_empty(fds[0]);
+		default:
+			return ENOSYS;
+	}
+}
+
+void
+batch_message (
+	ProcessEnvironment & envs,
+	const char * data,
+	std::size_t length,
+	bool truncated,
+	const std::vector<int> & fds,
+	bool in_shutdown
+) {
+	// Anything that we do not understand is simply dropped.
+	// Closing the reply pipe without writing anything to it tells a client to fall back to single command messages.
+	service_manager_rpc_batch_header h;
+	if (truncated || length < sizeof h) {
+		std::fprintf(stderr, "%s: WARNING: malformed control message batch with %lu file descriptors\n", prog, fds.size());
+		return;
+	}
+	std::memcpy(&h, data, sizeof h);
+	if (service_manager_rpc_batch_header::VERSION != h.version || service_manager_rpc_batch_header::MAX_FDS < h.count) {
+		std::fprintf(stderr, "%s: WARNING: unsupported control message batch version %u with %lu file descriptors\n", prog, h.version, fds.size());
+		return;
+	}
+	std::size_t count_fds(fds.size());
+	int reply_fd(-1);
+	if (h.flags & service_manager_rpc_batch_header::REPLY) {
+		if (fds.empty()) return;
+		reply_fd = fds[--count_fds];
+	}
+	if (in_shutdown)
+		std::fprintf(stderr, "%s: WARNING: Shutting down so ignoring control message batch of %u commands with %lu file descriptors\n", prog, h.count, count_fds);
+
+	std::vector<int32_t> statuses;
+	statuses.reserve(h.count);
+	std::size_t offset(sizeof h), next_fd(0U);
+	for (uint32_t i(0U); i < h.count; ++i) {
+		service_manager_rpc_batch_entry e;
+		if (length - offset < sizeof e) break;
+		std::memcpy(&e, data + offset, sizeof e);
+		offset += sizeof e;
+		if (length - offset < e.name_length) break;
+		char name[sizeof service_manager_rpc_message::name];
+		const std::size_t l(std::min<std::size_t>(e.name_length, sizeof name - 1U));
+		std::memcpy(name, data + offset, l);
+		name[l] = '\0';
+		offset += e.name_length;
+		const std::size_t n(std::min(fds_for_command(e.command), count_fds - next_fd));
+		statuses.push_back(in_shutdown ? ESHUTDOWN : execute_command(envs, e.command, name, fds.data() + next_fd, n));
+		next_fd += n;
+	}
+	// Entries that run off the end of the message fail wholesale.
+	statuses.resize(h.count, EPROTO);
+
+	if (0 <= reply_fd) {
+		// The client made this pipe afresh for this batch, and a whole batch of statuses is within PIPE_BUF.
+		// Non-blocking mode is solely to guard against a client that passes us something else.
+		set_non_blocking(reply_fd, true);
+		write(reply_fd, statuses.data(), statuses.size() * sizeof *statuses.data());
+	}
+}
+
 inline
 void
 control_message (
@@ -1216,9 +1486,10 @@ control_message (
 	int socket_fd,
 	bool in_shutdown
 ) {
-	service_manager_rpc_message m;
-	struct iovec v[1] = { { &m, sizeof m } };
-	char buf[CMSG_SPACE(3 * sizeof(int))];
+	// These are large enough for the largest batch, and are static because that is fairly large.
+	static char data[sizeof(service_manager_rpc_batch_header) + service_manager_rpc_batch_header::MAX_FDS * (sizeof(service_manager_rpc_batch_entry) + sizeof service_manager_rpc_message::name)];
+	static char buf[CMSG_SPACE(service_manager_rpc_batch_header::MAX_FDS * sizeof(int))];
+	struct iovec v[1] = { { data, sizeof data } };
 	struct msghdr msg = {
 		nullptr, 0,
 		v, sizeof v/sizeof *v,
@@ -1230,49 +1501,32 @@ control_message (
 		message_fatal_errno(prog, envs, "recvmsg");
 		return;
 	}
+	std::vector<int> fds;
 	for (struct cmsghdr *cmsg(CMSG_FIRSTHDR(&msg)); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
-			const int * fds(reinterpret_cast<int*>(CMSG_DATA(cmsg)));
-			const size_t count_fds((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof *fds);
-			for (size_t i(0); i < count_fds; ++i)
-				set_close_on_exec(fds[i], true);
-		}
-	}
-	for (struct cmsghdr *cmsg(CMSG_FIRSTHDR(&msg)); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
-			const int * fds(reinterpret_cast<int*>(CMSG_DATA(cmsg)));
-			const size_t count_fds((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof *fds);
-			if (in_shutdown)
-				std::fprintf(stderr, "%s: WARNING: Shutting down so ignoring control message command %u with %lu file descriptors\n", prog, m.command, count_fds);
-			else
-			switch (m.command) {
-				case service_manager_rpc_message::PLUMB:
-					plumb(fds[0], fds[1]);
-					break;
-				case service_manager_rpc_message::LOAD:
-					load(envs, m.name, fds[0], fds[1]);
-					break;
-				case service_manager_rpc_message::MAKE_INPUT_ACTIVATED:
-					make_input_activated(fds[0]);
-					break;
-				/// \bug FIXME: Remove this, no clients use this mechanism now.
-				case service_manager_rpc_message::UNLOAD:
-					set_unload(fds[0]);
-					break;
-				case service_manager_rpc_message::MAKE_PIPE_CONNECTABLE:
-					make_pipe_connectable(fds[0]);
-					break;
-				case service_manager_rpc_message::MAKE_RUN_ON_EMPTY:
-					make_run_on_empty(fds[0]);
-					break;
-				default:
-					std::fprintf(stderr, "%s: WARNING: unknown control message command %u with %lu file descriptors\n", prog, m.command, count_fds);
-					break;
+			const int * p(reinterpret_cast<int*>(CMSG_DATA(cmsg)));
+			const size_t count_fds((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof *p);
+			for (size_t i(0); i < count_fds; ++i) {
+				set_close_on_exec(p[i], true);
+				fds.push_back(p[i]);
 			}
-			for (size_t i(0); i < count_fds; ++i)
-				close(fds[i]);
 		}
 	}
+	if (0 < rc && service_manager_rpc_message::BATCH == static_cast<unsigned char>(data[0]))
+		batch_message(envs, data, rc, msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC), fds, in_shutdown);
+	else
+	if (!fds.empty()) {
+		service_manager_rpc_message m;
+		std::memset(&m, 0, sizeof m);
+		std::memcpy(&m, data, std::min<std::size_t>(rc, sizeof m));
+		if (in_shutdown)
+			std::fprintf(stderr, "%s: WARNING: Shutting down so ignoring control message command %u with %lu file descriptors\n", prog, m.command, fds.size());
+		else
+		if (ENOSYS == execute_command(envs, m.command, m.name, fds.data(), fds.size()))
+			std::fprintf(stderr, "%s: WARNING: unknown control message command %u with %lu file descriptors\n", prog, m.command, fds.size());
+	}
+	for (std::vector<int>::const_iterator i(fds.begin()), e(fds.end()); e != i; ++i)
+		close(*i);
 }
 
 void
@@ -1345,6 +1599,8 @@ service_manager [[gnu::noreturn]] (
 		die_errno(prog, envs, "LISTEN_FDS");
 	}
 
+	open_status_table(LISTEN_SOCKET_FILENO);
+
 	subreaper(true);
 
 #if !defined(__LINUX__) && !defined(__linux__)
@@ -31,9 +31,45 @@ enum {
 	STATUS_BLOCK_SIZE = ENCORE_STATUS_BLOCK_SIZE + 4U * EXIT_STATUS_SIZE,
 };
 struct service_manager_rpc_message {
-	enum { NOOP = 0, PLUMB, LOAD, MAKE_INPUT_ACTIVATED, UNLOAD, MAKE_PIPE_CONNECTABLE, MAKE_RUN_ON_EMPTY };
+	enum { NOOP = 0, PLUMB, LOAD, MAKE_INPUT_ACTIVATED, UNLOAD, MAKE_PIPE_CONNECTABLE, MAKE_RUN_ON_EMPTY, BATCH };
 	uint8_t command;
 	char name[256 + sizeof "/log"];
 };
+/// A BATCH message carries many commands, and all of their file descriptors, in one datagram.
+/// The header is followed by count entries, each immediately followed by name_length bytes of name.
+/// Commands take their file descriptors in turn: two each for PLUMB and LOAD, and one each for the rest.
+/// With the REPLY flag, one further descriptor, the last, is the write end of a pipe.
+/// The service manager writes one int32_t per command down it, zero or an errno value, and then closes it.
+struct service_manager_rpc_batch_header {
+	enum { VERSION = 1U };
+	enum { REPLY = 0x01 };
+	enum { MAX_FDS = 253U };	///< Linux's SCM_MAX_FD, the lowest limit of all
+	uint8_t command;	///< always BATCH, distinguishing this from a single command message
+	uint8_t version, flags, reserved;
+	uint32_t count;
+};
+struct service_manager_rpc_batch_entry {
+	uint8_t command, reserved;
+	uint16_t name_length;
+};
+/// The service manager also publishes every status block in a shared memory table, in a file named status-table alongside its control socket.
+/// This supplements the status files, which it still writes, so that a bulk status read is a memory scan rather than two opens and a read per service.
+/// The service manager holds an exclusive flock() on the file for as long as it is running; a table that can be locked is stale.
+/// The header is followed by slot_count slots, and the table only ever grows.
+struct alignas(64) service_manager_status_table_header {
+	enum { VERSION = 1U };
+	char magic[8];
+	uint32_t version, slot_size, slot_count;
+	uint32_t generation;	///< incremented whenever a slot is taken or freed
+};
+/// Each slot holds the status of one loaded service, keyed by the device and inode of its supervise directory; a zero inode marks a free slot.
+/// The sequence number is odd whilst the service manager is writing to the slot.
+/// Readers copy the slot and retry if the sequence number was odd, or changed in the meantime.
+struct alignas(64) service_manager_status_table_slot {
+	uint32_t sequence, reserved;
+	uint64_t dev, ino;
+	unsigned char status[STATUS_BLOCK_SIZE];
+};
+extern const char service_manager_status_table_magic[8];
 
 #endif
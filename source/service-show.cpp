@@ -5,6 +5,8 @@ For copyright and licensing terms, see the file named COPYING.
 
 #define __STDC_FORMAT_MACROS
 #include <vector>
+#include <list>
+#include <string>
 #include <memory>
 #include <cstdio>
 #include <cstdlib>
@@ -23,6 +25,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "service-manager.h"
 #include "FileDescriptorOwner.h"
 #include "DirStar.h"
+#include "BundleRelationCache.h"
 
 /* JSON and INI output ******************************************************
 // **************************************************************************
@@ -210,12 +213,30 @@ state_of (
 
 typedef std::list<std::string> Relations;
 
+inline
+std::string
+strip_up (
+	std::string d
+) {
+	if ("../" == d.substr(0, 3))
+		d = d.substr(3, d.npos);
+	return d;
+}
+
 Relations
 get_relations (
+	BundleRelationCache & cache,
 	int bundle_dir_fd,
 	const char * relation
 ) {
 	Relations r;
+	BundleRelationCache::edges edges;
+	if (cache.get(bundle_dir_fd, relation, edges)) {
+		for (BundleRelationCache::edges::const_iterator i(edges.begin()), e(edges.end()); e != i; ++i)
+			if (i->is_link)
+				r.push_back(strip_up(i->link));
+		return r;
+	}
 	FileDescriptorOwner relation_dir_fd(open_dir_at(bundle_dir_fd, relation));
 	if (0 <= relation_dir_fd.get()) {
 		const DirStar relation_dir(relation_dir_fd);
@@ -237,10 +258,7 @@ get_relations (
 			std::vector<char> buf(s.st_size, char());
 			const int l(readlinkat(relation_dir.fd(), entry->d_name, buf.data(), s.st_size));
 			if (0 > l) continue;
-			std::string d(buf.data(), l);
-			if ("../" == d.substr(0, 3))
-				d = d.substr(3, d.npos);
-			r.push_back(d);
+			r.push_back(strip_up(std::string(buf.data(), l)));
 		}
 	}
 	return r;
@@ -320,6 +338,7 @@ service_show [[gnu::noreturn]] (
 		die_missing_argument(prog, envs, "directory name(s)");
 	}
 
+	BundleRelationCache relations;
 	write_document_start();
 	for (std::vector<const char *>::const_iterator i(args.begin()); i != args.end(); ++i) {
 		const char * name(*i);
@@ -330,15 +349,15 @@ service_show [[gnu::noreturn]] (
 			std::fprintf(stderr, "%s: %s\n", name, std::strerror(error));
 			continue;
 		}
-		const Relations wants(get_relations(bundle_dir_fd.get(), "wants"));
-		const Relations expects(get_relations(bundle_dir_fd.get(), "expects"));
-		const Relations before(get_relations(bundle_dir_fd.get(), "before"));
-		const Relations after(get_relations(bundle_dir_fd.get(), "after"));
-		const Relations conflicts(get_relations(bundle_dir_fd.get(), "conflicts"));
-		const Relations requires(get_relations(bundle_dir_fd.get(), "requires"));
-		const Relations required_by(get_relations(bundle_dir_fd.get(), "required-by"));
-		const Relations wanted_by(get_relations(bundle_dir_fd.get(), "wanted-by"));
-		const Relations stopped_by(get_relations(bundle_dir_fd.get(), "stopped-by"));
+		const Relations wants(get_relations(relations, bundle_dir_fd.get(), "wants"));
+		const Relations expects(get_relations(relations, bundle_dir_fd.get(), "expects"));
+		const Relations before(get_relations(relations, bundle_dir_fd.get(), "before"));
+		const Relations after(get_relations(relations, bundle_dir_fd.get(), "after"));
+		const Relations conflicts(get_relations(relations, bundle_dir_fd.get(), "conflicts"));
+		const Relations requires(get_relations(relations, bundle_dir_fd.get(), "requires"));
+		const Relations required_by(get_relations(relations, bundle_dir_fd.get(), "required-by"));
+		const Relations wanted_by(get_relations(relations, bundle_dir_fd.get(), "wanted-by"));
+		const Relations stopped_by(get_relations(relations, bundle_dir_fd.get(), "stopped-by"));
 		const std::string log_service(get_log(bundle_dir_fd.get()));
 
 		const FileDescriptorOwner supervise_dir_fd(open_supervise_dir(bundle_dir_fd.get()));
@@ -430,5 +449,6 @@ service_show [[gnu::noreturn]] (
 		write_section_end();
 	}
 	write_document_end();
+	relations.save();
 	throw EXIT_SUCCESS;
 }
@@ -5,6 +5,7 @@ For copyright and licensing terms, see the file named COPYING.
 
 #define __STDC_FORMAT_MACROS
 #include <vector>
+#include <string>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdio>
@@ -15,15 +16,18 @@ For copyright and licensing terms, see the file named COPYING.
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "utils.h"
 #include "fdutils.h"
 #include "FileDescriptorOwner.h"
+#include "DirStar.h"
 #include "unpack.h"
 #include "popt.h"
 #include "service-manager-client.h"
 #include "service-manager.h"
+#include "ServiceStatusTable.h"
 #include "CharacterCell.h"
 #include "ECMA48Output.h"
 #include "TerminalCapabilities.h"
@@ -309,8 +313,142 @@ display (
 	}
 }
 
-// Used to preserve this argument when we return with new arguments.
-std::string current;
+}
+
+/* Log tails ****************************************************************
+// **************************************************************************
+*/
+
+namespace {
+
+enum { TAIL_BLOCK_SIZE = 64U * 1024U };
+
+bool
+pread_all (
+	int fd,
+	char * p,
+	std::size_t l,
+	off_t o
+) {
+	while (l) {
+		const ssize_t n(pread(fd, p, l, o));
+		if (0 > n) {
+			if (EINTR == errno) continue;
+			return false;
+		}
+		if (0 == n) return false;
+		p += n;
+		l -= n;
+		o += n;
+	}
+	return true;
+}
+
+/// Append up to wanted of the last lines of a file to lines, newest first, by reading backwards from its end in large blocks.
+/// As with tail, a final line that lacks a terminating LF still counts.
+void
+tail_lines (
+	int fd,
+	std::size_t wanted,
+	std::vector<std::string> & lines
+) {
+	struct stat s;
+	if (0 > fstat(fd, &s) || !S_ISREG(s.st_mode) || 0 >= s.st_size || !wanted) return;
+	const std::size_t full(lines.size() + wanted);
+	std::vector<char> block(s.st_size < TAIL_BLOCK_SIZE ? std::size_t(s.st_size) : std::size_t(TAIL_BLOCK_SIZE));
+	std::string carry;	// the start of the line that the next block back will complete
+	bool at_end(true);
+	for (off_t pos(s.st_size); pos > 0; ) {
+		const std::size_t n(pos < off_t(block.size()) ? std::size_t(pos) : block.size());
+		pos -= n;
+		if (!pread_all(fd, block.data(), n, pos)) return;
+		std::size_t e(n);
+		if (at_end) {
+			if ('\n' == block[e - 1U]) --e;
+			at_end = false;
+		}
+		for (std::size_t i(e); i-- > 0U; ) {
+			if ('\n' != block[i]) continue;
+			lines.push_back(std::string(block.data() + i + 1U, e - i - 1U) + carry);
+			carry.clear();
+			if (lines.size() >= full) return;
+			e = i;
+		}
+		carry.insert(0, block.data(), e);
+	}
+	lines.push_back(carry);
+}
+
+/// Find the most recently rotated-out log file, which the TAI64N timestamp in its name makes the greatest such name.
+std::string
+newest_old_log_file (
+	int log_dir_fd
+) {
+	std::string newest;
+	FileDescriptorOwner scan_dir_fd(dup(log_dir_fd));
+	if (0 > scan_dir_fd.get()) return newest;
+	const DirStar scan_dir(scan_dir_fd);
+	if (!scan_dir) return newest;
+	while (const dirent * entry = readdir(scan_dir)) {
+		const char * const n(entry->d_name);
+		if (27U != std::strlen(n) || '@' != n[0] || '.' != n[25] || ('s' != n[26] && 'u' != n[26])) continue;
+		if (24U != std::strspn(n + 1, "0123456789abcdefABCDEF")) continue;
+		if (newest < n) newest = n;
+	}
+	return newest;
+}
+
+/// Print a log line with a leading TAI64N timestamp, if it has one, converted to local time as tai64nlocal does.
+void
+print_log_line (
+	const ProcessEnvironment & envs,
+	const std::string & line
+) {
+	const char * p(line.c_str());
+	std::size_t l(line.length());
+	if (l >= 25U && '@' == p[0] && 24U <= std::strspn(p + 1, "0123456789abcdefABCDEF")) {
+		const uint64_t secs(std::strtoull(std::string(p + 1, 16U).c_str(), nullptr, 16));
+		const uint32_t nano(std::strtoul(std::string(p + 17, 8U).c_str(), nullptr, 16));
+		const TimeTAndLeap z(tai64_to_time(envs, secs));
+		struct tm tm;
+		if (localtime_r(&z.time, &tm)) {
+			if (z.leap) ++tm.tm_sec;
+			char fmt[64];
+			const std::size_t f(std::strftime(fmt, sizeof fmt, "%F %T", &tm));
+			std::fwrite(fmt, f, 1, stdout);
+			std::fprintf(stdout, ".%09" PRIu32, nano);
+			p += 25U;
+			l -= 25U;
+		}
+	}
+	std::fwrite(p, l, 1, stdout);
+	std::fputc('\n', stdout);
+}
+
+/// Print the last lines of a service's main log without running any external tail program.
+/// If the current file is short and rotated is set, the remainder come from the end of the most recently rotated-out file.
+void
+display_log_tail (
+	const ProcessEnvironment & envs,
+	int log_dir_fd,
+	std::size_t wanted,
+	bool rotated
+) {
+	std::vector<std::string> lines;
+	const FileDescriptorOwner current_fd(open_read_at(log_dir_fd, "current"));
+	if (0 <= current_fd.get())
+		tail_lines(current_fd.get(), wanted, lines);
+	if (rotated && lines.size() < wanted) {
+		const std::string old(newest_old_log_file(log_dir_fd));
+		if (!old.empty()) {
+			const FileDescriptorOwner old_fd(open_read_at(log_dir_fd, old.c_str()));
+			if (0 <= old_fd.get())
+				tail_lines(old_fd.get(), wanted - lines.size(), lines);
+		}
+	}
+	for (std::vector<std::string>::const_reverse_iterator i(lines.rbegin()), e(lines.rend()); e != i; ++i)
+		print_log_line(envs, *i);
+}
 
 }
 
@@ -330,15 +468,18 @@ service_status (
 
 	bool long_form(0 != std::strcmp(prog, "svstat"));
 	bool colours(isatty(STDOUT_FILENO));
-	const char * log_lines = "5";
+	unsigned long log_lines(5U);
+	bool rotated_logs(false);
 	try {
 		popt::bool_definition long_form_option('\0', "long", "Output in a longer form.", long_form);
 		popt::bool_definition colours_option('\0', "colour", "Force output in colour even if standard output is not a terminal.", colours);
-		popt::string_definition log_lines_option('\0', "log-lines", "number", "Control the number of log lines printed.", log_lines);
+		popt::unsigned_number_definition log_lines_option('\0', "log-lines", "number", "Control the number of log lines printed.", log_lines, 0);
+		popt::bool_definition rotated_logs_option('\0', "rotated-logs", "Take log lines from the last rotated-out log file if the current one is short.", rotated_logs);
 		popt::definition * top_table[] = {
 			&long_form_option,
 			&colours_option,
-			&log_lines_option
+			&log_lines_option,
+			&rotated_logs_option
 		};
 		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "{directories...}");
 
@@ -364,6 +505,7 @@ service_status (
 
 	reset_colour(o);
 
+	ServiceStatusTable status_table;
 	for (std::vector<const char *>::const_iterator i(args.begin()); i != args.end(); ++i) {
 		const char * name(*i);
 		const FileDescriptorOwner bundle_dir_fd(open_dir_at(AT_FDCWD, name));
@@ -397,68 +539,46 @@ service_status (
 		const bool use_kill(is_use_kill_signal(service_dir_fd.get()));
 		char status[STATUS_BLOCK_SIZE];
 
-		const FileDescriptorOwner ok_fd(open_writeexisting_at(supervise_dir_fd.get(), "ok"));
-		if (0 > ok_fd.get()) {
-			const int error(errno);
-			if (ENXIO != error) {
-				std::fprintf(stdout, "%s: %s: ", name, "supervise/ok");
-				if (colours) o.set_italics(true);
-				std::fprintf(stdout, "%s", std::strerror(error));
-				if (colours) o.set_italics(false);
-				std::fputc('\n', stdout);
-				continue;
-			}
-			display(envs, name, o, colours, long_form, false, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, 0U, status);
-		} else {
-			const FileDescriptorOwner status_fd(open_read_at(supervise_dir_fd.get(), "status"));
-			if (0 > status_fd.get()) {
+		// A running service manager publishes statuses in its shared memory table, sparing two opens and a read per service.
+		struct stat supervise_dir_s;
+		if (0 <= fstat(supervise_dir_fd.get(), &supervise_dir_s) && status_table.query(supervise_dir_s, status)) {
+			display(envs, name, o, colours, long_form, true, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, sizeof status, status);
+		} else
+		{
+			const FileDescriptorOwner ok_fd(open_writeexisting_at(supervise_dir_fd.get(), "ok"));
+			if (0 > ok_fd.get()) {
 				const int error(errno);
-				std::fprintf(stdout, "%s: %s: ", name, "status");
-				if (colours) o.set_italics(true);
-				std::fprintf(stdout, "%s", std::strerror(error));
-				if (colours) o.set_italics(false);
-				std::fputc('\n', stdout);
-				display(envs, name, o, colours, long_form, true, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, 0U, status);
+				if (ENXIO != error) {
+					std::fprintf(stdout, "%s: %s: ", name, "supervise/ok");
+					if (colours) o.set_italics(true);
+					std::fprintf(stdout, "%s", std::strerror(error));
+					if (colours) o.set_italics(false);
+					std::fputc('\n', stdout);
+					continue;
+				}
+				display(envs, name, o, colours, long_form, false, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, 0U, status);
 			} else {
-				const int b(read(status_fd.get(), status, sizeof status));
-				display(envs, name, o, colours, long_form, true, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, static_cast<unsigned int>(b), status);
+				const FileDescriptorOwner status_fd(open_read_at(supervise_dir_fd.get(), "status"));
+				if (0 > status_fd.get()) {
+					const int error(errno);
+					std::fprintf(stdout, "%s: %s: ", name, "status");
+					if (colours) o.set_italics(true);
+					std::fprintf(stdout, "%s", std::strerror(error));
+					if (colours) o.set_italics(false);
+					std::fputc('\n', stdout);
+					display(envs, name, o, colours, long_form, true, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, 0U, status);
+				} else {
+					const int b(read(status_fd.get(), status, sizeof status));
+					display(envs, name, o, colours, long_form, true, initially_up, run_on_empty, ready_after_run, use_hangup, use_kill, z, static_cast<unsigned int>(b), status);
+				}
 			}
 		}
 
 		if (long_form) {
 			const FileDescriptorOwner log_main_dir_fd(open_dir_at(bundle_dir_fd.get(), "log/main/"));
 
-			if (0 <= log_main_dir_fd.get()) {
-				std::fflush(stdout);
-
-				// We are going to clean up the grandchild(ren) so that our parent does not get stuck with zombies.
-				subreaper(true);
-
-				const pid_t child(fork());
-				if (0 > child) {
-					die_errno(prog, envs, "fork");
-				}
-				if (0 == child) {
-					// We could do some of this in code, but this is simpler and more maintainable, given that we have the builtins.
-					current = name + std::string("/log/main/current");
-					args.clear();
-					args.push_back("pipe");
-					args.push_back("--inwards");
-					args.push_back("tail");
-					args.push_back("-n");
-					args.push_back(log_lines);
-					args.push_back(current.c_str());
-					args.push_back("|");
-					args.push_back("tai64nlocal");
-					next_prog = arg0_of(args);
-					return;
-				}
-				for (;;) {
-					int child_status, child_code;
-					pid_t c;
-					if (0 >= wait_blocking_for_anychild_exit(c, child_status, child_code)) break;
-				}
-			}
+			if (0 <= log_main_dir_fd.get())
+				display_log_tail(envs, log_main_dir_fd.get(), log_lines, rotated_logs);
 		}
 	}
 	throw EXIT_SUCCESS;
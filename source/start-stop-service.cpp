@@ -7,6 +7,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <map>
 #include <unordered_map>
 #include <set>
+#include <deque>
 #include <cstddef>
 #include <cstdlib>
 #include <cstdio>
@@ -15,6 +16,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include <cerrno>
 #include <new>
 #include <memory>
+#include <ctime>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -25,6 +27,7 @@ For copyright and licensing terms, see the file named COPYING.
 #include "popt.h"
 #include "FileDescriptorOwner.h"
 #include "DirStar.h"
+#include "BundleRelationCache.h"
 #include "CharacterCell.h"
 #include "ECMA48Output.h"
 #include "TerminalCapabilities.h"
@@ -43,17 +46,18 @@ namespace {
 
 enum { COLOUR_DEFAULT = -1 };
 
-bool verbose(false), pretending(false);
+bool verbose(false), pretending(false), timing(false);
 
 struct index : public std::pair<dev_t, ino_t> {
 	index(const struct stat & s) : pair(s.st_dev, s.st_ino) {}
+	index(dev_t d, ino_t i) : pair(d, i) {}
 	std::size_t hash() const { return static_cast<std::size_t>(first) + static_cast<std::size_t>(second); }
 };
 
 struct bundle;
 
 typedef std::set<bundle *> bundle_pointer_set;
-typedef std::list<bundle *> bundle_pointer_list;
+typedef std::vector<bundle *> bundle_pointer_vector;
 
 struct bundle {
 	bundle() :
@@ -65,8 +69,11 @@ struct bundle {
 		primary_target(false),
 		use_hangup(false),
 		use_final_kill(false),
-		order(-1),
 		wants(WANT_NONE),
+		pending_predecessors(0U),
+		unblocked_at(0.0),
+		done_at(0.0),
+		last_predecessor(nullptr),
 		job_state(INITIAL)
 	{
 	}
@@ -86,9 +93,12 @@ struct bundle {
 	int bundle_dir_fd, supervise_dir_fd, service_dir_fd, status_file_fd;
 	std::string path, name;
 	bool ss_scanned, primary_target, use_hangup, use_final_kill;
-	int order;
 	unsigned wants;
 	bundle_pointer_set sort_after;
+	bundle_pointer_vector sort_before;	///< the inverse of sort_after
+	std::size_t pending_predecessors;	///< the number of sort_after bundles not yet done
+	double unblocked_at, done_at;		///< seconds since jobs processing began
+	bundle * last_predecessor;		///< the predecessor whose completion unblocked this, on the critical path
 
 	bool done() const { return job_state >= DONE; }
 	bool initial() const { return job_state < BLOCKED; }
@@ -120,6 +130,7 @@ struct bundle {
 	void start_initial() { start(supervise_dir_fd); }
 	bool has_started() const;
 	bool has_stopped() const;
+	bool has_finished() const;
 	void print_event(const char *, ECMA48Output &, enum event) const;
 protected:
 	// Our state machine guarantees that state transitions only ever increase the state value.
@@ -161,6 +172,17 @@ bundle::has_stopped() const
 	return 0 <= supervise_dir_fd && (!is_ok(supervise_dir_fd) || 0 < stopped_status_file(status_file_fd));
 }
 
+inline
+bool
+bundle::has_finished() const
+{
+	switch (wants) {
+		case WANT_START:	return has_started();
+		case WANT_STOP:		return has_stopped();
+		default:		return true;
+	}
+}
+
 inline
 const char *
 bundle::name_of (
@@ -345,11 +367,21 @@ add_primary_target_bundles (
 inline
 void
 add_related_bundles (
+	BundleRelationCache & relations,
 	bundle_info_map & bundles,
 	const bundle & b,
 	const char * subdir_name,
 	int want
 ) {
+	BundleRelationCache::edges edges;
+	if (relations.get(b.bundle_dir_fd, subdir_name, edges)) {
+		for (BundleRelationCache::edges::const_iterator i(edges.begin()), e(edges.end()); e != i; ++i) {
+			const int dir_fd(open_dir_at(b.bundle_dir_fd, (subdir_name + i->name).c_str()));
+			if (0 > dir_fd) continue;
+			add_bundle(bundles, dir_fd, (b.path + b.name + "/") + subdir_name, i->name, want);
+		}
+		return;
+	}
 	FileDescriptorOwner subdir_fd(open_dir_at(b.bundle_dir_fd, subdir_name));
 	if (0 > subdir_fd.get()) return;
 	const DirStar subdir_dir(subdir_fd);
@@ -385,11 +417,29 @@ lookup_without_adding (
 inline
 bundle_pointer_set
 lookup_without_adding (
+	BundleRelationCache & relations,
 	bundle_info_map & bundles,
 	const bundle & b,
 	const char * subdir_name
 ) {
 	bundle_pointer_set r;
+	BundleRelationCache::edges edges;
+	if (relations.get(b.bundle_dir_fd, subdir_name, edges)) {
+		for (BundleRelationCache::edges::const_iterator i(edges.begin()), e(edges.end()); e != i; ++i) {
+			// The cached identity saves opening the entry if it names a bundle that we already have.
+			// It might be out of date, if the bundle has been replaced, so anything else is looked up the slow way.
+			const bundle_info_map::iterator bundle_i(bundles.find(index(i->dev, i->ino)));
+			if (i->ino && bundles.end() != bundle_i) {
+				r.insert(&bundle_i->second);
+				continue;
+			}
+			const FileDescriptorOwner dir_fd(open_dir_at(b.bundle_dir_fd, (subdir_name + i->name).c_str()));
+			if (0 > dir_fd.get()) continue;
+			if (bundle * p = lookup_without_adding(bundles, dir_fd.get()))
+				r.insert(p);
+		}
+		return r;
+	}
 	FileDescriptorOwner subdir_fd(open_dir_at(b.bundle_dir_fd, subdir_name));
 	if (0 > subdir_fd.get()) return r;
 	const DirStar subdir_dir(subdir_fd);
@@ -409,39 +459,40 @@ lookup_without_adding (
 	return r;
 }
 
+/// Kahn's algorithm, which yields predecessors before successors in O(bundles + orderings) and leaves any ordering loops unsorted.
 void
-mark_paths_in_order (
-	bundle * parent,
-	bundle * b
+topological_sort (
+	const char * prog,
+	const bundle_pointer_set & unsorted,
+	bundle_pointer_vector & sorted
 ) {
-	if (0 == b->order) {
-		std::fprintf(stderr, "%s: %s: %s\n", parent ? parent->name.c_str() : "", b->name.c_str(), "Ordering loop.");
-		return;
+	std::deque<bundle *> ready;
+	for (bundle_pointer_set::const_iterator i(unsorted.begin()); unsorted.end() != i; ++i) {
+		bundle * b(*i);
+		b->pending_predecessors = b->sort_after.size();
+		if (0U == b->pending_predecessors)
+			ready.push_back(b);
 	}
-	if (0 > b->order) {
-		b->order = 0;	// fencepost "marking in progress" value
-		const bundle_pointer_set & a(b->sort_after);
-		for (bundle_pointer_set::const_iterator j(a.begin()); a.end() != j; ++j) {
-			bundle * p(*j);
-			mark_paths_in_order(b, p);
-			if (p->order > b->order) b->order = p->order;
+	sorted.clear();
+	sorted.reserve(unsorted.size());
+	while (!ready.empty()) {
+		bundle * b(ready.front());
+		ready.pop_front();
+		sorted.push_back(b);
+		for (bundle_pointer_vector::const_iterator j(b->sort_before.begin()); b->sort_before.end() != j; ++j) {
+			bundle * s(*j);
+			if (0U == --s->pending_predecessors)
+				ready.push_back(s);
 		}
-		++b->order;	// Never assigns order zero.
 	}
-}
-
-void
-insertion_sort (
-	bundle_pointer_list & sorted,
-	bundle * b
-) {
-	for (bundle_pointer_list::iterator j(sorted.begin()); sorted.end() != j; ++j) {
-		if ((*j)->order > b->order) {
-			sorted.insert(j, b);
-			return;
+	if (sorted.size() < unsorted.size()) {
+		for (bundle_pointer_set::const_iterator i(unsorted.begin()); unsorted.end() != i; ++i) {
+			bundle * b(*i);
+			if (0U == b->pending_predecessors) continue;
+			std::fprintf(stderr, "%s: %s: %s\n", prog, b->name.c_str(), "Ordering loop.");
+			sorted.push_back(b);
 		}
 	}
-	sorted.push_back(b);
 }
 
 inline
@@ -461,13 +512,15 @@ make_symlink_target (
 	mkdirat(bundle_dir_fd, buf.data(), mode);
 }
 
+/// Add the commands to load a service, if it is not already loaded, to a batch.
+/// \returns false if the service needs to be waited for once the batch has been sent
 inline
 bool
 load (
 	const char * prog,
 	ECMA48Output & o,
 	bundle & b,
-	const int socket_fd,
+	ServiceManagerBatch & batch,
 	const int supervise_dir_fd,
 	const int service_dir_fd,
 	const std::string name,
@@ -484,11 +537,96 @@ load (
 	}
 	if (pretending) return true;
 	make_supervise_fifos (supervise_dir_fd);
-	::load(prog, socket_fd, name.c_str(), supervise_dir_fd, service_dir_fd);
+	batch.load(name.c_str(), supervise_dir_fd, service_dir_fd);
 	if (run_on_empty)
-		make_run_on_empty(prog, socket_fd, supervise_dir_fd);
-	make_pipe_connectable(prog, socket_fd, supervise_dir_fd);
-	return wait_ok(supervise_dir_fd, 5000);
+		batch.make_run_on_empty(supervise_dir_fd);
+	batch.make_pipe_connectable(supervise_dir_fd);
+	return false;
+}
+
+inline
+double
+seconds_since (
+	const timespec & start
+) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1E9;
+}
+
+/// Take whatever action is appropriate upon the job for a bundle entering its current state.
+inline
+void
+enact (
+	const char * prog,
+	ECMA48Output & o,
+	bundle & b
+) {
+	if (!b.needs_action()) return;
+	switch (b.wants) {
+		case bundle::WANT_START:
+		{
+			if (0 > b.supervise_dir_fd) break;
+			const bool was_already_loaded(is_ok(b.supervise_dir_fd));
+			if (!was_already_loaded)
+				b.print_event(prog, o, b.CANNOT_START);
+			else
+			if (b.needs_initial_action()) {
+				if (verbose)
+					b.print_event(prog, o, b.IS_START);
+				if (!pretending)
+					b.start_initial();
+			}
+			break;
+		}
+		case bundle::WANT_STOP:
+		{
+			if (0 > b.supervise_dir_fd) break;
+			const bool was_already_loaded(is_ok(b.supervise_dir_fd));
+			if (!was_already_loaded)
+				b.print_event(prog, o, b.CANNOT_STOP);
+			else
+			if (b.needs_hardest_action()) {
+				if (verbose)
+					b.print_event(prog, o, b.STOP_HARDEST);
+				if (!pretending)
+					b.stop_hardest();
+			} else
+			if (b.needs_harder_action()) {
+				if (verbose)
+					b.print_event(prog, o, b.STOP_HARDER);
+				if (!pretending)
+					b.stop_harder();
+			} else
+			if (b.needs_initial_action()) {
+				if (verbose)
+					b.print_event(prog, o, b.IS_STOP);
+				if (!pretending)
+					b.stop_initial();
+			}
+			break;
+		}
+	}
+}
+
+void
+print_timings (
+	const char * prog,
+	const bundle_pointer_vector & finished
+) {
+	for (bundle_pointer_vector::const_iterator i(finished.begin()); finished.end() != i; ++i) {
+		const bundle & b(**i);
+		std::fprintf(stderr, "%s: timing: %s%s: unblocked %.3fs done %.3fs took %.3fs\n", prog, b.path.c_str(), b.name.c_str(), b.unblocked_at, b.done_at, b.done_at - b.unblocked_at);
+	}
+	if (finished.empty()) return;
+	// The critical path is the chain of last-finishing predecessors back from whatever job finished last.
+	bundle_pointer_vector path;
+	for (bundle * p(finished.back()); p; p = p->last_predecessor)
+		path.push_back(p);
+	for (bundle_pointer_vector::const_reverse_iterator i(path.rbegin()); path.rend() != i; ++i) {
+		const bundle & b(**i);
+		std::fprintf(stderr, "%s: critical path: %s%s: %.3fs (+%.3fs)\n", prog, b.path.c_str(), b.name.c_str(), b.done_at, b.done_at - b.unblocked_at);
+	}
 }
 
 }
@@ -520,6 +658,7 @@ start_stop_common [[gnu::noreturn]] (
 	if (0 > socket_fd.get()) throw EXIT_FAILURE;
 
 	// Create the list of primary target bundles from the command-line arguments, then add in all of the bundles that they relate to.
+	BundleRelationCache relations;
 	bundle_info_map bundles;
 	add_primary_target_bundles(prog, envs, bundles, args, want);
 	for (;;) {
@@ -531,14 +670,14 @@ start_stop_common [[gnu::noreturn]] (
 					case bundle::WANT_NONE:
 						break;
 					case bundle::WANT_START:
-						add_related_bundles(bundles, i->second, "wants/", START);
-						add_related_bundles(bundles, i->second, "conflicts/", STOP);
+						add_related_bundles(relations, bundles, i->second, "wants/", START);
+						add_related_bundles(relations, bundles, i->second, "conflicts/", STOP);
 						break;
 					case bundle::WANT_STOP:
 #if 0 /// TODO \todo Maybe, in the future.
-						add_related_bundles(bundles, i->second, "on-stop/", START);
+						add_related_bundles(relations, bundles, i->second, "on-stop/", START);
 #endif
-						add_related_bundles(bundles, i->second, "required-by/", STOP);
+						add_related_bundles(relations, bundles, i->second, "required-by/", STOP);
 						break;
 				}
 				done_one = true;
@@ -567,8 +706,8 @@ start_stop_common [[gnu::noreturn]] (
 	// This is complicated by the fact that ordering depends from whether a predecessor/successor is being started or stopped and whether this bundle is being started or stopped.
 	bundle_pointer_set unsorted;
 	for (bundle_info_map::iterator i(bundles.begin()); bundles.end() != i; ++i) {
-		const bundle_pointer_set a(lookup_without_adding(bundles, i->second, "after/"));
-		const bundle_pointer_set b(lookup_without_adding(bundles, i->second, "before/"));
+		const bundle_pointer_set a(lookup_without_adding(relations, bundles, i->second, "after/"));
+		const bundle_pointer_set b(lookup_without_adding(relations, bundles, i->second, "before/"));
 		switch (i->second.wants) {
 			case bundle::WANT_START:
 				for (bundle_pointer_set::const_iterator j(a.begin()); a.end() != j; ++j) {
@@ -628,19 +767,23 @@ start_stop_common [[gnu::noreturn]] (
 		unsorted.insert(&i->second);
 	}
 
+	for (bundle_pointer_set::const_iterator i(unsorted.begin()); unsorted.end() != i; ++i) {
+		bundle * b(*i);
+		for (bundle_pointer_set::const_iterator j(b->sort_after.begin()); b->sort_after.end() != j; ++j)
+			(*j)->sort_before.push_back(b);
+	}
+
 	// Do a topological sort on the bundles.
-	// This isn't strictly necessary, as checks in the enacting loop will ensure that no bundle has action taken if a predecessor action has yet to happen.
+	// This isn't strictly necessary, as the enacting loop will ensure that no bundle has action taken if a predecessor action has yet to happen.
 	// But for large targets, with lots of prerequisites, this yields a consistent and fairly sensible ordering of actions in the log output, for humans.
-	for (bundle_pointer_set::const_iterator i(unsorted.begin()); unsorted.end() != i; ++i)
-		mark_paths_in_order(nullptr, *i);
-	bundle_pointer_list sorted;
-	for (bundle_pointer_set::const_iterator i(unsorted.begin()); unsorted.end() != i; ++i)
-		insertion_sort(sorted, *i);
+	bundle_pointer_vector sorted;
+	topological_sort(prog, unsorted, sorted);
+	relations.save();
 
 	// Make the various "supervise" directories, if they are in a RAM volume, and open file descriptors for them.
 	umask(0022);
 	bool any_missing_supervise(false);
-	for (bundle_pointer_list::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+	for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
 		bundle & b(**i);
 		if (bundle::WANT_NONE == b.wants) continue;
 		make_symlink_target(b.bundle_dir_fd, "supervise", 0755);
@@ -660,40 +803,82 @@ start_stop_common [[gnu::noreturn]] (
 	// Load any services (into the service manager) that are about to be started but that are not already loaded.
 	// Do the same for their log services, even if those log services are not part of the calculated bundle set.
 	// This is because the service manager must have the log service loaded in order to plumb the main service's output to the right place, even if the log service isn't being acted upon here.
+	// The commands for all of the services go to the service manager in as few messages as possible, and only then is anything waited for.
+	// A log service is only loaded once its main service is known to have loaded, and only plumbed to once it is itself known to have loaded.
 	bool any_not_loaded(false);
-	for (bundle_pointer_list::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
-		bundle & b(**i);
-		if (bundle::WANT_START != b.wants) continue;
-		if (0 > b.supervise_dir_fd) continue;
+	bundle_pointer_set not_loaded;
+	std::vector<bundle *> loading;
+	{
+		ServiceManagerBatch batch(prog, socket_fd.get());
+		for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+			bundle & b(**i);
+			if (bundle::WANT_START != b.wants) continue;
+			if (0 > b.supervise_dir_fd) continue;
 
-		if (!load(prog, o, b, socket_fd.get(), b.supervise_dir_fd, b.service_dir_fd, b.name, b.LOAD, b.RUN_ON_EMPTY)) {
+			if (!load(prog, o, b, batch, b.supervise_dir_fd, b.service_dir_fd, b.name, b.LOAD, b.RUN_ON_EMPTY))
+				loading.push_back(&b);
+		}
+		batch.flush();
+	}
+	for (std::vector<bundle *>::const_iterator i(loading.begin()); loading.end() != i; ++i) {
+		bundle & b(**i);
+		if (!wait_ok(b.supervise_dir_fd, 5000)) {
 			std::fprintf(stderr, "%s: ERROR: %s/%s/%s: %s\n", prog, b.path.c_str(), b.name.c_str(), "ok", "Unable to load service bundle.");
+			not_loaded.insert(&b);
 			if (b.primary_target)
 				any_not_loaded = true;
 			else
 				b.wants = b.WANT_NONE;
-			continue;
 		}
-		const FileDescriptorOwner log_bundle_dir_fd(open_dir_at(b.bundle_dir_fd, "log/"));
-		if (0 <= log_bundle_dir_fd.get()) {
+	}
+	std::vector<bundle *> logged, log_loading;
+	{
+		ServiceManagerBatch batch(prog, socket_fd.get());
+		for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+			bundle & b(**i);
+			if (bundle::WANT_START != b.wants) continue;
+			if (0 > b.supervise_dir_fd) continue;
+			if (not_loaded.end() != not_loaded.find(&b)) continue;
+
+			const FileDescriptorOwner log_bundle_dir_fd(open_dir_at(b.bundle_dir_fd, "log/"));
+			if (0 > log_bundle_dir_fd.get()) continue;
 			const FileDescriptorOwner log_supervise_dir_fd(open_supervise_dir(log_bundle_dir_fd.get()));
 			const FileDescriptorOwner log_service_dir_fd(open_service_dir(log_bundle_dir_fd.get()));
-			if (0 <= log_supervise_dir_fd.get() && 0 <= log_service_dir_fd.get()) {
-				const std::string log_name(b.name + "/log");
-				if (!load(prog, o, b, socket_fd.get(), log_supervise_dir_fd.get(), log_service_dir_fd.get(), log_name, b.LOG_LOAD, b.LOG_RUN_ON_EMPTY)) {
-					std::fprintf(stderr, "%s: ERROR: %s/%s/%s: %s\n", prog, b.path.c_str(), log_name.c_str(), "ok", "Unable to load service bundle.");
-					continue;
-				}
-				if (!pretending)
-					plumb(prog, socket_fd.get(), b.supervise_dir_fd, log_supervise_dir_fd.get());
-			}
+			if (0 > log_supervise_dir_fd.get() || 0 > log_service_dir_fd.get()) continue;
+			const std::string log_name(b.name + "/log");
+			logged.push_back(&b);
+			if (!load(prog, o, b, batch, log_supervise_dir_fd.get(), log_service_dir_fd.get(), log_name, b.LOG_LOAD, b.LOG_RUN_ON_EMPTY))
+				log_loading.push_back(&b);
+		}
+		batch.flush();
+	}
+	bundle_pointer_set log_not_loaded;
+	for (std::vector<bundle *>::const_iterator i(log_loading.begin()); log_loading.end() != i; ++i) {
+		bundle & b(**i);
+		const FileDescriptorOwner log_bundle_dir_fd(open_dir_at(b.bundle_dir_fd, "log/"));
+		const FileDescriptorOwner log_supervise_dir_fd(0 > log_bundle_dir_fd.get() ? -1 : open_supervise_dir(log_bundle_dir_fd.get()));
+		if (0 > log_supervise_dir_fd.get() || !wait_ok(log_supervise_dir_fd.get(), 5000)) {
+			std::fprintf(stderr, "%s: ERROR: %s/%s/%s/%s: %s\n", prog, b.path.c_str(), b.name.c_str(), "log", "ok", "Unable to load service bundle.");
+			log_not_loaded.insert(&b);
 		}
 	}
+	if (!pretending) {
+		ServiceManagerBatch batch(prog, socket_fd.get());
+		for (std::vector<bundle *>::const_iterator i(logged.begin()); logged.end() != i; ++i) {
+			bundle & b(**i);
+			if (log_not_loaded.end() != log_not_loaded.find(&b)) continue;
+			const FileDescriptorOwner log_bundle_dir_fd(open_dir_at(b.bundle_dir_fd, "log/"));
+			const FileDescriptorOwner log_supervise_dir_fd(0 > log_bundle_dir_fd.get() ? -1 : open_supervise_dir(log_bundle_dir_fd.get()));
+			if (0 <= log_supervise_dir_fd.get())
+				batch.plumb(b.supervise_dir_fd, log_supervise_dir_fd.get());
+		}
+		batch.flush();
+	}
 	if (any_not_loaded) throw EXIT_FAILURE;
 
 	// Open all of the status files.
 	bool any_status_not_opened(false);
-	for (bundle_pointer_list::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+	for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
 		bundle & b(**i);
 		if (0 > b.supervise_dir_fd) continue;
 		b.status_file_fd = open_read_at(b.supervise_dir_fd, "status");
@@ -708,124 +893,136 @@ start_stop_common [[gnu::noreturn]] (
 	}
 	if (any_status_not_opened) throw EXIT_FAILURE;
 
+	// Set up the job engine.
+	// Jobs that are already finished are done from the outset.
+	// Every other job counts its unfinished predecessors, and is watched for changes to its status file, which is how it learns that it has finished.
+	// Jobs with no unfinished predecessors go onto the ready queue, and thereafter jobs only go onto the ready queue when their last predecessor finishes.
+	timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	std::deque<bundle *> ready;
+	bundle_pointer_set in_progress;
+	bundle_pointer_vector finished;
+	std::unordered_map<int, bundle *> bundle_for_status_file;
+	std::size_t pending(0U);
+	for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+		bundle & b(**i);
+		if (b.has_finished()) {
+			if (verbose)
+				b.print_event(prog, o, bundle::WANT_START == b.wants ? b.IS_READY: b.IS_DONE);
+			b.mark_done();
+		}
+	}
+	for (bundle_pointer_vector::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
+		bundle & b(**i);
+		if (b.done()) continue;
+		++pending;
+		b.pending_predecessors = 0U;
+		for (bundle_pointer_set::const_iterator j(b.sort_after.begin()); b.sort_after.end() != j; ++j) {
+			bundle * p(*j);
+			if (p->done()) continue;
+			if (verbose && 0U == b.pending_predecessors) {
+				b.print_event(prog, o, b.IS_BLOCKED);
+				p->print_event(prog, o, p->IS_BLOCKING);
+			}
+			++b.pending_predecessors;
+		}
+		if (0U == b.pending_predecessors)
+			ready.push_back(&b);
+		else
+			b.mark_blocked();
+		if (0 <= b.status_file_fd) {
+			bundle_for_status_file[b.status_file_fd] = &b;
+			struct kevent k;
+			set_event(k, b.status_file_fd, EVFILT_VNODE, EV_ADD|EV_ENABLE|EV_CLEAR, NOTE_WRITE, 0, nullptr);
+			kevent(queue.get(), &k, 1, nullptr, 0, nullptr);
+		}
+	}
+
 	// The main enacting loop; where we keep trying to start/stop any remaining services with pending actions until no more are left.
+	// Each wakeup only looks at the jobs that it concerns, and at stop jobs in progress; only a full second without any wakeups at all touches every job in progress.
 	timespec one_second;
-	bool timed_out(true);
 	one_second.tv_sec = 1;
 	one_second.tv_nsec = 0;
 	std::vector<struct kevent> revents(256);
+	std::vector<bundle *> changed;
 	for (;;) {
-		bool any_more_pending(false);
-		for (bundle_pointer_list::const_iterator i(sorted.begin()); sorted.end() != i; ++i) {
-			bundle & b(**i);
-
-			// Check for any outward transitions that we can make.
-
-			// Finishing the action transitions the state machine to the done state from any state.
-			if (!b.done()) {
-				bool is_done(true);
-				switch (b.wants) {
-					case bundle::WANT_START:	is_done = b.has_started(); break;
-					case bundle::WANT_STOP:		is_done = b.has_stopped(); break;
-				}
-				if (is_done) {
-					if (verbose)
-						b.print_event(prog, o, bundle::WANT_START == b.wants ? b.IS_READY: b.IS_DONE);
-					b.mark_done();
-					struct kevent k;
-					set_event(k, b.status_file_fd, EVFILT_VNODE, EV_DELETE|EV_DISABLE, NOTE_WRITE, 0, nullptr);
-					kevent(queue.get(), &k, 1, nullptr, 0, nullptr);
+		// Finishing the action transitions the state machine to the done state from any state, and unblocks successors.
+		while (!changed.empty()) {
+			bundle & b(*changed.back());
+			changed.pop_back();
+			if (b.done() || !b.has_finished()) continue;
+			if (verbose)
+				b.print_event(prog, o, bundle::WANT_START == b.wants ? b.IS_READY: b.IS_DONE);
+			b.mark_done();
+			b.done_at = seconds_since(start_time);
+			finished.push_back(&b);
+			in_progress.erase(&b);
+			--pending;
+			if (0 <= b.status_file_fd) {
+				bundle_for_status_file.erase(b.status_file_fd);
+				struct kevent k;
+				set_event(k, b.status_file_fd, EVFILT_VNODE, EV_DELETE|EV_DISABLE, NOTE_WRITE, 0, nullptr);
+				kevent(queue.get(), &k, 1, nullptr, 0, nullptr);
+			}
+			for (bundle_pointer_vector::const_iterator j(b.sort_before.begin()); b.sort_before.end() != j; ++j) {
+				bundle * s(*j);
+				if (s->done() || 0U == s->pending_predecessors) continue;
+				if (0U == --s->pending_predecessors) {
+					s->last_predecessor = &b;
+					ready.push_back(s);
 				}
 			}
+		}
+		// All dependencies finishing causes transition from BLOCKED to ACTIONED.
+		if (!ready.empty()) {
+			bundle & b(*ready.front());
+			ready.pop_front();
 			if (b.done()) continue;
-			any_more_pending = true;
-			if (b.blocked()) {
-				// All dependencies finishing causes transition from BLOCKED to ACTIONED.
-				bool is_blocked(false);
-				const bundle_pointer_set & a(b.sort_after);
-				for (bundle_pointer_set::const_iterator j(a.begin()); a.end() != j; ++j) {
-					bundle * p(*j);
-					if (!p->done()) {
-						if (verbose && b.initial()) {
-							b.print_event(prog, o, b.IS_BLOCKED);
-							p->print_event(prog, o, p->IS_BLOCKING);
-						}
-						is_blocked = true;
-						break;
-					}
-				}
-				if (is_blocked) {
-					if (b.initial())
-						b.mark_blocked();
+			if (verbose)
+				b.print_event(prog, o, b.IS_UNBLOCKED);
+			b.mark_unblocked();
+			b.unblocked_at = seconds_since(start_time);
+			in_progress.insert(&b);
+			enact(prog, o, b);
+			// The action might have finished the job already.
+			changed.push_back(&b);
+			continue;
+		}
+		if (!pending) break;
+		const int ne(kevent(queue.get(), nullptr, 0, revents.data(), revents.size(), &one_second));
+		if (0 < ne) {
+			for (std::size_t i(0U); i < std::size_t(ne); ++i) {
+				const struct kevent & e(revents[i]);
+				if (EVFILT_VNODE != e.filter) continue;
+				std::unordered_map<int, bundle *>::const_iterator j(bundle_for_status_file.find(static_cast<int>(e.ident)));
+				if (bundle_for_status_file.end() != j)
+					changed.push_back(j->second);
+			}
+			// A stop job also finishes when its service is unloaded, which writes no status file, so stop jobs are rechecked on every wakeup.
+			for (bundle_pointer_set::const_iterator i(in_progress.begin()); in_progress.end() != i; ++i) {
+				bundle & b(**i);
+				if (bundle::WANT_STOP == b.wants)
+					changed.push_back(&b);
+			}
+		} else
+		if (0 == ne) {
+			// Timing out transitions all states at ACTIONED and above to the next state.
+			// Jobs can finish without their status files changing (e.g. by being unloaded), so they are all rechecked, too.
+			for (bundle_pointer_set::const_iterator i(in_progress.begin()); in_progress.end() != i; ++i) {
+				bundle & b(**i);
+				if (b.has_finished()) {
+					changed.push_back(&b);
 					continue;
 				}
-				if (verbose)
-					b.print_event(prog, o, b.IS_UNBLOCKED);
-				b.mark_unblocked();
-				struct kevent k;
-				set_event(k, b.status_file_fd, EVFILT_VNODE, EV_ADD|EV_ENABLE|EV_CLEAR, NOTE_WRITE, 0, nullptr);
-				kevent(queue.get(), &k, 1, nullptr, 0, nullptr);
-			} else {
-				// Timing out transitions all states at ACTIONED and above to the next state.
-				if (!timed_out) continue;
 				b.tick();
-			}
-
-			// At this point, we have just transitioned into a new state.
-			// Check for actions on entering the state.
-
-			if (b.needs_action()) {
-				switch (b.wants) {
-					case bundle::WANT_START:
-					{
-						if (0 > b.supervise_dir_fd) break;
-						const bool was_already_loaded(is_ok(b.supervise_dir_fd));
-						if (!was_already_loaded)
-							b.print_event(prog, o, b.CANNOT_START);
-						else
-						if (b.needs_initial_action()) {
-							if (verbose)
-								b.print_event(prog, o, b.IS_START);
-							if (!pretending)
-								b.start_initial();
-						}
-						break;
-					}
-					case bundle::WANT_STOP:
-					{
-						if (0 > b.supervise_dir_fd) break;
-						const bool was_already_loaded(is_ok(b.supervise_dir_fd));
-						if (!was_already_loaded)
-							b.print_event(prog, o, b.CANNOT_STOP);
-						else
-						if (b.needs_hardest_action()) {
-							if (verbose)
-								b.print_event(prog, o, b.STOP_HARDEST);
-							if (!pretending)
-								b.stop_hardest();
-						} else
-						if (b.needs_harder_action()) {
-							if (verbose)
-								b.print_event(prog, o, b.STOP_HARDER);
-							if (!pretending)
-								b.stop_harder();
-						} else
-						if (b.needs_initial_action()) {
-							if (verbose)
-								b.print_event(prog, o, b.IS_STOP);
-							if (!pretending)
-								b.stop_initial();
-						}
-						break;
-					}
-				}
+				enact(prog, o, b);
 			}
 		}
-		if (!any_more_pending) break;
-		const int ne(kevent(queue.get(), nullptr, 0, revents.data(), revents.size(), &one_second));
-		timed_out = 0 == ne;
 	}
 
+	if (timing)
+		print_timings(prog, finished);
+
 	throw EXIT_SUCCESS;
 }
 
@@ -842,11 +1039,13 @@ activate [[gnu::noreturn]] (
 		popt::bool_definition colours_option('\0', "colour", "Force output in colour even if standard error is not a terminal.", colours);
 		popt::bool_definition verbose_option('v', "verbose", "Display verbose information.", verbose);
 		popt::bool_definition pretending_option('n', "pretend", "Pretend to take action, without telling the service manager to do anything.", pretending);
+		popt::bool_definition timing_option('\0', "timing", "Display how long each job took, and the critical path, at the end.", timing);
 		popt::definition * main_table[] = {
 			&user_option,
 			&colours_option,
 			&verbose_option,
-			&pretending_option
+			&pretending_option,
+			&timing_option
 		};
 		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "[service(s)...]");
 
@@ -876,11 +1075,13 @@ deactivate [[gnu::noreturn]] (
 		popt::bool_definition colours_option('\0', "colour", "Force output in colour even if standard error is not a terminal.", colours);
 		popt::bool_definition verbose_option('v', "verbose", "Display verbose information.", verbose);
 		popt::bool_definition pretending_option('n', "pretend", "Pretend to take action, without telling the service manager to do anything.", pretending);
+		popt::bool_definition timing_option('\0', "timing", "Display how long each job took, and the critical path, at the end.", timing);
 		popt::definition * main_table[] = {
 			&user_option,
 			&colours_option,
 			&verbose_option,
-			&pretending_option
+			&pretending_option,
+			&timing_option
 		};
 		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "[service(s)...]");
 
@@ -910,11 +1111,13 @@ isolate [[gnu::noreturn]] (
 		popt::bool_definition colours_option('\0', "colour", "Force output in colour even if standard error is not a terminal.", colours);
 		popt::bool_definition verbose_option('v', "verbose", "Display verbose information.", verbose);
 		popt::bool_definition pretending_option('n', "pretend", "Pretend to take action, without telling the service manager to do anything.", pretending);
+		popt::bool_definition timing_option('\0', "timing", "Display how long each job took, and the critical path, at the end.", timing);
 		popt::definition * main_table[] = {
 			&user_option,
 			&colours_option,
 			&verbose_option,
-			&pretending_option
+			&pretending_option,
+			&timing_option
 		};
 		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "[service(s)...]");
 
@@ -944,11 +1147,13 @@ reset [[gnu::noreturn]] (
 		popt::bool_definition colours_option('\0', "colour", "Force output in colour even if standard error is not a terminal.", colours);
 		popt::bool_definition verbose_option('v', "verbose", "Display verbose information.", verbose);
 		popt::bool_definition pretending_option('n', "pretend", "Pretend to take action, without telling the service manager to do anything.", pretending);
+		popt::bool_definition timing_option('\0', "timing", "Display how long each job took, and the critical path, at the end.", timing);
 		popt::definition * main_table[] = {
 			&user_option,
 			&colours_option,
 			&verbose_option,
-			&pretending_option
+			&pretending_option,
+			&timing_option
 		};
 		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table, main_table, "Main options", "[service(s)...]");
 
@@ -11,10 +11,13 @@ For copyright and licensing terms, see the file named COPYING.
 #include <csignal>
 #include <cstring>
 #include <cerrno>
-#include <iostream>
+#include <cstdio>
+#include <cstddef>
+#include <ctime>
 #include <sys/types.h>
 #include "kqueue_common.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
 #include <netinet/ip.h>
@@ -29,51 +32,200 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
-static inline
-void
-process_message (
-	const char * prog,
-	int socket_fd
+#if defined(__LINUX__) || defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__)
+#	define HAS_RECVMMSG 1
+#else
+#	define HAS_RECVMMSG 0
+#endif
+
+namespace {
+
+#if !HAS_RECVMMSG
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+inline
+int
+recvmmsg (
+	int socket_fd,
+	struct mmsghdr * v,
+	unsigned int n,
+	int flags,
+	struct timespec *
 ) {
-	char msg[65536];	// RFC 5426 maximum legal size
-	union {
-		sockaddr_storage s;
-		sockaddr_un u;
-	} remoteaddr;
-	socklen_t addrlen(sizeof remoteaddr);
-	const int rc(recvfrom(socket_fd, &msg, sizeof msg, 0, reinterpret_cast<sockaddr *>(&remoteaddr), &addrlen));
-	if (0 > rc) {
-		const int error(errno);
-		std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, "recvfrom", std::strerror(error));
-		return;
+	unsigned int i(0U);
+	while (i < n) {
+		const ssize_t rc(recvmsg(socket_fd, &v[i].msg_hdr, flags));
+		if (0 > rc) {
+			if (i > 0U && (EAGAIN == errno || EWOULDBLOCK == errno)) break;
+			return 0U == i ? -1 : static_cast<int>(i);
+		}
+		v[i++].msg_len = rc;
+	}
+	return i;
+}
+#endif
+
+/// Datagrams are received, as many at a time as are waiting, straight into a set of preallocated slots.
+/// A single writev() then sends all of them, with their prefixes and terminators, to the log pipe.
+/// Nothing is copied, and a slot is only reused after its message has been written.
+class Batch
+{
+public:
+	Batch();
+	bool empty() const { return 0U == count; }
+	bool full() const { return SLOTS <= count; }
+	void receive(const char * prog, int socket_fd);
+	void flush(const char * prog);
+	const timespec & first_received() const { return first; }
+protected:
+	enum { SLOTS = 32U, SLOT_SIZE = 65536U /* RFC 5426 maximum legal size */ };
+	struct slot {
+		union {
+			sockaddr_storage s;
+			sockaddr_un u;
+		} remoteaddr;
+		iovec message;
+		char prefix[sizeof sockaddr_un::sun_path + INET6_ADDRSTRLEN + sizeof ":65535: "];
+	};
+	std::vector<char> buffers;
+	slot slots[SLOTS];
+	mmsghdr headers[SLOTS];
+	iovec output[SLOTS * 3U];
+	std::size_t count;
+	timespec first;
+
+	void set_prefix(slot &, socklen_t);
+};
+
+Batch::Batch(
+) :
+	buffers(SLOTS * SLOT_SIZE),
+	count(0U)
+{
+	for (std::size_t i(0U); i < SLOTS; ++i) {
+		slot & s(slots[i]);
+		s.message.iov_base = buffers.data() + i * SLOT_SIZE;
+		s.message.iov_len = SLOT_SIZE;
+		msghdr & m(headers[i].msg_hdr);
+		std::memset(&m, 0, sizeof m);
+		m.msg_iov = &s.message;
+		m.msg_iovlen = 1;
 	}
-	switch (remoteaddr.s.ss_family) {
+}
+
+inline
+void
+Batch::set_prefix (
+	slot & s,
+	socklen_t addrlen
+) {
+	s.prefix[0] = '\0';
+	switch (s.remoteaddr.s.ss_family) {
 		case AF_INET:
 		{
-			const struct sockaddr_in & remoteaddr4(*reinterpret_cast<const struct sockaddr_in *>(&remoteaddr));
+			const struct sockaddr_in & remoteaddr4(*reinterpret_cast<const struct sockaddr_in *>(&s.remoteaddr));
 			char ip[INET_ADDRSTRLEN];
 			if (nullptr != inet_ntop(remoteaddr4.sin_family, &remoteaddr4.sin_addr, ip, sizeof ip))
-				std::cout << ip << ':' << ntohs(remoteaddr4.sin_port) << ": ";
+				std::snprintf(s.prefix, sizeof s.prefix, "%s:%u: ", ip, ntohs(remoteaddr4.sin_port));
 			break;
 		}
 		case AF_INET6:
 		{
-			const struct sockaddr_in6 & remoteaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(&remoteaddr));
+			const struct sockaddr_in6 & remoteaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(&s.remoteaddr));
 			char ip[INET6_ADDRSTRLEN];
 			if (nullptr != inet_ntop(remoteaddr6.sin6_family, &remoteaddr6.sin6_addr, ip, sizeof ip))
-				std::cout << ip << ':' << ntohs(remoteaddr6.sin6_port) << ": ";
+				std::snprintf(s.prefix, sizeof s.prefix, "%s:%u: ", ip, ntohs(remoteaddr6.sin6_port));
 			break;
 		}
 		case AF_LOCAL:
 		{
-			if (addrlen > offsetof(sockaddr_un, sun_path) && remoteaddr.u.sun_path[0])
-				std::cout << remoteaddr.u.sun_path << ": ";
+			if (addrlen > offsetof(sockaddr_un, sun_path) && s.remoteaddr.u.sun_path[0]) {
+				const std::size_t l(strnlen(s.remoteaddr.u.sun_path, addrlen - offsetof(sockaddr_un, sun_path)));
+				std::memcpy(s.prefix, s.remoteaddr.u.sun_path, l);
+				std::memcpy(s.prefix + l, ": ", sizeof ": ");
+			}
 			break;
 		}
 		default:
 			break;
 	}
-	std::cout.write(msg, rc).put('\n').flush();
+}
+
+/// Receive whatever is waiting on the socket, up to the number of free slots, with a single recvmmsg().
+/// Anything left waiting is left for a later wakeup, so that one busy socket cannot starve signals and other sockets.
+void
+Batch::receive (
+	const char * prog,
+	int socket_fd
+) {
+	if (full()) return;
+	for (std::size_t i(count); i < SLOTS; ++i) {
+		msghdr & m(headers[i].msg_hdr);
+		m.msg_name = &slots[i].remoteaddr;
+		m.msg_namelen = sizeof slots[i].remoteaddr;
+		slots[i].message.iov_len = SLOT_SIZE;
+	}
+	const std::size_t wanted(SLOTS - count);
+	int rc;
+	do {
+		rc = recvmmsg(socket_fd, headers + count, wanted, MSG_DONTWAIT, nullptr);
+	} while (0 > rc && EINTR == errno);
+	if (0 > rc) {
+		const int error(errno);
+		if (EAGAIN != error && EWOULDBLOCK != error)
+			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, "recvmmsg", std::strerror(error));
+		return;
+	}
+	if (empty() && 0 < rc)
+		clock_gettime(CLOCK_MONOTONIC, &first);
+	for (int i(0); i < rc; ++i) {
+		slot & s(slots[count]);
+		s.message.iov_len = headers[count].msg_len;
+		set_prefix(s, headers[count].msg_hdr.msg_namelen);
+		++count;
+	}
+}
+
+void
+Batch::flush (
+	const char * prog
+) {
+	std::size_t n(0U);
+	for (std::size_t i(0U); i < count; ++i) {
+		slot & s(slots[i]);
+		output[n].iov_base = s.prefix;
+		output[n++].iov_len = std::strlen(s.prefix);
+		output[n++] = s.message;
+		output[n].iov_base = const_cast<char *>("\n");
+		output[n++].iov_len = 1U;
+	}
+	count = 0U;
+	iovec * v(output);
+	while (n) {
+		const ssize_t rc(writev(STDOUT_FILENO, v, n));
+		if (0 > rc) {
+			const int error(errno);
+			if (EINTR == error) continue;
+			std::fprintf(stderr, "%s: ERROR: %s: %s\n", prog, "writev", std::strerror(error));
+			return;
+		}
+		// Pipes can take less than everything; this resumes part-way through an iovec if need be.
+		std::size_t w(rc);
+		while (n && w >= v->iov_len) {
+			w -= v->iov_len;
+			++v;
+			--n;
+		}
+		if (n) {
+			v->iov_base = static_cast<char *>(v->iov_base) + w;
+			v->iov_len -= w;
+		}
+	}
+}
+
 }
 
 /* Main function ************************************************************
@@ -87,8 +239,13 @@ syslog_read [[gnu::noreturn]] (
 	ProcessEnvironment & envs
 ) {
 	const char * prog(basename_of(args[0]));
+	unsigned long flush_latency(0UL);
 	try {
-		popt::top_table_definition main_option(0, nullptr, "Main options", "");
+		popt::unsigned_number_definition flush_latency_option('\0', "flush-latency", "milliseconds", "Allow output to be held back this long, to write it in larger blocks.", flush_latency, 0);
+		popt::definition * top_table[] = {
+			&flush_latency_option
+		};
+		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "");
 
 		std::vector<const char *> new_args;
 		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
@@ -130,20 +287,40 @@ syslog_read [[gnu::noreturn]] (
 		}
 	}
 
+	Batch batch;
 	bool in_shutdown(false);
 	for (;;) {
 		try {
 			if (in_shutdown) break;
+			// Output is held back no longer than the flush latency after the first message that is waiting.
+			timespec timeout;
+			if (!batch.empty()) {
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				const timespec & first(batch.first_received());
+				const long long remaining(static_cast<long long>(flush_latency) * 1000000LL - ((now.tv_sec - first.tv_sec) * 1000000000LL + (now.tv_nsec - first.tv_nsec)));
+				if (0 >= remaining) {
+					batch.flush(prog);
+					continue;
+				}
+				timeout.tv_sec = remaining / 1000000000LL;
+				timeout.tv_nsec = remaining % 1000000000LL;
+			}
 			struct kevent e;
-			if (0 > kevent(queue, nullptr, 0, &e, 1, nullptr)) {
+			const int rc(kevent(queue, nullptr, 0, &e, 1, batch.empty() ? nullptr : &timeout));
+			if (0 > rc) {
 				if (EINTR == errno) continue;
 				die_errno(prog, envs, "kevent");
 			}
+			if (0 == rc) continue;
 			switch (e.filter) {
 				case EVFILT_READ:
-					if (LISTEN_SOCKET_FILENO <= static_cast<int>(e.ident) && LISTEN_SOCKET_FILENO + static_cast<int>(listen_fds) > static_cast<int>(e.ident))
-						process_message(prog, e.ident);
-					else
+					if (LISTEN_SOCKET_FILENO <= static_cast<int>(e.ident) && LISTEN_SOCKET_FILENO + static_cast<int>(listen_fds) > static_cast<int>(e.ident)) {
+						// The read events are level-triggered, so anything still waiting on the socket brings us back here.
+						batch.receive(prog, e.ident);
+						if (batch.full() || (0UL == flush_latency && !batch.empty()))
+							batch.flush(prog);
+					} else
 						std::fprintf(stderr, "%s: DEBUG: read event ident %lu\n", prog, e.ident);
 					break;
 				case EVFILT_SIGNAL:
@@ -174,5 +351,7 @@ syslog_read [[gnu::noreturn]] (
 			std::fprintf(stderr, "%s: ERROR: exception: %s\n", prog, e.what());
 		}
 	}
+	if (!batch.empty())
+		batch.flush(prog);
 	throw EXIT_SUCCESS;
 }
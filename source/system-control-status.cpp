@@ -57,14 +57,17 @@ common_subcommand (
 ) {
 	const char * prog(basename_of(args[0]));
 	const char * log_lines(nullptr);
+	bool rotated_logs(false);
 	try {
 		popt::bool_definition user_option('u', "user", "Communicate with the per-user manager.", per_user_mode);
 		popt::string_definition log_lines_option('\0', "log-lines", "number", "Control the number of log lines printed.", log_lines);
+		popt::bool_definition rotated_logs_option('\0', "rotated-logs", "Take log lines from the last rotated-out log file if the current one is short.", rotated_logs);
 		popt::definition * main_table[] = {
 			&user_option,
-			&log_lines_option
+			&log_lines_option,
+			&rotated_logs_option
 		};
-		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table - (show_log_lines?0:1), main_table, "Main options", "{service(s)...}");
+		popt::top_table_definition main_option(sizeof main_table/sizeof *main_table - (show_log_lines?0:2), main_table, "Main options", "{service(s)...}");
 
 		std::vector<const char *> new_args;
 		popt::arg_processor<const char **> p(args.data() + 1, args.data() + args.size(), prog, envs, main_option, new_args);
@@ -88,6 +91,8 @@ common_subcommand (
 		args.insert(args.begin(), log_lines);
 		args.insert(args.begin(), "--log-lines");
 	}
+	if (rotated_logs)
+		args.insert(args.begin(), "--rotated-logs");
 	args.insert(args.begin(), command);
 	next_prog = arg0_of(args);
 }
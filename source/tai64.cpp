@@ -3,6 +3,7 @@ For copyright and licensing terms, see the file named COPYING.
 // **************************************************************************
 */
 
+#include <algorithm>
 #include <ctime>
 #include <stdint.h>
 #include <cstring>
@@ -68,6 +69,15 @@ struct leapsec {
 	// No new leap seconds as of 2025-05-28
 };
 
+inline
+bool
+starts_after (
+	uint64_t tai64,
+	const leapsec & l
+) {
+	return tai64 < l.start;
+}
+
 #if defined(__LINUX__) || defined(__linux__) || defined(__OpenBSD__)
 
 int checked(-1);
@@ -151,14 +161,13 @@ tai64_to_time (
 	const uint64_t tai_since_posix_epoch(tai64 - 0x4000000000000000ULL);
 	if (time_t_is_tai(envs))
 		return TimeTAndLeap(tai_since_posix_epoch - 10UL, false);
-	for (std::size_t i(sizeof leap_seconds_table/sizeof *leap_seconds_table); i > 0U; ) {
-		const struct leapsec & l(leap_seconds_table[--i]);
-		if (l.start == tai64)
-			return TimeTAndLeap(tai_since_posix_epoch - l.offset, l.leap);
-		if (l.start < tai64)
-			return TimeTAndLeap(tai_since_posix_epoch - l.offset, false);
-	}
-	return TimeTAndLeap(tai_since_posix_epoch, false);
+	// The table is in ascending order, so the entry in force is the last one that does not start after tai64.
+	const leapsec * const b(leap_seconds_table), * const e(b + sizeof leap_seconds_table/sizeof *leap_seconds_table);
+	const leapsec * const i(std::upper_bound(b, e, tai64, starts_after));
+	if (b == i)
+		return TimeTAndLeap(tai_since_posix_epoch, false);
+	const leapsec & l(i[-1]);
+	return TimeTAndLeap(tai_since_posix_epoch - l.offset, l.start == tai64 && l.leap);
 }
 
 uint64_t
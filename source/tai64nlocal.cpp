@@ -19,8 +19,10 @@ For copyright and licensing terms, see the file named COPYING.
 #include "utils.h"
 #include "fdutils.h"
 #include "popt.h"
+#include "ChunkedReader.h"
 
 static bool non_standard(false);
+static char output_buffer[256U * 1024U];
 
 static
 void
@@ -63,52 +65,101 @@ convert (
 	return r;
 }
 
+/// \brief Formats stamps as local times
+/// Log lines come in runs with the same second, so the formatted second is remembered and only the fractional part is formatted afresh.
+class StampFormatter
+{
+public:
+	StampFormatter(const ProcessEnvironment & e) : envs(e), valid(false), secs(0U), length(0U) {}
+	bool write(uint64_t, uint32_t);
+protected:
+	const ProcessEnvironment & envs;
+	bool valid;
+	uint64_t secs;
+	std::size_t length;
+	char text[64 + 11];
+};
+
+bool
+StampFormatter::write (
+	uint64_t s,
+	uint32_t nano
+) {
+	if (!valid || secs != s) {
+		const TimeTAndLeap z(tai64_to_time(envs, s));
+		struct tm tm;
+		if (!localtime_r(&z.time, &tm)) return false;
+		if (z.leap) ++tm.tm_sec;
+		length = std::strftime(text, 64, non_standard ? "%x %X" : "%F %T", &tm);
+		secs = s;
+		valid = true;
+	}
+	char * p(text + length);
+	*p++ = '.';
+	char digits[10];
+	std::size_t d(0U);
+	do {
+		digits[d++] = '0' + nano % 10U;
+		nano /= 10U;
+	} while (nano);
+	while (d < 9U) digits[d++] = '0';
+	while (d) *p++ = digits[--d];
+	std::fwrite(text, p - text, 1, stdout);
+	return true;
+}
+
 static
 bool
 process (
 	const char * prog,
 	const ProcessEnvironment & envs,
 	const char * name,
-	int fd
+	int fd,
+	StampFormatter & formatter
 ) {
-	char buf[32768], s[16], n[8];
+	// This picks up from wherever the descriptor's offset is, as reading through stdio did; standard input may have been partly consumed already.
+	ChunkedReader f(fd);
+	char s[16], n[8];
 	size_t s_pos(0), n_pos(0), at(0);
 	bool done(false);
 	enum { BOL, STAMP, BODY } state = BOL;
-	for (;;) {
+	for (ChunkedReader::span chunk; ; ) {
 		if (BOL == state)
 			std::fflush(stdout);
-		const int rd(read(fd, buf, sizeof buf));
-		if (0 > rd) {
-			message_fatal_errno(prog, envs, name);
-			return false;
-		} else if (0 == rd)
-			break;
+		if (!f.read_chunk(chunk)) break;
 		done = true;
-		for (int i(0); i < rd; ++i) {
-			const char c(buf[i]);
+		for (const char * p(chunk.data), * const e(chunk.data + chunk.length); p < e; ) {
 			switch (state) {
-				body:
 				case BODY:
-					std::fputc(c, stdout);
-					if ('\n' == c) state = BOL;
+				body:
+				{
+					// The rest of the line, as far as it goes in this chunk, is copied in one go.
+					const char * const nl(static_cast<const char *>(std::memchr(p, '\n', e - p)));
+					const char * const end(nl ? nl + 1 : e);
+					std::fwrite(p, end - p, 1, stdout);
+					p = end;
+					if (nl) state = BOL;
 					break;
+				}
 				case BOL:
-					if ('@' == c) {
+					if ('@' == *p) {
 						state = STAMP;
 						s_pos = n_pos = 0;
 						at = 1;
+						++p;
 					} else {
-						finish(at, s, s_pos, n, s_pos);
 						at = s_pos = n_pos = 0;
 						state = BODY;
 						goto body;
 					}
 					break;
 				case STAMP:
+				{
+					const unsigned char c(*p);
 					if (s_pos < sizeof s/sizeof *s) {
 						if (std::isxdigit(c)) {
 							s[s_pos++] = c;
+							++p;
 						} else {
 							finish(at, s, s_pos, n, n_pos);
 							at = s_pos = n_pos = 0;
@@ -119,6 +170,7 @@ process (
 					if (n_pos < sizeof n/sizeof *n) {
 						if (std::isxdigit(c)) {
 							n[n_pos++] = c;
+							++p;
 						} else {
 							finish(at, s, s_pos, n, n_pos);
 							at = s_pos = n_pos = 0;
@@ -127,25 +179,22 @@ process (
 						}
 					} else
 					{
-						const TimeTAndLeap z(tai64_to_time(envs, convert(s, s_pos)));
-						const uint32_t nano(convert(n, n_pos));
-						struct tm tm;
-						if (localtime_r(&z.time, &tm)) {
-							if (z.leap) ++tm.tm_sec;
-							char fmt[64];
-							const int l(std::strftime(fmt, sizeof fmt, non_standard ? "%x %X" : "%F %T", &tm));
-							std::fwrite(fmt, l, 1, stdout);
-							std::fprintf(stdout, ".%09" PRIu32, nano);
-						} else
+						if (!formatter.write(convert(s, s_pos), convert(n, n_pos)))
 							finish(at, s, s_pos, n, n_pos);
 						at = s_pos = n_pos = 0;
 						state = BODY;
 						goto body;
 					}
 					break;
+				}
 			}
 		}
 	}
+	if (const int error = f.error()) {
+		errno = error;
+		message_fatal_errno(prog, envs, name);
+		return false;
+	}
 	if (BOL != state && done) {
 		finish(at, s, s_pos, n, n_pos);
 		std::fputc('\n', stdout);
@@ -179,8 +228,10 @@ tai64nlocal [[gnu::noreturn]] (
 	} catch (const popt::error & e) {
 		die(prog, envs, e);
 	}
+	std::setvbuf(stdout, output_buffer, _IOFBF, sizeof output_buffer);
+	StampFormatter formatter(envs);
 	if (args.empty()) {
-		if (!process(prog, envs, "<stdin>", STDIN_FILENO))
+		if (!process(prog, envs, "<stdin>", STDIN_FILENO, formatter))
 			throw static_cast<int>(EXIT_TEMPORARY_FAILURE);	// Bernstein daemontools compatibility
 	} else {
 		for (std::vector<const char *>::const_iterator i(args.begin()); i != args.end(); ++i) {
@@ -191,7 +242,7 @@ tai64nlocal [[gnu::noreturn]] (
 				std::fprintf(stderr, "%s: FATAL: %s: %s\n", prog, name, std::strerror(error));
 				throw static_cast<int>(EXIT_PERMANENT_FAILURE);	// Bernstein daemontools compatibility
 			}
-			if (!process(prog, envs, name, fd))
+			if (!process(prog, envs, name, fd, formatter))
 				throw static_cast<int>(EXIT_TEMPORARY_FAILURE);	// Bernstein daemontools compatibility
 			close(fd);
 		}
@@ -4,11 +4,13 @@ For copyright and licensing terms, see the file named COPYING.
 */
 
 #include <vector>
+#include <list>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <csignal>
 #include <cerrno>
+#include <climits>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -16,6 +18,8 @@ For copyright and licensing terms, see the file named COPYING.
 #include <netinet/ip.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include "popt.h"
 #include "utils.h"
@@ -37,6 +41,229 @@ q (
 	return value ? value : "";
 }
 
+/* Connecting *************************************************************
+// **************************************************************************
+*/
+
+namespace {
+
+/// How each socket is to be set up before it is connected.
+struct socket_setup {
+	socket_setup() : localaddress(nullptr), localport(nullptr), check_interfaces(false), keepalives(false), no_delay(false), no_kill_IP_options(false) {}
+	const char * localaddress;
+	const char * localport;
+	bool check_interfaces, keepalives, no_delay, no_kill_IP_options;
+
+	int open(const char * prog, const addrinfo & remote_info) const;
+};
+
+/// \returns a socket ready to connect to remote_info, or -1 having reported a fatal error
+int
+socket_setup::open (
+	const char * prog,
+	const addrinfo & remote_info
+) const {
+	FileDescriptorOwner s(socket(remote_info.ai_family, remote_info.ai_socktype, remote_info.ai_protocol));
+	if (0 > s.get()) {
+	exit_error:
+		const int error(errno);
+		std::fprintf(stderr, "%s: FATAL: %s\n", prog, std::strerror(error));
+		return -1;
+	}
+
+	if (localaddress || localport) {
+		addrinfo * local_info(nullptr), local_hints = {};
+		local_hints.ai_family = remote_info.ai_family;
+		local_hints.ai_socktype = remote_info.ai_socktype;
+		local_hints.ai_protocol = remote_info.ai_protocol;
+		local_hints.ai_flags = AI_NUMERICHOST|AI_NUMERICSERV|AI_PASSIVE;
+		if (check_interfaces) local_hints.ai_flags |= AI_ADDRCONFIG;
+		const int lrc(getaddrinfo(localaddress, localport, &local_hints, &local_info));
+		if (0 != lrc) {
+			const int error(errno);
+			std::fprintf(stderr, "%s: FATAL: %s %s: %s\n", prog, localaddress, localport, EAI_SYSTEM == lrc ? std::strerror(error) : gai_strerror(lrc));
+			return -1;
+		}
+		const int brc(bind(s.get(), local_info->ai_addr, local_info->ai_addrlen));
+		freeaddrinfo(local_info);
+		if (0 > brc) goto exit_error;
+	}
+
+	if (keepalives) {
+		if (0 > socket_set_boolean_option(s.get(), SOL_SOCKET, SO_KEEPALIVE, true)) goto exit_error ;
+	}
+	if (no_delay) {
+		if (0 > socket_set_boolean_option(s.get(), IPPROTO_TCP, TCP_NODELAY, true)) goto exit_error ;
+	}
+#if defined(IP_OPTIONS)
+	if (!no_kill_IP_options) {
+		switch (remote_info.ai_family) {
+			case AF_INET:
+				if (0 > setsockopt(s.get(), IPPROTO_IP, IP_OPTIONS, nullptr, 0)) goto exit_error ;
+				break;
+			default:
+				break;
+		}
+	}
+#endif
+	return s.release();
+}
+
+inline
+unsigned long long
+monotonic_milliseconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000ULL + t.tv_nsec / 1000000UL;
+}
+
+/// \returns delay milliseconds after when, saturating rather than wrapping for a very large delay
+inline
+unsigned long long
+deadline (
+	unsigned long long when,
+	unsigned long delay
+) {
+	return delay > ULLONG_MAX - when ? ULLONG_MAX : when + delay;
+}
+
+/// \returns a poll() timeout for waiting from now until when, clamped to what poll() can express so that it is never negative
+inline
+int
+poll_timeout (
+	unsigned long long when,
+	unsigned long long now
+) {
+	if (when <= now) return 0;
+	const unsigned long long remaining(when - now);
+	return remaining > static_cast<unsigned long long>(INT_MAX) ? INT_MAX : static_cast<int>(remaining);
+}
+
+/// Interleave the addresses so that they alternate between the first address's family and the others, per RFC 8305.
+std::vector<addrinfo *>
+interleave_families (
+	addrinfo * remote_info_list
+) {
+	std::vector<addrinfo *> first, others, r;
+	for (addrinfo * remote_info(remote_info_list); remote_info; remote_info = remote_info->ai_next)
+		(remote_info_list->ai_family == remote_info->ai_family ? first : others).push_back(remote_info);
+	for (std::size_t i(0U); i < first.size() || i < others.size(); ++i) {
+		if (i < first.size()) r.push_back(first[i]);
+		if (i < others.size()) r.push_back(others[i]);
+	}
+	return r;
+}
+
+struct attempt {
+	attempt(int f, addrinfo * i, unsigned long long t) : fd(f), info(i), started(t) {}
+	FileDescriptorOwner fd;
+	addrinfo * info;
+	unsigned long long started;
+};
+typedef std::list<attempt> attempts;
+
+/// \brief Make non-blocking connection attempts to the addresses in order, the first to succeed winning
+/// If staggered, a further attempt is started every stagger_delay milliseconds whilst earlier ones are still in progress, per RFC 8305.
+/// Otherwise a further attempt is only started once earlier ones have failed.
+/// In either case, a failed attempt causes the next to be started at once; and an attempt is abandoned if still in progress after connect_timeout milliseconds, if that is not zero.
+/// \returns the winning address, with its connected socket in s; or nullptr, with fatal set if an error has already been reported
+addrinfo *
+race_connect (
+	const char * prog,
+	const socket_setup & setup,
+	const std::vector<addrinfo *> & addresses,
+	bool staggered,
+	unsigned long stagger_delay,
+	unsigned long connect_timeout,
+	FileDescriptorOwner & s,
+	bool & fatal
+) {
+	attempts in_progress;
+	std::vector<addrinfo *>::const_iterator next(addresses.begin());
+	unsigned long long next_start(monotonic_milliseconds());
+	fatal = false;
+	for (;;) {
+		const unsigned long long now(monotonic_milliseconds());
+		if (connect_timeout) {
+			for (attempts::iterator i(in_progress.begin()); in_progress.end() != i; ) {
+				if (now - i->started >= connect_timeout) {
+					i = in_progress.erase(i);
+					next_start = now;
+				} else
+					++i;
+			}
+		}
+		if (addresses.end() != next && (in_progress.empty() || (staggered && now >= next_start))) {
+			addrinfo * remote_info(*next++);
+			FileDescriptorOwner fd(setup.open(prog, *remote_info));
+			if (0 > fd.get()) {
+				fatal = true;
+				return nullptr;
+			}
+			set_non_blocking(fd.get(), true);
+			if (0 <= connect(fd.get(), remote_info->ai_addr, remote_info->ai_addrlen)) {
+				set_non_blocking(fd.get(), false);
+				s.reset(fd.release());
+				return remote_info;
+			}
+			if (EINPROGRESS == errno || EINTR == errno || EAGAIN == errno) {
+				in_progress.push_back(attempt(fd.release(), remote_info, now));
+				next_start = deadline(now, stagger_delay);
+			} else
+				next_start = now;
+			continue;
+		}
+		if (in_progress.empty()) return nullptr;
+
+		int timeout(-1);
+		if (staggered && addresses.end() != next)
+			timeout = poll_timeout(next_start, now);
+		if (connect_timeout) {
+			for (attempts::const_iterator i(in_progress.begin()); in_progress.end() != i; ++i) {
+				const int remaining(poll_timeout(deadline(i->started, connect_timeout), now));
+				if (0 > timeout || remaining < timeout)
+					timeout = remaining;
+			}
+		}
+		std::vector<pollfd> p;
+		for (attempts::const_iterator i(in_progress.begin()); in_progress.end() != i; ++i) {
+			pollfd e;
+			e.fd = i->fd.get();
+			e.events = POLLOUT;
+			e.revents = 0;
+			p.push_back(e);
+		}
+		const int rc(poll(p.data(), p.size(), timeout));
+		if (0 > rc) {
+			if (EINTR == errno) continue;
+			const int error(errno);
+			std::fprintf(stderr, "%s: FATAL: %s: %s\n", prog, "poll", std::strerror(error));
+			fatal = true;
+			return nullptr;
+		}
+		std::vector<pollfd>::const_iterator e(p.begin());
+		for (attempts::iterator i(in_progress.begin()); in_progress.end() != i; ++e) {
+			if (!e->revents) {
+				++i;
+				continue;
+			}
+			int error;
+			socklen_t errorlen = sizeof error;
+			if (0 <= getsockopt(i->fd.get(), SOL_SOCKET, SO_ERROR, &error, &errorlen) && 0 == error) {
+				// The losers are closed as in_progress is destroyed.
+				set_non_blocking(i->fd.get(), false);
+				s.reset(i->fd.release());
+				return i->info;
+			}
+			i = in_progress.erase(i);
+			next_start = monotonic_milliseconds();
+		}
+	}
+}
+
+}
+
 /* Main function ************************************************************
 // **************************************************************************
 */
@@ -60,6 +287,8 @@ tcp_socket_connect (
 	bool no_kill_IP_options(false);
 #endif
 	bool no_delay(false);
+	bool race(false);
+	unsigned long stagger_delay(250U), connect_timeout(0U);
 	try {
 		popt::bool_definition verbose_option('v', "verbose", "Print status information.", verbose);
 		popt::bool_definition keepalives_option('k', "keepalives", "Enable TCP keepalive processing.", keepalives);
@@ -73,6 +302,9 @@ tcp_socket_connect (
 		popt::string_definition localhost_option('l', "local-host", "name", "Override the local host.", localhost);
 		popt::string_definition localaddress_option('i', "local-address", "address", "Override the local IP address.", localaddress);
 		popt::string_definition localport_option('p', "local-port", "port", "Override the local port.", localport);
+		popt::bool_definition race_option('\0', "race", "Race staggered connection attempts to all addresses.", race);
+		popt::unsigned_number_definition stagger_delay_option('\0', "stagger-delay", "milliseconds", "Wait this long before starting each further racing attempt.", stagger_delay, 0);
+		popt::unsigned_number_definition connect_timeout_option('\0', "connect-timeout", "milliseconds", "Abandon each connection attempt after this long.", connect_timeout, 0);
 		popt::definition * top_table[] = {
 			&verbose_option,
 			&keepalives_option,
@@ -85,7 +317,10 @@ tcp_socket_connect (
 			&numeric_service_option,
 			&localhost_option,
 			&localaddress_option,
-			&localport_option
+			&localport_option,
+			&race_option,
+			&stagger_delay_option,
+			&connect_timeout_option
 		};
 		popt::top_table_definition main_option(sizeof top_table/sizeof *top_table, top_table, "Main options", "{host} {port} {prog}");
 
@@ -127,129 +362,104 @@ tcp_socket_connect (
 		throw EXIT_FAILURE;
 	}
 
-	for (addrinfo * remote_info(remote_info_list); ; remote_info = remote_info->ai_next) {
-		if (!remote_info) {
+	socket_setup setup;
+	setup.localaddress = localaddress;
+	setup.localport = localport;
+	setup.check_interfaces = check_interfaces;
+	setup.keepalives = keepalives;
+	setup.no_delay = no_delay;
+	setup.no_kill_IP_options = no_kill_IP_options;
+
+	std::vector<addrinfo *> addresses;
+	if (race)
+		addresses = interleave_families(remote_info_list);
+	else
+		for (addrinfo * remote_info(remote_info_list); remote_info; remote_info = remote_info->ai_next)
+			addresses.push_back(remote_info);
+
+	FileDescriptorOwner s(-1);
+	bool fatal(false);
+	addrinfo * remote_info(race_connect(prog, setup, addresses, race, stagger_delay, connect_timeout, s, fatal));
+	if (!remote_info) {
+		if (!fatal)
 			std::fprintf(stderr, "%s: FATAL: %s\n", prog, "No addresses (remaining) to connect to.");
-		free_fail:
-			if (remote_info_list) freeaddrinfo(remote_info_list);
-			throw EXIT_FAILURE;
-		}
+	free_fail:
+		if (remote_info_list) freeaddrinfo(remote_info_list);
+		throw EXIT_FAILURE;
+	}
 
-		FileDescriptorOwner s(socket(remote_info->ai_family, remote_info->ai_socktype, remote_info->ai_protocol));
-		if (0 > s.get()) {
-		exit_error:
-			const int error(errno);
-			std::fprintf(stderr, "%s: FATAL: %s\n", prog, std::strerror(error));
-			goto free_fail;
-		}
+	sockaddr_storage localaddr;
+	socklen_t localaddrsz = sizeof localaddr;
+	if (0 > getsockname(s.get(), reinterpret_cast<sockaddr *>(&localaddr), &localaddrsz)) {
+	exit_error:
+		const int error(errno);
+		std::fprintf(stderr, "%s: FATAL: %s\n", prog, std::strerror(error));
+		goto free_fail;
+	}
 
-		if (localaddress || localport) {
-			addrinfo * local_info(nullptr), local_hints = {};
-			local_hints.ai_family = remote_info->ai_family;
-			local_hints.ai_socktype = remote_info->ai_socktype;
-			local_hints.ai_protocol = remote_info->ai_protocol;
-			local_hints.ai_flags = AI_NUMERICHOST|AI_NUMERICSERV|AI_PASSIVE;
-			if (check_interfaces) local_hints.ai_flags |= AI_ADDRCONFIG;
-			const int lrc(getaddrinfo(localaddress, localport, &local_hints, &local_info));
-			if (0 != lrc) {
-				const int error(errno);
-				std::fprintf(stderr, "%s: FATAL: %s %s: %s\n", prog, localaddress, localport, EAI_SYSTEM == lrc ? std::strerror(error) : gai_strerror(lrc));
-				goto free_fail;
-			}
-			if (0 > bind(s.get(), local_info->ai_addr, local_info->ai_addrlen)) goto exit_error;
-			freeaddrinfo(local_info);
-		}
+	if (0 > dup2(s.get(), 6)) goto exit_error;
+	if (0 > dup2(s.get(), 7)) goto exit_error;
+	if (6 == s.get() || 7 == s.get())
+		s.release();
 
-		if (keepalives) {
-			if (0 > socket_set_boolean_option(s.get(), SOL_SOCKET, SO_KEEPALIVE, true)) goto exit_error ;
+	envs.set("PROTO", "TCP");
+	switch (localaddr.ss_family) {
+		case AF_INET:
+		{
+			const struct sockaddr_in & localaddr4(*reinterpret_cast<const struct sockaddr_in *>(&localaddr));
+			char port[64], ip[INET_ADDRSTRLEN];
+			if (nullptr == inet_ntop(localaddr4.sin_family, &localaddr4.sin_addr, ip, sizeof ip)) goto exit_error;
+			snprintf(port, sizeof port, "%u", ntohs(localaddr4.sin_port));
+			envs.set("TCPLOCALIP", ip);
+			envs.set("TCPLOCALPORT", port);
+			break;
 		}
-		if (no_delay) {
-			if (0 > socket_set_boolean_option(s.get(), IPPROTO_TCP, TCP_NODELAY, true)) goto exit_error ;
-		}
-#if defined(IP_OPTIONS)
-		if (!no_kill_IP_options) {
-			switch (remote_info->ai_family) {
-				case AF_INET:
-					if (0 > setsockopt(s.get(), IPPROTO_IP, IP_OPTIONS, nullptr, 0)) goto exit_error ;
-					break;
-				default:
-					break;
-			}
+		case AF_INET6:
+		{
+			const struct sockaddr_in6 & localaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(&localaddr));
+			char port[64], ip[INET6_ADDRSTRLEN];
+			if (nullptr == inet_ntop(localaddr6.sin6_family, &localaddr6.sin6_addr, ip, sizeof ip)) goto exit_error;
+			snprintf(port, sizeof port, "%u", ntohs(localaddr6.sin6_port));
+			envs.set("TCPLOCALIP", ip);
+			envs.set("TCPLOCALPORT", port);
+			break;
 		}
-#endif
-
-		if (0 > socket_connect(s.get(), remote_info->ai_addr, remote_info->ai_addrlen)) continue;
-
-		sockaddr_storage localaddr;
-		socklen_t localaddrsz = sizeof localaddr;
-		if (0 > getsockname(s.get(), reinterpret_cast<sockaddr *>(&localaddr), &localaddrsz)) goto exit_error;
-
-		if (0 > dup2(s.get(), 6)) goto exit_error;
-		if (0 > dup2(s.get(), 7)) goto exit_error;
-		if (6 == s.get() || 7 == s.get())
-			s.release();
-
-		envs.set("PROTO", "TCP");
-		switch (localaddr.ss_family) {
-			case AF_INET:
-			{
-				const struct sockaddr_in & localaddr4(*reinterpret_cast<const struct sockaddr_in *>(&localaddr));
-				char port[64], ip[INET_ADDRSTRLEN];
-				if (nullptr == inet_ntop(localaddr4.sin_family, &localaddr4.sin_addr, ip, sizeof ip)) goto exit_error;
-				snprintf(port, sizeof port, "%u", ntohs(localaddr4.sin_port));
-				envs.set("TCPLOCALIP", ip);
-				envs.set("TCPLOCALPORT", port);
-				break;
-			}
-			case AF_INET6:
-			{
-				const struct sockaddr_in6 & localaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(&localaddr));
-				char port[64], ip[INET6_ADDRSTRLEN];
-				if (nullptr == inet_ntop(localaddr6.sin6_family, &localaddr6.sin6_addr, ip, sizeof ip)) goto exit_error;
-				snprintf(port, sizeof port, "%u", ntohs(localaddr6.sin6_port));
-				envs.set("TCPLOCALIP", ip);
-				envs.set("TCPLOCALPORT", port);
-				break;
-			}
-			default:
-				envs.set("TCPLOCALIP", nullptr);
-				envs.set("TCPLOCALPORT", nullptr);
-				break;
+		default:
+			envs.set("TCPLOCALIP", nullptr);
+			envs.set("TCPLOCALPORT", nullptr);
+			break;
+	}
+	switch (remote_info->ai_family) {
+		case AF_INET:
+		{
+			const struct sockaddr_in & remoteaddr4(*reinterpret_cast<const struct sockaddr_in *>(remote_info->ai_addr));
+			char port[64], ip[INET_ADDRSTRLEN];
+			if (nullptr == inet_ntop(remoteaddr4.sin_family, &remoteaddr4.sin_addr, ip, sizeof ip)) goto exit_error;
+			snprintf(port, sizeof port, "%u", ntohs(remoteaddr4.sin_port));
+			envs.set("TCPREMOTEIP", ip);
+			envs.set("TCPREMOTEPORT", port);
+			break;
 		}
-		switch (remote_info->ai_family) {
-			case AF_INET:
-			{
-				const struct sockaddr_in & remoteaddr4(*reinterpret_cast<const struct sockaddr_in *>(remote_info->ai_addr));
-				char port[64], ip[INET_ADDRSTRLEN];
-				if (nullptr == inet_ntop(remoteaddr4.sin_family, &remoteaddr4.sin_addr, ip, sizeof ip)) goto exit_error;
-				snprintf(port, sizeof port, "%u", ntohs(remoteaddr4.sin_port));
-				envs.set("TCPREMOTEIP", ip);
-				envs.set("TCPREMOTEPORT", port);
-				break;
-			}
-			case AF_INET6:
-			{
-				const struct sockaddr_in6 & remoteaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(remote_info->ai_addr));
-				char port[64], ip[INET6_ADDRSTRLEN];
-				if (nullptr == inet_ntop(remoteaddr6.sin6_family, &remoteaddr6.sin6_addr, ip, sizeof ip)) goto exit_error;
-				snprintf(port, sizeof port, "%u", ntohs(remoteaddr6.sin6_port));
-				envs.set("TCPREMOTEIP", ip);
-				envs.set("TCPREMOTEPORT", port);
-				break;
-			}
-			default:
-				envs.set("TCPREMOTEIP", nullptr);
-				envs.set("TCPREMOTEPORT", nullptr);
-				break;
+		case AF_INET6:
+		{
+			const struct sockaddr_in6 & remoteaddr6(*reinterpret_cast<const struct sockaddr_in6 *>(remote_info->ai_addr));
+			char port[64], ip[INET6_ADDRSTRLEN];
+			if (nullptr == inet_ntop(remoteaddr6.sin6_family, &remoteaddr6.sin6_addr, ip, sizeof ip)) goto exit_error;
+			snprintf(port, sizeof port, "%u", ntohs(remoteaddr6.sin6_port));
+			envs.set("TCPREMOTEIP", ip);
+			envs.set("TCPREMOTEPORT", port);
+			break;
 		}
-		envs.set("TCPLOCALHOST", localhost);
-		envs.set("TCPLOCALINFO", nullptr);
-		envs.set("TCPREMOTEHOST", nullptr);
-		envs.set("TCPREMOTEINFO", nullptr);
-
-		if (verbose)
-			std::fprintf(stderr, "%s: %u %s %s %s %s\n", prog, getpid(), q(envs, "TCPLOCALIP"), q(envs, "TCPLOCALPORT"), q(envs, "TCPREMOTEIP"), q(envs, "TCPREMOTEPORT"));
-
-		return;
+		default:
+			envs.set("TCPREMOTEIP", nullptr);
+			envs.set("TCPREMOTEPORT", nullptr);
+			break;
 	}
+	envs.set("TCPLOCALHOST", localhost);
+	envs.set("TCPLOCALINFO", nullptr);
+	envs.set("TCPREMOTEHOST", nullptr);
+	envs.set("TCPREMOTEINFO", nullptr);
+
+	if (verbose)
+		std::fprintf(stderr, "%s: %u %s %s %s %s\n", prog, getpid(), q(envs, "TCPLOCALIP"), q(envs, "TCPLOCALPORT"), q(envs, "TCPREMOTEIP"), q(envs, "TCPREMOTEPORT"));
 }
@@ -22,9 +22,13 @@ For copyright and licensing terms, see the file named COPYING.
 #include <sys/sysctl.h>
 #endif
 #include <time.h>
+#if defined(__LINUX__) || defined(__linux__)
+#include <sys/timerfd.h>
+#endif
 #include "utils.h"
 //#include "tai64utils.h"
 #include "ProcessEnvironment.h"
+#include "FileDescriptorOwner.h"
 #include "popt.h"
 
 /* Time handling and parsing ************************************************
@@ -1049,6 +1053,30 @@ time_pause_until (
 		sigpause(0);
 #endif
 	} else
+#if defined(__LINUX__) || defined(__linux__)
+	{
+		// The kernel wakes us once, at the time; or early if the clock is stepped, whereupon we re-evaluate against the new clock.
+		// So there is no need to wake up periodically to check for clock changes.
+		const FileDescriptorOwner timer_fd(timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC));
+		if (0 > timer_fd.get()) die_errno(prog, envs, "timerfd_create");
+		for (;;) {
+			NullableTAI64N n;
+			n.realtime(envs);
+			if (n.query_seconds() > t.query_seconds()) break;	// The time has passed.
+			if (n.query_seconds() == t.query_seconds() && n.query_nanoseconds() >= t.query_nanoseconds()) break;	// The time has passed.
+			const TimeTAndLeap w(tai64_to_time(envs, t.query_seconds()));
+			itimerspec i;
+			i.it_interval.tv_sec = 0;
+			i.it_interval.tv_nsec = 0;
+			i.it_value.tv_sec = w.time;
+			i.it_value.tv_nsec = t.query_nanoseconds();
+			if (0 > timerfd_settime(timer_fd.get(), TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET, &i, nullptr)) die_errno(prog, envs, "timerfd_settime");
+			uint64_t expirations;
+			if (0 <= read(timer_fd.get(), &expirations, sizeof expirations)) break;	// The time has come.
+			if (ECANCELED != errno && EINTR != errno) die_errno(prog, envs, "read");
+		}
+	}
+#else
 	for (;;) {
 		NullableTAI64N n;
 		n.realtime(envs);
@@ -1078,4 +1106,5 @@ time_pause_until (
 			nanosleep(&i, nullptr);
 		}
 	}
+#endif
 }
@@ -23,6 +23,7 @@ enum {
 
 struct ProcessEnvironment;
 struct FileStar;
+class ChunkedReader;
 
 extern
 const char *
@@ -64,7 +65,7 @@ read_file (
 extern
 std::vector<std::string>
 read_file (
-	FILE *,
+	ChunkedReader &,
 	unsigned long &
 ) ;
 extern
@@ -128,6 +129,12 @@ read_line (
 	std::string & l
 ) ;
 extern
+bool
+read_line (
+	ChunkedReader & r,
+	std::string & l
+) ;
+extern
 std::string
 read_env_file (
 	const char * prog,